@@ -60,9 +60,15 @@ groups_back = caen.GetGroupConfigurations()
 #     print(g)
 
 caen.EnableAcquisition()
-for i in range(2000):
-    caen.SoftwareTrigger()
-    time.sleep(0.001)
+# 2000 software triggers at 1 kHz from a C++ thread
+trigger_config = red_caen.CAENSoftwareTriggerConfig()
+trigger_config.Pattern = red_caen.CAENTriggerPattern.Periodic
+trigger_config.Rate = 1000.0
+trigger_config.MaxTriggers = 2000
+caen.StartSoftwareTriggerPacer(trigger_config)
+while caen.IsSoftwareTriggerPacerRunning():
+    time.sleep(0.1)
+print(caen.GetSoftwareTriggerPacerStats())
 
 time.sleep(2)
 
@@ -0,0 +1,194 @@
+/*
+ * Runs two event processors over synthetic decoded events with
+ * CAENAnalysisScheduler and prints the throughput for every number of
+ * workers up to the number of cores:
+ *  - PulseCounter counts threshold crossings per event and channel and
+ *    asks for its results in event order.
+ *  - AmplitudeHistogram fills a per-chunk histogram of the pulse
+ *    amplitudes and adds the chunks up in whatever order they finish.
+ *
+ * No digitizer needed.
+ *
+ * Usage: RedDigitizer_analysis_scheduler_ex [events per batch] [batches]
+ * */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RedDigitizer++/red_digitizer_helper.hpp"
+#include "RedDigitizer++/scheduler_helpers.hpp"
+
+using namespace RedDigitizer;
+using Waveforms = CAENWaveforms<uint16_t>;
+using WaveformsPtr = std::shared_ptr<Waveforms>;
+
+constexpr uint16_t kBaseline = 8000;
+constexpr uint16_t kThreshold = 100;
+constexpr std::size_t kNumBins = 256;
+
+struct NoScratch { };
+
+struct PulseCounts {
+    std::size_t NumEvents = 0;
+    // [event, channel]
+    std::vector<uint32_t> Counts;
+};
+
+// Number of pulses of each channel, one entry per event and channel
+class PulseCounter :
+    public CAENBasicEventProcessor<WaveformsPtr, NoScratch, PulseCounts> {
+    std::vector<uint32_t> _counts;
+    uint64_t _next_event = 0;
+    bool _in_order = true;
+
+ protected:
+    void processChunk(std::span<const WaveformsPtr> events, const uint64_t&,
+                      NoScratch&, PulseCounts& result) override {
+        result.NumEvents = events.size();
+        result.Counts.clear();
+        for (const auto& event : events) {
+            for (std::size_t ch = 0; ch < event->getNumEnabledChannels(); ch++) {
+                uint32_t pulses = 0;
+                bool below = false;
+                for (const auto& sample : event->getChannel(ch)) {
+                    const bool now_below = sample + kThreshold < kBaseline;
+                    pulses += now_below and not below;
+                    below = now_below;
+                }
+                result.Counts.push_back(pulses);
+            }
+        }
+    }
+
+    void mergeChunk(const uint64_t& first_event, PulseCounts& result) override {
+        _in_order &= first_event == _next_event;
+        _next_event = first_event + result.NumEvents;
+        _counts.insert(_counts.end(), result.Counts.begin(), result.Counts.end());
+    }
+
+ public:
+    PulseCounter() : CAENBasicEventProcessor(true) { }
+
+    const std::vector<uint32_t>& getCounts() const noexcept {
+        return _counts;
+    }
+
+    bool wasInOrder() const noexcept {
+        return _in_order;
+    }
+};
+
+// Histogram of (baseline - min sample) of every channel
+class AmplitudeHistogram :
+    public CAENBasicEventProcessor<WaveformsPtr, NoScratch, std::vector<uint64_t>> {
+    std::vector<uint64_t> _bins = std::vector<uint64_t>(kNumBins, 0);
+
+ protected:
+    void processChunk(std::span<const WaveformsPtr> events, const uint64_t&,
+                      NoScratch&, std::vector<uint64_t>& result) override {
+        result.assign(kNumBins, 0);
+        for (const auto& event : events) {
+            for (std::size_t ch = 0; ch < event->getNumEnabledChannels(); ch++) {
+                const auto samples = event->getChannel(ch);
+                const uint16_t min_val = *std::min_element(samples.begin(), samples.end());
+                const int amplitude = std::max(kBaseline - min_val, 0);
+                result[std::min<std::size_t>(amplitude / 16, kNumBins - 1)]++;
+            }
+        }
+    }
+
+    void mergeChunk(const uint64_t&, std::vector<uint64_t>& result) override {
+        for (std::size_t i = 0; i < kNumBins; i++) {
+            _bins[i] += result[i];
+        }
+    }
+
+ public:
+    uint64_t getEntries() const noexcept {
+        uint64_t out = 0;
+        for (const auto& bin : _bins) {
+            out += bin;
+        }
+        return out;
+    }
+};
+
+std::vector<WaveformsPtr> make_events(const std::size_t& num_events) {
+    const auto& constants = CAENDigitizerModelsConstantsMap.at(CAENDigitizerModel::DT5730B);
+    CAENGlobalConfig global_config;
+    global_config.RecordLength = 1000;
+    std::array<CAENGroupConfig, 8> group_configs;
+    for (std::size_t ch = 0; ch < 4; ch++) {
+        group_configs[ch].Enabled = true;
+    }
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 5.0f);
+    std::uniform_int_distribution<uint32_t> position(0, global_config.RecordLength - 50);
+    std::uniform_int_distribution<uint32_t> height(50, 2000);
+
+    std::vector<WaveformsPtr> out;
+    for (std::size_t i = 0; i < num_events; i++) {
+        auto event = std::make_shared<Waveforms>(constants, global_config, group_configs);
+        auto data = event->getData();
+        for (auto& sample : data) {
+            sample = static_cast<uint16_t>(kBaseline + noise(rng));
+        }
+        for (std::size_t ch = 0; ch < event->getNumEnabledChannels(); ch++) {
+            const uint32_t start = position(rng);
+            const uint32_t h = height(rng);
+            for (uint32_t s = 0; s < 50; s++) {
+                data[ch*global_config.RecordLength + start + s] -= h*(50 - s)/50;
+            }
+        }
+        out.push_back(std::move(event));
+    }
+    return out;
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t batch_events = argc > 1 ? std::stoul(argv[1]) : 1024;
+    const std::size_t num_batches = argc > 2 ? std::stoul(argv[2]) : 50;
+    const auto events = make_events(batch_events);
+    const std::size_t max_workers = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "kevents/s"
+              << std::setw(10) << "speedup" << std::setw(10) << "steals"
+              << std::setw(10) << "ordered" << std::endl;
+
+    double serial_rate = 0.0;
+    for (std::size_t threads = 1; threads <= max_workers; threads++) {
+        auto pulses = std::make_shared<PulseCounter>();
+        auto amplitudes = std::make_shared<AmplitudeHistogram>();
+        CAENSchedulerConfig config;
+        config.NumWorkers = threads - 1;
+        CAENAnalysisScheduler<WaveformsPtr> scheduler({pulses, amplitudes}, config);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t b = 0; b < num_batches; b++) {
+            scheduler.process(events);
+        }
+        const double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        const auto stats = scheduler.getStats();
+        const double rate = stats.Events / elapsed;
+        if (threads == 1) {
+            serial_rate = rate;
+        }
+        std::cout << std::setw(8) << threads << std::setw(12) << 1e-3*rate
+                  << std::setw(10) << rate / serial_rate
+                  << std::setw(10) << stats.Steals
+                  << std::setw(10) << (pulses->wasInOrder() ? "yes" : "NO")
+                  << std::endl;
+    }
+}
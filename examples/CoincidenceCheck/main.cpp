@@ -0,0 +1,133 @@
+/*
+ * Checks CAENCoincidenceFilter against a brute force N-of-M coincidence
+ * on random events: baseline noise with a few pulses per channel, many
+ * of them close to the end of the record, where the stretched hits run
+ * into the end of the scratch buffers. Random record lengths, windows,
+ * thresholds and multiplicities.
+ *
+ * No digitizer needed. Returns 1 if any decision differs.
+ *
+ * Usage: RedDigitizer_coincidence_check_ex [events] [seed]
+ * */
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "RedDigitizer++/red_digitizer_helper.hpp"
+
+using namespace RedDigitizer;
+using Waveforms = CAENWaveforms<uint16_t>;
+
+// Straight from the definition: a channel is hit at i if it is past the
+// threshold there, stretched it is hit at i if it was hit in the last
+// Window samples, and the condition passes if enough channels are
+// stretched-hit at the same sample.
+bool reference(const Waveforms& event, const CAENCoincidenceConfig& config,
+               const CAENCoincidenceCondition& condition) {
+    const std::size_t n = event.getRecordLength();
+    std::vector<uint32_t> counts(n, 0);
+    for (const auto& ch : condition.Channels) {
+        const std::size_t ch_index = event.findChannel(ch);
+        if (ch_index >= event.getNumEnabledChannels()) {
+            continue;
+        }
+        const auto samples = event.getChannel(ch_index);
+        const std::size_t num_baseline = std::clamp<std::size_t>(config.BaselineSamples, 1, n);
+        int64_t sum = 0;
+        for (std::size_t i = 0; i < num_baseline; i++) {
+            sum += samples[i];
+        }
+        const int64_t baseline = sum / static_cast<int64_t>(num_baseline);
+        const int64_t limit = config.NegativePolarity ?
+            baseline - condition.Threshold : baseline + condition.Threshold;
+        if (limit <= 0 or limit >= 0xFFFF) {
+            continue;
+        }
+        std::vector<bool> hits(n);
+        for (std::size_t i = 0; i < n; i++) {
+            hits[i] = config.NegativePolarity ? samples[i] < limit : samples[i] > limit;
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            const std::size_t from = i + 1 >= condition.Window ? i + 1 - condition.Window : 0;
+            counts[i] += std::any_of(hits.begin() + from, hits.begin() + i + 1,
+                                     [](bool hit) { return hit; });
+        }
+    }
+    return *std::max_element(counts.begin(), counts.end()) >= condition.Multiplicity;
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t num_events = argc > 1 ? std::stoul(argv[1]) : 20000;
+    const unsigned seed = argc > 2 ? std::stoul(argv[2]) : 1;
+
+    const auto& constants = CAENDigitizerModelsConstantsMap.at(CAENDigitizerModel::V1740D);
+    std::array<CAENGroupConfig, 8> group_configs;
+    group_configs[0].Enabled = true;
+    for (std::size_t ch = 0; ch < 8; ch++) {
+        group_configs[0].AcquisitionMask[ch] = true;
+    }
+
+    std::mt19937 rng(seed);
+    auto uniform = [&](const std::size_t& low, const std::size_t& high) {
+        return std::uniform_int_distribution<std::size_t>(low, high)(rng);
+    };
+
+    std::size_t mismatches = 0;
+    std::size_t passed = 0;
+    for (std::size_t e = 0; e < num_events; e++) {
+        CAENGlobalConfig global_config;
+        global_config.RecordLength = uniform(1, 1100);
+        const std::size_t n = global_config.RecordLength;
+        Waveforms event(constants, global_config, group_configs);
+
+        CAENCoincidenceConfig config;
+        config.NegativePolarity = uniform(0, 1);
+        config.BaselineSamples = uniform(1, 40);
+        CAENCoincidenceCondition condition;
+        condition.Window = uniform(1, 80);
+        condition.Threshold = uniform(20, 200);
+        for (std::size_t ch = 0; ch < 8; ch++) {
+            if (uniform(0, 3) != 0) {
+                condition.Channels.push_back(ch);
+            }
+        }
+        if (condition.Channels.empty()) {
+            condition.Channels.push_back(0);
+        }
+        condition.Multiplicity = uniform(1, condition.Channels.size());
+        config.Conditions.push_back(condition);
+
+        const int sign = config.NegativePolarity ? -1 : 1;
+        for (std::size_t ch = 0; ch < 8; ch++) {
+            auto data = event.getData().subspan(ch*n, n);
+            for (auto& sample : data) {
+                sample = static_cast<uint16_t>(2000 + uniform(0, 20));
+            }
+            const std::size_t num_pulses = uniform(0, 3);
+            for (std::size_t p = 0; p < num_pulses; p++) {
+                // Half of them in the last 64 samples
+                const std::size_t at = uniform(0, 1) ?
+                    uniform(n > 64 ? n - 64 : 0, n - 1) : uniform(0, n - 1);
+                const int height = static_cast<int>(uniform(0, 400));
+                for (std::size_t i = at; i < std::min(n, at + uniform(1, 8)); i++) {
+                    data[i] = static_cast<uint16_t>(data[i] + sign*height);
+                }
+            }
+        }
+
+        CAENCoincidenceFilter filter(config);
+        const bool expected = reference(event, config, condition);
+        passed += expected;
+        if (filter.accept(event) != expected) {
+            mismatches++;
+        }
+    }
+
+    std::cout << num_events << " events, " << passed << " pass the reference, "
+              << mismatches << " decisions differ" << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+/*
+ * Reads several digitizers from a single thread with coroutines, writes
+ * each one to a run file flushed every second, and takes commands from
+ * the terminal ("q" + enter stops) while the readout runs.
+ *
+ * The same readout runs first as a plain polling loop and then on
+ * CAENEventLoop, and the CPU time of both is printed.
+ *
+ * Usage: RedDigitizer_coroutine_acq_ex [model] [number of boards] [seconds]
+ * Boards are opened on USB links 0, 1, ...
+ * */
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RedDigitizer++/red_digitizer_helper.hpp"
+#include "RedDigitizer++/coroutine_helpers.hpp"
+#include "RedDigitizer++/file_helpers.hpp"
+
+using namespace RedDigitizer;
+using namespace std::chrono_literals;
+
+struct Board {
+    std::unique_ptr<CAEN<>> Digitizer;
+    std::unique_ptr<CAENRunFileWriter> Writer;
+    uint64_t Batches = 0;
+    uint64_t Events = 0;
+};
+
+struct RunResult {
+    double WallSeconds = 0.0;
+    double CPUSeconds = 0.0;
+    uint64_t Batches = 0;
+    uint64_t Events = 0;
+};
+
+constexpr uint32_t kBatchEvents = 100;
+// Wait of the polling loop when no board had a batch
+constexpr auto kPollSleep = 1ms;
+
+// State shared with the terminal thread. It is owned through a shared_ptr
+// so it outlives main() if the thread is still waiting for input.
+struct Control {
+    CAENEventLoop Loop;
+    bool Running = false;
+    std::atomic<bool> Quit = false;
+};
+
+void start_boards(std::vector<Board>& boards, const std::string& tag) {
+    CAENSoftwareTriggerConfig trigger_config;
+    trigger_config.Rate = 2000.0;
+    for (std::size_t i = 0; i < boards.size(); i++) {
+        auto& board = boards[i];
+        auto& caen = *board.Digitizer;
+        board.Writer = std::make_unique<CAENRunFileWriter>(
+            "board" + std::to_string(i) + "_" + tag + ".rdr",
+            caen.ModelConstants, caen.GetGlobalConfiguration(),
+            caen.GetGroupConfigurations());
+        board.Batches = 0;
+        board.Events = 0;
+        caen.EnableAcquisition();
+        caen.StartSoftwareTriggerPacer(trigger_config);
+    }
+}
+
+RunResult stop_boards(std::vector<Board>& boards) {
+    RunResult out;
+    for (auto& board : boards) {
+        board.Digitizer->DisableAcquisition();
+        board.Writer->close();
+        out.Batches += board.Batches;
+        out.Events += board.Events;
+    }
+    return out;
+}
+
+void store_batch(Board& board) {
+    auto events = board.Digitizer->GetWaveformsView();
+    board.Writer->write(events);
+    board.Batches++;
+    board.Events += events.size();
+}
+
+// The usual way: check every board in a loop. Without the sleep it burns
+// a core; with it, batches wait up to a full sleep.
+RunResult run_polling(std::vector<Board>& boards, const std::atomic<bool>& quit,
+                      const std::chrono::duration<double>& duration) {
+    start_boards(boards, "poll");
+    const auto start = std::chrono::steady_clock::now();
+    const auto cpu_start = std::clock();
+    auto next_flush = start + 1s;
+    while (not quit and std::chrono::steady_clock::now() - start < duration) {
+        bool any = false;
+        for (auto& board : boards) {
+            if (board.Digitizer->RetrieveDataUntilNEvents(kBatchEvents)) {
+                board.Digitizer->DecodeEvents();
+                store_batch(board);
+                any = true;
+            }
+        }
+        if (not any) {
+            std::this_thread::sleep_for(kPollSleep);
+        }
+        if (std::chrono::steady_clock::now() > next_flush) {
+            for (auto& board : boards) {
+                board.Writer->flush();
+            }
+            next_flush += 1s;
+        }
+    }
+    RunResult out = stop_boards(boards);
+    out.CPUSeconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    out.WallSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return out;
+}
+
+CAENTask<> readout(CAENEventLoop& loop, Board& board, const bool& running) {
+    while (running) {
+        // GCC 12 never resumes a co_await on a temporary task inside an if
+        // condition, so the result goes through a local.
+        const bool got = co_await loop.nextBatch(*board.Digitizer, kBatchEvents, 100ms);
+        if (got) {
+            store_batch(board);
+        } else if (board.Digitizer->HasError()) {
+            co_return;
+        }
+    }
+}
+
+CAENTask<> flusher(CAENEventLoop& loop, std::vector<Board>& boards, const bool& running) {
+    while (running) {
+        co_await loop.sleepFor(1s);
+        for (auto& board : boards) {
+            board.Writer->flush();
+        }
+    }
+}
+
+CAENTask<> timer(CAENEventLoop& loop, bool& running,
+                 const std::chrono::duration<double> duration) {
+    co_await loop.sleepFor(duration);
+    running = false;
+}
+
+RunResult run_coroutines(std::vector<Board>& boards, CAENEventLoop& loop,
+                         bool& running, const std::chrono::duration<double>& duration) {
+    start_boards(boards, "coro");
+    const auto start = std::chrono::steady_clock::now();
+    const auto cpu_start = std::clock();
+    running = true;
+    for (auto& board : boards) {
+        loop.spawn(readout(loop, board, running));
+    }
+    loop.spawn(flusher(loop, boards, running));
+    loop.spawn(timer(loop, running, duration));
+    loop.run();
+
+    RunResult out = stop_boards(boards);
+    out.CPUSeconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    out.WallSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return out;
+}
+
+void print_result(const std::string& name, const RunResult& result) {
+    std::cout << name << ": " << result.Events << " events in "
+              << result.Batches << " batches, "
+              << result.Events / result.WallSeconds << " events/s, "
+              << "CPU " << 100.0 * result.CPUSeconds / result.WallSeconds
+              << "% of a core" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string model_str = argc > 1 ? argv[1] : "DT5730B";
+    const std::size_t num_boards = argc > 2 ? std::stoul(argv[2]) : 1;
+    const std::chrono::duration<double> duration(argc > 3 ? std::stod(argv[3]) : 10.0);
+    auto model = CAENDigitizerModelsMap.at(model_str);
+
+    std::shared_ptr<iostream_wrapper> logger = std::make_shared<iostream_wrapper>();
+    std::vector<Board> boards(num_boards);
+    for (std::size_t i = 0; i < num_boards; i++) {
+        boards[i].Digitizer = std::make_unique<CAEN<>>(logger, model,
+            CAENConnectionType::USB, static_cast<int>(i), 0, 0);
+
+        CAENGlobalConfig global_config;
+        global_config.RecordLength = 1000;
+        global_config.MaxEventsPerRead = 512;
+        global_config.SWTriggerMode = CAEN_DGTZ_TriggerMode_t::CAEN_DGTZ_TRGMODE_ACQ_ONLY;
+        std::array<CAENGroupConfig, 8> group_configs;
+        group_configs[0].Enabled = true;
+        boards[i].Digitizer->Setup(global_config, group_configs);
+    }
+
+    // Commands from the terminal, handled on the loop thread. getline can
+    // not be interrupted, so the thread is detached and only touches
+    // control, which it keeps alive.
+    auto control = std::make_shared<Control>();
+    std::thread terminal([control]() {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line == "q") {
+                control->Quit = true;
+                // Runs on the loop, which control owns
+                control->Loop.post([state = control.get()]() {
+                    state->Running = false;
+                    state->Loop.stop();
+                });
+                break;
+            }
+        }
+    });
+    terminal.detach();
+
+    print_result("polling", run_polling(boards, control->Quit, duration));
+    if (not control->Quit) {
+        print_result("coroutines", run_coroutines(boards, control->Loop,
+                                                  control->Running, duration));
+        const auto& stats = control->Loop.getStats();
+        std::cout << "loop: " << stats.Resumes << " resumes, " << stats.Sleeps
+                  << " sleeps, " << stats.EmptyPolls << " empty polls" << std::endl;
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ * Compares channel-major CAENWaveforms with sample-major
+ * CAENInterleavedWaveforms on synthetic V1740D events (64 channels):
+ *  - transpose: cost of going from the decoder order to sample-major,
+ *    scalar and SIMD, next to the plain channel-major copy.
+ *  - sums: the sum of all channels (and of each 8 channel group) at
+ *    every sample, the way a software trigger or an array-wide pulse
+ *    finder would compute it.
+ *
+ * No digitizer needed.
+ *
+ * Usage: RedDigitizer_layout_bench_ex [events] [repetitions]
+ * */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "RedDigitizer++/red_digitizer_helper.hpp"
+#include "RedDigitizer++/layout_helpers.hpp"
+
+using namespace RedDigitizer;
+using Clock = std::chrono::steady_clock;
+using Waveforms = CAENWaveforms<uint16_t>;
+using Interleaved = CAENInterleavedWaveforms<>;
+
+// Not benchmarked, only keeps the 8-bit storage compiled
+template class RedDigitizer::CAENWaveforms<uint8_t>;
+
+constexpr std::size_t kGroupChannels = 8;
+
+double seconds_since(const Clock::time_point& start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Runs f repetitions times and returns the events per second
+template<typename F>
+double rate(const std::size_t& num_events, const std::size_t& repetitions, F&& f) {
+    const auto start = Clock::now();
+    for (std::size_t r = 0; r < repetitions; r++) {
+        f();
+    }
+    return num_events*repetitions / seconds_since(start);
+}
+
+void print(const std::string& name, const double& events_per_s, const double& baseline) {
+    std::cout << std::setw(34) << name << std::setw(12) << 1e-3*events_per_s
+              << std::setw(10) << events_per_s / baseline << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t num_events = argc > 1 ? std::stoul(argv[1]) : 256;
+    const std::size_t repetitions = argc > 2 ? std::stoul(argv[2]) : 20;
+
+    const auto& constants = CAENDigitizerModelsConstantsMap.at(CAENDigitizerModel::V1740D);
+    CAENGlobalConfig global_config;
+    global_config.RecordLength = 1024;
+    std::array<CAENGroupConfig, 8> group_configs;
+    for (auto& group : group_configs) {
+        group.Enabled = true;
+        for (std::size_t ch = 0; ch < kGroupChannels; ch++) {
+            group.AcquisitionMask[ch] = true;
+        }
+    }
+    const std::size_t rl = global_config.RecordLength;
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint16_t> adc(0, 4095);
+    std::vector<std::shared_ptr<Waveforms>> channel_major;
+    std::vector<std::shared_ptr<Interleaved>> sample_major;
+    for (std::size_t i = 0; i < num_events; i++) {
+        auto event = std::make_shared<Waveforms>(constants, global_config, group_configs);
+        for (auto& sample : event->getData()) {
+            sample = adc(rng);
+        }
+        channel_major.push_back(event);
+        sample_major.push_back(std::make_shared<Interleaved>(constants, global_config,
+                                                             group_configs));
+        sample_major.back()->copy(*event);
+    }
+    const std::size_t num_channels = channel_major[0]->getNumEnabledChannels();
+    const std::size_t num_groups = num_channels / kGroupChannels;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << num_events << " events of " << num_channels << " channels x "
+              << rl << " samples\n"
+              << std::setw(34) << "" << std::setw(12) << "kevents/s"
+              << std::setw(10) << "vs first" << std::endl;
+
+    // Decoder order -> storage
+    auto copy_target = std::make_shared<Waveforms>(constants, global_config, group_configs);
+    std::vector<uint16_t> transposed(num_channels*rl);
+    std::vector<const uint16_t*> sources(num_channels);
+    auto set_sources = [&](const Waveforms& event) {
+        for (std::size_t ch = 0; ch < num_channels; ch++) {
+            sources[ch] = event.getChannel(ch).data();
+        }
+    };
+    const double copy_rate = rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            copy_target->copy(*event);
+        }
+    });
+    print("channel-major copy", copy_rate, copy_rate);
+    print("transpose, scalar", rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            set_sources(*event);
+            detail::transpose_channels_scalar(sources, 0, rl, 0, transposed.data());
+        }
+    }), copy_rate);
+    print("transpose, SIMD", rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            set_sources(*event);
+            transpose_channels(sources, rl, transposed.data());
+        }
+    }), copy_rate);
+    std::cout << std::endl;
+
+    // Sum of all channels at every sample
+    std::vector<uint32_t> sums(rl);
+    std::vector<uint32_t> reference(rl);
+    bool all_equal = true;
+    const double strided_rate = rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            const auto data = event->getData();
+            for (std::size_t s = 0; s < rl; s++) {
+                uint32_t sum = 0;
+                for (std::size_t ch = 0; ch < num_channels; ch++) {
+                    sum += data[ch*rl + s];
+                }
+                sums[s] = sum;
+            }
+        }
+    });
+    reference = sums;
+    print("sum, channel-major", strided_rate, strided_rate);
+    print("sum, channel-major by rows", rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            std::fill(sums.begin(), sums.end(), 0);
+            for (std::size_t ch = 0; ch < num_channels; ch++) {
+                const auto samples = event->getChannel(ch);
+                for (std::size_t s = 0; s < rl; s++) {
+                    sums[s] += samples[s];
+                }
+            }
+        }
+    }), strided_rate);
+    all_equal &= sums == reference;
+    print("sum, sample-major", rate(num_events, repetitions, [&]() {
+        for (const auto& event : sample_major) {
+            event->sumChannels(sums);
+        }
+    }), strided_rate);
+    all_equal &= sums == reference;
+    std::cout << std::endl;
+
+    // Sum of each group at every sample
+    std::vector<uint32_t> group_sums(num_groups*rl);
+    const double group_strided_rate = rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            const auto data = event->getData();
+            for (std::size_t g = 0; g < num_groups; g++) {
+                for (std::size_t s = 0; s < rl; s++) {
+                    uint32_t sum = 0;
+                    for (std::size_t ch = 0; ch < kGroupChannels; ch++) {
+                        sum += data[(g*kGroupChannels + ch)*rl + s];
+                    }
+                    group_sums[g*rl + s] = sum;
+                }
+            }
+        }
+    });
+    const auto group_reference = group_sums;
+    print("group sums, channel-major", group_strided_rate, group_strided_rate);
+    print("group sums, channel-major by rows", rate(num_events, repetitions, [&]() {
+        for (const auto& event : channel_major) {
+            std::fill(group_sums.begin(), group_sums.end(), 0);
+            for (std::size_t ch = 0; ch < num_channels; ch++) {
+                const auto samples = event->getChannel(ch);
+                uint32_t* out = group_sums.data() + ch / kGroupChannels*rl;
+                for (std::size_t s = 0; s < rl; s++) {
+                    out[s] += samples[s];
+                }
+            }
+        }
+    }), group_strided_rate);
+    all_equal &= group_sums == group_reference;
+    // Comes out as [sample, group]
+    std::vector<uint32_t> interleaved_sums(num_groups*rl);
+    print("group sums, sample-major", rate(num_events, repetitions, [&]() {
+        for (const auto& event : sample_major) {
+            event->sumGroups(interleaved_sums, kGroupChannels);
+        }
+    }), group_strided_rate);
+    for (std::size_t g = 0; g < num_groups; g++) {
+        for (std::size_t s = 0; s < rl; s++) {
+            all_equal &= interleaved_sums[s*num_groups + g] == group_reference[g*rl + s];
+        }
+    }
+
+    if (not all_equal) {
+        std::cerr << "The sums of both layouts differ" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,228 @@
+/*
+ * Measures the handoff between two threads through the queues of
+ * queue_helpers.hpp, with every wait strategy, next to a std::mutex +
+ * std::condition_variable queue:
+ *  - throughput: items/s through the queue, one producer and one consumer
+ *    (and 2+2 for the MPMC queue).
+ *  - latency: one way handoff time from a ping-pong between two threads.
+ *  - batches: pooled CAENBatch handles going producer -> consumer -> pool.
+ *
+ * No digitizer needed.
+ *
+ * Usage: RedDigitizer_queue_bench_ex [millions of items]
+ * */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RedDigitizer++/batch_helpers.hpp"
+#include "RedDigitizer++/queue_helpers.hpp"
+
+using namespace RedDigitizer;
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t kCapacity = 1024;
+constexpr std::size_t kPingPongs = 100000;
+
+// What people write first
+template<typename T>
+class MutexQueue {
+    std::mutex _mtx;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<T> _items;
+    std::size_t _capacity;
+    bool _closed = false;
+
+ public:
+    explicit MutexQueue(const std::size_t& capacity) : _capacity{capacity} { }
+
+    bool push(T&& value) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _not_full.wait(lock, [&]() { return _items.size() < _capacity or _closed; });
+        if (_closed) {
+            return false;
+        }
+        _items.push_back(std::move(value));
+        lock.unlock();
+        _not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _not_empty.wait(lock, [&]() { return not _items.empty() or _closed; });
+        if (_items.empty()) {
+            return false;
+        }
+        out = std::move(_items.front());
+        _items.pop_front();
+        lock.unlock();
+        _not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _closed = true;
+        }
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+};
+
+double seconds_since(const Clock::time_point& start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Items per second from num_producers to num_consumers threads
+template<typename Queue>
+double throughput(const std::size_t& num_items, const std::size_t& num_producers,
+                  const std::size_t& num_consumers) {
+    Queue queue(kCapacity);
+    std::vector<std::thread> consumers;
+    std::vector<uint64_t> sums(num_consumers, 0);
+    for (std::size_t c = 0; c < num_consumers; c++) {
+        consumers.emplace_back([&queue, &sums, c]() {
+            uint64_t item = 0;
+            uint64_t sum = 0;
+            while (queue.pop(item)) {
+                sum += item;
+            }
+            sums[c] = sum;
+        });
+    }
+
+    const auto start = Clock::now();
+    std::vector<std::thread> producers;
+    for (std::size_t p = 0; p < num_producers; p++) {
+        producers.emplace_back([&queue, num_items, num_producers, p]() {
+            for (uint64_t i = p; i < num_items; i += num_producers) {
+                queue.push(uint64_t{i});
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    queue.close();
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+    const double elapsed = seconds_since(start);
+
+    uint64_t sum = 0;
+    for (const auto& s : sums) {
+        sum += s;
+    }
+    if (sum != num_items*(num_items - 1)/2) {
+        std::cerr << "Items were lost or duplicated" << std::endl;
+    }
+    return num_items / elapsed;
+}
+
+// Median and 99th percentile of the one way handoff, in ns
+template<typename Queue>
+std::pair<double, double> latency() {
+    Queue ping(kCapacity);
+    Queue pong(kCapacity);
+    std::thread echo([&]() {
+        uint64_t item = 0;
+        while (ping.pop(item)) {
+            pong.push(std::move(item));
+        }
+    });
+
+    std::vector<double> samples;
+    samples.reserve(kPingPongs);
+    uint64_t item = 0;
+    for (std::size_t i = 0; i < kPingPongs; i++) {
+        const auto start = Clock::now();
+        ping.push(uint64_t{i});
+        pong.pop(item);
+        samples.push_back(0.5e9*seconds_since(start));
+    }
+    ping.close();
+    echo.join();
+
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size()/2], samples[samples.size()*99/100]};
+}
+
+// Batches per second from a pool, through the queue and back to the pool
+template<typename Queue>
+double batch_handoff(const std::size_t& num_batches) {
+    auto pool = CAENBatchPool::create(16, 64, 8, 1000);
+    Queue queue(kCapacity);
+    std::thread consumer([&queue]() {
+        CAENBatchHandle batch;
+        uint64_t events = 0;
+        while (queue.pop(batch)) {
+            events += batch->NumEvents;
+            batch.release();
+        }
+    });
+
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < num_batches; i++) {
+        auto batch = pool->acquireFor(std::chrono::seconds(1));
+        batch->NumEvents = batch->Capacity;
+        queue.push(std::move(batch));
+    }
+    queue.close();
+    consumer.join();
+    return num_batches / seconds_since(start);
+}
+
+template<CAENWaitStrategy Wait>
+void run(const std::string& name, const std::size_t& num_items) {
+    using SPSC = CAENSPSCQueue<uint64_t, Wait>;
+    using MPMC = CAENMPMCQueue<uint64_t, Wait>;
+    const auto [median, p99] = latency<SPSC>();
+    std::cout << std::setw(8) << name
+              << std::setw(12) << 1e-6*throughput<SPSC>(num_items, 1, 1)
+              << std::setw(12) << 1e-6*throughput<MPMC>(num_items, 1, 1)
+              << std::setw(12) << 1e-6*throughput<MPMC>(num_items, 2, 2)
+              << std::setw(10) << median << std::setw(10) << p99
+              << std::setw(12) << 1e-3*batch_handoff<CAENBatchSPSCQueue<Wait>>(num_items/100)
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t num_items = 1000000*(argc > 1 ? std::stoul(argv[1]) : 10);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Throughput in Mitems/s, latency in ns, batches in kbatches/s\n"
+              << std::setw(8) << "wait" << std::setw(12) << "SPSC 1:1"
+              << std::setw(12) << "MPMC 1:1" << std::setw(12) << "MPMC 2:2"
+              << std::setw(10) << "median" << std::setw(10) << "p99"
+              << std::setw(12) << "batches" << std::endl;
+
+    // Two spinning threads on one core just wait for each other's time slice
+    if (std::thread::hardware_concurrency() > 1) {
+        run<CAENWaitStrategy::Spin>("spin", num_items);
+    }
+    run<CAENWaitStrategy::Yield>("yield", num_items);
+    run<CAENWaitStrategy::Futex>("futex", num_items);
+
+    using Mutex = MutexQueue<uint64_t>;
+    const auto [median, p99] = latency<Mutex>();
+    std::cout << std::setw(8) << "mutex"
+              << std::setw(12) << 1e-6*throughput<Mutex>(num_items, 1, 1)
+              << std::setw(12) << "-"
+              << std::setw(12) << 1e-6*throughput<Mutex>(num_items, 2, 2)
+              << std::setw(10) << median << std::setw(10) << p99
+              << std::setw(12)
+              << 1e-3*batch_handoff<MutexQueue<CAENBatchHandle>>(num_items/100)
+              << std::endl;
+}
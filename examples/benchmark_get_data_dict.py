@@ -0,0 +1,124 @@
+import statistics
+import time
+import numpy as np
+import red_caen
+
+# Compares the single pass GetDataDict() against the way it used to be
+# built: GetEventsInfoDict() and GetWaveforms() through Python, the masks
+# from the group configurations and a last pass remapping the trigger
+# source.
+#
+# Needs a digitizer. Change the model and connection to yours.
+
+N_EVENTS = 500
+N_REPEATS = 200
+# DT5740D
+N_GROUPS = 4
+N_CHANNELS_PER_GROUP = 8
+
+caen = red_caen.CAEN(
+    red_caen.iostream_wrapper(),
+    red_caen.CAENDigitizerModel.DT5740D,
+    red_caen.CAENConnectionType.USB,
+    0,
+    0,
+    0)
+
+global_config = red_caen.CAENGlobalConfig()
+global_config.MaxEventsPerRead = N_EVENTS
+global_config.RecordLength = 180
+global_config.PostTriggerPorcentage = 50
+global_config.EXTTriggerMode = red_caen.CAEN_DGTZ_TriggerMode.DISABLED
+global_config.SWTriggerMode = red_caen.CAEN_DGTZ_TriggerMode.ACQ_ONLY
+global_config.CHTriggerMode = red_caen.CAEN_DGTZ_TriggerMode.DISABLED
+global_config.TriggerPolarity = red_caen.CAEN_DGTZ_TriggerPolarity.Falling
+global_config.IOLevel = red_caen.CAEN_DGTZ_IOLevel.TTL
+
+group_configs = [red_caen.CAENGroupConfig() for i in range(8)]
+for i in range(8):
+    acq_mask = red_caen.ChannelsMask()
+    trg_mask = red_caen.ChannelsMask()
+    for ch in range(8):
+        acq_mask[ch] = True
+    group_configs[i].Enabled = True
+    group_configs[i].DCOffset = 0x8000
+    group_configs[i].DCCorrections = [0, 0, 0, 0, 0, 0, 0, 0]
+    group_configs[i].DCRange = 0
+    group_configs[i].TriggerThreshold = 0x800
+    group_configs[i].AcquisitionMask = acq_mask
+    group_configs[i].TriggerMask = trg_mask
+
+caen.Setup(global_config, group_configs)
+caen.EnableAcquisition()
+
+trigger_config = red_caen.CAENSoftwareTriggerConfig()
+trigger_config.Pattern = red_caen.CAENTriggerPattern.Periodic
+trigger_config.Rate = 5000.0
+trigger_config.MaxTriggers = N_EVENTS
+caen.StartSoftwareTriggerPacer(trigger_config)
+while caen.IsSoftwareTriggerPacerRunning():
+    time.sleep(0.01)
+
+while not caen.RetrieveDataUntilNEvents(N_EVENTS):
+    time.sleep(0.01)
+caen.DecodeEvents()
+caen.DisableAcquisition()
+n_events = caen.GetNumberOfEvents()
+print(f"Benchmarking with {n_events} decoded events")
+
+
+def legacy_data_dict(caen):
+    # What GetDataDict() did before it was fused
+    events_info = caen.GetEventsInfoDict()
+    waveforms = caen.GetWaveforms()
+
+    trig_mask = 0
+    acq_mask = 0
+    group_configs = caen.GetGroupConfigurations()
+    for group in range(N_GROUPS):
+        if group_configs[group].Enabled:
+            shift = group*N_CHANNELS_PER_GROUP
+            trig_mask |= group_configs[group].TriggerMask.get() << shift
+            acq_mask |= group_configs[group].AcquisitionMask.get() << shift
+
+    # Move the software and external trigger bits (10-11) to 4-5
+    pattern = events_info["Pattern"]
+    extracted = (pattern >> 6) & (0b11 << 4)
+    pattern &= ~np.uint32(0b11 << 10 | 0b11 << 4)
+    pattern |= extracted
+
+    return {
+        "EventCounter": events_info["EventCounter"],
+        "TriggerSource": pattern,
+        "GroupMask": events_info["ChannelMask"],
+        "TriggerMask": trig_mask,
+        "AcquisitionMask": acq_mask,
+        "TriggerTimeTag": events_info["TriggerTimeTag"],
+        "Waveforms": waveforms,
+    }
+
+
+def bench(f):
+    f(caen)
+    times = []
+    for _ in range(N_REPEATS):
+        start = time.perf_counter()
+        f(caen)
+        times.append(time.perf_counter() - start)
+    return statistics.median(times)
+
+
+fused = caen.GetDataDict()
+legacy = legacy_data_dict(caen)
+for key in legacy:
+    assert np.array_equal(np.asarray(fused[key]), np.asarray(legacy[key])), key
+
+t_legacy = bench(legacy_data_dict)
+t_fused = bench(lambda c: c.GetDataDict())
+event_bytes = fused["Waveforms"][0].nbytes if n_events else 0
+
+print(f"{'':10} {'ms/batch':>10} {'Mevents/s':>10} {'GB/s':>8}")
+for name, t in (("legacy", t_legacy), ("fused", t_fused)):
+    print(f"{name:10} {1e3*t:10.3f} {1e-6*n_events/t:10.3f} "
+          f"{1e-9*n_events*event_bytes/t:8.2f}")
+print(f"speedup: {t_legacy/t_fused:.2f}x")
@@ -0,0 +1,279 @@
+/*
+    Batch helpers
+    Description: Preallocated blocks of events (event info columns plus
+    waveforms as [event, channel, sample]) and a fixed pool to recycle
+    them, so steady state acquisition does not allocate per batch.
+*/
+
+#ifndef RD_BATCH_HELPERS_H
+#define RD_BATCH_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+// A block of up to Capacity events. All the memory is allocated on
+// construction and reused by every fill(...).
+struct CAENBatch {
+    uint32_t Capacity = 0;
+    uint32_t NumEvents = 0;
+    uint32_t NumChannels = 0;
+    uint32_t RecordLength = 0;
+    // False if the last fill(...) kept only the event info, Waveforms is
+    // then not valid
+    bool HasWaveforms = true;
+    // Each event kept by the last fill(...) stands for Prescale read events
+    uint32_t Prescale = 1;
+    // Set by whoever hands out the batch (e.g. CAENPipeline), 0 otherwise
+    uint64_t Sequence = 0;
+
+    // CAEN channel numbers of the channels in Waveforms
+    std::vector<std::size_t> Channels;
+
+    std::vector<uint32_t> EventCounter;
+    std::vector<uint32_t> EventSize;
+    std::vector<uint32_t> BoardId;
+    std::vector<uint32_t> Pattern;
+    std::vector<uint32_t> ChannelMask;
+    std::vector<uint32_t> TriggerTimeTag;
+
+    // [event, channel, sample]. Empty for batches built without waveforms.
+    std::vector<uint16_t> Waveforms;
+
+    // If with_waveforms is false only the event info is allocated and
+    // every fill(...) drops the samples.
+    CAENBatch(const uint32_t& capacity, const uint32_t& num_channels,
+              const uint32_t& record_length, const bool& with_waveforms = true) :
+        Capacity{capacity},
+        NumChannels{num_channels},
+        RecordLength{record_length},
+        Channels(num_channels),
+        EventCounter(capacity),
+        EventSize(capacity),
+        BoardId(capacity),
+        Pattern(capacity),
+        ChannelMask(capacity),
+        TriggerTimeTag(capacity),
+        Waveforms(with_waveforms ? std::size_t{capacity}*num_channels*record_length : 0)
+    { }
+
+    std::size_t getEventSamples() const noexcept {
+        return std::size_t{NumChannels}*RecordLength;
+    }
+
+    // Copies up to Capacity events. Events that are nullptr or do not
+    // match the batch geometry are skipped.
+    // Only one out of every prescale events is kept, and the samples are
+    // dropped if copy_waveforms is false or the batch has no waveforms.
+    // phase is the position of events[0] in a longer stream, so the
+    // prescale carries over when the stream is split across calls.
+    // Returns how many events of the list were consumed, so a list bigger
+    // than Capacity can be split across batches.
+    template<typename WaveformsPtr>
+    std::size_t fill(std::span<const WaveformsPtr> events,
+                     const uint32_t& prescale = 1,
+                     const bool& copy_waveforms = true,
+                     const uint64_t& phase = 0) noexcept {
+        NumEvents = 0;
+        Prescale = std::max<uint32_t>(prescale, 1);
+        HasWaveforms = copy_waveforms and not Waveforms.empty();
+        std::size_t consumed = 0;
+        const std::size_t event_samples = getEventSamples();
+        for (; consumed < events.size() and NumEvents < Capacity; consumed++) {
+            const auto& event = events[consumed];
+            if ((phase + consumed) % Prescale != 0
+                or not event
+                or event->getNumEnabledChannels() != NumChannels
+                or event->getRecordLength() != RecordLength) {
+                continue;
+            }
+
+            if (NumEvents == 0) {
+                const auto& chs = event->getEnabledChannels();
+                std::copy(chs.begin(), chs.end(), Channels.begin());
+            }
+
+            const auto& info = event->getInfo();
+            EventCounter[NumEvents] = info.EventCounter;
+            EventSize[NumEvents] = info.EventSize;
+            BoardId[NumEvents] = info.BoardId;
+            Pattern[NumEvents] = info.Pattern;
+            ChannelMask[NumEvents] = info.ChannelMask;
+            TriggerTimeTag[NumEvents] = info.TriggerTimeTag;
+
+            if (HasWaveforms) {
+                const auto data = event->getData();
+                std::copy(data.begin(), data.end(),
+                          Waveforms.begin() + NumEvents*event_samples);
+            }
+            NumEvents++;
+        }
+        return consumed;
+    }
+};
+
+class CAENBatchPool;
+
+// Owns one batch of a CAENBatchPool and gives it back when destroyed or
+// when release() is called. Move only. Keeps the pool alive.
+class CAENBatchHandle {
+    std::shared_ptr<CAENBatchPool> _pool;
+    CAENBatch* _batch = nullptr;
+
+ public:
+    CAENBatchHandle() = default;
+    CAENBatchHandle(std::shared_ptr<CAENBatchPool> pool, CAENBatch* batch) :
+        _pool{std::move(pool)}, _batch{batch} { }
+
+    CAENBatchHandle(const CAENBatchHandle&) = delete;
+    CAENBatchHandle& operator=(const CAENBatchHandle&) = delete;
+
+    CAENBatchHandle(CAENBatchHandle&& other) noexcept :
+        _pool{std::move(other._pool)},
+        _batch{std::exchange(other._batch, nullptr)} { }
+
+    CAENBatchHandle& operator=(CAENBatchHandle&& other) noexcept {
+        if (this != &other) {
+            release();
+            _pool = std::move(other._pool);
+            _batch = std::exchange(other._batch, nullptr);
+        }
+        return *this;
+    }
+
+    ~CAENBatchHandle() {
+        release();
+    }
+
+    // Gives the batch back to the pool. The handle is empty afterwards.
+    inline void release() noexcept;
+
+    explicit operator bool() const noexcept {
+        return _batch != nullptr;
+    }
+
+    CAENBatch* get() const noexcept {
+        return _batch;
+    }
+
+    CAENBatch* operator->() const noexcept {
+        return _batch;
+    }
+
+    CAENBatch& operator*() const noexcept {
+        return *_batch;
+    }
+};
+
+// A fixed number of CAENBatch allocated once. acquire() hands out a batch
+// through a CAENBatchHandle, which gives it back when released. Neither
+// acquiring nor releasing allocates memory.
+class CAENBatchPool : public std::enable_shared_from_this<CAENBatchPool> {
+    friend class CAENBatchHandle;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::vector<std::unique_ptr<CAENBatch>> _batches;
+    // Has capacity for all the batches, so push_back never allocates
+    std::vector<CAENBatch*> _free;
+
+    CAENBatchPool() = default;
+
+    void _give_back(CAENBatch* batch) noexcept {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _free.push_back(batch);
+        }
+        _cv.notify_one();
+    }
+
+    CAENBatchHandle _take(CAENBatch* batch) {
+        batch->NumEvents = 0;
+        batch->Prescale = 1;
+        batch->Sequence = 0;
+        return CAENBatchHandle(shared_from_this(), batch);
+    }
+
+ public:
+    static std::shared_ptr<CAENBatchPool> create(const std::size_t& num_batches,
+                                                 const uint32_t& capacity,
+                                                 const uint32_t& num_channels,
+                                                 const uint32_t& record_length,
+                                                 const bool& with_waveforms = true) {
+        std::shared_ptr<CAENBatchPool> pool(new CAENBatchPool());
+        pool->_batches.reserve(num_batches);
+        pool->_free.reserve(num_batches);
+        for (std::size_t i = 0; i < num_batches; i++) {
+            pool->_batches.push_back(std::make_unique<CAENBatch>(
+                capacity, num_channels, record_length, with_waveforms));
+            pool->_free.push_back(pool->_batches.back().get());
+        }
+        return pool;
+    }
+
+    // Returns an empty handle if all batches are in use.
+    CAENBatchHandle acquire() {
+        CAENBatch* batch = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_free.empty()) {
+                return CAENBatchHandle{};
+            }
+            batch = _free.back();
+            _free.pop_back();
+        }
+        return _take(batch);
+    }
+
+    // Same as acquire() but waits up to timeout for a batch to be released.
+    template<typename Rep, typename Period>
+    CAENBatchHandle acquireFor(const std::chrono::duration<Rep, Period>& timeout) {
+        CAENBatch* batch = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            if (not _cv.wait_for(lock, timeout, [this]() { return not _free.empty(); })) {
+                return CAENBatchHandle{};
+            }
+            batch = _free.back();
+            _free.pop_back();
+        }
+        return _take(batch);
+    }
+
+    // Number of batches currently free
+    std::size_t available() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _free.size();
+    }
+
+    std::size_t size() const noexcept {
+        return _batches.size();
+    }
+};
+
+void CAENBatchHandle::release() noexcept {
+    if (_batch) {
+        _pool->_give_back(_batch);
+        _batch = nullptr;
+    }
+    _pool.reset();
+}
+
+}  // namespace RedDigitizer
+
+#endif
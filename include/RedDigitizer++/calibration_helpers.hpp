@@ -0,0 +1,333 @@
+/*
+    Calibration helpers
+    Description: Per channel ADC counts to volts calibration (volts =
+    Gain*counts + Offset) and the kernels that apply it to whole
+    waveforms, writing float32 or float16 straight into the caller's
+    buffer (a NumPy array from Python).
+
+    The nominal calibration comes from the model and the group configs,
+    see make_nominal_calibration(...). It can be overridden per channel
+    from a text file or measured on pedestal (or two known level) runs.
+*/
+
+#ifndef RD_CALIBRATION_HELPERS_H
+#define RD_CALIBRATION_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RD_CALIBRATION_SSE2 1
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#define RD_CALIBRATION_F16C 1
+#endif
+#include <cstring>
+
+// C 3rd party includes
+// C++ STD includes
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+namespace detail {
+
+// float to IEEE half (bits), rounding to nearest even. Overflows go to
+// infinity, NaN stays NaN.
+inline uint16_t float_to_half(const float& value) noexcept {
+    uint32_t f = 0;
+    std::memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint32_t out = 0;
+    if (f >= (127u + 16) << 23) {
+        out = f > 0x7F800000u ? 0x7E00 : 0x7C00;
+    } else if (f < 113u << 23) {
+        // Subnormal or zero: adding this float leaves the 10 mantissa bits
+        // at the bottom, rounded by the FPU
+        constexpr uint32_t kMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+        float magic = 0;
+        std::memcpy(&magic, &kMagic, sizeof(magic));
+        float sum = 0;
+        std::memcpy(&sum, &f, sizeof(sum));
+        sum += magic;
+        std::memcpy(&out, &sum, sizeof(out));
+        out -= kMagic;
+    } else {
+        // Rebias the exponent and round the 13 dropped bits to even
+        const uint32_t odd = (f >> 13) & 1;
+        out = (f + ((15u - 127u) << 23) + 0xFFF + odd) >> 13;
+    }
+    return static_cast<uint16_t>(out | sign >> 16);
+}
+
+#ifdef RD_CALIBRATION_SSE2
+// Same as float_to_half for 4 floats, each result in the low 16 bits of
+// its lane
+inline __m128i float_to_half_4(const __m128& value) noexcept {
+#ifdef RD_CALIBRATION_F16C
+    return _mm_unpacklo_epi16(_mm_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT),
+                              _mm_setzero_si128());
+#else
+    const __m128i f_signed = _mm_castps_si128(value);
+    const __m128i sign = _mm_and_si128(f_signed, _mm_set1_epi32(INT32_MIN));
+    const __m128i f = _mm_xor_si128(f_signed, sign);
+
+    const __m128i odd = _mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1));
+    const __m128i normal = _mm_srli_epi32(_mm_add_epi32(
+        _mm_add_epi32(f, _mm_set1_epi32(((15 - 127) << 23) + 0xFFF)), odd), 13);
+    // Usual case, every lane is a normal half: f - (113 << 23) in
+    // [0, 30 << 23)
+    const __m128i in_normal = _mm_cmplt_epi32(
+        _mm_sub_epi32(f, _mm_set1_epi32(INT32_MIN + (113 << 23))),
+        _mm_set1_epi32(INT32_MIN + (30 << 23)));
+    if (_mm_movemask_epi8(in_normal) == 0xFFFF) {
+        return _mm_or_si128(normal, _mm_srli_epi32(sign, 16));
+    }
+
+    const __m128i magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(
+        _mm_castsi128_ps(f), _mm_castsi128_ps(magic))), magic);
+
+    auto select = [](const __m128i& mask, const __m128i& a, const __m128i& b) {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    };
+    __m128i out = select(_mm_cmplt_epi32(f, _mm_set1_epi32(113 << 23)), subnormal, normal);
+    const __m128i inf_nan = select(_mm_cmpgt_epi32(f, _mm_set1_epi32(0x7F800000)),
+                                   _mm_set1_epi32(0x7E00), _mm_set1_epi32(0x7C00));
+    out = select(_mm_cmpgt_epi32(f, _mm_set1_epi32(((127 + 16) << 23) - 1)), inf_nan, out);
+    return _mm_or_si128(out, _mm_srli_epi32(sign, 16));
+#endif
+}
+
+// Gain*counts + offset of 8 counts as two vectors of 4 floats
+inline void counts_to_volts_8(const uint16_t* counts, const __m128& gain,
+                              const __m128& offset, __m128& lo, __m128& hi) noexcept {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(counts));
+    const __m128i zero = _mm_setzero_si128();
+    lo = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), gain), offset);
+    hi = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), gain), offset);
+}
+#endif
+
+}  // namespace detail
+
+// out[i] = gain*counts[i] + offset. out must hold counts.size() floats.
+inline void counts_to_volts(std::span<const uint16_t> counts, const float& gain,
+                            const float& offset, float* out) noexcept {
+    std::size_t i = 0;
+#ifdef RD_CALIBRATION_SSE2
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 o = _mm_set1_ps(offset);
+    for (const std::size_t full = counts.size() / 8 * 8; i < full; i += 8) {
+        __m128 lo, hi;
+        detail::counts_to_volts_8(counts.data() + i, g, o, lo, hi);
+        _mm_storeu_ps(out + i, lo);
+        _mm_storeu_ps(out + i + 4, hi);
+    }
+#endif
+    for (; i < counts.size(); i++) {
+        out[i] = gain*static_cast<float>(counts[i]) + offset;
+    }
+}
+
+// Same as counts_to_volts but out gets IEEE half floats (the bits, as
+// NumPy float16 stores them). Computed in float and rounded once.
+inline void counts_to_volts_half(std::span<const uint16_t> counts, const float& gain,
+                                 const float& offset, uint16_t* out) noexcept {
+    std::size_t i = 0;
+#ifdef RD_CALIBRATION_SSE2
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 o = _mm_set1_ps(offset);
+    for (const std::size_t full = counts.size() / 8 * 8; i < full; i += 8) {
+        __m128 lo, hi;
+        detail::counts_to_volts_8(counts.data() + i, g, o, lo, hi);
+        // Sign extend so the signed pack keeps the 16 bits as they are
+        auto narrow = [](const __m128i& v) {
+            return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        };
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(
+            narrow(detail::float_to_half_4(lo)), narrow(detail::float_to_half_4(hi))));
+    }
+#endif
+    for (; i < counts.size(); i++) {
+        out[i] = detail::float_to_half(gain*static_cast<float>(counts[i]) + offset);
+    }
+}
+
+struct CAENChannelCalibration {
+    // Volts per ADC count
+    double Gain = 1.0;
+    // Volts at 0 ADC counts
+    double Offset = 0.0;
+};
+
+// Calibration of every channel of a digitizer, by CAEN channel number.
+// volts = Gain*counts + Offset.
+class CAENCalibrationTable {
+    std::vector<CAENChannelCalibration> _channels;
+
+ public:
+    CAENCalibrationTable() = default;
+    // num_channels channels with Gain 1 and Offset 0
+    explicit CAENCalibrationTable(const std::size_t& num_channels) :
+        _channels(num_channels) { }
+    explicit CAENCalibrationTable(std::vector<CAENChannelCalibration> channels) :
+        _channels{std::move(channels)} { }
+
+    std::size_t size() const noexcept {
+        return _channels.size();
+    }
+
+    // Throws std::out_of_range if the table does not have channel ch
+    const CAENChannelCalibration& at(const std::size_t& ch) const {
+        return _channels.at(ch);
+    }
+    void set(const std::size_t& ch, const CAENChannelCalibration& calibration) {
+        _channels.at(ch) = calibration;
+    }
+
+    std::span<const CAENChannelCalibration> getChannels() const noexcept {
+        return _channels;
+    }
+
+    double toVolts(const std::size_t& ch, const double& counts) const {
+        const auto& c = at(ch);
+        return c.Gain*counts + c.Offset;
+    }
+    double toCounts(const std::size_t& ch, const double& volts) const {
+        const auto& c = at(ch);
+        return (volts - c.Offset) / c.Gain;
+    }
+
+    // Writes every channel of event in volts into out as [channel,
+    // sample]. Throws std::invalid_argument if out is too small and
+    // std::out_of_range if a channel of event is not in the table.
+    template<typename Waveforms>
+    void toVolts(const Waveforms& event, std::span<float> out) const {
+        _convert(event, out, counts_to_volts);
+    }
+    // Same as toVolts with IEEE half floats
+    template<typename Waveforms>
+    void toVoltsHalf(const Waveforms& event, std::span<uint16_t> out) const {
+        _convert(event, out, counts_to_volts_half);
+    }
+
+    // Sets the Offset of every channel of events so the mean of all their
+    // samples reads volts. Meant for pedestal runs (no signal, known
+    // input level, usually 0 V). Gains are kept.
+    template<typename WaveformsPtr>
+    void measureOffsets(std::span<const WaveformsPtr> events, const double& volts = 0.0) {
+        if (events.empty()) {
+            return;
+        }
+        const auto& channels = events[0]->getEnabledChannels();
+        for (std::size_t ch_index = 0; ch_index < channels.size(); ch_index++) {
+            double sum = 0.0;
+            std::size_t num_samples = 0;
+            for (const auto& event : events) {
+                if (event->getEnabledChannels() != channels) {
+                    continue;
+                }
+                for (const auto& sample : event->getChannel(ch_index)) {
+                    sum += sample;
+                }
+                num_samples += event->getRecordLength();
+            }
+            if (num_samples == 0) {
+                continue;
+            }
+            auto& c = _channels.at(channels[ch_index]);
+            c.Offset = volts - c.Gain*sum / static_cast<double>(num_samples);
+        }
+    }
+
+    // Sets Gain and Offset of ch from two inputs of known volts that read
+    // counts_a and counts_b. Throws std::invalid_argument if both read the
+    // same.
+    void measureTwoPoint(const std::size_t& ch,
+                         const double& counts_a, const double& volts_a,
+                         const double& counts_b, const double& volts_b) {
+        if (counts_a == counts_b) {
+            throw std::invalid_argument("Both calibration points read the same "
+                                        "counts on channel " + std::to_string(ch) + ".");
+        }
+        auto& c = _channels.at(ch);
+        c.Gain = (volts_b - volts_a) / (counts_b - counts_a);
+        c.Offset = volts_a - c.Gain*counts_a;
+    }
+
+    // Text file, one "channel gain offset" line per channel. Lines
+    // starting with # are comments.
+    void save(const std::string& path) const {
+        std::ofstream file(path);
+        file.precision(std::numeric_limits<double>::max_digits10);
+        file << "# channel gain(V/count) offset(V)\n";
+        for (std::size_t ch = 0; ch < _channels.size(); ch++) {
+            file << ch << " " << _channels[ch].Gain << " " << _channels[ch].Offset << "\n";
+        }
+        if (not file) {
+            throw std::runtime_error("Failed to write " + path + ".");
+        }
+    }
+
+    // Overrides the channels listed in a file written by save(...), the
+    // others are kept. Throws std::runtime_error, leaving the table as it
+    // was, if the file can not be read or a line is not "channel gain
+    // offset" of a channel in the table.
+    void load(const std::string& path) {
+        std::ifstream file(path);
+        if (not file) {
+            throw std::runtime_error("Failed to open " + path + ".");
+        }
+        auto channels = _channels;
+        std::string line;
+        for (std::size_t line_num = 1; std::getline(file, line); line_num++) {
+            const auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos or line[first] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            std::size_t ch = 0;
+            CAENChannelCalibration c;
+            if (not (fields >> ch >> c.Gain >> c.Offset) or ch >= channels.size()) {
+                throw std::runtime_error(path + ":" + std::to_string(line_num)
+                    + " is not a \"channel gain offset\" line of a channel "
+                    "of this digitizer.");
+            }
+            channels[ch] = c;
+        }
+        _channels = std::move(channels);
+    }
+
+ private:
+    template<typename Waveforms, typename T, typename Kernel>
+    void _convert(const Waveforms& event, std::span<T> out, Kernel&& kernel) const {
+        const std::size_t rl = event.getRecordLength();
+        const auto& channels = event.getEnabledChannels();
+        if (out.size() < channels.size()*rl) {
+            throw std::invalid_argument("Output buffer too small for the event.");
+        }
+        for (std::size_t ch_index = 0; ch_index < channels.size(); ch_index++) {
+            const auto& c = at(channels[ch_index]);
+            kernel(event.getChannel(ch_index), static_cast<float>(c.Gain),
+                   static_cast<float>(c.Offset), out.data() + ch_index*rl);
+        }
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,344 @@
+/*
+    Coincidence helpers
+    Description: Software N-of-M coincidence on decoded waveforms, finer
+    than the hardware majority (one level and one window for the whole
+    board): each condition is a named set of channels, how many of them
+    have to go over a threshold and the window, in samples, they have to
+    do it within.
+
+    CAEN uses it right after decoding (see CAEN::EnableCoincidenceFilter)
+    so the events that fail never reach the exports, the shared ring, the
+    trigger streams or the run files.
+*/
+
+#ifndef RD_COINCIDENCE_HELPERS_H
+#define RD_COINCIDENCE_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RD_COINCIDENCE_SSE2 1
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+namespace detail {
+
+// The kernels of CAENCoincidenceFilter. SSE2 does 16 samples per step,
+// the scalar loops do the tails (and everything without SSE2).
+
+// hits[i] = x[i] < limit (Below) or x[i] > limit. Returns true if any,
+// with the positions of the first and last hits.
+template<bool Below>
+inline bool coincidence_hits(const uint16_t* x, const std::size_t& n,
+                             const uint16_t& limit, uint8_t* hits,
+                             std::size_t& first, std::size_t& last) noexcept {
+    first = n;
+    last = 0;
+    std::size_t i = 0;
+#ifdef RD_COINCIDENCE_SSE2
+    // No unsigned 16 bit compare in SSE2: flip the sign bits and compare
+    // signed
+    const __m128i flip = _mm_set1_epi16(-0x8000);
+    const __m128i lim = _mm_xor_si128(_mm_set1_epi16(static_cast<int16_t>(limit)), flip);
+    const __m128i one = _mm_set1_epi8(1);
+    for (const std::size_t full = n / 16 * 16; i < full; i += 16) {
+        const __m128i a = _mm_xor_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)), flip);
+        const __m128i b = _mm_xor_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i + 8)), flip);
+        const __m128i ma = Below ? _mm_cmplt_epi16(a, lim) : _mm_cmpgt_epi16(a, lim);
+        const __m128i mb = Below ? _mm_cmplt_epi16(b, lim) : _mm_cmpgt_epi16(b, lim);
+        const __m128i m = _mm_packs_epi16(ma, mb);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(hits + i), _mm_and_si128(m, one));
+        const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(m));
+        if (mask != 0) {
+            first = std::min<std::size_t>(first, i + std::countr_zero(mask));
+            last = i + std::bit_width(mask) - 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        hits[i] = Below ? x[i] < limit : x[i] > limit;
+        if (hits[i]) {
+            first = std::min(first, i);
+            last = i;
+        }
+    }
+    return first < n;
+}
+
+// out[i] = in[i] | in[i - shift] (in[i] for i < shift)
+inline void coincidence_or_shifted(const uint8_t* in, const std::size_t& shift,
+                                   const std::size_t& n, uint8_t* out) noexcept {
+    std::size_t i = 0;
+    for (; i < std::min(shift, n); i++) {
+        out[i] = in[i];
+    }
+#ifdef RD_COINCIDENCE_SSE2
+    // i starts at shift, so bound by the end and not by n / 16 * 16
+    for (; i + 16 <= n; i += 16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_or_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i - shift))));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = in[i] | in[i - shift];
+    }
+}
+
+// counts[i] += in[i] | in[i - shift] (in[i] for i < shift)
+inline void coincidence_add_shifted(const uint8_t* in, const std::size_t& shift,
+                                    const std::size_t& n, uint8_t* counts) noexcept {
+    std::size_t i = 0;
+    for (; i < std::min(shift, n); i++) {
+        counts[i] += in[i];
+    }
+#ifdef RD_COINCIDENCE_SSE2
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_or_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i - shift)));
+        __m128i* c = reinterpret_cast<__m128i*>(counts + i);
+        _mm_storeu_si128(c, _mm_add_epi8(_mm_loadu_si128(c), v));
+    }
+#endif
+    for (; i < n; i++) {
+        counts[i] += in[i] | in[i - shift];
+    }
+}
+
+inline uint8_t coincidence_max(const uint8_t* counts, const std::size_t& n) noexcept {
+    std::size_t i = 0;
+    uint8_t out = 0;
+#ifdef RD_COINCIDENCE_SSE2
+    __m128i max_v = _mm_setzero_si128();
+    for (const std::size_t full = n / 16 * 16; i < full; i += 16) {
+        max_v = _mm_max_epu8(max_v,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(counts + i)));
+    }
+    alignas(16) uint8_t lanes[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), max_v);
+    out = *std::max_element(lanes, lanes + 16);
+#endif
+    for (; i < n; i++) {
+        out = std::max(out, counts[i]);
+    }
+    return out;
+}
+
+}  // namespace detail
+
+struct CAENCoincidenceCondition {
+    // Used in the stats and the logs
+    std::string Name;
+    // CAEN channel numbers of the set (the M). Channels that are not read
+    // out never count as hit.
+    std::vector<std::size_t> Channels;
+    // Channels of the set that have to be over threshold (the N)
+    uint32_t Multiplicity = 2;
+    // Excursion from the baseline, in ADC counts, that makes a hit
+    uint32_t Threshold = 50;
+    // Hits closer than Window samples are coincident
+    uint32_t Window = 16;
+};
+
+struct CAENCoincidenceConfig {
+    std::vector<CAENCoincidenceCondition> Conditions;
+    // true -> an event has to pass every condition, false -> any of them
+    bool RequireAll = false;
+
+    // Number of samples at the beginning of each channel used for the
+    // baseline. Clamped to the record length.
+    uint32_t BaselineSamples = 20;
+    // true -> pulses go below the baseline (most PMT/SiPM signals)
+    // false -> pulses go above the baseline
+    bool NegativePolarity = true;
+};
+
+struct CAENCoincidenceStats {
+    // Events evaluated
+    uint64_t Events = 0;
+    // Events kept
+    uint64_t Kept = 0;
+    // Events that passed each condition, in Conditions order. Every
+    // condition is evaluated on every event, so these are the true pass
+    // rates whatever RequireAll is.
+    std::vector<uint64_t> Passed;
+};
+
+// Evaluates the conditions of a CAENCoincidenceConfig on decoded events.
+// Per condition and event:
+//  1. each channel of the set is compared to baseline +- Threshold,
+//  2. its hits are stretched Window samples forward,
+//  3. the stretched hits of all channels are added sample by sample and
+//     the condition passes if any sample reaches Multiplicity.
+// Every step works on uint8_t per sample, 16 samples per SSE2 step.
+// Channels without any hit skip steps 2 and 3, the others only stretch
+// from their first hit to Window samples after their last one.
+//
+// Scratch buffers grow to the biggest record length seen.
+class CAENCoincidenceFilter {
+    CAENCoincidenceConfig _config;
+    CAENCoincidenceStats _stats;
+
+    std::vector<uint8_t> _hits;
+    std::vector<uint8_t> _stretched;
+    std::vector<uint8_t> _counts;
+
+    // Sets _hits[i] to 1 where samples is over threshold, and [first, last]
+    // to where the hits are. Returns false if there are no hits at all.
+    bool _find_hits(std::span<const uint16_t> samples, const uint32_t& threshold,
+                    std::size_t& first, std::size_t& last) noexcept {
+        const std::size_t n = samples.size();
+        const std::size_t num_baseline = std::clamp<std::size_t>(
+            _config.BaselineSamples, 1, n);
+        int64_t base_sum = 0;
+        for (std::size_t i = 0; i < num_baseline; i++) {
+            base_sum += samples[i];
+        }
+        const int64_t baseline = base_sum / static_cast<int64_t>(num_baseline);
+
+        // The threshold as a sample value, so the kernel compares uint16_t
+        const int64_t limit = _config.NegativePolarity ?
+            baseline - threshold : baseline + threshold;
+        if (limit <= 0 or limit >= 0xFFFF) {
+            return false;
+        }
+        const auto lim = static_cast<uint16_t>(limit);
+        if (_config.NegativePolarity) {
+            return detail::coincidence_hits<true>(samples.data(), n, lim, _hits.data(),
+                                                  first, last);
+        }
+        return detail::coincidence_hits<false>(samples.data(), n, lim, _hits.data(),
+                                               first, last);
+    }
+
+    // Adds OR of _hits[i - window + 1 .. i] to _counts[i]. Done by
+    // doubling the span covered (1, 2, 4, ... samples) and then OR-ing two
+    // overlapping power of two spans, log2(window) passes in total. Only
+    // [first, last + window) can change, so only that part is touched.
+    void _stretch(const std::size_t& first, const std::size_t& last,
+                  const std::size_t& record_length, const uint32_t& window) noexcept {
+        const std::size_t n = std::min<std::size_t>(record_length, last + window) - first;
+        uint8_t* cur = _hits.data() + first;
+        uint8_t* next = _stretched.data() + first;
+        std::size_t span = 1;
+        const std::size_t target = std::bit_floor(std::max<uint32_t>(window, 1));
+        for (; span < target; span *= 2) {
+            detail::coincidence_or_shifted(cur, span, n, next);
+            std::swap(cur, next);
+        }
+
+        // cur covers span samples, span <= window < 2*span. The last OR
+        // goes straight into the counts.
+        detail::coincidence_add_shifted(cur, window - span, n, _counts.data() + first);
+    }
+
+ public:
+    // Throws std::invalid_argument if a condition can never pass
+    explicit CAENCoincidenceFilter(const CAENCoincidenceConfig& config) :
+        _config{config}
+    {
+        for (const auto& condition : _config.Conditions) {
+            if (condition.Multiplicity == 0
+                or condition.Multiplicity > condition.Channels.size()) {
+                throw std::invalid_argument("Coincidence condition " + condition.Name
+                    + " needs a multiplicity between 1 and its number of channels.");
+            }
+            if (condition.Window == 0) {
+                throw std::invalid_argument("Coincidence condition " + condition.Name
+                    + " needs a window of at least 1 sample.");
+            }
+            if (condition.Channels.size() > 255) {
+                throw std::invalid_argument("Coincidence condition " + condition.Name
+                    + " has more than 255 channels.");
+            }
+        }
+        _stats.Passed.resize(_config.Conditions.size(), 0);
+    }
+
+    const CAENCoincidenceConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    // Evaluates condition c on event, without touching the stats.
+    template<typename Waveforms>
+    bool evaluate(const Waveforms& event, const std::size_t& c) noexcept {
+        const auto& condition = _config.Conditions[c];
+        const std::size_t n = event.getRecordLength();
+        if (_hits.size() < n) {
+            _hits.resize(n);
+            _stretched.resize(n);
+            _counts.resize(n);
+        }
+        std::fill_n(_counts.begin(), n, 0);
+
+        uint32_t hit_channels = 0;
+        for (std::size_t k = 0; k < condition.Channels.size(); k++) {
+            // Not enough channels left to reach the multiplicity
+            if (hit_channels + (condition.Channels.size() - k) < condition.Multiplicity) {
+                return false;
+            }
+            const std::size_t ch_index = event.findChannel(condition.Channels[k]);
+            std::size_t first = 0;
+            std::size_t last = 0;
+            if (ch_index >= event.getNumEnabledChannels()
+                or not _find_hits(event.getChannel(ch_index), condition.Threshold,
+                                  first, last)) {
+                continue;
+            }
+            _stretch(first, last, n, condition.Window);
+            hit_channels++;
+        }
+
+        if (hit_channels < condition.Multiplicity) {
+            return false;
+        }
+        return detail::coincidence_max(_counts.data(), n) >= condition.Multiplicity;
+    }
+
+    // Evaluates every condition on event, updates the stats and returns
+    // whether the event is kept. Without conditions every event is kept.
+    template<typename Waveforms>
+    bool accept(const Waveforms& event) noexcept {
+        _stats.Events++;
+        bool keep = _config.RequireAll or _config.Conditions.empty();
+        for (std::size_t c = 0; c < _config.Conditions.size(); c++) {
+            const bool passed = evaluate(event, c);
+            _stats.Passed[c] += passed;
+            keep = _config.RequireAll ? keep and passed : keep or passed;
+        }
+        _stats.Kept += keep;
+        return keep;
+    }
+
+    const CAENCoincidenceStats& getStats() const noexcept {
+        return _stats;
+    }
+
+    void resetStats() noexcept {
+        _stats.Events = 0;
+        _stats.Kept = 0;
+        std::fill(_stats.Passed.begin(), _stats.Passed.end(), 0);
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,455 @@
+/*
+    Coroutine helpers
+    Description: C++20 coroutines for the acquisition. CAENTask is an
+    awaitable task and CAENEventLoop a single thread executor with timers,
+    so one thread can read several boards, flush writers and take control
+    commands from other threads without busy polling:
+
+        CAENTask<> readout(CAENEventLoop& loop, CAEN<>& caen) {
+            while (true) {
+                const bool got = co_await loop.nextBatch(caen, 100, 1s);
+                if (not got) {
+                    break;
+                }
+                ...
+            }
+        }
+
+    Keep co_await out of if/while conditions: GCC 12 miscompiles it there
+    and the coroutine is never resumed.
+
+    The CAEN API has no descriptor to wait on, so nextBatch(...) checks the
+    board on a timer that backs off while it is empty. The loop sleeps
+    until the closest timer or until work is posted to it.
+*/
+
+#ifndef RD_COROUTINE_HELPERS_H
+#define RD_COROUTINE_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <iterator>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+template<typename T = void>
+class CAENTask;
+
+namespace detail {
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> Continuation = nullptr;
+    std::exception_ptr Error = nullptr;
+
+    // Resumes whoever awaited the task, if anyone
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            if (auto cont = h.promise().Continuation) {
+                return cont;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() const noexcept { }
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { Error = std::current_exception(); }
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> Value;
+
+    CAENTask<T> get_return_object() noexcept;
+    template<typename U>
+    void return_value(U&& value) { Value.emplace(std::forward<U>(value)); }
+
+    T result() {
+        if (Error) {
+            std::rethrow_exception(Error);
+        }
+        return std::move(*Value);
+    }
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    CAENTask<void> get_return_object() noexcept;
+    void return_void() const noexcept { }
+
+    void result() {
+        if (Error) {
+            std::rethrow_exception(Error);
+        }
+    }
+};
+
+}  // namespace detail
+
+// Lazy coroutine: it starts when awaited, or when given to
+// CAENEventLoop::spawn(...) or runUntilComplete(...). Move only; the frame
+// is destroyed with the task.
+template<typename T>
+class CAENTask {
+ public:
+    using promise_type = detail::TaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+ private:
+    handle_type _handle = nullptr;
+
+ public:
+    CAENTask() = default;
+    explicit CAENTask(handle_type handle) noexcept : _handle{handle} { }
+
+    CAENTask(const CAENTask&) = delete;
+    CAENTask& operator=(const CAENTask&) = delete;
+
+    CAENTask(CAENTask&& other) noexcept :
+        _handle{std::exchange(other._handle, nullptr)} { }
+
+    CAENTask& operator=(CAENTask&& other) noexcept {
+        if (this != &other) {
+            if (_handle) {
+                _handle.destroy();
+            }
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~CAENTask() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    bool isDone() const noexcept {
+        return not _handle or _handle.done();
+    }
+
+    handle_type getHandle() const noexcept {
+        return _handle;
+    }
+
+    // Value returned by the coroutine, or rethrows its exception. Only
+    // valid once isDone().
+    T result() {
+        return _handle.promise().result();
+    }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            handle_type Handle;
+            bool await_ready() const noexcept {
+                return not Handle or Handle.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                Handle.promise().Continuation = awaiting;
+                return Handle;
+            }
+            T await_resume() {
+                return Handle.promise().result();
+            }
+        };
+        return Awaiter{_handle};
+    }
+};
+
+namespace detail {
+
+template<typename T>
+CAENTask<T> TaskPromise<T>::get_return_object() noexcept {
+    return CAENTask<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline CAENTask<void> TaskPromise<void>::get_return_object() noexcept {
+    return CAENTask<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+struct CAENPollConfig {
+    // First wait after the board did not have enough events, in seconds
+    double MinInterval = 100e-6;
+    // The wait doubles every empty check up to this, in seconds
+    double MaxInterval = 5e-3;
+};
+
+struct CAENEventLoopStats {
+    // Coroutines resumed
+    uint64_t Resumes = 0;
+    // Times the thread went to sleep waiting for a timer or a post
+    uint64_t Sleeps = 0;
+    // Checks done by nextBatch(...) that found fewer events than asked
+    uint64_t EmptyPolls = 0;
+    uint64_t BatchesRead = 0;
+};
+
+// Runs coroutines on the thread that calls run(). Only post(...) and
+// stop() can be called from other threads.
+class CAENEventLoop {
+    using clock = std::chrono::steady_clock;
+
+    struct Timer {
+        clock::time_point Deadline;
+        // Keeps timers with the same deadline in order
+        uint64_t Order = 0;
+        std::coroutine_handle<> Handle;
+
+        bool operator>(const Timer& other) const noexcept {
+            return Deadline != other.Deadline ? Deadline > other.Deadline
+                                              : Order > other.Order;
+        }
+    };
+
+    std::deque<std::coroutine_handle<>> _ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+    uint64_t _timer_order = 0;
+    std::vector<CAENTask<void>> _spawned;
+    CAENEventLoopStats _stats;
+
+    // Shared with other threads
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::vector<std::function<void()>> _posted;
+    bool _stop = false;
+
+    // Runs the posted functions. Returns false if stop() was called.
+    bool _take_posted() {
+        std::vector<std::function<void()>> posted;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_stop) {
+                return false;
+            }
+            posted.swap(_posted);
+        }
+        for (auto& f : posted) {
+            f();
+        }
+        return true;
+    }
+
+    // Rethrows the exception of a finished spawned task and forgets the
+    // finished ones.
+    void _reap() {
+        auto it = std::partition(_spawned.begin(), _spawned.end(),
+            [](const CAENTask<void>& task) { return not task.isDone(); });
+        std::vector<CAENTask<void>> done;
+        std::move(it, _spawned.end(), std::back_inserter(done));
+        _spawned.erase(it, _spawned.end());
+        for (auto& task : done) {
+            task.result();
+        }
+    }
+
+    // One round: posted work, expired timers, then every ready coroutine.
+    // Sleeps first if there is nothing to do. Returns false on stop().
+    bool _step(const std::function<bool()>& done) {
+        if (not _take_posted()) {
+            return false;
+        }
+
+        if (_ready.empty() and not done()) {
+            std::unique_lock<std::mutex> lock(_mtx);
+            const auto has_work = [this]() { return _stop or not _posted.empty(); };
+            if (not has_work()) {
+                _stats.Sleeps++;
+                if (_timers.empty()) {
+                    _cv.wait(lock, has_work);
+                } else {
+                    _cv.wait_until(lock, _timers.top().Deadline, has_work);
+                }
+            }
+            lock.unlock();
+            if (not _take_posted()) {
+                return false;
+            }
+        }
+
+        const auto now = clock::now();
+        while (not _timers.empty() and _timers.top().Deadline <= now) {
+            _ready.push_back(_timers.top().Handle);
+            _timers.pop();
+        }
+
+        // Coroutines made ready while resuming wait for the next round, so
+        // timers and posts are not starved.
+        for (std::size_t n = _ready.size(); n > 0; n--) {
+            auto handle = _ready.front();
+            _ready.pop_front();
+            _stats.Resumes++;
+            handle.resume();
+        }
+        _reap();
+        return true;
+    }
+
+ public:
+    CAENEventLoop() = default;
+    CAENEventLoop(const CAENEventLoop&) = delete;
+    CAENEventLoop& operator=(const CAENEventLoop&) = delete;
+
+    // Resumes handle in the next round
+    void schedule(std::coroutine_handle<> handle) {
+        _ready.push_back(handle);
+    }
+
+    // Resumes handle at deadline
+    void scheduleAt(std::coroutine_handle<> handle, const clock::time_point& deadline) {
+        _timers.push(Timer{deadline, _timer_order++, handle});
+    }
+
+    // co_await loop.sleepFor(duration)
+    template<typename Rep, typename Period>
+    auto sleepFor(const std::chrono::duration<Rep, Period>& duration) {
+        struct Awaiter {
+            CAENEventLoop& Loop;
+            clock::time_point Deadline;
+            bool await_ready() const noexcept { return Deadline <= clock::now(); }
+            void await_suspend(std::coroutine_handle<> h) { Loop.scheduleAt(h, Deadline); }
+            void await_resume() const noexcept { }
+        };
+        return Awaiter{*this, clock::now()
+            + std::chrono::duration_cast<clock::duration>(duration)};
+    }
+
+    // co_await loop.yield() lets the other ready coroutines run
+    auto yield() {
+        struct Awaiter {
+            CAENEventLoop& Loop;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { Loop.schedule(h); }
+            void await_resume() const noexcept { }
+        };
+        return Awaiter{*this};
+    }
+
+    // Starts task in the background. The loop owns it; an exception
+    // thrown by it is rethrown by run().
+    void spawn(CAENTask<void> task) {
+        if (task.isDone()) {
+            return;
+        }
+        schedule(task.getHandle());
+        _spawned.push_back(std::move(task));
+    }
+
+    // Thread-safe. Runs f on the loop thread in the next round, e.g. a
+    // control command from another thread.
+    void post(std::function<void()> f) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _posted.push_back(std::move(f));
+        }
+        _cv.notify_one();
+    }
+
+    // Thread-safe. Makes run() return after the current round.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+        _cv.notify_one();
+    }
+
+    // Runs until every spawned task finished or stop() is called.
+    void run() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = false;
+        }
+        const std::function<bool()> done = [this]() { return _spawned.empty(); };
+        while (not done() and _step(done)) { }
+    }
+
+    // Runs task and every spawned task until task finishes, then returns
+    // its result. Throws std::runtime_error if stop() was called first.
+    template<typename T>
+    T runUntilComplete(CAENTask<T> task) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = false;
+        }
+        schedule(task.getHandle());
+        const std::function<bool()> done = [&task]() { return task.isDone(); };
+        while (not done()) {
+            if (not _step(done)) {
+                throw std::runtime_error("Event loop stopped before the task finished.");
+            }
+        }
+        return task.result();
+    }
+
+    const CAENEventLoopStats& getStats() const noexcept {
+        return _stats;
+    }
+
+    // Waits until caen has at least min_events events, then retrieves and
+    // decodes them and returns true. Returns false after timeout (negative
+    // waits forever) or if caen has an error. While the board is empty
+    // the wait between checks backs off following poll.
+    template<typename CAENType, typename Rep = double, typename Period = std::ratio<1>>
+    CAENTask<bool> nextBatch(CAENType& caen, const uint32_t min_events,
+                             const std::chrono::duration<Rep, Period> timeout
+                                = std::chrono::duration<double>(-1.0),
+                             const CAENPollConfig poll = CAENPollConfig{}) {
+        const bool forever = timeout < timeout.zero();
+        const auto deadline = clock::now() + (forever ? clock::duration::zero()
+            : std::chrono::duration_cast<clock::duration>(timeout));
+        std::chrono::duration<double> interval(poll.MinInterval);
+        const std::chrono::duration<double> max_interval(
+            std::max(poll.MaxInterval, poll.MinInterval));
+
+        while (true) {
+            if (caen.RetrieveDataUntilNEvents(min_events)) {
+                caen.DecodeEvents();
+                _stats.BatchesRead++;
+                co_return true;
+            }
+            if (caen.HasError()) {
+                co_return false;
+            }
+            _stats.EmptyPolls++;
+
+            auto wait = std::chrono::duration_cast<clock::duration>(interval);
+            if (not forever) {
+                const auto left = deadline - clock::now();
+                if (left <= clock::duration::zero()) {
+                    co_return false;
+                }
+                wait = std::min(wait, left);
+            }
+            co_await sleepFor(wait);
+            interval = std::min(interval*2, max_interval);
+        }
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,992 @@
+/*
+    File helpers
+    Description: Run files of decoded events stored in chunks, column by
+    column, with an index of the chunks at the end of the file so a reader
+    can find any event, EventCounter or trigger time with a binary search
+    instead of scanning the run.
+
+    Layout:
+        CAENRunFileHeader
+        chunk 0, chunk 1, ...
+        CAENRunIndexEntry x NumChunks
+        CAENRunFileTrailer (last 32 bytes of the file)
+
+    Each chunk is a CAENRunChunkHeader followed by the event info columns
+    (uint32_t, in CAENEventColumn order), the extended EventCounter and
+    trigger time tag (uint64_t), and the samples of each channel as
+    [event, sample] uint16_t, one block per channel. Everything starts at a
+    multiple of 64 bytes from the start of the file, see CAENRunChunkLayout.
+
+    A file whose writer did not finish has no index; the readers rebuild
+    it by walking the chunk headers. Assumes a little endian machine.
+
+    CAENRunFileReader reads chunks with plain file reads, CAENRunFileMap
+    maps the whole file and hands out views of the mapped pages.
+*/
+
+#ifndef RD_FILE_HELPERS_H
+#define RD_FILE_HELPERS_H
+#pragma once
+
+// C STD includes
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <cstring>
+
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "red_digitizer_helper.hpp"
+#include "batch_helpers.hpp"
+#include "table_helpers.hpp"
+
+namespace RedDigitizer {
+
+static_assert(std::endian::native == std::endian::little,
+              "Run files assume a little endian machine.");
+
+// First 8 bytes of a run file: "RDRUNFIL"
+constexpr uint64_t kRunFileMagic = 0x4C49464E55524452ull;
+// First 8 bytes of each chunk: "RDCHUNK_"
+constexpr uint64_t kRunChunkMagic = 0x5F4B4E5548434452ull;
+// Last 8 bytes of a finished run file: "RDRUNIDX"
+constexpr uint64_t kRunIndexMagic = 0x5844494E55524452ull;
+constexpr uint32_t kRunFileVersion = 1;
+// Max number of channels a run file can describe (x740 has 64)
+constexpr std::size_t kRunFileMaxChannels = 64;
+// Every block of a chunk starts at a multiple of this
+constexpr std::size_t kRunFileAlignment = 64;
+
+struct CAENRunFileHeader {
+    uint64_t Magic = kRunFileMagic;
+    uint32_t Version = kRunFileVersion;
+    uint32_t HeaderSize = 0;
+    uint32_t NumChannels = 0;
+    uint32_t RecordLength = 0;
+    uint32_t ADCResolution = 0;
+    // Events per chunk, the last chunk can have less
+    uint32_t ChunkEvents = 0;
+    // In ns
+    double SamplePeriod = 0.0;
+    // In ns
+    double TriggerTimeTagLSB = 0.0;
+    // Width of the trigger time tag counter before it rolls over
+    uint32_t TriggerTimeTagBits = 0;
+    uint32_t Reserved = 0;
+    // CAEN channel numbers of the channels stored
+    std::array<uint8_t, kRunFileMaxChannels> Channels = {};
+};
+
+struct alignas(kRunFileAlignment) CAENRunChunkHeader {
+    uint64_t Magic = kRunChunkMagic;
+    // Index of the first event of the chunk in the run
+    uint64_t FirstEvent = 0;
+    uint32_t NumEvents = 0;
+    uint32_t Reserved = 0;
+};
+
+// One per chunk. Counters and trigger time tags are extended, so they
+// only go up along the run and can be searched.
+struct CAENRunIndexEntry {
+    // In bytes from the start of the file
+    uint64_t Offset = 0;
+    uint64_t FirstEvent = 0;
+    uint32_t NumEvents = 0;
+    uint32_t Reserved = 0;
+    uint64_t FirstCounter = 0;
+    uint64_t LastCounter = 0;
+    uint64_t FirstTriggerTimeTag = 0;
+    uint64_t LastTriggerTimeTag = 0;
+};
+
+struct CAENRunFileTrailer {
+    uint64_t IndexOffset = 0;
+    uint64_t NumChunks = 0;
+    uint64_t NumEvents = 0;
+    uint64_t Magic = kRunIndexMagic;
+};
+
+// Where everything is inside a chunk of num_events events, in bytes from
+// the chunk start.
+struct CAENRunChunkLayout {
+    std::array<std::size_t, kNumEventColumns> Columns = {};
+    std::size_t ExtendedCounter = 0;
+    std::size_t ExtendedTriggerTimeTag = 0;
+    // First channel block, the others follow every ChannelStride bytes
+    std::size_t Samples = 0;
+    std::size_t ChannelStride = 0;
+    std::size_t ChunkSize = 0;
+
+    static constexpr std::size_t align(const std::size_t& x) noexcept {
+        return (x + kRunFileAlignment - 1) & ~(kRunFileAlignment - 1);
+    }
+
+    CAENRunChunkLayout() = default;
+    CAENRunChunkLayout(const uint32_t& num_events,
+                       const uint32_t& num_channels,
+                       const uint32_t& record_length) {
+        const std::size_t column = align(sizeof(uint32_t)*num_events);
+        const std::size_t wide_column = align(sizeof(uint64_t)*num_events);
+        std::size_t offset = align(sizeof(CAENRunChunkHeader));
+        for (auto& col : Columns) {
+            col = offset;
+            offset += column;
+        }
+        ExtendedCounter = offset;
+        ExtendedTriggerTimeTag = ExtendedCounter + wide_column;
+        Samples = ExtendedTriggerTimeTag + wide_column;
+        ChannelStride = align(sizeof(uint16_t)*num_events*record_length);
+        ChunkSize = Samples + num_channels*ChannelStride;
+    }
+};
+
+struct CAENRunFileConfig {
+    // Events per chunk. Bigger chunks mean fewer index entries and longer
+    // sequential reads, smaller ones finer seeks.
+    uint32_t ChunkEvents = 4096;
+    // Width of the trigger time tag counter of the digitizer
+    uint32_t TriggerTimeTagBits = 31;
+};
+
+// A chunk as seen by a reader. Everything points into memory owned by the
+// reader (or the caller buffer given to it).
+struct CAENRunChunkView {
+    uint64_t FirstEvent = 0;
+    uint32_t NumEvents = 0;
+    uint32_t NumChannels = 0;
+    uint32_t RecordLength = 0;
+    std::array<std::span<const uint32_t>, kNumEventColumns> Columns;
+    std::span<const uint64_t> ExtendedCounter;
+    std::span<const uint64_t> ExtendedTriggerTimeTag;
+    // [channel, event, sample], channel blocks are ChannelStride apart
+    const uint16_t* Samples = nullptr;
+    std::size_t ChannelStride = 0;
+
+    std::span<const uint32_t> column(const CAENEventColumn& col) const noexcept {
+        return Columns[static_cast<std::size_t>(col)];
+    }
+
+    // [event, sample] of channel index ch_index
+    std::span<const uint16_t> channel(const std::size_t& ch_index) const noexcept {
+        return std::span<const uint16_t>(Samples + ch_index*ChannelStride,
+                                         std::size_t{NumEvents}*RecordLength);
+    }
+
+    // Samples of event ev (relative to the chunk) in channel index ch_index
+    std::span<const uint16_t> waveform(const std::size_t& ev,
+                                       const std::size_t& ch_index) const noexcept {
+        return channel(ch_index).subspan(ev*RecordLength, RecordLength);
+    }
+
+    static CAENRunChunkView fromMemory(const std::byte* chunk,
+                                       const CAENRunFileHeader& header) noexcept {
+        CAENRunChunkHeader chunk_header;
+        std::memcpy(&chunk_header, chunk, sizeof(chunk_header));
+        const CAENRunChunkLayout layout(chunk_header.NumEvents,
+                                        header.NumChannels, header.RecordLength);
+
+        CAENRunChunkView out;
+        out.FirstEvent = chunk_header.FirstEvent;
+        out.NumEvents = chunk_header.NumEvents;
+        out.NumChannels = header.NumChannels;
+        out.RecordLength = header.RecordLength;
+        for (std::size_t c = 0; c < kNumEventColumns; c++) {
+            out.Columns[c] = std::span<const uint32_t>(
+                reinterpret_cast<const uint32_t*>(chunk + layout.Columns[c]),
+                out.NumEvents);
+        }
+        out.ExtendedCounter = std::span<const uint64_t>(
+            reinterpret_cast<const uint64_t*>(chunk + layout.ExtendedCounter),
+            out.NumEvents);
+        out.ExtendedTriggerTimeTag = std::span<const uint64_t>(
+            reinterpret_cast<const uint64_t*>(chunk + layout.ExtendedTriggerTimeTag),
+            out.NumEvents);
+        out.Samples = reinterpret_cast<const uint16_t*>(chunk + layout.Samples);
+        out.ChannelStride = layout.ChannelStride / sizeof(uint16_t);
+        return out;
+    }
+};
+
+namespace detail {
+
+// Extends a counter of bits bits that rolls over into a 64 bit one
+class RolloverCounter {
+    uint64_t _mask = 0;
+    uint32_t _bits = 0;
+    uint64_t _rollovers = 0;
+    uint64_t _last = 0;
+    bool _has_last = false;
+
+ public:
+    RolloverCounter() = default;
+    explicit RolloverCounter(const uint32_t& bits) :
+        _mask{(1ull << bits) - 1}, _bits{bits} { }
+
+    uint64_t extend(const uint64_t& raw) noexcept {
+        const uint64_t count = raw & _mask;
+        if (_has_last and count < _last) {
+            _rollovers++;
+        }
+        _last = count;
+        _has_last = true;
+        return (_rollovers << _bits) | count;
+    }
+};
+
+// Checks and reads the header of a run file from its first bytes
+inline CAENRunFileHeader read_run_file_header(std::span<const std::byte> data,
+                                              const std::string& path) {
+    CAENRunFileHeader header;
+    if (data.size() < sizeof(header)) {
+        throw std::runtime_error(path + " is too small to be a run file.");
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.Magic != kRunFileMagic) {
+        throw std::runtime_error(path + " is not a RedDigitizer run file.");
+    }
+    if (header.Version != kRunFileVersion) {
+        throw std::runtime_error(path + " has run file version "
+            + std::to_string(header.Version) + ", expected "
+            + std::to_string(kRunFileVersion) + ".");
+    }
+    if (header.NumChannels > kRunFileMaxChannels
+        or header.HeaderSize < sizeof(header)
+        or header.HeaderSize % kRunFileAlignment != 0) {
+        throw std::runtime_error(path + " has a corrupted header.");
+    }
+    return header;
+}
+
+// Whether a chunk of num_events events starting at offset fits in the
+// first end bytes of the file. Every factor of the layout is bounded
+// first, so a corrupted header or index can not overflow it.
+inline bool run_chunk_fits(const CAENRunFileHeader& header, const uint64_t& offset,
+                           const uint32_t& num_events, const uint64_t& end) noexcept {
+    if (num_events == 0 or offset < header.HeaderSize or offset > end
+        or offset % kRunFileAlignment != 0) {
+        return false;
+    }
+    const uint64_t room = end - offset;
+    if (num_events > room / sizeof(uint64_t)
+        or (header.RecordLength > 0 and num_events > room / header.RecordLength)) {
+        return false;
+    }
+    const CAENRunChunkLayout layout(num_events, header.NumChannels, header.RecordLength);
+    return layout.ChunkSize <= room;
+}
+
+// Checks the index entries of a closed file against the file itself:
+// every chunk lies between the header and the index, after the previous
+// one, and starts with a chunk header that agrees with its entry.
+template<typename ReadAt>
+bool valid_run_index(const CAENRunFileHeader& header, const uint64_t& index_offset,
+                     std::span<const CAENRunIndexEntry> entries, ReadAt&& read_at) {
+    uint64_t next = header.HeaderSize;
+    uint64_t next_event = 0;
+    for (const auto& entry : entries) {
+        if (entry.Offset < next or entry.FirstEvent != next_event
+            or not run_chunk_fits(header, entry.Offset, entry.NumEvents, index_offset)) {
+            return false;
+        }
+        CAENRunChunkHeader chunk_header;
+        read_at(entry.Offset, &chunk_header, sizeof(chunk_header));
+        if (chunk_header.Magic != kRunChunkMagic
+            or chunk_header.NumEvents != entry.NumEvents
+            or chunk_header.FirstEvent != entry.FirstEvent) {
+            return false;
+        }
+        next = entry.Offset
+            + CAENRunChunkLayout(entry.NumEvents, header.NumChannels, header.RecordLength).ChunkSize;
+        next_event += entry.NumEvents;
+    }
+    return true;
+}
+
+// Loads the index of a run file of file_size bytes, or rebuilds it from
+// the chunk headers if the file has none or its index does not match
+// the file. read_at(offset, out, size) copies size bytes of the file at
+// offset into out.
+template<typename ReadAt>
+std::vector<CAENRunIndexEntry> load_run_index(const CAENRunFileHeader& header,
+                                              const uint64_t& file_size,
+                                              ReadAt&& read_at) {
+    CAENRunFileTrailer trailer;
+    trailer.Magic = 0;
+    if (file_size >= header.HeaderSize + sizeof(trailer)) {
+        read_at(file_size - sizeof(trailer), &trailer, sizeof(trailer));
+    }
+    // Sizes checked one by one so a corrupted trailer can not overflow
+    const uint64_t index_room = file_size >= header.HeaderSize + sizeof(trailer) ?
+        file_size - sizeof(trailer) : 0;
+    if (trailer.Magic == kRunIndexMagic
+        and trailer.IndexOffset >= header.HeaderSize
+        and trailer.IndexOffset <= index_room
+        and trailer.NumChunks == (index_room - trailer.IndexOffset) / sizeof(CAENRunIndexEntry)
+        and (index_room - trailer.IndexOffset) % sizeof(CAENRunIndexEntry) == 0) {
+        std::vector<CAENRunIndexEntry> entries(trailer.NumChunks);
+        if (not entries.empty()) {
+            read_at(trailer.IndexOffset, entries.data(),
+                    entries.size()*sizeof(CAENRunIndexEntry));
+        }
+        if (valid_run_index(header, trailer.IndexOffset, entries, read_at)) {
+            return entries;
+        }
+    }
+
+    // The writer did not close the file, or the index is corrupted. A
+    // partially written last chunk is ignored.
+    std::vector<CAENRunIndexEntry> entries;
+    uint64_t offset = header.HeaderSize;
+    while (offset + sizeof(CAENRunChunkHeader) <= file_size) {
+        CAENRunChunkHeader chunk_header;
+        read_at(offset, &chunk_header, sizeof(chunk_header));
+        if (chunk_header.Magic != kRunChunkMagic
+            or not run_chunk_fits(header, offset, chunk_header.NumEvents, file_size)) {
+            break;
+        }
+        const CAENRunChunkLayout layout(chunk_header.NumEvents,
+            header.NumChannels, header.RecordLength);
+
+        const std::size_t last = chunk_header.NumEvents - 1;
+        CAENRunIndexEntry entry;
+        entry.Offset = offset;
+        entry.FirstEvent = chunk_header.FirstEvent;
+        entry.NumEvents = chunk_header.NumEvents;
+        read_at(offset + layout.ExtendedCounter, &entry.FirstCounter, sizeof(uint64_t));
+        read_at(offset + layout.ExtendedCounter + last*sizeof(uint64_t),
+                &entry.LastCounter, sizeof(uint64_t));
+        read_at(offset + layout.ExtendedTriggerTimeTag,
+                &entry.FirstTriggerTimeTag, sizeof(uint64_t));
+        read_at(offset + layout.ExtendedTriggerTimeTag + last*sizeof(uint64_t),
+                &entry.LastTriggerTimeTag, sizeof(uint64_t));
+        entries.push_back(entry);
+        offset += layout.ChunkSize;
+    }
+    return entries;
+}
+
+}  // namespace detail
+
+// The index of a run file and the searches over it. Shared by the readers.
+class CAENRunIndex {
+    std::vector<CAENRunIndexEntry> _entries;
+    uint64_t _num_events = 0;
+
+ public:
+    CAENRunIndex() = default;
+    explicit CAENRunIndex(std::vector<CAENRunIndexEntry> entries) :
+        _entries{std::move(entries)}
+    {
+        if (not _entries.empty()) {
+            _num_events = _entries.back().FirstEvent + _entries.back().NumEvents;
+        }
+    }
+
+    const std::vector<CAENRunIndexEntry>& entries() const noexcept {
+        return _entries;
+    }
+
+    std::size_t numChunks() const noexcept {
+        return _entries.size();
+    }
+
+    const uint64_t& numEvents() const noexcept {
+        return _num_events;
+    }
+
+    // Chunk holding event index event, numChunks() if out of range
+    std::size_t findEvent(const uint64_t& event) const noexcept {
+        if (event >= _num_events) {
+            return _entries.size();
+        }
+        auto it = std::upper_bound(_entries.begin(), _entries.end(), event,
+            [](const uint64_t& x, const CAENRunIndexEntry& e) { return x < e.FirstEvent; });
+        return static_cast<std::size_t>(it - _entries.begin()) - 1;
+    }
+
+    // First chunk whose last extended EventCounter is >= counter,
+    // numChunks() if there is none
+    std::size_t findCounter(const uint64_t& counter) const noexcept {
+        auto it = std::lower_bound(_entries.begin(), _entries.end(), counter,
+            [](const CAENRunIndexEntry& e, const uint64_t& x) { return e.LastCounter < x; });
+        return static_cast<std::size_t>(it - _entries.begin());
+    }
+
+    // First chunk whose last extended trigger time tag is >= ttt,
+    // numChunks() if there is none
+    std::size_t findTriggerTimeTag(const uint64_t& ttt) const noexcept {
+        auto it = std::lower_bound(_entries.begin(), _entries.end(), ttt,
+            [](const CAENRunIndexEntry& e, const uint64_t& x) {
+                return e.LastTriggerTimeTag < x;
+            });
+        return static_cast<std::size_t>(it - _entries.begin());
+    }
+};
+
+// Writes decoded events into a run file. Events are gathered into a chunk
+// in memory and written when it is full, at flush() or at close().
+// Throws std::runtime_error on I/O errors.
+class CAENRunFileWriter {
+    std::string _path;
+    std::ofstream _file;
+    CAENRunFileConfig _config;
+    CAENRunFileHeader _header;
+    std::vector<std::size_t> _channels;
+
+    // Chunk being gathered
+    uint32_t _num_events = 0;
+    std::vector<uint32_t> _columns;
+    std::vector<uint64_t> _ext_counter;
+    std::vector<uint64_t> _ext_ttt;
+    // [channel, event, sample]
+    std::vector<uint16_t> _samples;
+
+    detail::RolloverCounter _counter_extender{24};
+    detail::RolloverCounter _ttt_extender;
+
+    uint64_t _offset = 0;
+    uint64_t _events_written = 0;
+    std::vector<CAENRunIndexEntry> _index;
+
+    void _write(const void* data, const std::size_t& size) {
+        _file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (not _file) {
+            throw std::runtime_error("Failed to write " + _path + ": "
+                                     + std::strerror(errno));
+        }
+        _offset += size;
+    }
+
+    void _pad_to(const uint64_t& offset) {
+        static constexpr std::array<char, kRunFileAlignment> zeros = {};
+        while (_offset < offset) {
+            _write(zeros.data(), std::min<uint64_t>(offset - _offset, zeros.size()));
+        }
+    }
+
+    void _add_event(const CAEN_DGTZ_EventInfo_t& info) noexcept {
+        const uint32_t i = _num_events;
+        const uint32_t cap = _config.ChunkEvents;
+        auto col = [&](const CAENEventColumn& c) -> uint32_t& {
+            return _columns[static_cast<std::size_t>(c)*cap + i];
+        };
+        col(CAENEventColumn::EventCounter) = info.EventCounter;
+        col(CAENEventColumn::EventSize) = info.EventSize;
+        col(CAENEventColumn::BoardId) = info.BoardId;
+        col(CAENEventColumn::Pattern) = info.Pattern;
+        col(CAENEventColumn::ChannelMask) = info.ChannelMask;
+        col(CAENEventColumn::TriggerTimeTag) = info.TriggerTimeTag;
+        col(CAENEventColumn::TriggerSource) = remap_trigger_source(info.Pattern);
+        _ext_counter[i] = _counter_extender.extend(info.EventCounter);
+        _ext_ttt[i] = _ttt_extender.extend(info.TriggerTimeTag);
+    }
+
+    // Copies the samples of channel index ch into the chunk
+    void _add_samples(const std::size_t& ch, std::span<const uint16_t> samples) noexcept {
+        const std::size_t rl = _header.RecordLength;
+        const std::size_t n = std::min(samples.size(), rl);
+        std::copy_n(samples.begin(), n, _samples.begin()
+            + (ch*_config.ChunkEvents + _num_events)*rl);
+    }
+
+    void _event_done() {
+        _num_events++;
+        if (_num_events == _config.ChunkEvents) {
+            flush();
+        }
+    }
+
+ public:
+    CAENRunFileWriter(const std::string& path,
+                      const CAENDigitizerModelConstants& model_constants,
+                      const CAENGlobalConfig& global_config,
+                      const std::array<CAENGroupConfig, 8>& groups,
+                      const CAENRunFileConfig& config = CAENRunFileConfig{},
+                      const std::vector<std::size_t>& channels = {}) :
+        _path{path},
+        _config{config},
+        _channels{select_channels(get_enabled_channels(model_constants, groups),
+                                  channels)},
+        _ttt_extender{config.TriggerTimeTagBits}
+    {
+        if (_config.ChunkEvents == 0) {
+            throw std::invalid_argument("Chunk events must be positive.");
+        }
+        if (_config.TriggerTimeTagBits == 0 or _config.TriggerTimeTagBits > 32) {
+            throw std::invalid_argument("Trigger time tag bits must be in [1, 32].");
+        }
+        if (_channels.size() > kRunFileMaxChannels) {
+            throw std::invalid_argument("Too many channels for a run file.");
+        }
+
+        _header.HeaderSize = static_cast<uint32_t>(
+            CAENRunChunkLayout::align(sizeof(CAENRunFileHeader)));
+        _header.NumChannels = static_cast<uint32_t>(_channels.size());
+        _header.RecordLength = global_config.RecordLength;
+        _header.ADCResolution = model_constants.ADCResolution;
+        _header.ChunkEvents = _config.ChunkEvents;
+        _header.SamplePeriod = 1e9 / model_constants.AcquisitionRate
+            * std::max<uint16_t>(global_config.DecimationFactor, 1);
+        _header.TriggerTimeTagLSB = model_constants.TriggerTimeTagLSB;
+        _header.TriggerTimeTagBits = _config.TriggerTimeTagBits;
+        for (std::size_t i = 0; i < _channels.size(); i++) {
+            _header.Channels[i] = static_cast<uint8_t>(_channels[i]);
+        }
+
+        const std::size_t cap = _config.ChunkEvents;
+        _columns.resize(kNumEventColumns*cap);
+        _ext_counter.resize(cap);
+        _ext_ttt.resize(cap);
+        _samples.resize(_channels.size()*cap*_header.RecordLength);
+
+        _file.open(path, std::ios::binary | std::ios::trunc);
+        if (not _file) {
+            throw std::runtime_error("Failed to open " + path + ": "
+                                     + std::strerror(errno));
+        }
+        _write(&_header, sizeof(_header));
+        _pad_to(_header.HeaderSize);
+    }
+
+    CAENRunFileWriter(const CAENRunFileWriter&) = delete;
+    CAENRunFileWriter& operator=(const CAENRunFileWriter&) = delete;
+
+    // Closes the file if close() was not called. Errors are swallowed
+    // here; call close() to see them.
+    ~CAENRunFileWriter() {
+        try {
+            close();
+        } catch (...) { }
+    }
+
+    const CAENRunFileHeader& getHeader() const noexcept {
+        return _header;
+    }
+
+    // Events written to the file or waiting in the current chunk
+    uint64_t getNumEvents() const noexcept {
+        return _events_written + _num_events;
+    }
+
+    std::size_t getNumChunks() const noexcept {
+        return _index.size();
+    }
+
+    bool isOpen() const noexcept {
+        return _file.is_open();
+    }
+
+    // Appends decoded events, only the file channels of each. Events that
+    // are nullptr, miss one of the file channels or do not match the
+    // record length are skipped. Returns the number of events appended.
+    template<typename WaveformsPtr>
+    std::size_t write(std::span<const WaveformsPtr> events) {
+        std::size_t written = 0;
+        std::array<std::size_t, kRunFileMaxChannels> ch_indexes{};
+        for (const auto& event : events) {
+            if (not event or event->getRecordLength() != _header.RecordLength) {
+                continue;
+            }
+            // Events of one batch share their channels, so this is usually
+            // a single comparison.
+            const auto& event_chs = event->getEnabledChannels();
+            bool missing = false;
+            for (std::size_t ch = 0; ch < _channels.size(); ch++) {
+                ch_indexes[ch] = ch < event_chs.size() and event_chs[ch] == _channels[ch] ?
+                    ch : event->findChannel(_channels[ch]);
+                missing |= ch_indexes[ch] >= event_chs.size();
+            }
+            if (missing) {
+                continue;
+            }
+            _add_event(event->getInfo());
+            for (std::size_t ch = 0; ch < _header.NumChannels; ch++) {
+                _add_samples(ch, event->getChannel(ch_indexes[ch]));
+            }
+            _event_done();
+            written++;
+        }
+        return written;
+    }
+
+    // Appends the events of a batch. Does nothing if its geometry does not
+    // match the file or it has no waveforms.
+    std::size_t write(const CAENBatch& batch) {
+        if (batch.NumChannels != _header.NumChannels
+            or batch.RecordLength != _header.RecordLength
+            or not batch.HasWaveforms) {
+            return 0;
+        }
+
+        const std::size_t rl = batch.RecordLength;
+        for (uint32_t ev = 0; ev < batch.NumEvents; ev++) {
+            CAEN_DGTZ_EventInfo_t info{};
+            info.EventCounter = batch.EventCounter[ev];
+            info.EventSize = batch.EventSize[ev];
+            info.BoardId = batch.BoardId[ev];
+            info.Pattern = batch.Pattern[ev];
+            info.ChannelMask = batch.ChannelMask[ev];
+            info.TriggerTimeTag = batch.TriggerTimeTag[ev];
+            _add_event(info);
+            const uint16_t* event_samples = batch.Waveforms.data()
+                + ev*batch.getEventSamples();
+            for (std::size_t ch = 0; ch < batch.NumChannels; ch++) {
+                _add_samples(ch, std::span<const uint16_t>(event_samples + ch*rl, rl));
+            }
+            _event_done();
+        }
+        return batch.NumEvents;
+    }
+
+    // Writes the events gathered so far as a chunk, even if not full.
+    void flush() {
+        if (_num_events == 0 or not _file.is_open()) {
+            return;
+        }
+
+        const uint32_t n = _num_events;
+        const std::size_t cap = _config.ChunkEvents;
+        const std::size_t rl = _header.RecordLength;
+        const CAENRunChunkLayout layout(n, _header.NumChannels, _header.RecordLength);
+        const uint64_t start = _offset;
+
+        CAENRunChunkHeader chunk_header;
+        chunk_header.FirstEvent = _events_written;
+        chunk_header.NumEvents = n;
+        _write(&chunk_header, sizeof(chunk_header));
+        for (std::size_t c = 0; c < kNumEventColumns; c++) {
+            _pad_to(start + layout.Columns[c]);
+            _write(_columns.data() + c*cap, sizeof(uint32_t)*n);
+        }
+        _pad_to(start + layout.ExtendedCounter);
+        _write(_ext_counter.data(), sizeof(uint64_t)*n);
+        _pad_to(start + layout.ExtendedTriggerTimeTag);
+        _write(_ext_ttt.data(), sizeof(uint64_t)*n);
+        for (std::size_t ch = 0; ch < _header.NumChannels; ch++) {
+            _pad_to(start + layout.Samples + ch*layout.ChannelStride);
+            _write(_samples.data() + ch*cap*rl, sizeof(uint16_t)*n*rl);
+        }
+        _pad_to(start + layout.ChunkSize);
+
+        CAENRunIndexEntry entry;
+        entry.Offset = start;
+        entry.FirstEvent = _events_written;
+        entry.NumEvents = n;
+        entry.FirstCounter = _ext_counter[0];
+        entry.LastCounter = _ext_counter[n - 1];
+        entry.FirstTriggerTimeTag = _ext_ttt[0];
+        entry.LastTriggerTimeTag = _ext_ttt[n - 1];
+        _index.push_back(entry);
+
+        _events_written += n;
+        _num_events = 0;
+    }
+
+    // Flushes the last chunk and writes the index. Safe to call more than
+    // once.
+    void close() {
+        if (not _file.is_open()) {
+            return;
+        }
+        flush();
+
+        CAENRunFileTrailer trailer;
+        trailer.IndexOffset = _offset;
+        trailer.NumChunks = _index.size();
+        trailer.NumEvents = _events_written;
+        _write(_index.data(), sizeof(CAENRunIndexEntry)*_index.size());
+        _write(&trailer, sizeof(trailer));
+        _file.close();
+    }
+};
+
+// Reads a run file with plain file reads: only the header and the index
+// are loaded on open, chunks are read on demand with readChunk(...).
+// Throws std::runtime_error if the file is not a valid run file.
+class CAENRunFileReader {
+    std::string _path;
+    mutable std::ifstream _file;
+    CAENRunFileHeader _header;
+    CAENRunIndex _index;
+    uint64_t _file_size = 0;
+
+    void _read_at(const uint64_t& offset, void* out, const std::size_t& size) const {
+        _file.clear();
+        _file.seekg(static_cast<std::streamoff>(offset));
+        _file.read(static_cast<char*>(out), static_cast<std::streamsize>(size));
+        if (not _file) {
+            throw std::runtime_error("Failed to read " + _path + " at "
+                                     + std::to_string(offset) + ".");
+        }
+    }
+
+ public:
+    explicit CAENRunFileReader(const std::string& path) :
+        _path{path},
+        _file(path, std::ios::binary)
+    {
+        if (not _file) {
+            throw std::runtime_error("Failed to open " + path + ": "
+                                     + std::strerror(errno));
+        }
+        _file.seekg(0, std::ios::end);
+        _file_size = static_cast<uint64_t>(_file.tellg());
+
+        std::array<std::byte, sizeof(CAENRunFileHeader)> raw_header{};
+        if (_file_size >= raw_header.size()) {
+            _read_at(0, raw_header.data(), raw_header.size());
+        }
+        _header = detail::read_run_file_header(
+            std::span<const std::byte>(raw_header.data(),
+                std::min<uint64_t>(_file_size, raw_header.size())), path);
+
+        _index = CAENRunIndex(detail::load_run_index(_header, _file_size,
+            [this](const uint64_t& offset, void* out, const std::size_t& size) {
+                _read_at(offset, out, size);
+            }));
+    }
+
+    const CAENRunFileHeader& getHeader() const noexcept {
+        return _header;
+    }
+
+    const CAENRunIndex& getIndex() const noexcept {
+        return _index;
+    }
+
+    std::size_t getNumChunks() const noexcept {
+        return _index.numChunks();
+    }
+
+    const uint64_t& getNumEvents() const noexcept {
+        return _index.numEvents();
+    }
+
+    // CAEN channel numbers of the channels stored
+    std::vector<std::size_t> getChannels() const {
+        return std::vector<std::size_t>(_header.Channels.begin(),
+            _header.Channels.begin() + _header.NumChannels);
+    }
+
+    // Reads chunk i into buffer (resized as needed, reuse it between calls
+    // to avoid allocations) and returns a view into it.
+    CAENRunChunkView readChunk(const std::size_t& i,
+                               std::vector<std::byte>& buffer) const {
+        if (i >= _index.numChunks()) {
+            throw std::out_of_range("Chunk " + std::to_string(i) + " out of range.");
+        }
+        const auto& entry = _index.entries()[i];
+        const CAENRunChunkLayout layout(entry.NumEvents,
+            _header.NumChannels, _header.RecordLength);
+        // Keeps the 64 bytes alignment of the file in memory
+        buffer.resize(layout.ChunkSize + kRunFileAlignment);
+        const auto addr = reinterpret_cast<std::uintptr_t>(buffer.data());
+        std::byte* chunk = buffer.data()
+            + (CAENRunChunkLayout::align(addr) - addr);
+        _read_at(entry.Offset, chunk, layout.ChunkSize);
+        return CAENRunChunkView::fromMemory(chunk, _header);
+    }
+};
+
+enum class CAENRunFileAccess {
+    // Kernel default readahead
+    Normal,
+    // Aggressive readahead, pages behind are dropped early. For full scans.
+    Sequential,
+    // No readahead. For seeks to scattered events.
+    Random
+};
+
+// Maps a whole run file read-only. Opening only reads the header and the
+// index, so it takes the same time for any file size; chunk(i) returns
+// views of the mapped pages, which the OS loads on first access.
+// Throws std::runtime_error if the file cannot be mapped or is not a valid
+// run file.
+class CAENRunFileMap {
+    std::string _path;
+    const std::byte* _data = nullptr;
+    std::size_t _size = 0;
+    CAENRunFileHeader _header;
+    CAENRunIndex _index;
+
+    void _unmap() noexcept {
+#ifndef _WIN32
+        if (_data) {
+            munmap(const_cast<std::byte*>(_data), _size);
+        }
+#endif
+        _data = nullptr;
+    }
+
+    void _advise(const uint64_t& offset, const std::size_t& size,
+                 [[maybe_unused]] const int& advice) const noexcept {
+#ifndef _WIN32
+        if (not _data or size == 0) {
+            return;
+        }
+        // madvise wants page aligned addresses
+        static const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const uint64_t start = offset / page * page;
+        madvise(const_cast<std::byte*>(_data) + start, offset + size - start, advice);
+#endif
+    }
+
+    void _advise_chunks(const std::size_t& first, const std::size_t& count,
+                        const int& advice) const noexcept {
+        const std::size_t last = std::min(first + count, _index.numChunks());
+        if (first >= last) {
+            return;
+        }
+        const auto& entries = _index.entries();
+        const CAENRunChunkLayout layout(entries[last - 1].NumEvents,
+            _header.NumChannels, _header.RecordLength);
+        const uint64_t begin = entries[first].Offset;
+        const uint64_t end = entries[last - 1].Offset + layout.ChunkSize;
+        _advise(begin, end - begin, advice);
+    }
+
+ public:
+    explicit CAENRunFileMap(const std::string& path,
+                            const CAENRunFileAccess& access = CAENRunFileAccess::Normal) :
+        _path{path}
+    {
+#ifndef _WIN32
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("open(" + path + ") failed: "
+                                     + std::strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            const int err = errno;
+            ::close(fd);
+            throw std::runtime_error("fstat(" + path + ") failed: "
+                                     + std::strerror(err));
+        }
+        _size = static_cast<std::size_t>(st.st_size);
+        if (_size == 0) {
+            ::close(fd);
+            throw std::runtime_error(path + " is empty.");
+        }
+        void* ptr = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        const int err = errno;
+        // The mapping keeps the file alive
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            throw std::runtime_error("mmap(" + path + ") failed: "
+                                     + std::strerror(err));
+        }
+        _data = static_cast<const std::byte*>(ptr);
+
+        try {
+            _header = detail::read_run_file_header(
+                std::span<const std::byte>(_data, _size), path);
+            _index = CAENRunIndex(detail::load_run_index(_header, _size,
+                [this](const uint64_t& offset, void* out, const std::size_t& size) {
+                    if (offset + size > _size) {
+                        throw std::runtime_error(_path + " is truncated.");
+                    }
+                    std::memcpy(out, _data + offset, size);
+                }));
+        } catch (...) {
+            _unmap();
+            throw;
+        }
+        setAccess(access);
+#else
+        throw std::runtime_error("Mapped run files are only supported on POSIX systems.");
+#endif
+    }
+
+    CAENRunFileMap(const CAENRunFileMap&) = delete;
+    CAENRunFileMap& operator=(const CAENRunFileMap&) = delete;
+
+    ~CAENRunFileMap() {
+        _unmap();
+    }
+
+    const CAENRunFileHeader& getHeader() const noexcept {
+        return _header;
+    }
+
+    const CAENRunIndex& getIndex() const noexcept {
+        return _index;
+    }
+
+    std::size_t getNumChunks() const noexcept {
+        return _index.numChunks();
+    }
+
+    const uint64_t& getNumEvents() const noexcept {
+        return _index.numEvents();
+    }
+
+    // CAEN channel numbers of the channels stored
+    std::vector<std::size_t> getChannels() const {
+        return std::vector<std::size_t>(_header.Channels.begin(),
+            _header.Channels.begin() + _header.NumChannels);
+    }
+
+    // In bytes
+    const std::size_t& getFileSize() const noexcept {
+        return _size;
+    }
+
+    // View of chunk i. Valid as long as this object lives.
+    CAENRunChunkView chunk(const std::size_t& i) const {
+        if (i >= _index.numChunks()) {
+            throw std::out_of_range("Chunk " + std::to_string(i) + " out of range.");
+        }
+        return CAENRunChunkView::fromMemory(_data + _index.entries()[i].Offset, _header);
+    }
+
+    // Readahead hint for the whole file
+    void setAccess(const CAENRunFileAccess& access) const noexcept {
+#ifndef _WIN32
+        int advice = MADV_NORMAL;
+        if (access == CAENRunFileAccess::Sequential) {
+            advice = MADV_SEQUENTIAL;
+        } else if (access == CAENRunFileAccess::Random) {
+            advice = MADV_RANDOM;
+        }
+        _advise(0, _size, advice);
+#endif
+    }
+
+    // Asks the OS to start loading count chunks from chunk first in the
+    // background, e.g. the next chunks while the current one is processed.
+    void willNeed(const std::size_t& first, const std::size_t& count = 1) const noexcept {
+#ifndef _WIN32
+        _advise_chunks(first, count, MADV_WILLNEED);
+#endif
+    }
+
+    // Tells the OS the pages of count chunks from chunk first are not
+    // needed anymore, so they are the first to be dropped.
+    void dontNeed(const std::size_t& first, const std::size_t& count = 1) const noexcept {
+#ifndef _WIN32
+        _advise_chunks(first, count, MADV_DONTNEED);
+#endif
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
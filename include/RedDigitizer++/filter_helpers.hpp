@@ -0,0 +1,298 @@
+/*
+    Filter helpers
+    Description: Software decimation for digitizers without hardware
+    decimation (x730). Each channel is low-pass filtered (boxcar average or
+    FIR) and reduced by a power of two into CAENWaveforms with the same
+    layout as the input, so the other stages can run on the output.
+*/
+
+#ifndef RD_FILTER_HELPERS_H
+#define RD_FILTER_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "red_digitizer_helper.hpp"
+
+namespace RedDigitizer {
+
+enum class CAENDecimationFilter {
+    // Average of every Factor samples. Cheapest, but a poor low-pass.
+    Boxcar,
+    // Windowed-sinc low-pass evaluated only at the kept samples
+    FIR
+};
+
+struct CAENDecimationConfig {
+    // Samples kept are 1 out of Factor. Must be a power of two.
+    uint32_t Factor = 8;
+
+    CAENDecimationFilter Filter = CAENDecimationFilter::Boxcar;
+
+    // FIR only. Number of taps of the low-pass, made odd if it is not.
+    uint32_t NumTaps = 63;
+    // FIR only. Cutoff as a fraction of the output Nyquist frequency.
+    double Cutoff = 0.8;
+    // FIR only. If not empty, these taps are used instead of the
+    // designed ones. Symmetric taps keep the output aligned in time.
+    std::vector<float> Taps;
+};
+
+// Decimates blocks of events into a set of preallocated CAENWaveforms with
+// RecordLength / Factor samples per channel. Output samples are rounded to
+// the nearest ADC count.
+//
+// The boxcar output sample j is the average of input samples
+// [j*Factor, (j + 1)*Factor), the FIR output sample j is centred at input
+// sample j*Factor; edges are extended with the first and last samples.
+class CAENDecimationStage {
+    using Waveforms = CAENWaveforms<uint16_t>;
+    using Waveforms_ptr = std::shared_ptr<Waveforms>;
+
+    CAENDecimationConfig _config;
+    CAENDigitizerModelConstants _model_constants;
+    CAENGlobalConfig _output_config;
+    std::array<CAENGroupConfig, 8> _groups;
+    uint32_t _log2_factor = 0;
+    uint32_t _input_record_length = 0;
+    double _sample_period = 1.0;
+
+    // Mirrored taps, so the inner loop is a straight dot product
+    std::vector<float> _taps;
+
+    // Grows to the biggest block seen and is reused afterwards
+    std::vector<Waveforms_ptr> _outputs;
+    // Outputs of the last process(...), nullptr where the input was
+    std::vector<Waveforms_ptr> _results;
+
+    // Scratch: sums of the boxcar, or the channel with edges for the FIR
+    std::vector<uint32_t> _sums;
+    std::vector<float> _padded;
+
+    static std::vector<float> _design_low_pass(const uint32_t& num_taps,
+                                               const double& cutoff) {
+        // cutoff is in cycles per input sample
+        std::vector<float> taps(num_taps);
+        const double center = 0.5*(num_taps - 1);
+        double sum = 0.0;
+        for (uint32_t i = 0; i < num_taps; i++) {
+            const double x = i - center;
+            const double sinc = x == 0.0 ? 2.0*cutoff
+                : std::sin(2.0*std::numbers::pi*cutoff*x) / (std::numbers::pi*x);
+            // Blackman window
+            const double w = num_taps == 1 ? 1.0 : 0.42
+                - 0.5*std::cos(2.0*std::numbers::pi*i / (num_taps - 1))
+                + 0.08*std::cos(4.0*std::numbers::pi*i / (num_taps - 1));
+            taps[i] = static_cast<float>(sinc*w);
+            sum += sinc*w;
+        }
+        // Unity gain at DC
+        for (auto& tap : taps) {
+            tap = static_cast<float>(tap / sum);
+        }
+        return taps;
+    }
+
+    static uint16_t _to_adc(const float& x) noexcept {
+        return static_cast<uint16_t>(std::clamp(x + 0.5f, 0.0f, 65535.0f));
+    }
+
+    void _boxcar(std::span<const uint16_t> in, std::span<uint16_t> out) noexcept {
+        const std::size_t n_out = out.size();
+        const std::size_t factor = _config.Factor;
+        uint32_t* sums = _sums.data();
+
+        // Pairwise sums, halving the length each pass. Every pass is a
+        // plain loop the compiler vectorises.
+        std::size_t n = n_out*factor;
+        if (factor == 1) {
+            std::copy_n(in.begin(), n_out, out.begin());
+            return;
+        }
+        for (std::size_t i = 0; i < n/2; i++) {
+            sums[i] = static_cast<uint32_t>(in[2*i]) + in[2*i + 1];
+        }
+        n /= 2;
+        for (; n > n_out; n /= 2) {
+            for (std::size_t i = 0; i < n/2; i++) {
+                sums[i] = sums[2*i] + sums[2*i + 1];
+            }
+        }
+
+        const uint32_t half = 1u << (_log2_factor - 1);
+        for (std::size_t i = 0; i < n_out; i++) {
+            out[i] = static_cast<uint16_t>((sums[i] + half) >> _log2_factor);
+        }
+    }
+
+    void _fir(std::span<const uint16_t> in, std::span<uint16_t> out) noexcept {
+        const std::size_t num_taps = _taps.size();
+        const std::size_t half = num_taps / 2;
+        const std::size_t n = in.size();
+
+        // Channel as float with half taps of edge extension on each side
+        float* padded = _padded.data();
+        std::fill_n(padded, half, static_cast<float>(in.front()));
+        for (std::size_t i = 0; i < n; i++) {
+            padded[half + i] = in[i];
+        }
+        std::fill_n(padded + half + n, half, static_cast<float>(in.back()));
+
+        const float* taps = _taps.data();
+        for (std::size_t j = 0; j < out.size(); j++) {
+            const float* x = padded + j*_config.Factor;
+            // Independent accumulators so the compiler can use SIMD lanes
+            // without reordering a single float sum.
+            float acc[8] = {};
+            std::size_t k = 0;
+            for (; k + 8 <= num_taps; k += 8) {
+                for (std::size_t l = 0; l < 8; l++) {
+                    acc[l] += taps[k + l]*x[k + l];
+                }
+            }
+            for (; k < num_taps; k++) {
+                acc[0] += taps[k]*x[k];
+            }
+            out[j] = _to_adc(((acc[0] + acc[1]) + (acc[2] + acc[3]))
+                             + ((acc[4] + acc[5]) + (acc[6] + acc[7])));
+        }
+    }
+
+ public:
+    CAENDecimationStage(const CAENDigitizerModelConstants& model_constants,
+                        const CAENGlobalConfig& global_config,
+                        const std::array<CAENGroupConfig, 8>& groups,
+                        const CAENDecimationConfig& config) :
+        _config{config},
+        _model_constants{model_constants},
+        _output_config{global_config},
+        _groups{groups},
+        _input_record_length{global_config.RecordLength}
+    {
+        if (not std::has_single_bit(_config.Factor)) {
+            throw std::invalid_argument("Decimation factor must be a power "
+                                        "of two.");
+        }
+        if (_config.Factor > _input_record_length) {
+            throw std::invalid_argument("Decimation factor is bigger than the "
+                                        "record length.");
+        }
+        _log2_factor = static_cast<uint32_t>(std::countr_zero(_config.Factor));
+
+        // Downstream stages see the decimated rate through DecimationFactor
+        _output_config.RecordLength = _input_record_length / _config.Factor;
+        const uint32_t hw_decimation = std::max<uint16_t>(global_config.DecimationFactor, 1);
+        _output_config.DecimationFactor = static_cast<uint16_t>(hw_decimation*_config.Factor);
+        _sample_period = 1e9 / model_constants.AcquisitionRate * _output_config.DecimationFactor;
+
+        if (_config.Filter == CAENDecimationFilter::FIR) {
+            if (not _config.Taps.empty()) {
+                _taps = _config.Taps;
+            } else {
+                const uint32_t num_taps = std::max<uint32_t>(_config.NumTaps, 1) | 1u;
+                const double cutoff = std::clamp(_config.Cutoff, 0.01, 1.0)
+                    * 0.5 / _config.Factor;
+                _taps = _design_low_pass(num_taps, cutoff);
+            }
+            std::reverse(_taps.begin(), _taps.end());
+            _padded.resize(_input_record_length + _taps.size());
+        } else {
+            _sums.resize(_input_record_length / 2);
+        }
+    }
+
+    const CAENDecimationConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    // Global configuration that describes the output waveforms: reduced
+    // RecordLength and DecimationFactor multiplied by Factor. Pass it to
+    // the stages that run on the output (e.g. CAENTimingStage).
+    const CAENGlobalConfig& getOutputConfig() const noexcept {
+        return _output_config;
+    }
+
+    const uint32_t& getOutputRecordLength() const noexcept {
+        return _output_config.RecordLength;
+    }
+
+    // Of the output, in ns
+    const double& getSamplePeriod() const noexcept {
+        return _sample_period;
+    }
+
+    // FIR taps in use, empty for Boxcar
+    std::vector<float> getTaps() const {
+        return std::vector<float>(_taps.rbegin(), _taps.rend());
+    }
+
+    // Decimates one event into out. Does nothing and returns false if the
+    // geometries do not match the stage or each other.
+    template<typename InWaveforms>
+    bool process(const InWaveforms& in, Waveforms& out) noexcept {
+        if (in.getRecordLength() != _input_record_length
+            or out.getRecordLength() != _output_config.RecordLength
+            or in.getEnabledChannels() != out.getEnabledChannels()) {
+            return false;
+        }
+
+        out.setInfo(in.getInfo());
+        auto out_data = out.getData();
+        const auto out_rl = _output_config.RecordLength;
+        for (std::size_t ch = 0; ch < in.getNumEnabledChannels(); ch++) {
+            const auto samples = in.getChannel(ch);
+            const auto out_samples = out_data.subspan(ch*out_rl, out_rl);
+            if (_config.Filter == CAENDecimationFilter::FIR) {
+                _fir(samples, out_samples);
+            } else {
+                _boxcar(samples, out_samples);
+            }
+        }
+        return true;
+    }
+
+    // Decimates every event. The returned waveforms are owned by the stage
+    // and reused by the next call, copy them (or their shared_ptr is
+    // enough as long as this stage does not process again) to keep them.
+    // Each output holds the channels of its input (e.g. a readout subset).
+    // nullptr inputs, or inputs that do not match the stage, give nullptr
+    // outputs.
+    template<typename WaveformsPtr>
+    std::span<const Waveforms_ptr> process(std::span<const WaveformsPtr> events) {
+        _outputs.resize(std::max(_outputs.size(), events.size()));
+
+        _results.resize(events.size());
+        for (std::size_t i = 0; i < events.size(); i++) {
+            _results[i] = nullptr;
+            if (not events[i]) {
+                continue;
+            }
+            const auto& channels = events[i]->getEnabledChannels();
+            if (not _outputs[i] or _outputs[i]->getEnabledChannels() != channels) {
+                _outputs[i] = std::make_shared<Waveforms>(_model_constants,
+                    _output_config, _groups, channels);
+            }
+            if (process(*events[i], *_outputs[i])) {
+                _results[i] = _outputs[i];
+            }
+        }
+        return _results;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
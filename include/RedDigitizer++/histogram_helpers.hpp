@@ -0,0 +1,301 @@
+/*
+    Histogram helpers
+    Description: Online per-channel histograms filled from decoded
+    CAENWaveforms. Meant for detector monitoring: filling is lock-free so
+    several decode workers can fill the same service, and the bins can be
+    read at any time without stopping the acquisition.
+*/
+
+#ifndef RD_HISTOGRAM_HELPERS_H
+#define RD_HISTOGRAM_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "red_digitizer_helper.hpp"
+
+namespace RedDigitizer {
+
+// Uniform binning between Low and High. Values outside go to the
+// underflow or overflow counters.
+struct CAENHistogramBinning {
+    uint32_t NumBins = 100;
+    double Low = 0.0;
+    double High = 100.0;
+};
+
+// All the quantities the histogram service knows how to fill.
+enum class CAENHistogramType {
+    // Max excursion from the baseline, in ADC counts
+    Amplitude = 0,
+    // Sum of the baseline subtracted samples, in ADC counts x samples
+    Integral,
+    // RMS of the baseline samples, in ADC counts
+    BaselineRMS,
+    // Difference between consecutive trigger time tags, in TTT counts.
+    // It is the same for all channels of an event, so there is only one
+    // per board (channel argument is ignored).
+    TTTDelta
+};
+
+struct CAENHistogramConfig {
+    CAENHistogramBinning Amplitude = {4096, 0.0, 4096.0};
+    CAENHistogramBinning Integral = {1000, 0.0, 100000.0};
+    CAENHistogramBinning BaselineRMS = {200, 0.0, 50.0};
+    CAENHistogramBinning TTTDelta = {1000, 0.0, 1000000.0};
+
+    // Number of samples at the start of the waveform used to calculate
+    // the baseline and its RMS. Clamped to the record length.
+    uint32_t BaselineSamples = 20;
+
+    // true -> pulses go below the baseline (most PMT/SiPM signals)
+    // false -> pulses go above the baseline
+    bool NegativePolarity = true;
+};
+
+// A 1D histogram with atomic bins. fill(...) can be called from any
+// number of threads, snapshot() returns a copy of the current counts.
+class CAENHistogram {
+    CAENHistogramBinning _binning;
+    double _inv_bin_width = 1.0;
+    // NumBins + 2 counters: [underflow, bins..., overflow]
+    std::unique_ptr<std::atomic<uint64_t>[]> _bins;
+
+ public:
+    explicit CAENHistogram(const CAENHistogramBinning& binning) :
+        _binning{binning}
+    {
+        if (binning.NumBins == 0 or not (binning.High > binning.Low)) {
+            throw std::invalid_argument("Histogram binning needs at least one "
+                                        "bin and High > Low.");
+        }
+        // In size_t, NumBins + 2 would wrap around in 32 bits
+        _bins.reset(new std::atomic<uint64_t>[std::size_t{_binning.NumBins} + 2]);
+        _inv_bin_width = _binning.NumBins / (_binning.High - _binning.Low);
+        clear();
+    }
+
+    void fill(const double& x) noexcept {
+        std::size_t index = 0;
+        if (x >= _binning.High) {
+            index = std::size_t{_binning.NumBins} + 1;
+        } else if (x >= _binning.Low) {
+            index = 1 + static_cast<std::size_t>((x - _binning.Low)*_inv_bin_width);
+            // Protects against rounding right at the upper edge
+            index = std::min<std::size_t>(index, _binning.NumBins);
+        }
+        _bins[index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void clear() noexcept {
+        for (std::size_t i = 0; i < std::size_t{_binning.NumBins} + 2; i++) {
+            _bins[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    const CAENHistogramBinning& getBinning() const noexcept {
+        return _binning;
+    }
+
+    // Copies the bin contents (without under/overflow) into out.
+    // out must be at least NumBins long.
+    void snapshot(std::span<uint64_t> out) const noexcept {
+        const std::size_t n = std::min<std::size_t>(out.size(), _binning.NumBins);
+        for (std::size_t i = 0; i < n; i++) {
+            out[i] = _bins[i + 1].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<uint64_t> snapshot() const {
+        std::vector<uint64_t> out(_binning.NumBins);
+        snapshot(out);
+        return out;
+    }
+
+    uint64_t getUnderflow() const noexcept {
+        return _bins[0].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getOverflow() const noexcept {
+        return _bins[std::size_t{_binning.NumBins} + 1].load(std::memory_order_relaxed);
+    }
+
+    // Returns NumBins + 1 bin edges
+    std::vector<double> getBinEdges() const {
+        std::vector<double> out(std::size_t{_binning.NumBins} + 1);
+        const double width = (_binning.High - _binning.Low) / _binning.NumBins;
+        for (std::size_t i = 0; i < out.size(); i++) {
+            out[i] = _binning.Low + width*i;
+        }
+        return out;
+    }
+};
+
+// Holds one set of histograms per digitizer channel (indexed by the CAEN
+// channel number) and fills them from decoded waveforms.
+//
+// Thread-safe: fill(...) can be called from several decode workers at
+// the same time and snapshots can be taken while filling.
+// TTT deltas are only meaningful if batches are filled in order.
+class CAENHistogramService {
+    CAENHistogramConfig _config;
+    std::size_t _num_channels = 0;
+
+    std::vector<CAENHistogram> _amplitude;
+    std::vector<CAENHistogram> _integral;
+    std::vector<CAENHistogram> _baseline_rms;
+    CAENHistogram _ttt_delta;
+
+    // Last trigger time tag seen. Bit 32 is set when there is one.
+    std::atomic<uint64_t> _last_ttt = 0;
+    static constexpr uint64_t kHasTTT = 1ull << 32;
+    // TTT is a 31 bit counter, bit 31 is the roll-over flag.
+    static constexpr uint32_t kTTTMask = 0x7FFFFFFF;
+
+    static std::vector<CAENHistogram> _make_histograms(
+            const std::size_t& n, const CAENHistogramBinning& binning) {
+        std::vector<CAENHistogram> out;
+        out.reserve(n);
+        for (std::size_t i = 0; i < n; i++) {
+            out.emplace_back(binning);
+        }
+        return out;
+    }
+
+    void _fill_ttt(const uint32_t& ttt) noexcept {
+        const uint64_t prev = _last_ttt.exchange(kHasTTT | ttt,
+                                                 std::memory_order_relaxed);
+        if (prev & kHasTTT) {
+            const uint32_t delta = (ttt - static_cast<uint32_t>(prev)) & kTTTMask;
+            _ttt_delta.fill(delta);
+        }
+    }
+
+ public:
+    CAENHistogramService(const CAENDigitizerModelConstants& model_constants,
+                         const CAENHistogramConfig& config) :
+        _config{config},
+        _num_channels{model_constants.NumChannels},
+        _amplitude{_make_histograms(_num_channels, config.Amplitude)},
+        _integral{_make_histograms(_num_channels, config.Integral)},
+        _baseline_rms{_make_histograms(_num_channels, config.BaselineRMS)},
+        _ttt_delta{config.TTTDelta}
+    { }
+
+    const CAENHistogramConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    const std::size_t& getNumChannels() const noexcept {
+        return _num_channels;
+    }
+
+    // Throws std::out_of_range if ch is not a channel of this digitizer.
+    const CAENHistogram& get(const CAENHistogramType& type,
+                             const std::size_t& ch = 0) const {
+        switch (type) {
+        case CAENHistogramType::Amplitude:
+            return _amplitude.at(ch);
+        case CAENHistogramType::Integral:
+            return _integral.at(ch);
+        case CAENHistogramType::BaselineRMS:
+            return _baseline_rms.at(ch);
+        default:
+        case CAENHistogramType::TTTDelta:
+            return _ttt_delta;
+        }
+    }
+
+    // Fills all the histograms with a single event.
+    template<typename DataType, typename Allocator>
+    void fill(const CAENWaveforms<DataType, Allocator>& waveforms) noexcept {
+        _fill_ttt(waveforms.getInfo().TriggerTimeTag);
+
+        const auto record_length = waveforms.getRecordLength();
+        if (record_length == 0) {
+            return;
+        }
+
+        const uint32_t num_baseline = std::clamp<uint32_t>(
+            _config.BaselineSamples, 1u, record_length);
+        const auto& en_chs = waveforms.getEnabledChannels();
+        for (std::size_t ch_index = 0; ch_index < en_chs.size(); ch_index++) {
+            const auto ch = en_chs[ch_index];
+            if (ch >= _num_channels) {
+                continue;
+            }
+
+            const auto samples = waveforms.getChannel(ch_index);
+            // Integer accumulators so the compiler can vectorise these.
+            uint64_t base_sum = 0;
+            uint64_t base_sum2 = 0;
+            for (uint32_t i = 0; i < num_baseline; i++) {
+                const uint64_t s = samples[i];
+                base_sum += s;
+                base_sum2 += s*s;
+            }
+
+            uint64_t sum = 0;
+            uint32_t min_val = samples[0];
+            uint32_t max_val = samples[0];
+            for (uint32_t i = 0; i < record_length; i++) {
+                const uint32_t s = samples[i];
+                sum += s;
+                min_val = std::min(min_val, s);
+                max_val = std::max(max_val, s);
+            }
+
+            const double baseline = static_cast<double>(base_sum) / num_baseline;
+            const double variance = static_cast<double>(base_sum2) / num_baseline
+                - baseline*baseline;
+            const double integral = static_cast<double>(sum)
+                - baseline*record_length;
+
+            if (_config.NegativePolarity) {
+                _amplitude[ch].fill(baseline - min_val);
+                _integral[ch].fill(-integral);
+            } else {
+                _amplitude[ch].fill(max_val - baseline);
+                _integral[ch].fill(integral);
+            }
+            _baseline_rms[ch].fill(std::sqrt(std::max(variance, 0.0)));
+        }
+    }
+
+    // Fills with every event in the list, in order. nullptr are skipped.
+    template<typename WaveformsPtr>
+    void fill(std::span<const WaveformsPtr> waveforms) noexcept {
+        for (const auto& waveform : waveforms) {
+            if (waveform) {
+                fill(*waveform);
+            }
+        }
+    }
+
+    void clear() noexcept {
+        for (std::size_t ch = 0; ch < _num_channels; ch++) {
+            _amplitude[ch].clear();
+            _integral[ch].clear();
+            _baseline_rms[ch].clear();
+        }
+        _ttt_delta.clear();
+        _last_ttt.store(0, std::memory_order_relaxed);
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
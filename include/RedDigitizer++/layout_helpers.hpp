@@ -0,0 +1,233 @@
+/*
+    Layout helpers
+    Description: Kernels for waveforms stored sample-major ([sample,
+    channel], all channels of a sample next to each other) instead of the
+    channel-major order the CAEN decoder gives ([channel, sample]).
+
+    Cross-channel work (summing the channels of a group, software
+    majority, hit patterns) then reads memory in order instead of jumping
+    a record length between channels. The transposition from the decoder
+    order is done in 8x8 blocks with SSE2 where available.
+
+    See CAENInterleavedWaveforms and CAEN::SetWaveformsLayout(...).
+*/
+
+#ifndef RD_LAYOUT_HELPERS_H
+#define RD_LAYOUT_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RD_LAYOUT_SSE2 1
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+enum class CAENWaveformsLayout {
+    // [channel, sample], the order of the decoder. What CAENWaveforms uses.
+    ChannelMajor,
+    // [sample, channel], see CAENInterleavedWaveforms
+    SampleMajor
+};
+
+namespace detail {
+
+// Samples and channels per transposition block
+constexpr std::size_t kTransposeBlock = 8;
+
+#ifdef RD_LAYOUT_SSE2
+// Transposes 8 samples of 8 channels: channels[c][offset + s] goes to
+// out[s*stride + c].
+inline void transpose_8x8(const uint16_t* const* channels, const std::size_t& offset,
+                          uint16_t* out, const std::size_t& stride) noexcept {
+    auto load = [&](const std::size_t& c) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(channels[c] + offset));
+    };
+    const __m128i a0 = load(0), a1 = load(1), a2 = load(2), a3 = load(3);
+    const __m128i a4 = load(4), a5 = load(5), a6 = load(6), a7 = load(7);
+
+    // Pairs of channels: c0 c1 of samples 0-3 and 4-7
+    const __m128i t0 = _mm_unpacklo_epi16(a0, a1), t1 = _mm_unpackhi_epi16(a0, a1);
+    const __m128i t2 = _mm_unpacklo_epi16(a2, a3), t3 = _mm_unpackhi_epi16(a2, a3);
+    const __m128i t4 = _mm_unpacklo_epi16(a4, a5), t5 = _mm_unpackhi_epi16(a4, a5);
+    const __m128i t6 = _mm_unpacklo_epi16(a6, a7), t7 = _mm_unpackhi_epi16(a6, a7);
+
+    // Quads of channels: c0-c3 of samples 0-1, 2-3, 4-5 and 6-7
+    const __m128i u0 = _mm_unpacklo_epi32(t0, t2), u1 = _mm_unpackhi_epi32(t0, t2);
+    const __m128i u2 = _mm_unpacklo_epi32(t1, t3), u3 = _mm_unpackhi_epi32(t1, t3);
+    const __m128i u4 = _mm_unpacklo_epi32(t4, t6), u5 = _mm_unpackhi_epi32(t4, t6);
+    const __m128i u6 = _mm_unpacklo_epi32(t5, t7), u7 = _mm_unpackhi_epi32(t5, t7);
+
+    auto store = [&](const std::size_t& s, const __m128i& row) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + s*stride), row);
+    };
+    store(0, _mm_unpacklo_epi64(u0, u4));
+    store(1, _mm_unpackhi_epi64(u0, u4));
+    store(2, _mm_unpacklo_epi64(u1, u5));
+    store(3, _mm_unpackhi_epi64(u1, u5));
+    store(4, _mm_unpacklo_epi64(u2, u6));
+    store(5, _mm_unpackhi_epi64(u2, u6));
+    store(6, _mm_unpacklo_epi64(u3, u7));
+    store(7, _mm_unpackhi_epi64(u3, u7));
+}
+#endif
+
+// Same as transpose_channels without SIMD. Also used for the edges.
+inline void transpose_channels_scalar(std::span<const uint16_t* const> channels,
+                                      const std::size_t& first_sample,
+                                      const std::size_t& num_samples,
+                                      const std::size_t& first_channel,
+                                      uint16_t* out) noexcept {
+    const std::size_t stride = channels.size();
+    for (std::size_t s = first_sample; s < first_sample + num_samples; s++) {
+        for (std::size_t c = first_channel; c < stride; c++) {
+            out[s*stride + c] = channels[c][s];
+        }
+    }
+}
+
+}  // namespace detail
+
+// Writes num_samples samples of every channel into out as [sample,
+// channel]: channels[c][s] -> out[s*channels.size() + c]. out must hold
+// num_samples*channels.size() samples.
+inline void transpose_channels(std::span<const uint16_t* const> channels,
+                               const std::size_t& num_samples,
+                               uint16_t* out) noexcept {
+#ifdef RD_LAYOUT_SSE2
+    constexpr std::size_t B = detail::kTransposeBlock;
+    const std::size_t stride = channels.size();
+    const std::size_t full_channels = stride / B * B;
+    const std::size_t full_samples = num_samples / B * B;
+    // Sample blocks outside so every output row is written in one go
+    for (std::size_t s = 0; s < full_samples; s += B) {
+        for (std::size_t c = 0; c < full_channels; c += B) {
+            detail::transpose_8x8(channels.data() + c, s, out + s*stride + c, stride);
+        }
+    }
+    if (full_channels < stride) {
+        detail::transpose_channels_scalar(channels, 0, full_samples, full_channels, out);
+    }
+    detail::transpose_channels_scalar(channels, full_samples,
+                                      num_samples - full_samples, 0, out);
+#else
+    detail::transpose_channels_scalar(channels, 0, num_samples, 0, out);
+#endif
+}
+
+namespace detail {
+
+#ifdef RD_LAYOUT_SSE2
+// Pairwise sums of 8 uint16_t as 4 int32. _mm_madd_epi16 is signed, so
+// the samples are moved to the int16_t range first and each pair gets
+// 2*0x8000 back from kPairBias.
+inline __m128i pair_sums(const uint16_t* in) noexcept {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    return _mm_madd_epi16(_mm_xor_si128(v, _mm_set1_epi16(-0x8000)),
+                          _mm_set1_epi16(1));
+}
+
+constexpr uint32_t kPairBias = 2*0x8000;
+
+// Adds up the 4 lanes of a, b, c and d: {sum(a), sum(b), sum(c), sum(d)}
+inline __m128i reduce_4x4(const __m128i& a, const __m128i& b,
+                          const __m128i& c, const __m128i& d) noexcept {
+    const __m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+    const __m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+    return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+}
+#endif
+
+}  // namespace detail
+
+// out[s] = sum of data[s*stride + first .. s*stride + first + count) for
+// every sample s < out.size(). data is [sample, channel] with stride
+// channels per sample.
+inline void sum_interleaved(const uint16_t* data, const std::size_t& stride,
+                            const std::size_t& first, const std::size_t& count,
+                            std::span<uint32_t> out) noexcept {
+#ifdef RD_LAYOUT_SSE2
+    const std::size_t full = count / 8 * 8;
+    const uint32_t bias = static_cast<uint32_t>(full / 2)*detail::kPairBias;
+    for (std::size_t s = 0; s < out.size(); s++) {
+        const uint16_t* row = data + s*stride + first;
+        __m128i acc = _mm_setzero_si128();
+        for (std::size_t c = 0; c < full; c += 8) {
+            acc = _mm_add_epi32(acc, detail::pair_sums(row + c));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        uint32_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc)) + bias;
+        for (std::size_t c = full; c < count; c++) {
+            sum += row[c];
+        }
+        out[s] = sum;
+    }
+#else
+    for (std::size_t s = 0; s < out.size(); s++) {
+        const uint16_t* row = data + s*stride + first;
+        uint32_t sum = 0;
+        for (std::size_t c = 0; c < count; c++) {
+            sum += row[c];
+        }
+        out[s] = sum;
+    }
+#endif
+}
+
+// Sums every group of group_size consecutive channels in a single pass,
+// sample-major as well: out[s*num_groups + g] = sum of the channels of
+// group g at sample s, for the num_groups = stride / group_size full
+// groups. out must hold num_samples*num_groups values.
+inline void sum_interleaved_groups(const uint16_t* data, const std::size_t& stride,
+                                   const std::size_t& group_size,
+                                   const std::size_t& num_samples,
+                                   uint32_t* out) noexcept {
+    if (group_size == 0) {
+        return;
+    }
+    const std::size_t num_groups = stride / group_size;
+    std::size_t first_group = 0;
+#ifdef RD_LAYOUT_SSE2
+    // The x740 case: 8 channel groups, four of them per iteration
+    if (group_size == 8) {
+        first_group = num_groups / 4 * 4;
+        const __m128i bias = _mm_set1_epi32(static_cast<int>(4*detail::kPairBias));
+        for (std::size_t s = 0; s < num_samples; s++) {
+            const uint16_t* row = data + s*stride;
+            for (std::size_t g = 0; g < first_group; g += 4) {
+                const uint16_t* in = row + 8*g;
+                const __m128i sums = detail::reduce_4x4(
+                    detail::pair_sums(in), detail::pair_sums(in + 8),
+                    detail::pair_sums(in + 16), detail::pair_sums(in + 24));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + s*num_groups + g),
+                                 _mm_add_epi32(sums, bias));
+            }
+        }
+    }
+#endif
+    for (std::size_t s = 0; s < num_samples; s++) {
+        const uint16_t* row = data + s*stride;
+        for (std::size_t g = first_group; g < num_groups; g++) {
+            uint32_t sum = 0;
+            for (std::size_t c = g*group_size; c < (g + 1)*group_size; c++) {
+                sum += row[c];
+            }
+            out[s*num_groups + g] = sum;
+        }
+    }
+}
+
+}  // namespace RedDigitizer
+
+#endif
@@ -13,49 +13,103 @@
 #pragma once
 
 // C STD includes
+#include <ctime>
 // C 3rd party includes
 // C++ STD includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 // C++ 3rd party includes
 // my includes
 
 namespace RedDigitizer {
 
+namespace detail {
+
+// Writes a single argument into the stream. Enums are printed as their
+// underlying value, everything else uses operator<<.
+template<typename T>
+void write_log_arg(std::ostream& os, const T& arg) {
+    if constexpr (std::is_enum_v<T>) {
+        os << static_cast<std::underlying_type_t<T>>(arg);
+    } else if constexpr (std::is_same_v<T, uint8_t> or std::is_same_v<T, int8_t>) {
+        // Otherwise they are printed as characters
+        os << static_cast<int>(arg);
+    } else {
+        os << arg;
+    }
+}
+
+// Replaces each "{}" in fmt with the next argument. Extra arguments are
+// ignored and extra "{}" are printed as they are.
+inline void format_braces(std::ostream& os, std::string_view fmt) {
+    os << fmt;
+}
+
+template<typename T, typename ...Args>
+void format_braces(std::ostream& os, std::string_view fmt,
+                   const T& arg, const Args&... args) {
+    auto pos = fmt.find("{}");
+    if (pos == std::string_view::npos) {
+        os << fmt;
+        return;
+    }
+
+    os << fmt.substr(0, pos);
+    write_log_arg(os, arg);
+    format_braces(os, fmt.substr(pos + 2), args...);
+}
+
+}  // namespace detail
+
 // Use this class in red_digitizer_helper if a very basic logging is required.
 // It will print directly to terminal with no timestamp, no way to discern
-// the type of message, and lacks formatting features.
+// the type of message, and only supports "{}" formatting.
 class iostream_wrapper {
  public:
     iostream_wrapper() = default;
 
+    // No std::endl: the terminal is flushed when needed, not every line.
     template<typename ...Args>
-    void print(const std::string& out, Args&&... args) {
-        std::cout << out << std::endl;
+    void print(std::string_view out, Args&&... args) {
+        detail::format_braces(std::cout, out, args...);
+        std::cout << '\n';
     }
 
     template<typename ...Args>
-    void info(const std::string& out, Args&&... args) {
-        print(out);
+    void info(std::string_view out, Args&&... args) {
+        print(out, std::forward<Args>(args)...);
     }
 
     template<typename ...Args>
-    void debug(const std::string& out, Args&&... args) {
-        print(out);
+    void debug(std::string_view out, Args&&... args) {
+        print(out, std::forward<Args>(args)...);
     }
 
     template<typename ...Args>
-    void warn(const std::string& out, Args&&... args) {
-        print(out);
+    void warn(std::string_view out, Args&&... args) {
+        print(out, std::forward<Args>(args)...);
     }
 
     template<typename ...Args>
-    void log(const std::string& out, Args&&... args) {
-        print(out);
+    void log(std::string_view out, Args&&... args) {
+        print(out, std::forward<Args>(args)...);
     }
 
     template<typename ...Args>
-    void error(const std::string& out, Args&&... args) {
-        print(out);
+    void error(std::string_view out, Args&&... args) {
+        print(out, std::forward<Args>(args)...);
+        std::cout.flush();
     }
 };
 
@@ -65,24 +119,346 @@ class no_logger {
     no_logger() = default;
 
     template<typename ...Args>
-    void print(const std::string& out, Args&&... args) { }
+    void print(std::string_view, Args&&...) { }
 
     template<typename ...Args>
-    void info(const std::string& out, Args&&... args) { }
+    void info(std::string_view, Args&&...) { }
 
     template<typename ...Args>
-    void debug(const std::string& out, Args&&... args) { }
+    void debug(std::string_view, Args&&...) { }
 
     template<typename ...Args>
-    void warn(const std::string& out, Args&&... args) { }
+    void warn(std::string_view, Args&&...) { }
 
     template<typename ...Args>
-    void log(const std::string& out, Args&&... args) { }
+    void log(std::string_view, Args&&...) { }
+
+    template<typename ...Args>
+    void error(std::string_view, Args&&...) { }
+};
+
+// Use this class in red_digitizer_helper if logging must not slow down
+// the thread doing the logging.
+//
+// The calling thread only copies the format string and the arguments
+// into a fixed-size record of a lock-free ring; no memory is allocated
+// and nothing is formatted. A background thread formats the records and
+// writes them to the output file (stdout by default).
+//
+// If the ring is full the message is dropped and counted, the caller
+// never waits. Arguments that are not numbers or strings are formatted
+// in the calling thread, so keep those out of the hot path.
+class async_logger {
+ public:
+    enum class Level : uint8_t { Print, Info, Debug, Warn, Log, Error };
+
+    // Max number of arguments captured per message
+    static constexpr std::size_t kMaxArgs = 8;
+    // Bytes available for the format string and all the string arguments.
+    // Anything longer is truncated.
+    static constexpr std::size_t kTextSize = 400;
+
+ private:
+    struct Arg {
+        enum class Kind : uint8_t { Signed, Unsigned, Floating, Boolean, Text };
+        Kind Type = Kind::Signed;
+        uint16_t TextOffset = 0;
+        uint16_t TextLength = 0;
+        union {
+            int64_t Signed;
+            uint64_t Unsigned;
+            double Floating;
+            bool Boolean;
+        } Value = {0};
+    };
+
+    struct Record {
+        Level MsgLevel = Level::Print;
+        uint8_t NumArgs = 0;
+        uint16_t FmtLength = 0;
+        uint16_t TextUsed = 0;
+        std::chrono::system_clock::time_point Time;
+        std::array<Arg, kMaxArgs> Args;
+        std::array<char, kTextSize> Text;
+
+        // Copies str into Text and returns its length after truncation
+        uint16_t append_text(std::string_view str) noexcept {
+            const std::size_t len = std::min(str.size(),
+                                             kTextSize - TextUsed);
+            std::memcpy(Text.data() + TextUsed, str.data(), len);
+            TextUsed += static_cast<uint16_t>(len);
+            return static_cast<uint16_t>(len);
+        }
+    };
+
+    // Bounded multi-producer ring (D. Vyukov). Each cell has a sequence
+    // number that tells producers and the consumer whose turn it is.
+    struct alignas(64) Cell {
+        std::atomic<std::size_t> Sequence = 0;
+        Record Msg;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    const std::size_t _mask;
+    alignas(64) std::atomic<std::size_t> _enqueue_pos = 0;
+    alignas(64) std::size_t _dequeue_pos = 0;
+    // Bumped after each enqueue. The writer thread sleeps on it.
+    alignas(64) std::atomic<uint32_t> _pending = 0;
+    std::atomic<uint64_t> _dropped = 0;
+    std::atomic<bool> _running = true;
+
+    std::FILE* _out;
+    std::thread _writer;
+
+    static std::size_t _round_capacity(std::size_t capacity) noexcept {
+        std::size_t out = 2;
+        while (out < capacity) {
+            out <<= 1;
+        }
+        return out;
+    }
+
+    template<typename T>
+    static void _capture(Record& rec, const T& arg) {
+        if (rec.NumArgs >= kMaxArgs) {
+            return;
+        }
+
+        Arg& out = rec.Args[rec.NumArgs++];
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, bool>) {
+            out.Type = Arg::Kind::Boolean;
+            out.Value.Boolean = arg;
+        } else if constexpr (std::is_enum_v<U>) {
+            out.Type = Arg::Kind::Signed;
+            out.Value.Signed = static_cast<int64_t>(arg);
+        } else if constexpr (std::is_integral_v<U> and std::is_signed_v<U>) {
+            out.Type = Arg::Kind::Signed;
+            out.Value.Signed = arg;
+        } else if constexpr (std::is_integral_v<U>) {
+            out.Type = Arg::Kind::Unsigned;
+            out.Value.Unsigned = arg;
+        } else if constexpr (std::is_floating_point_v<U>) {
+            out.Type = Arg::Kind::Floating;
+            out.Value.Floating = arg;
+        } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            out.Type = Arg::Kind::Text;
+            out.TextOffset = rec.TextUsed;
+            out.TextLength = rec.append_text(std::string_view(arg));
+        } else {
+            // Not a trivially capturable type, format it now.
+            std::ostringstream oss;
+            detail::write_log_arg(oss, arg);
+            out.Type = Arg::Kind::Text;
+            out.TextOffset = rec.TextUsed;
+            out.TextLength = rec.append_text(oss.str());
+        }
+    }
 
     template<typename ...Args>
-    void error(const std::string& out, Args&&... args) { }
+    void _push(Level level, std::string_view fmt, const Args&... args) {
+        Cell* cell = nullptr;
+        std::size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[pos & _mask];
+            const std::size_t seq = cell->Sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq)
+                - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Full. Never block the caller.
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        Record& rec = cell->Msg;
+        rec.MsgLevel = level;
+        rec.NumArgs = 0;
+        rec.TextUsed = 0;
+        rec.Time = std::chrono::system_clock::now();
+        rec.FmtLength = rec.append_text(fmt);
+        (_capture(rec, args), ...);
+
+        cell->Sequence.store(pos + 1, std::memory_order_release);
+        _pending.fetch_add(1, std::memory_order_release);
+        _pending.notify_one();
+    }
+
+    bool _pop(std::string& line) {
+        Cell* cell = &_cells[_dequeue_pos & _mask];
+        const std::size_t seq = cell->Sequence.load(std::memory_order_acquire);
+        if (seq != _dequeue_pos + 1) {
+            return false;
+        }
+
+        _format(cell->Msg, line);
+        cell->Sequence.store(_dequeue_pos + _mask + 1, std::memory_order_release);
+        _dequeue_pos++;
+        return true;
+    }
+
+    static void _format(const Record& rec, std::string& line) {
+        static constexpr std::array<std::string_view, 6> kLevelNames = {
+            "print", "info", "debug", "warning", "log", "error"
+        };
+
+        line.clear();
+        const auto time_t = std::chrono::system_clock::to_time_t(rec.Time);
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            rec.Time.time_since_epoch()).count() % 1000000;
+        std::tm tm_buf = {};
+        localtime_r(&time_t, &tm_buf);
+        char stamp[32];
+        const auto stamp_len = std::strftime(stamp, sizeof(stamp),
+                                             "%H:%M:%S", &tm_buf);
+        line.append("[").append(stamp, stamp_len);
+        char us_buf[16];
+        std::snprintf(us_buf, sizeof(us_buf), ".%06lld] [",
+                      static_cast<long long>(us));
+        line.append(us_buf);
+        line.append(kLevelNames[static_cast<std::size_t>(rec.MsgLevel)]);
+        line.append("] ");
+
+        std::string_view fmt(rec.Text.data(), rec.FmtLength);
+        char num_buf[32];
+        for (std::size_t i = 0; i < rec.NumArgs; i++) {
+            auto pos = fmt.find("{}");
+            if (pos == std::string_view::npos) {
+                break;
+            }
+            line.append(fmt.substr(0, pos));
+            fmt.remove_prefix(pos + 2);
+
+            const Arg& arg = rec.Args[i];
+            int len = 0;
+            switch (arg.Type) {
+            case Arg::Kind::Signed:
+                len = std::snprintf(num_buf, sizeof(num_buf), "%lld",
+                                    static_cast<long long>(arg.Value.Signed));
+                line.append(num_buf, len);
+                break;
+            case Arg::Kind::Unsigned:
+                len = std::snprintf(num_buf, sizeof(num_buf), "%llu",
+                    static_cast<unsigned long long>(arg.Value.Unsigned));
+                line.append(num_buf, len);
+                break;
+            case Arg::Kind::Floating:
+                len = std::snprintf(num_buf, sizeof(num_buf), "%g",
+                                    arg.Value.Floating);
+                line.append(num_buf, len);
+                break;
+            case Arg::Kind::Boolean:
+                line.append(arg.Value.Boolean ? "true" : "false");
+                break;
+            case Arg::Kind::Text:
+                line.append(rec.Text.data() + arg.TextOffset, arg.TextLength);
+                break;
+            }
+        }
+        line.append(fmt);
+        line.push_back('\n');
+    }
+
+    void _writer_loop() {
+        std::string line;
+        line.reserve(2*kTextSize);
+        while (true) {
+            const uint32_t seen = _pending.load(std::memory_order_acquire);
+            bool wrote = false;
+            while (_pop(line)) {
+                std::fwrite(line.data(), 1, line.size(), _out);
+                wrote = true;
+            }
+
+            if (wrote) {
+                std::fflush(_out);
+            }
+
+            if (not _running.load(std::memory_order_acquire)) {
+                // One last pass to catch anything pushed before stopping.
+                while (_pop(line)) {
+                    std::fwrite(line.data(), 1, line.size(), _out);
+                }
+                std::fflush(_out);
+                return;
+            }
+
+            _pending.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+ public:
+    // capacity -> number of messages the ring can hold before dropping.
+    //  Rounded up to a power of 2.
+    // out -> where the messages are written. Not owned by the logger.
+    explicit async_logger(std::size_t capacity = 1024,
+                          std::FILE* out = stdout) :
+        _cells{new Cell[_round_capacity(capacity)]},
+        _mask{_round_capacity(capacity) - 1},
+        _out{out}
+    {
+        for (std::size_t i = 0; i <= _mask; i++) {
+            _cells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+        _writer = std::thread(&async_logger::_writer_loop, this);
+    }
+
+    async_logger(const async_logger&) = delete;
+    async_logger& operator=(const async_logger&) = delete;
+
+    // Writes all pending messages before returning.
+    ~async_logger() {
+        _running.store(false, std::memory_order_release);
+        _pending.fetch_add(1, std::memory_order_release);
+        _pending.notify_one();
+        if (_writer.joinable()) {
+            _writer.join();
+        }
+    }
+
+    // Number of messages lost because the ring was full.
+    uint64_t dropped() const noexcept {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    template<typename ...Args>
+    void print(std::string_view out, const Args&... args) {
+        _push(Level::Print, out, args...);
+    }
+
+    template<typename ...Args>
+    void info(std::string_view out, const Args&... args) {
+        _push(Level::Info, out, args...);
+    }
+
+    template<typename ...Args>
+    void debug(std::string_view out, const Args&... args) {
+        _push(Level::Debug, out, args...);
+    }
+
+    template<typename ...Args>
+    void warn(std::string_view out, const Args&... args) {
+        _push(Level::Warn, out, args...);
+    }
+
+    template<typename ...Args>
+    void log(std::string_view out, const Args&... args) {
+        _push(Level::Log, out, args...);
+    }
+
+    template<typename ...Args>
+    void error(std::string_view out, const Args&... args) {
+        _push(Level::Error, out, args...);
+    }
 };
 
 }  // namespace RedDigitizer
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,371 @@
+/*
+    Memory helpers
+    Description: An arena for the waveform storage of CAEN and CAENWaveforms.
+    Memory is taken from the OS in big blocks that can be backed by
+    transparent or explicit huge pages, and can be pre-faulted before the
+    acquisition starts, so the readout loop does not pay for page faults
+    and TLB misses.
+
+    CAENArenaAllocator is the standard allocator interface on top of it.
+    A default constructed CAENArenaAllocator has no arena and uses the heap.
+*/
+
+#ifndef RD_MEMORY_HELPERS_H
+#define RD_MEMORY_HELPERS_H
+#pragma once
+
+// C STD includes
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+enum class CAENHugePages {
+    // Normal pages
+    Off,
+    // Blocks are aligned to 2 MiB and marked with madvise(MADV_HUGEPAGE).
+    // Works out of the box if THP is in "madvise" or "always" mode.
+    Transparent,
+    // MAP_HUGETLB. Requires pages reserved in /proc/sys/vm/nr_hugepages.
+    // Falls back to Transparent if there are not enough of them.
+    Explicit
+};
+
+struct CAENArenaConfig {
+    // Size of each block requested to the OS, in bytes. Bigger allocations
+    // get a block of their own. Rounded up to the huge page size.
+    std::size_t BlockSize = 64ull << 20;
+
+    CAENHugePages HugePages = CAENHugePages::Transparent;
+
+    // Touch every page of the arena on prefault(). CAEN calls it at
+    // EnableAcquisition().
+    bool Prefault = true;
+};
+
+struct CAENArenaFootprint {
+    // Bytes mapped from the OS
+    std::size_t Reserved = 0;
+    // Bytes handed out since the arena was last empty
+    std::size_t Used = 0;
+    // Bytes currently allocated and not freed
+    std::size_t Live = 0;
+    // Highest Live seen
+    std::size_t Peak = 0;
+    std::size_t Blocks = 0;
+    // Blocks backed by MAP_HUGETLB
+    std::size_t ExplicitHugePageBlocks = 0;
+    // Blocks marked with MADV_HUGEPAGE
+    std::size_t TransparentHugePageBlocks = 0;
+    // Bytes touched by prefault()
+    std::size_t Prefaulted = 0;
+};
+
+// Bump allocator over a list of OS blocks. Individual deallocations only
+// decrease the live counter; once everything is freed the blocks are
+// reused from the start. Blocks go back to the OS when the arena is
+// destroyed.
+//
+// Thread-safe. Allocation is meant to happen at setup time, deallocation
+// can happen from any thread (e.g. the last Python reference to a
+// waveform going away).
+class CAENArena {
+ public:
+    static constexpr std::size_t kHugePageSize = 2ull << 20;
+
+ private:
+    struct Block {
+        std::byte* Data = nullptr;
+        std::size_t Size = 0;
+        std::size_t Offset = 0;
+        // What has to be given back to the OS, can differ from Data/Size
+        // because of the alignment for transparent huge pages.
+        void* MapData = nullptr;
+        std::size_t MapSize = 0;
+        CAENHugePages Pages = CAENHugePages::Off;
+        // Bytes already touched by prefault()
+        std::size_t Prefaulted = 0;
+    };
+
+    CAENArenaConfig _config;
+    std::mutex _mtx;
+    std::vector<Block> _blocks;
+    std::size_t _current = 0;
+    std::size_t _live = 0;
+    std::size_t _peak = 0;
+
+    static std::size_t _round_up(const std::size_t& x, const std::size_t& to) noexcept {
+        return (x + to - 1) / to * to;
+    }
+
+    static std::size_t _page_size() noexcept {
+#ifndef _WIN32
+        static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+#else
+        return 4096;
+#endif
+    }
+
+    Block _map_block(const std::size_t& min_size) {
+        Block block;
+#ifndef _WIN32
+        const std::size_t size = _round_up(std::max(min_size, _config.BlockSize),
+            _config.HugePages == CAENHugePages::Off ? _page_size() : kHugePageSize);
+        block.Size = size;
+
+        if (_config.HugePages == CAENHugePages::Explicit) {
+            void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (ptr != MAP_FAILED) {
+                block.Data = static_cast<std::byte*>(ptr);
+                block.MapData = ptr;
+                block.MapSize = size;
+                block.Pages = CAENHugePages::Explicit;
+                return block;
+            }
+        }
+
+        if (_config.HugePages == CAENHugePages::Off) {
+            void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            block.Data = static_cast<std::byte*>(ptr);
+            block.MapData = ptr;
+            block.MapSize = size;
+            return block;
+        }
+
+        // Transparent huge pages need 2 MiB aligned ranges: map one extra
+        // huge page and use the aligned part.
+        const std::size_t map_size = size + kHugePageSize;
+        void* ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        const auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+        block.Data = reinterpret_cast<std::byte*>(_round_up(addr, kHugePageSize));
+        block.MapData = ptr;
+        block.MapSize = map_size;
+#ifdef MADV_HUGEPAGE
+        if (madvise(block.Data, size, MADV_HUGEPAGE) == 0) {
+            block.Pages = CAENHugePages::Transparent;
+        }
+#endif
+#else
+        // No huge pages support, plain aligned heap memory.
+        block.Size = std::max(min_size, _config.BlockSize);
+        block.Data = static_cast<std::byte*>(::operator new(block.Size,
+            std::align_val_t{kHugePageSize}));
+        block.MapData = block.Data;
+        block.MapSize = block.Size;
+#endif
+        return block;
+    }
+
+    static void _unmap_block(Block& block) noexcept {
+        if (not block.MapData) {
+            return;
+        }
+#ifndef _WIN32
+        munmap(block.MapData, block.MapSize);
+#else
+        ::operator delete(block.MapData, std::align_val_t{kHugePageSize});
+#endif
+        block.MapData = nullptr;
+    }
+
+ public:
+    explicit CAENArena(const CAENArenaConfig& config = CAENArenaConfig{}) :
+        _config{config}
+    {
+        if (_config.BlockSize == 0) {
+            throw std::invalid_argument("Arena block size must be positive.");
+        }
+    }
+
+    CAENArena(const CAENArena&) = delete;
+    CAENArena& operator=(const CAENArena&) = delete;
+
+    ~CAENArena() {
+        for (auto& block : _blocks) {
+            _unmap_block(block);
+        }
+    }
+
+    const CAENArenaConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    void* allocate(const std::size_t& bytes, const std::size_t& alignment) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        // First fit starting from the current block. Earlier blocks only
+        // have space again once the arena is empty.
+        for (; _current < _blocks.size(); _current++) {
+            auto& block = _blocks[_current];
+            const std::size_t offset = _round_up(block.Offset, alignment);
+            if (offset + bytes <= block.Size) {
+                block.Offset = offset + bytes;
+                _live += bytes;
+                _peak = std::max(_peak, _live);
+                return block.Data + offset;
+            }
+        }
+
+        _blocks.push_back(_map_block(bytes));
+        _current = _blocks.size() - 1;
+        auto& block = _blocks.back();
+        block.Offset = bytes;
+        _live += bytes;
+        _peak = std::max(_peak, _live);
+        return block.Data;
+    }
+
+    void deallocate(void*, const std::size_t& bytes) noexcept {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _live -= std::min(bytes, _live);
+        if (_live == 0) {
+            for (auto& block : _blocks) {
+                block.Offset = 0;
+            }
+            _current = 0;
+        }
+    }
+
+    // Writes to every page of the arena so the OS backs it now instead of
+    // on first use. Pages touched by an earlier call are skipped.
+    // Returns the number of bytes touched by this call.
+    std::size_t prefault() noexcept {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (not _config.Prefault) {
+            return 0;
+        }
+
+        const std::size_t step = _page_size();
+        std::size_t touched = 0;
+        for (auto& block : _blocks) {
+            // Only write to memory that is not handed out yet; the rest is
+            // read so its content is preserved.
+            for (std::size_t i = block.Prefaulted; i < block.Size; i += step) {
+                volatile std::byte* page = block.Data + i;
+                if (i >= block.Offset) {
+                    *page = std::byte{0};
+                } else {
+                    *page = *page;
+                }
+            }
+            touched += block.Size - block.Prefaulted;
+            block.Prefaulted = block.Size;
+        }
+        return touched;
+    }
+
+    CAENArenaFootprint getFootprint() noexcept {
+        std::lock_guard<std::mutex> lock(_mtx);
+        CAENArenaFootprint out;
+        out.Live = _live;
+        out.Peak = _peak;
+        out.Blocks = _blocks.size();
+        for (const auto& block : _blocks) {
+            out.Reserved += block.Size;
+            out.Used += block.Offset;
+            out.Prefaulted += block.Prefaulted;
+            if (block.Pages == CAENHugePages::Explicit) {
+                out.ExplicitHugePageBlocks++;
+            } else if (block.Pages == CAENHugePages::Transparent) {
+                out.TransparentHugePageBlocks++;
+            }
+        }
+        return out;
+    }
+};
+
+// Standard allocator over a shared CAENArena. The arena lives as long as
+// any allocator (and therefore any container) that uses it.
+//
+// A default constructed allocator has no arena and falls back to
+// std::allocator, so containers using it behave as usual until an arena
+// is given.
+template<typename T>
+class CAENArenaAllocator {
+    template<typename U> friend class CAENArenaAllocator;
+
+    std::shared_ptr<CAENArena> _arena;
+
+ public:
+    using value_type = T;
+    // Waveforms never mix arenas: every buffer goes back to the arena it
+    // came from. Copy assignment keeps the target allocator, so the copy
+    // is made in the target arena. Move assignment and swap take the
+    // buffer together with its allocator. Without that, moving between
+    // arenas would copy element by element, and swapping would be
+    // undefined behaviour.
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    CAENArenaAllocator() noexcept = default;
+    explicit CAENArenaAllocator(std::shared_ptr<CAENArena> arena) noexcept :
+        _arena{std::move(arena)} { }
+
+    template<typename U>
+    CAENArenaAllocator(const CAENArenaAllocator<U>& other) noexcept :
+        _arena{other._arena} { }
+
+    [[nodiscard]] T* allocate(const std::size_t& n) {
+        if (not _arena) {
+            return std::allocator<T>{}.allocate(n);
+        }
+        return static_cast<T*>(_arena->allocate(n*sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, const std::size_t& n) noexcept {
+        if (not _arena) {
+            std::allocator<T>{}.deallocate(ptr, n);
+            return;
+        }
+        _arena->deallocate(ptr, n*sizeof(T));
+    }
+
+    const std::shared_ptr<CAENArena>& getArena() const noexcept {
+        return _arena;
+    }
+
+    // Used by CAEN at EnableAcquisition()
+    std::size_t prefault() const noexcept {
+        return _arena ? _arena->prefault() : 0;
+    }
+
+    CAENArenaFootprint getFootprint() const noexcept {
+        return _arena ? _arena->getFootprint() : CAENArenaFootprint{};
+    }
+
+    template<typename U>
+    bool operator==(const CAENArenaAllocator<U>& other) const noexcept {
+        return _arena == other._arena;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,306 @@
+/*
+    Monitor helpers
+    Description: Live-time and buffer occupancy monitor. A thread samples
+    the number of events stored in the board and its memory full flag at
+    a fixed rate, and accumulates how long the board spent full (dropping
+    triggers) versus accepting them. Used by CAEN.
+
+    The registers are read through a callable, so this file does not
+    depend on the CAEN API (CAEN uses CAEN_DGTZ_ReadRegister).
+*/
+
+#ifndef RD_MONITOR_HELPERS_H
+#define RD_MONITOR_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+struct CAENLiveTimeMonitorConfig {
+    // Samples per second, in Hz. Each sample reads two registers.
+    double SampleRate = 1000.0;
+
+    // Register with the number of events stored in the board memory
+    uint32_t EventStoredRegister = 0x812C;
+    // Acquisition status register and its memory full bit
+    uint32_t AcquisitionStatusRegister = 0x8104;
+    uint32_t MemoryFullBit = 4;
+};
+
+struct CAENLiveTimeStats {
+    uint64_t Samples = 0;
+    // Samples where reading a register failed, not counted in the times
+    uint64_t ReadErrors = 0;
+
+    // Time covered by the samples, in seconds
+    double ElapsedSeconds = 0.0;
+    // Time the board memory was full, in seconds
+    double FullSeconds = 0.0;
+    // Time the board could accept triggers, in seconds
+    double AcceptingSeconds = 0.0;
+    // AcceptingSeconds / ElapsedSeconds
+    double LiveFraction = 1.0;
+    // Times the board went from accepting to full
+    uint64_t FullEpisodes = 0;
+
+    // Average number of events stored in the board
+    double MeanOccupancy = 0.0;
+    uint32_t MaxOccupancy = 0;
+
+    // EventCounter accounting over the read events
+    uint64_t EventsSeen = 0;
+    // Counts missing between consecutive events. If the board counts all
+    // triggers (TriggerCountingMode) these are triggers lost to deadtime,
+    // otherwise they are events lost in the readout and should be 0.
+    uint64_t CounterGaps = 0;
+    bool CountsAllTriggers = true;
+    // EventsSeen / (EventsSeen + CounterGaps)
+    double TriggerLiveFraction = 1.0;
+};
+
+// Samples the board from its own thread. observe(...) is called by the
+// readout thread with the EventCounter of every read event.
+//
+// All counters are atomics, so getStats() and getOccupancyHistogram()
+// can be called from any thread at any time.
+class CAENLiveTimeMonitor {
+ public:
+    // Returns true if the register was read into value
+    using ReadRegisterFunc = std::function<bool(uint32_t, uint32_t&)>;
+
+    // EventCounter is a 24 bit counter
+    static constexpr uint32_t kEventCounterMask = 0xFFFFFF;
+    // Slowest SampleRate, in Hz: one sample every ~17 minutes, far from
+    // overflowing the nanosecond period.
+    static constexpr double kMinSampleRate = 1e-3;
+
+ private:
+    using clock = std::chrono::steady_clock;
+
+    CAENLiveTimeMonitorConfig _config;
+    ReadRegisterFunc _read_register;
+    bool _counts_all_triggers = true;
+
+    std::atomic<bool> _running = true;
+    std::atomic<uint64_t> _samples = 0;
+    std::atomic<uint64_t> _read_errors = 0;
+    std::atomic<int64_t> _elapsed_ns = 0;
+    std::atomic<int64_t> _full_ns = 0;
+    std::atomic<uint64_t> _full_episodes = 0;
+    std::atomic<uint64_t> _occupancy_sum = 0;
+    std::atomic<uint32_t> _max_occupancy = 0;
+    // [0, MaxBuffers], the last bin also counts anything above
+    std::unique_ptr<std::atomic<uint64_t>[]> _occupancy;
+    std::size_t _num_occupancy_bins = 0;
+
+    // Only touched by the readout thread
+    uint32_t _last_counter = 0;
+    bool _has_last_counter = false;
+    std::atomic<uint64_t> _events_seen = 0;
+    std::atomic<uint64_t> _counter_gaps = 0;
+
+    std::thread _thread;
+    // Wakes the thread up from its sleep when stopped
+    std::mutex _mtx;
+    std::condition_variable _cv;
+
+    void _loop() {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+
+        const auto period = duration_cast<nanoseconds>(
+            std::chrono::duration<double>(1.0 / _config.SampleRate));
+        const uint32_t full_mask = 1u << _config.MemoryFullBit;
+
+        auto next = clock::now();
+        auto last = next;
+        bool was_full = false;
+        while (_running.load(std::memory_order_relaxed)) {
+            uint32_t stored = 0;
+            uint32_t status = 0;
+            const bool ok = _read_register(_config.EventStoredRegister, stored)
+                and _read_register(_config.AcquisitionStatusRegister, status);
+
+            // The interval since the last sample is given the state seen
+            // now; with a fast enough sample rate the error is small.
+            const auto now = clock::now();
+            const auto dt = duration_cast<nanoseconds>(now - last).count();
+            last = now;
+            _samples.fetch_add(1, std::memory_order_relaxed);
+
+            if (ok) {
+                const bool full = status & full_mask;
+                _elapsed_ns.fetch_add(dt, std::memory_order_relaxed);
+                if (full) {
+                    _full_ns.fetch_add(dt, std::memory_order_relaxed);
+                    if (not was_full) {
+                        _full_episodes.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                was_full = full;
+
+                _occupancy_sum.fetch_add(stored, std::memory_order_relaxed);
+                if (stored > _max_occupancy.load(std::memory_order_relaxed)) {
+                    _max_occupancy.store(stored, std::memory_order_relaxed);
+                }
+                const std::size_t bin = std::min<std::size_t>(stored,
+                                                              _num_occupancy_bins - 1);
+                _occupancy[bin].fetch_add(1, std::memory_order_relaxed);
+            } else {
+                _read_errors.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            next += period;
+            if (clock::now() > next) {
+                // Too slow for the sample rate, do not try to catch up.
+                next = clock::now();
+            }
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait_until(lock, next, [this]() {
+                return not _running.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+ public:
+    // max_buffers is the number of events the board can hold, it sets the
+    // range of the occupancy histogram. counts_all_triggers is the
+    // TriggerCountingMode of the board.
+    CAENLiveTimeMonitor(const CAENLiveTimeMonitorConfig& config,
+                        const uint32_t& max_buffers,
+                        const bool& counts_all_triggers,
+                        ReadRegisterFunc read_register) :
+        _config{config},
+        _read_register{std::move(read_register)},
+        _counts_all_triggers{counts_all_triggers},
+        _occupancy{new std::atomic<uint64_t>[std::size_t{max_buffers} + 1]},
+        _num_occupancy_bins{std::size_t{max_buffers} + 1}
+    {
+        if (not _read_register) {
+            throw std::invalid_argument("Read register function is empty.");
+        }
+        if (not (_config.SampleRate >= kMinSampleRate)) {
+            throw std::invalid_argument("Monitor sample rate must be at least "
+                                        "1e-3 Hz.");
+        }
+        if (_config.MemoryFullBit >= 32) {
+            throw std::invalid_argument("Memory full bit must be below 32.");
+        }
+        for (std::size_t i = 0; i < _num_occupancy_bins; i++) {
+            _occupancy[i].store(0, std::memory_order_relaxed);
+        }
+
+        _thread = std::thread(&CAENLiveTimeMonitor::_loop, this);
+    }
+
+    CAENLiveTimeMonitor(const CAENLiveTimeMonitor&) = delete;
+    CAENLiveTimeMonitor& operator=(const CAENLiveTimeMonitor&) = delete;
+
+    ~CAENLiveTimeMonitor() {
+        stop();
+    }
+
+    // Stops and joins the thread. Safe to call more than once.
+    void stop() noexcept {
+        {
+            // Under the lock so the thread can not miss the notification
+            // between checking _running and going to sleep
+            std::lock_guard<std::mutex> lock(_mtx);
+            _running.store(false, std::memory_order_relaxed);
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    bool isRunning() const noexcept {
+        return _running.load(std::memory_order_relaxed);
+    }
+
+    const CAENLiveTimeMonitorConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    // Accounts the EventCounter of a block of read events, in order.
+    // Only call it from one thread (the readout).
+    void observe(std::span<const uint32_t> event_counters) noexcept {
+        uint64_t gaps = 0;
+        for (const auto& raw : event_counters) {
+            const uint32_t counter = raw & kEventCounterMask;
+            if (_has_last_counter) {
+                gaps += (counter - _last_counter - 1) & kEventCounterMask;
+            }
+            _last_counter = counter;
+            _has_last_counter = true;
+        }
+        _events_seen.fetch_add(event_counters.size(), std::memory_order_relaxed);
+        _counter_gaps.fetch_add(gaps, std::memory_order_relaxed);
+    }
+
+    // Forgets the last EventCounter, call it when the board counters are
+    // reset (new acquisition).
+    void resetCounter() noexcept {
+        _has_last_counter = false;
+    }
+
+    CAENLiveTimeStats getStats() const noexcept {
+        CAENLiveTimeStats out;
+        out.Samples = _samples.load(std::memory_order_relaxed);
+        out.ReadErrors = _read_errors.load(std::memory_order_relaxed);
+        out.ElapsedSeconds = 1e-9*_elapsed_ns.load(std::memory_order_relaxed);
+        out.FullSeconds = 1e-9*_full_ns.load(std::memory_order_relaxed);
+        out.AcceptingSeconds = out.ElapsedSeconds - out.FullSeconds;
+        if (out.ElapsedSeconds > 0.0) {
+            out.LiveFraction = out.AcceptingSeconds / out.ElapsedSeconds;
+        }
+        out.FullEpisodes = _full_episodes.load(std::memory_order_relaxed);
+
+        const uint64_t good_samples = out.Samples - out.ReadErrors;
+        if (good_samples > 0) {
+            out.MeanOccupancy = static_cast<double>(
+                _occupancy_sum.load(std::memory_order_relaxed)) / good_samples;
+        }
+        out.MaxOccupancy = _max_occupancy.load(std::memory_order_relaxed);
+
+        out.EventsSeen = _events_seen.load(std::memory_order_relaxed);
+        out.CounterGaps = _counter_gaps.load(std::memory_order_relaxed);
+        out.CountsAllTriggers = _counts_all_triggers;
+        if (out.EventsSeen + out.CounterGaps > 0) {
+            out.TriggerLiveFraction = static_cast<double>(out.EventsSeen)
+                / (out.EventsSeen + out.CounterGaps);
+        }
+        return out;
+    }
+
+    // Number of samples that saw 0, 1, ..., max_buffers events stored
+    std::vector<uint64_t> getOccupancyHistogram() const {
+        std::vector<uint64_t> out(_num_occupancy_bins);
+        for (std::size_t i = 0; i < _num_occupancy_bins; i++) {
+            out[i] = _occupancy[i].load(std::memory_order_relaxed);
+        }
+        return out;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
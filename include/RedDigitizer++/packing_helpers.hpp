@@ -0,0 +1,262 @@
+/*
+    Packing helpers
+    Description: Bit packed waveform storage. Samples are kept with 8, 12,
+    14 or 16 bits instead of a full uint16_t, so long event histories take
+    less RAM (12 bits -> 25% smaller, 14 bits -> 12.5% smaller).
+
+    Samples are packed four at a time into a 64 bit word (SWAR) and written
+    or read with a single unaligned 8 bytes access. Assumes a little endian
+    machine, as the CAEN libraries do.
+*/
+
+#ifndef RD_PACKING_HELPERS_H
+#define RD_PACKING_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "red_digitizer_helper.hpp"
+
+namespace RedDigitizer {
+
+static_assert(std::endian::native == std::endian::little,
+              "Packed waveforms assume a little endian machine.");
+
+// Packs groups of 4 samples of Bits bits into Bits/2 bytes.
+//
+// When the ADC has more bits than Bits, the least significant bits are
+// dropped on pack and the samples come back shifted to the ADC scale on
+// unpack, so values are always in ADC counts.
+template<uint32_t Bits>
+requires (Bits == 8 or Bits == 12 or Bits == 14 or Bits == 16)
+struct CAENPacking {
+    static constexpr std::size_t kGroupSamples = 4;
+    static constexpr std::size_t kGroupBytes = Bits / 2;
+    // Every group is written and read with 8 bytes accesses, so buffers
+    // need these many bytes after the last group.
+    static constexpr std::size_t kPadding = sizeof(uint64_t) - kGroupBytes;
+    static constexpr uint64_t kMask = (1ull << Bits) - 1;
+
+    // Bytes needed for n samples, without padding.
+    static constexpr std::size_t packedSize(const std::size_t& n) noexcept {
+        return (n + kGroupSamples - 1) / kGroupSamples * kGroupBytes;
+    }
+
+    // Packs in into out. out needs packedSize(in.size()) + kPadding bytes.
+    // The padding bytes are overwritten with zeros, so consecutive blocks
+    // have to be packed in order.
+    static void pack(std::span<const uint16_t> in, uint8_t* out,
+                     const uint32_t& shift = 0) noexcept {
+        const std::size_t num_groups = in.size() / kGroupSamples;
+        const uint16_t* src = in.data();
+        for (std::size_t g = 0; g < num_groups; g++, src += kGroupSamples) {
+            const uint64_t word = (static_cast<uint64_t>(src[0] >> shift) & kMask)
+                | ((static_cast<uint64_t>(src[1] >> shift) & kMask) << Bits)
+                | ((static_cast<uint64_t>(src[2] >> shift) & kMask) << 2*Bits)
+                | ((static_cast<uint64_t>(src[3] >> shift) & kMask) << 3*Bits);
+            std::memcpy(out + g*kGroupBytes, &word, sizeof(word));
+        }
+
+        // Last group padded with zeros
+        const std::size_t tail = in.size() - num_groups*kGroupSamples;
+        if (tail > 0) {
+            uint64_t word = 0;
+            for (std::size_t i = 0; i < tail; i++) {
+                word |= (static_cast<uint64_t>(src[i] >> shift) & kMask) << i*Bits;
+            }
+            std::memcpy(out + num_groups*kGroupBytes, &word, sizeof(word));
+        }
+    }
+
+    // Unpacks out.size() samples from in. in needs
+    // packedSize(out.size()) + kPadding readable bytes.
+    static void unpack(const uint8_t* in, std::span<uint16_t> out,
+                       const uint32_t& shift = 0) noexcept {
+        const std::size_t num_groups = out.size() / kGroupSamples;
+        uint16_t* dst = out.data();
+        for (std::size_t g = 0; g < num_groups; g++, dst += kGroupSamples) {
+            uint64_t word;
+            std::memcpy(&word, in + g*kGroupBytes, sizeof(word));
+            dst[0] = static_cast<uint16_t>((word & kMask) << shift);
+            dst[1] = static_cast<uint16_t>(((word >> Bits) & kMask) << shift);
+            dst[2] = static_cast<uint16_t>(((word >> 2*Bits) & kMask) << shift);
+            dst[3] = static_cast<uint16_t>(((word >> 3*Bits) & kMask) << shift);
+        }
+
+        const std::size_t tail = out.size() - num_groups*kGroupSamples;
+        if (tail > 0) {
+            uint64_t word;
+            std::memcpy(&word, in + num_groups*kGroupBytes, sizeof(word));
+            for (std::size_t i = 0; i < tail; i++) {
+                dst[i] = static_cast<uint16_t>(((word >> i*Bits) & kMask) << shift);
+            }
+        }
+    }
+};
+
+// Same as CAENWaveforms but the samples are stored bit packed with Bits
+// bits per sample. Use 12 for x740 and 14 for x730 to keep the full ADC
+// resolution, or 8 to keep only the 8 most significant bits.
+//
+// Channels are packed one after the other so a single channel can be
+// unpacked on demand as uint16_t.
+template<uint32_t Bits, typename Allocator = std::allocator<uint8_t>>
+class CAENPackedWaveforms {
+    using Packing = CAENPacking<Bits>;
+
+    std::vector<std::size_t> _en_chs = {};
+    std::size_t _num_en_chs = 0;
+    uint32_t _record_length = 0;
+    // Bits dropped from each sample when the ADC has more than Bits bits
+    uint32_t _shift = 0;
+    // Packed bytes per channel
+    std::size_t _channel_bytes = 0;
+    CAEN_DGTZ_EventInfo_t _info = CAEN_DGTZ_EventInfo_t{};
+    // All channels packed, plus the padding needed by CAENPacking
+    std::vector<uint8_t, Allocator> _data;
+
+ public:
+    using allocator_type = Allocator;
+    static constexpr uint32_t kBits = Bits;
+
+    CAENPackedWaveforms() = default;
+    CAENPackedWaveforms(const CAENDigitizerModelConstants& model_constants,
+                        const CAENGlobalConfig& gp_config,
+                        const std::array<CAENGroupConfig, 8>& groups,
+                        const Allocator& alloc = Allocator()) :
+            _en_chs{get_enabled_channels(model_constants, groups)},
+            _num_en_chs{_en_chs.size()},
+            _record_length{gp_config.RecordLength},
+            _shift{model_constants.ADCResolution > Bits ?
+                model_constants.ADCResolution - Bits : 0},
+            _channel_bytes{Packing::packedSize(_record_length)},
+            _data(_num_en_chs*_channel_bytes + Packing::kPadding, alloc)
+    { }
+
+    // Holds only the enabled channels listed in channels (CAEN numbers),
+    // the others are skipped when copying from a CAENEvent. Empty channels
+    // holds all of them.
+    CAENPackedWaveforms(const CAENDigitizerModelConstants& model_constants,
+                        const CAENGlobalConfig& gp_config,
+                        const std::array<CAENGroupConfig, 8>& groups,
+                        const std::vector<std::size_t>& channels,
+                        const Allocator& alloc = Allocator()) :
+            _en_chs{select_channels(get_enabled_channels(model_constants, groups),
+                                    channels)},
+            _num_en_chs{_en_chs.size()},
+            _record_length{gp_config.RecordLength},
+            _shift{model_constants.ADCResolution > Bits ?
+                model_constants.ADCResolution - Bits : 0},
+            _channel_bytes{Packing::packedSize(_record_length)},
+            _data(_num_en_chs*_channel_bytes + Packing::kPadding, alloc)
+    { }
+
+    const uint32_t& getRecordLength() const {
+        return _record_length;
+    }
+    // In samples
+    std::size_t getTotalSize() const {
+        return _num_en_chs*_record_length;
+    }
+    // In bytes, what this event takes in memory
+    std::size_t getPackedSize() const {
+        return _data.size();
+    }
+    const std::size_t& getNumEnabledChannels() const {
+        return _num_en_chs;
+    }
+    const std::vector<std::size_t>& getEnabledChannels() const {
+        return _en_chs;
+    }
+    const CAEN_DGTZ_EventInfo_t& getInfo() const {
+        return _info;
+    }
+    // Least significant bits dropped from each sample
+    const uint32_t& getShift() const {
+        return _shift;
+    }
+
+    // Packs event into the internal buffer.
+    // Does not copy if record length does not match the size
+    void copy(const std::unique_ptr<CAENEvent>& event) noexcept {
+        const CAEN_DGTZ_UINT16_EVENT_t* data = event->getData();
+
+        if (data->ChSize[0] != _record_length) {
+            return;
+        }
+
+        _info = event->getInfo();
+        for (std::size_t ch_index = 0; ch_index < _num_en_chs; ch_index++) {
+            const auto& en_ch = _en_chs[ch_index];
+            const auto ch_size = std::min<std::size_t>(data->ChSize[en_ch],
+                                                       _record_length);
+            Packing::pack(std::span<const uint16_t>(data->DataChannel[en_ch], ch_size),
+                          _data.data() + ch_index*_channel_bytes, _shift);
+        }
+    }
+
+    // Packs a decoded event. Does not copy if both waveforms do not match
+    // in enabled channels or record length.
+    template<typename OtherAllocator>
+    void copy(const CAENWaveforms<uint16_t, OtherAllocator>& other) noexcept {
+        if (other.getEnabledChannels() != _en_chs
+            or other.getRecordLength() != _record_length) {
+            return;
+        }
+
+        _info = other.getInfo();
+        for (std::size_t ch_index = 0; ch_index < _num_en_chs; ch_index++) {
+            Packing::pack(other.getChannel(ch_index),
+                          _data.data() + ch_index*_channel_bytes, _shift);
+        }
+    }
+
+    // Unpacks channel index ch_index (the position in getEnabledChannels())
+    // into out, which must hold at least the record length.
+    // Returns the part of out that was written.
+    std::span<const uint16_t> getChannel(const std::size_t& ch_index,
+                                         std::span<uint16_t> out) const noexcept {
+        const auto n = std::min<std::size_t>(out.size(), _record_length);
+        Packing::unpack(_data.data() + ch_index*_channel_bytes,
+                        out.first(n), _shift);
+        return out.first(n);
+    }
+
+    // Returns the data of channel index ch_index
+    std::vector<uint16_t> get(const std::size_t& ch_index) const {
+        std::vector<uint16_t> out(_record_length);
+        getChannel(ch_index, out);
+        return out;
+    }
+
+    // Unpacks all channels as [channel, sample]. out must hold at least
+    // getTotalSize() samples.
+    void unpack(std::span<uint16_t> out) const noexcept {
+        if (out.size() < getTotalSize()) {
+            return;
+        }
+        for (std::size_t ch_index = 0; ch_index < _num_en_chs; ch_index++) {
+            getChannel(ch_index, out.subspan(ch_index*_record_length,
+                                             _record_length));
+        }
+    }
+
+    [[nodiscard]] std::span<const uint8_t> getPackedData() const noexcept {
+        return std::span(_data.data(), _data.size());
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,260 @@
+/*
+    Pile-up helpers
+    Description: Counts the pulses of each decoded channel with a
+    derivative and threshold discriminator, so events where more than one
+    pulse lands in the same record (which spoils charge integration) can be
+    flagged or dropped downstream.
+
+    CAEN counts the pulses while it copies the decoded samples out of the
+    CAEN event (see CAEN::EnablePileUpDetection), so they are read once,
+    and stores the counts next to the event metadata, see
+    CAENEventInfoTable::pulses(...).
+*/
+
+#ifndef RD_PILEUP_HELPERS_H
+#define RD_PILEUP_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RD_PILEUP_SSE2 1
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+namespace detail {
+
+// Pulse counting state carried from one block of samples to the next
+struct PileUpScan {
+    uint32_t Pulses = 0;
+    // Position of the last pulse counted, valid if Pulses > 0
+    std::size_t Last = 0;
+    // The derivative was over threshold at the previous sample
+    bool Over = false;
+};
+
+// Counts the pulse at pos unless it is within holdoff of the last one
+inline void pileup_count(PileUpScan& scan, const std::size_t& pos,
+                         const uint32_t& holdoff) noexcept {
+    if (scan.Pulses == 0 or pos - scan.Last >= holdoff) {
+        scan.Pulses++;
+        scan.Last = pos;
+    }
+}
+
+// Scalar version of count_pulses, also does the tails. Starts at i.
+template<bool Negative>
+inline void count_pulses_scalar(const uint16_t* x, std::size_t i, const std::size_t& n,
+                                const std::size_t& rise, const uint16_t& threshold,
+                                const uint32_t& holdoff, PileUpScan& scan) noexcept {
+    for (; i < n; i++) {
+        const int32_t step = Negative ? x[i - rise] - x[i] : x[i] - x[i - rise];
+        const bool over = step > threshold;
+        if (over and not scan.Over) {
+            pileup_count(scan, i, holdoff);
+        }
+        scan.Over = over;
+    }
+}
+
+// Number of times x[i] - x[i - rise] (x[i - rise] - x[i] if Negative)
+// goes over threshold, ignoring the ones within holdoff samples of the
+// last pulse counted.
+// If Copy, x is also copied to dst (n samples) in the same pass.
+template<bool Negative, bool Copy = false>
+inline uint32_t count_pulses(const uint16_t* x, const std::size_t& n,
+                             const std::size_t& rise, const uint16_t& threshold,
+                             const uint32_t& holdoff, uint16_t* dst = nullptr) noexcept {
+    PileUpScan scan;
+    if (n <= rise) {
+        if constexpr (Copy) {
+            std::copy_n(x, n, dst);
+        }
+        return 0;
+    }
+    if constexpr (Copy) {
+        std::copy_n(x, rise, dst);
+    }
+    std::size_t i = rise;
+#ifdef RD_PILEUP_SSE2
+    // a - b > threshold without overflow for any uint16_t:
+    // subs(subs(a, b), threshold) != 0.
+    const __m128i thr = _mm_set1_epi16(static_cast<short>(threshold));
+    const __m128i zero = _mm_setzero_si128();
+    // Not zero where the derivative is over threshold, 8 samples from at
+    auto excess = [&](const std::size_t& at) {
+        const __m128i now = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + at));
+        const __m128i before = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(x + at - rise));
+        if constexpr (Copy) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + at), now);
+        }
+        const __m128i step = Negative ? _mm_subs_epu16(before, now) :
+                                        _mm_subs_epu16(now, before);
+        return _mm_subs_epu16(step, thr);
+    };
+    // One bit per sample of a and b, set where over threshold
+    auto over_mask = [&](const __m128i& a, const __m128i& b) -> uint32_t {
+        return ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(
+            _mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero)))) & 0xFFFF;
+    };
+    // Counts the rising edges of the width samples of over, from at
+    auto count_edges = [&](const std::size_t& at, const uint32_t& over,
+                           const uint32_t& width) {
+        uint32_t edges = over & ~(over << 1 | static_cast<uint32_t>(scan.Over));
+        scan.Over = (over >> (width - 1)) & 1;
+        for (; edges != 0; edges &= edges - 1) {
+            pileup_count(scan, at + std::countr_zero(edges), holdoff);
+        }
+    };
+
+    // 32 samples per step. Most of them have nothing over threshold and
+    // are done after a single test.
+    for (const std::size_t full = rise + (n - rise) / 32 * 32; i < full; i += 32) {
+        const __m128i e0 = excess(i), e1 = excess(i + 8);
+        const __m128i e2 = excess(i + 16), e3 = excess(i + 24);
+        const __m128i any = _mm_or_si128(_mm_or_si128(e0, e1), _mm_or_si128(e2, e3));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(any, zero)) == 0xFFFF) {
+            scan.Over = false;
+            continue;
+        }
+        count_edges(i, over_mask(e0, e1) | over_mask(e2, e3) << 16, 32);
+    }
+    if (n - i >= 16) {
+        count_edges(i, over_mask(excess(i), excess(i + 8)), 16);
+        i += 16;
+    }
+#endif
+    if constexpr (Copy) {
+        std::copy(x + i, x + n, dst + i);
+    }
+    count_pulses_scalar<Negative>(x, i, n, rise, threshold, holdoff, scan);
+    return scan.Pulses;
+}
+
+}  // namespace detail
+
+struct CAENPileUpConfig {
+    // Samples between the two points of the derivative, about the rise
+    // time of the pulses. Longer is less sensitive to noise but merges
+    // pulses closer than this.
+    uint32_t RiseSamples = 4;
+    // ADC counts the signal has to move in RiseSamples to start a pulse.
+    // Measured from the signal itself, so a pulse on the tail of another
+    // one still counts.
+    uint32_t Threshold = 50;
+    // Samples after the start of a pulse during which the discriminator
+    // can not start another one (ringing, noise on the rising edge)
+    uint32_t Holdoff = 8;
+    // true -> pulses go below the baseline (most PMT/SiPM signals)
+    // false -> pulses go above the baseline
+    bool NegativePolarity = true;
+};
+
+struct CAENPileUpStats {
+    // Events processed
+    uint64_t Events = 0;
+    // Events with more than one pulse in any channel
+    uint64_t PileUpEvents = 0;
+    // Pulses in all the channels of all the events
+    uint64_t Pulses = 0;
+};
+
+// Counts the pulses of every channel of an event. A channel with more
+// than one pulse is piled up.
+class CAENPileUpDetector {
+    CAENPileUpConfig _config;
+    CAENPileUpStats _stats;
+
+ public:
+    // Throws std::invalid_argument if nothing would ever be counted
+    explicit CAENPileUpDetector(const CAENPileUpConfig& config) :
+        _config{config}
+    {
+        if (_config.RiseSamples == 0) {
+            throw std::invalid_argument("Pile-up detection needs RiseSamples of "
+                                        "at least 1.");
+        }
+        if (_config.Threshold == 0 or _config.Threshold >= 0xFFFF) {
+            throw std::invalid_argument("Pile-up detection needs a Threshold "
+                                        "between 1 and 65534 ADC counts.");
+        }
+    }
+
+    const CAENPileUpConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    uint32_t countPulses(std::span<const uint16_t> samples) const noexcept {
+        const auto thr = static_cast<uint16_t>(_config.Threshold);
+        if (_config.NegativePolarity) {
+            return detail::count_pulses<true>(samples.data(), samples.size(),
+                _config.RiseSamples, thr, _config.Holdoff);
+        }
+        return detail::count_pulses<false>(samples.data(), samples.size(),
+            _config.RiseSamples, thr, _config.Holdoff);
+    }
+
+    // Same as countPulses(samples), also copying samples to dst in the
+    // same pass. dst must hold samples.size() values.
+    uint32_t copyAndCountPulses(std::span<const uint16_t> samples,
+                                uint16_t* dst) const noexcept {
+        const auto thr = static_cast<uint16_t>(_config.Threshold);
+        if (_config.NegativePolarity) {
+            return detail::count_pulses<true, true>(samples.data(), samples.size(),
+                _config.RiseSamples, thr, _config.Holdoff, dst);
+        }
+        return detail::count_pulses<false, true>(samples.data(), samples.size(),
+            _config.RiseSamples, thr, _config.Holdoff, dst);
+    }
+
+    // Adds the pulses of each channel of an event to the stats. Returns
+    // the number of piled up channels.
+    uint32_t record(std::span<const uint32_t> pulses) noexcept {
+        uint32_t piled_up = 0;
+        for (const auto& n : pulses) {
+            piled_up += n > 1;
+            _stats.Pulses += n;
+        }
+        _stats.Events++;
+        _stats.PileUpEvents += piled_up > 0;
+        return piled_up;
+    }
+
+    // Writes the pulses of each channel of event into pulses, by channel
+    // index, and updates the stats. pulses must hold
+    // event.getNumEnabledChannels() values. Returns the number of piled
+    // up channels.
+    template<typename Waveforms>
+    uint32_t process(const Waveforms& event, std::span<uint32_t> pulses) noexcept {
+        const std::size_t num_channels = event.getNumEnabledChannels();
+        for (std::size_t ch = 0; ch < num_channels; ch++) {
+            pulses[ch] = countPulses(event.getChannel(ch));
+        }
+        return record(pulses.first(num_channels));
+    }
+
+    const CAENPileUpStats& getStats() const noexcept {
+        return _stats;
+    }
+
+    void resetStats() noexcept {
+        _stats = {};
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,425 @@
+/*
+    Pipeline helpers
+    Description: A bounded queue of CAENBatch between the readout and the
+    consumers. When the consumers fall behind, a backpressure policy
+    decides what is lost (readout stalls, oldest batches, samples or a
+    fraction of the events) and every loss is counted, instead of the
+    board silently dropping triggers once its memory is full.
+
+    CAENReadoutThread drains a CAEN into a CAENPipeline from its own
+    thread.
+*/
+
+#ifndef RD_PIPELINE_HELPERS_H
+#define RD_PIPELINE_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "batch_helpers.hpp"
+
+namespace RedDigitizer {
+
+enum class CAENBackpressurePolicy {
+    // The readout waits for a free buffer. Nothing is lost in software,
+    // but the board keeps filling and drops triggers once it is full.
+    Block,
+    // The oldest batch waiting in the queue is dropped to make room.
+    DropOldest,
+    // Above HighWater, batches keep only the event info. Their buffers are
+    // small so many more of them can wait in the queue.
+    DropWaveforms,
+    // Above HighWater, only one out of PrescaleFactor events is kept.
+    Prescale
+};
+
+struct CAENPipelineConfig {
+    CAENBackpressurePolicy Policy = CAENBackpressurePolicy::Block;
+
+    // Buffers with waveforms
+    std::size_t NumBuffers = 8;
+    // Events per buffer
+    uint32_t BatchCapacity = 1024;
+
+    // DropWaveforms and Prescale only. Fraction of NumBuffers in use
+    // (queued or held by consumers) from which the policy kicks in.
+    double HighWater = 0.5;
+    // DropWaveforms only. Buffers that hold only the event info.
+    std::size_t NumMetadataBuffers = 64;
+    // Prescale only. 1 out of PrescaleFactor events is kept.
+    uint32_t PrescaleFactor = 10;
+};
+
+// Every event pushed ends up in exactly one of EventsQueued,
+// DroppedOldest, DroppedPrescale or DroppedOverflow. WaveformsDropped is
+// part of EventsQueued.
+struct CAENPipelineStats {
+    uint64_t EventsPushed = 0;
+    // Events delivered or still waiting in the queue
+    uint64_t EventsQueued = 0;
+    uint64_t BatchesQueued = 0;
+    uint64_t BatchesPopped = 0;
+
+    // Events queued without their samples (DropWaveforms)
+    uint64_t WaveformsDropped = 0;
+    // Events of queued batches dropped to make room (DropOldest)
+    uint64_t DroppedOldest = 0;
+    // Events left out by the prescale (Prescale), and events skipped
+    // because they did not match the batch geometry
+    uint64_t DroppedPrescale = 0;
+    // Events dropped because there was no buffer at all
+    uint64_t DroppedOverflow = 0;
+
+    // Time the readout spent waiting for a buffer, in seconds (Block)
+    double BlockedSeconds = 0.0;
+    // Times the readout had to wait (Block)
+    uint64_t BlockEpisodes = 0;
+
+    std::size_t QueueDepth = 0;
+    std::size_t MaxQueueDepth = 0;
+};
+
+// One producer pushes lists of decoded events, any number of consumers pop
+// batches. Buffers come from fixed pools, so nothing is allocated after
+// construction. A popped batch goes back to its pool when its handle is
+// released.
+class CAENPipeline {
+    using clock = std::chrono::steady_clock;
+
+    CAENPipelineConfig _config;
+    std::shared_ptr<CAENBatchPool> _pool;
+    std::shared_ptr<CAENBatchPool> _metadata_pool;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    // Ring of NumBuffers + NumMetadataBuffers handles
+    std::vector<CAENBatchHandle> _queue;
+    std::size_t _head = 0;
+    std::size_t _size = 0;
+    bool _closed = false;
+    uint64_t _sequence = 0;
+    // Events pushed so far, the prescale phase of the next one. Only
+    // touched by the producer.
+    uint64_t _prescale_counter = 0;
+
+    CAENPipelineStats _stats;
+
+    // Buffers with waveforms in use before the policy kicks in
+    std::size_t _high_water = 0;
+
+    bool _congested() {
+        return _pool->size() - _pool->available() >= _high_water;
+    }
+
+    // Caller holds _mtx
+    void _enqueue(CAENBatchHandle&& handle) {
+        handle->Sequence = _sequence++;
+        _stats.EventsQueued += handle->NumEvents;
+        _stats.BatchesQueued++;
+        if (not handle->HasWaveforms) {
+            _stats.WaveformsDropped += handle->NumEvents;
+        }
+        _queue[(_head + _size) % _queue.size()] = std::move(handle);
+        _size++;
+        _stats.MaxQueueDepth = std::max(_stats.MaxQueueDepth, _size);
+    }
+
+    // Caller holds _mtx
+    CAENBatchHandle _dequeue() {
+        auto handle = std::move(_queue[_head]);
+        _head = (_head + 1) % _queue.size();
+        _size--;
+        return handle;
+    }
+
+    // A buffer for the next batch following the policy, or an empty handle
+    // if the events have to be dropped. Sets prescale and copy_waveforms.
+    CAENBatchHandle _get_buffer(uint32_t& prescale, bool& copy_waveforms) {
+        prescale = 1;
+        copy_waveforms = true;
+
+        switch (_config.Policy) {
+        case CAENBackpressurePolicy::Block: {
+            auto handle = _pool->acquire();
+            if (handle) {
+                return handle;
+            }
+
+            const auto start = clock::now();
+            while (not handle) {
+                {
+                    std::lock_guard<std::mutex> lock(_mtx);
+                    if (_closed) {
+                        break;
+                    }
+                }
+                handle = _pool->acquireFor(std::chrono::milliseconds(10));
+            }
+            const std::chrono::duration<double> blocked = clock::now() - start;
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stats.BlockedSeconds += blocked.count();
+            _stats.BlockEpisodes++;
+            return handle;
+        }
+        case CAENBackpressurePolicy::DropOldest: {
+            auto handle = _pool->acquire();
+            if (handle) {
+                return handle;
+            }
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_size == 0) {
+                // Every buffer is held by a consumer
+                return handle;
+            }
+            handle = _dequeue();
+            _stats.EventsQueued -= handle->NumEvents;
+            _stats.DroppedOldest += handle->NumEvents;
+            return handle;
+        }
+        case CAENBackpressurePolicy::DropWaveforms:
+            if (_congested()) {
+                copy_waveforms = false;
+                return _metadata_pool->acquire();
+            }
+            return _pool->acquire();
+        case CAENBackpressurePolicy::Prescale:
+            if (_congested()) {
+                prescale = _config.PrescaleFactor;
+            }
+            return _pool->acquire();
+        }
+        return CAENBatchHandle{};
+    }
+
+ public:
+    // num_channels and record_length are the geometry of the events that
+    // will be pushed.
+    CAENPipeline(const CAENPipelineConfig& config,
+                 const uint32_t& num_channels,
+                 const uint32_t& record_length) :
+        _config{config}
+    {
+        if (_config.NumBuffers == 0 or _config.BatchCapacity == 0) {
+            throw std::invalid_argument("Pipeline needs at least one buffer "
+                                        "and a positive batch capacity.");
+        }
+        if (_config.Policy == CAENBackpressurePolicy::Prescale
+            and _config.PrescaleFactor == 0) {
+            throw std::invalid_argument("Prescale factor must be positive.");
+        }
+
+        _pool = CAENBatchPool::create(_config.NumBuffers, _config.BatchCapacity,
+                                      num_channels, record_length);
+        std::size_t num_metadata = 0;
+        if (_config.Policy == CAENBackpressurePolicy::DropWaveforms) {
+            num_metadata = _config.NumMetadataBuffers;
+            _metadata_pool = CAENBatchPool::create(num_metadata, _config.BatchCapacity,
+                                                   num_channels, record_length, false);
+        }
+        _queue.resize(_config.NumBuffers + num_metadata);
+
+        const double high_water = std::clamp(_config.HighWater, 0.0, 1.0);
+        _high_water = std::max<std::size_t>(1, static_cast<std::size_t>(
+            high_water*_config.NumBuffers + 0.5));
+    }
+
+    CAENPipeline(const CAENPipeline&) = delete;
+    CAENPipeline& operator=(const CAENPipeline&) = delete;
+
+    ~CAENPipeline() {
+        close();
+    }
+
+    const CAENPipelineConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    // Producer side. Copies events into batches and queues them following
+    // the policy. Only blocks with CAENBackpressurePolicy::Block. Call it
+    // from one thread.
+    // Returns false if the pipeline is closed.
+    template<typename WaveformsPtr>
+    bool push(std::span<const WaveformsPtr> events) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_closed) {
+                return false;
+            }
+            _stats.EventsPushed += events.size();
+        }
+
+        while (not events.empty()) {
+            uint32_t prescale = 1;
+            bool copy_waveforms = true;
+            auto handle = _get_buffer(prescale, copy_waveforms);
+            if (not handle) {
+                std::lock_guard<std::mutex> lock(_mtx);
+                // Whatever is left cannot be stored
+                if (not _closed) {
+                    _stats.DroppedOverflow += events.size();
+                }
+                break;
+            }
+
+            const std::size_t consumed = handle->fill(events, prescale, copy_waveforms,
+                                                      _prescale_counter);
+            _prescale_counter += consumed;
+            events = events.subspan(consumed);
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                if (_closed) {
+                    return false;
+                }
+                _stats.DroppedPrescale += consumed - handle->NumEvents;
+                if (handle->NumEvents > 0) {
+                    _enqueue(std::move(handle));
+                }
+            }
+            _cv.notify_one();
+        }
+        return true;
+    }
+
+    // Consumer side. Waits up to timeout for a batch. Returns an empty
+    // handle on timeout, or when the pipeline is closed and empty.
+    template<typename Rep, typename Period>
+    CAENBatchHandle pop(const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (not _cv.wait_for(lock, timeout, [this]() { return _size > 0 or _closed; })
+            or _size == 0) {
+            return CAENBatchHandle{};
+        }
+        _stats.BatchesPopped++;
+        return _dequeue();
+    }
+
+    // Returns an empty handle if nothing is queued
+    CAENBatchHandle tryPop() {
+        return pop(std::chrono::seconds(0));
+    }
+
+    // Stops accepting events and wakes up everyone waiting. Batches already
+    // queued can still be popped.
+    void close() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _closed = true;
+        }
+        _cv.notify_all();
+    }
+
+    bool isClosed() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _closed;
+    }
+
+    // True once closed and every queued batch was popped
+    bool isDone() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _closed and _size == 0;
+    }
+
+    CAENPipelineStats getStats() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto out = _stats;
+        out.QueueDepth = _size;
+        return out;
+    }
+};
+
+// Runs the readout of a CAEN into a CAENPipeline: waits for n events,
+// decodes them and pushes them, until stopped or the digitizer reports an
+// error. The pipeline is closed when the thread ends.
+//
+// While it runs, the thread owns the readout of caen: do not call
+// RetrieveData*, DecodeEvent(s) or GetWaveform(s) from anywhere else.
+template<typename CAENType>
+class CAENReadoutThread {
+    std::shared_ptr<CAENType> _caen;
+    std::shared_ptr<CAENPipeline> _pipeline;
+    uint32_t _n = 1;
+    std::chrono::duration<double> _poll_interval;
+
+    std::atomic<bool> _running = true;
+    std::thread _thread;
+
+    void _loop() {
+        while (_running.load(std::memory_order_relaxed)) {
+            if (_caen->RetrieveDataUntilNEvents(_n)) {
+                _caen->DecodeEvents();
+                if (not _pipeline->push(_caen->GetWaveformsView())) {
+                    break;
+                }
+                continue;
+            }
+
+            if (_caen->HasError()) {
+                break;
+            }
+            std::this_thread::sleep_for(_poll_interval);
+        }
+        _running.store(false, std::memory_order_relaxed);
+        _pipeline->close();
+    }
+
+ public:
+    // poll_interval is the wait, in seconds, when fewer than n events are
+    // in the board.
+    CAENReadoutThread(std::shared_ptr<CAENType> caen,
+                      std::shared_ptr<CAENPipeline> pipeline,
+                      const uint32_t& n, const double& poll_interval = 1e-3) :
+        _caen{std::move(caen)},
+        _pipeline{std::move(pipeline)},
+        _n{std::max<uint32_t>(n, 1)},
+        _poll_interval{std::max(poll_interval, 0.0)}
+    {
+        if (not _caen or not _pipeline) {
+            throw std::invalid_argument("Readout thread needs a CAEN and a pipeline.");
+        }
+        _thread = std::thread(&CAENReadoutThread::_loop, this);
+    }
+
+    CAENReadoutThread(const CAENReadoutThread&) = delete;
+    CAENReadoutThread& operator=(const CAENReadoutThread&) = delete;
+
+    ~CAENReadoutThread() {
+        stop();
+    }
+
+    // Stops and joins the thread, closing the pipeline. Safe to call more
+    // than once.
+    void stop() noexcept {
+        _running.store(false, std::memory_order_relaxed);
+        _pipeline->close();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    bool isRunning() const noexcept {
+        return _running.load(std::memory_order_relaxed);
+    }
+
+    const std::shared_ptr<CAENPipeline>& getPipeline() const noexcept {
+        return _pipeline;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
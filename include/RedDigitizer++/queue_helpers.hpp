@@ -0,0 +1,403 @@
+/*
+    Queue helpers
+    Description: Bounded lock-free queues to hand batches (or any movable
+    handle: CAENBatchHandle, a unique_ptr to a table, ...) between the
+    readout, decode, analysis and writer threads.
+
+    CAENSPSCQueue has one producer and one consumer, CAENMPMCQueue any
+    number of both. The indices each side writes live in their own cache
+    line so the two sides do not fight over it.
+
+    The wait strategy decides what a blocking push/pop does while the
+    queue is full/empty: Spin keeps the core busy (lowest latency), Yield
+    gives the core away between checks and Futex sleeps in the kernel
+    until the other side wakes it (std::atomic::wait, a futex on Linux).
+    Waking only costs a syscall if someone is actually sleeping.
+*/
+
+#ifndef RD_QUEUE_HELPERS_H
+#define RD_QUEUE_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+// C++ 3rd party includes
+// my includes
+#include "batch_helpers.hpp"
+
+namespace RedDigitizer {
+
+constexpr std::size_t kCacheLineSize = 64;
+
+enum class CAENWaitStrategy {
+    // Busy loop with a pause instruction. Burns a core per waiting thread.
+    Spin,
+    // Spins for a short while then calls std::this_thread::yield().
+    Yield,
+    // Spins for a short while then sleeps until notified.
+    Futex
+};
+
+namespace detail {
+
+// Spin iterations before yielding or sleeping
+constexpr uint32_t kQueueSpinTries = 128;
+
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+inline std::size_t round_up_pow2(const std::size_t& x) noexcept {
+    std::size_t out = 2;
+    while (out < x) {
+        out <<= 1;
+    }
+    return out;
+}
+
+// Where one side of a queue waits for the other. A waiter raises
+// _sleeping before going to sleep and the first notify() after that
+// clears it and wakes everyone, so notify() is a fence and a load while
+// nobody sleeps and a producer does not pay a syscall per item while the
+// consumer is still waking up.
+class alignas(kCacheLineSize) QueueWaitPoint {
+    std::atomic<uint32_t> _epoch = 0;
+    std::atomic<bool> _sleeping = false;
+
+ public:
+    // Returns once ready() is true.
+    template<CAENWaitStrategy Wait, typename Ready>
+    void waitUntil(Ready&& ready) {
+        for (uint32_t i = 0; not ready(); i++) {
+            if (Wait == CAENWaitStrategy::Spin or i < kQueueSpinTries) {
+                cpu_relax();
+            } else if constexpr (Wait == CAENWaitStrategy::Yield) {
+                std::this_thread::yield();
+            } else {
+                const uint32_t epoch = _epoch.load(std::memory_order_acquire);
+                _sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (not ready()) {
+                    _epoch.wait(epoch, std::memory_order_acquire);
+                }
+            }
+        }
+    }
+
+    // Call after making ready() true for a waiter.
+    template<CAENWaitStrategy Wait>
+    void notify() noexcept {
+        if constexpr (Wait == CAENWaitStrategy::Futex) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed)
+                and _sleeping.exchange(false, std::memory_order_relaxed)) {
+                wakeAll();
+            }
+        }
+    }
+
+    void wakeAll() noexcept {
+        _epoch.fetch_add(1, std::memory_order_release);
+        _epoch.notify_all();
+    }
+};
+
+}  // namespace detail
+
+// Single producer, single consumer bounded queue. Capacity is rounded up
+// to a power of two. T has to be default constructible and nothrow
+// movable; a popped slot is left moved-from until it is reused.
+//
+// close() makes pushes fail and wakes every waiter. pop() keeps returning
+// what is left in the queue and then false.
+template<typename T, CAENWaitStrategy Wait = CAENWaitStrategy::Futex>
+class CAENSPSCQueue {
+    static_assert(std::is_default_constructible_v<T>
+                  and std::is_nothrow_move_assignable_v<T>,
+                  "CAENSPSCQueue items must be default constructible and nothrow movable");
+
+    const std::size_t _mask;
+    std::unique_ptr<T[]> _slots;
+
+    // Written by the consumer
+    alignas(kCacheLineSize) std::atomic<std::size_t> _head = 0;
+    // Consumer copy of _tail, avoids reading the producer line on every pop
+    std::size_t _cached_tail = 0;
+
+    // Written by the producer
+    alignas(kCacheLineSize) std::atomic<std::size_t> _tail = 0;
+    // Producer copy of _head
+    std::size_t _cached_head = 0;
+
+    alignas(kCacheLineSize) std::atomic<bool> _closed = false;
+    detail::QueueWaitPoint _not_empty;
+    detail::QueueWaitPoint _not_full;
+
+ public:
+    explicit CAENSPSCQueue(const std::size_t& capacity) :
+        _mask{detail::round_up_pow2(capacity) - 1},
+        _slots{std::make_unique<T[]>(_mask + 1)}
+    {
+        if (capacity == 0) {
+            throw std::invalid_argument("CAENSPSCQueue capacity must be above 0");
+        }
+    }
+
+    CAENSPSCQueue(const CAENSPSCQueue&) = delete;
+    CAENSPSCQueue& operator=(const CAENSPSCQueue&) = delete;
+
+    // Producer only. value is left untouched if it returns false.
+    bool tryPush(T&& value) noexcept {
+        const std::size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _cached_head > _mask) {
+            _cached_head = _head.load(std::memory_order_acquire);
+            if (tail - _cached_head > _mask) {
+                return false;
+            }
+        }
+        if (_closed.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        _slots[tail & _mask] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        _not_empty.template notify<Wait>();
+        return true;
+    }
+
+    // Consumer only
+    bool tryPop(T& out) noexcept {
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _cached_tail) {
+            _cached_tail = _tail.load(std::memory_order_acquire);
+            if (head == _cached_tail) {
+                return false;
+            }
+        }
+
+        out = std::move(_slots[head & _mask]);
+        _head.store(head + 1, std::memory_order_release);
+        _not_full.template notify<Wait>();
+        return true;
+    }
+
+    // Producer only. Waits for room, false if the queue was closed.
+    bool push(T&& value) {
+        bool pushed = false;
+        _not_full.template waitUntil<Wait>([&]() {
+            pushed = tryPush(std::move(value));
+            return pushed or _closed.load(std::memory_order_acquire);
+        });
+        return pushed;
+    }
+
+    // Consumer only. Waits for an item, false once the queue is closed
+    // and empty.
+    bool pop(T& out) {
+        bool popped = false;
+        _not_empty.template waitUntil<Wait>([&]() {
+            popped = tryPop(out);
+            return popped or _closed.load(std::memory_order_acquire);
+        });
+        // Anything pushed before close() is visible by now
+        return popped or tryPop(out);
+    }
+
+    void close() noexcept {
+        _closed.store(true, std::memory_order_release);
+        _not_empty.wakeAll();
+        _not_full.wakeAll();
+    }
+
+    bool isClosed() const noexcept {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+    // Approximate if the other side is running
+    std::size_t size() const noexcept {
+        return _tail.load(std::memory_order_acquire)
+            - _head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    std::size_t capacity() const noexcept {
+        return _mask + 1;
+    }
+};
+
+// Multi producer, multi consumer bounded queue (D. Vyukov). Each slot
+// has a sequence number that tells producers and consumers whose turn it
+// is, and sits in its own cache line. Same rules as CAENSPSCQueue.
+//
+// Producers should be done before close(): an item pushed at the same
+// time as close() can be left in the queue and is destroyed with it.
+template<typename T, CAENWaitStrategy Wait = CAENWaitStrategy::Futex>
+class CAENMPMCQueue {
+    static_assert(std::is_default_constructible_v<T>
+                  and std::is_nothrow_move_assignable_v<T>,
+                  "CAENMPMCQueue items must be default constructible and nothrow movable");
+
+    struct alignas(kCacheLineSize) Cell {
+        std::atomic<std::size_t> Sequence = 0;
+        T Value;
+    };
+
+    const std::size_t _mask;
+    std::unique_ptr<Cell[]> _cells;
+
+    alignas(kCacheLineSize) std::atomic<std::size_t> _enqueue_pos = 0;
+    alignas(kCacheLineSize) std::atomic<std::size_t> _dequeue_pos = 0;
+
+    alignas(kCacheLineSize) std::atomic<bool> _closed = false;
+    detail::QueueWaitPoint _not_empty;
+    detail::QueueWaitPoint _not_full;
+
+ public:
+    explicit CAENMPMCQueue(const std::size_t& capacity) :
+        _mask{detail::round_up_pow2(capacity) - 1},
+        _cells{std::make_unique<Cell[]>(_mask + 1)}
+    {
+        if (capacity == 0) {
+            throw std::invalid_argument("CAENMPMCQueue capacity must be above 0");
+        }
+        for (std::size_t i = 0; i <= _mask; i++) {
+            _cells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    CAENMPMCQueue(const CAENMPMCQueue&) = delete;
+    CAENMPMCQueue& operator=(const CAENMPMCQueue&) = delete;
+
+    // value is left untouched if it returns false.
+    bool tryPush(T&& value) noexcept {
+        if (_closed.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        Cell* cell = nullptr;
+        std::size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[pos & _mask];
+            const std::size_t seq = cell->Sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq)
+                - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->Value = std::move(value);
+        cell->Sequence.store(pos + 1, std::memory_order_release);
+        _not_empty.template notify<Wait>();
+        return true;
+    }
+
+    bool tryPop(T& out) noexcept {
+        Cell* cell = nullptr;
+        std::size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[pos & _mask];
+            const std::size_t seq = cell->Sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq)
+                - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        out = std::move(cell->Value);
+        cell->Sequence.store(pos + _mask + 1, std::memory_order_release);
+        _not_full.template notify<Wait>();
+        return true;
+    }
+
+    // Waits for room, false if the queue was closed.
+    bool push(T&& value) {
+        bool pushed = false;
+        _not_full.template waitUntil<Wait>([&]() {
+            pushed = tryPush(std::move(value));
+            return pushed or _closed.load(std::memory_order_acquire);
+        });
+        return pushed;
+    }
+
+    // Waits for an item, false once the queue is closed and empty.
+    bool pop(T& out) {
+        bool popped = false;
+        _not_empty.template waitUntil<Wait>([&]() {
+            popped = tryPop(out);
+            return popped or _closed.load(std::memory_order_acquire);
+        });
+        return popped or tryPop(out);
+    }
+
+    void close() noexcept {
+        _closed.store(true, std::memory_order_release);
+        _not_empty.wakeAll();
+        _not_full.wakeAll();
+    }
+
+    bool isClosed() const noexcept {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+    // Approximate if anyone else is running
+    std::size_t size() const noexcept {
+        const std::size_t head = _dequeue_pos.load(std::memory_order_acquire);
+        const std::size_t tail = _enqueue_pos.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    std::size_t capacity() const noexcept {
+        return _mask + 1;
+    }
+};
+
+// Queues of pooled batches between pipeline stages. Destroying a queue
+// gives whatever is still in it back to the pool.
+template<CAENWaitStrategy Wait = CAENWaitStrategy::Futex>
+using CAENBatchSPSCQueue = CAENSPSCQueue<CAENBatchHandle, Wait>;
+
+template<CAENWaitStrategy Wait = CAENWaitStrategy::Futex>
+using CAENBatchMPMCQueue = CAENMPMCQueue<CAENBatchHandle, Wait>;
+
+}  // namespace RedDigitizer
+
+#endif
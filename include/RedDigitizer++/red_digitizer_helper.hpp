@@ -24,6 +24,10 @@ T
 #include <stdexcept>
 #include <algorithm>
 #include <span>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <limits>
 
 // C++ 3rd party includes
 #include <CAENComm.h>
@@ -31,6 +35,16 @@ T
 
 // my includes
 #include "logger_helpers.hpp"
+#include "trigger_helpers.hpp"
+#include "shm_helpers.hpp"
+#include "memory_helpers.hpp"
+#include "table_helpers.hpp"
+#include "monitor_helpers.hpp"
+#include "routing_helpers.hpp"
+#include "layout_helpers.hpp"
+#include "coincidence_helpers.hpp"
+#include "pileup_helpers.hpp"
+#include "calibration_helpers.hpp"
 
 namespace RedDigitizer {
 
@@ -93,8 +107,12 @@ struct CAENDigitizerModelConstants {
     // Constant to transform Nloc to Recordlength
     float NLOCToRecordLength = 1.0f;
 
-    // Voltage ranges the digitizer has.
+    // Voltage ranges the digitizer has, in Vpp, indexed by
+    // CAENGroupConfig::DCRange.
     std::vector<double> VoltageRanges = {};
+
+    // Time of one count of the trigger time tag, in ns
+    double TriggerTimeTagLSB = 8.0;
 };
 
 // This is here so we can transform string to enums
@@ -123,7 +141,8 @@ const static inline std::unordered_map<CAENDigitizerModel, CAENDigitizerModelCon
             1,          // NumChannelsPerGroup
             1024,       // MaxNumBuffers
             10.0f,      // NLOCToRecordLength
-            {1.0}       // VoltageRanges
+            {1.0},      // VoltageRanges
+            8.0         // TriggerTimeTagLSB
         }},
         #endif
         {CAENDigitizerModel::DT5730B, CAENDigitizerModelConstants {
@@ -135,7 +154,8 @@ const static inline std::unordered_map<CAENDigitizerModel, CAENDigitizerModelCon
             8,          // NumChannelsPerGroup
             1024,       // MaxNumBuffers
             10.0f,      // NLOCToRecordLength
-            {0.5, 2.0}  // VoltageRanges
+            {2.0, 0.5}, // VoltageRanges
+            8.0         // TriggerTimeTagLSB
         }},
         {CAENDigitizerModel::DT5740D, CAENDigitizerModelConstants {
             12,         // ADCResolution
@@ -146,7 +166,8 @@ const static inline std::unordered_map<CAENDigitizerModel, CAENDigitizerModelCon
             8,          // NumberOfGroups
             1024,       // MaxNumBuffers
             1.5f,       // NLOCToRecordLength
-            {2.0, 10.0} // VoltageRanges
+            {2.0, 10.0},// VoltageRanges
+            8.0         // TriggerTimeTagLSB
         }},
         {CAENDigitizerModel::V1740D, CAENDigitizerModelConstants {
             12,         // ADCResolution
@@ -157,7 +178,8 @@ const static inline std::unordered_map<CAENDigitizerModel, CAENDigitizerModelCon
             8,          // NumberOfGroups
             1024,       // MaxNumBuffers
             1.5f,       // NLOCToRecordLength
-            {2.0}       // VoltageRanges
+            {2.0},      // VoltageRanges
+            8.0         // TriggerTimeTagLSB
         }}
     // This is a C++20 higher feature so lets keep everything 17 compliant
     // CAENDigitizerModelsConstants_map {
@@ -169,7 +191,7 @@ const static inline std::unordered_map<CAENDigitizerModel, CAENDigitizerModelCon
     //         .NumberOfGroups = 0,
     //         .NumChannelsPerGroup = 8,
     //         .NLOCToRecordLength = 10,
-    //         .VoltageRanges = {0.5, 2.0}
+    //         .VoltageRanges = {2.0, 0.5}
     //     }},
     //     {CAENDigitizerModel::DT5740D, CAENDigitizerModelConstants{
     //         .ADCResolution = 12,
@@ -443,28 +465,136 @@ class CAENEvent {
     }
 };
 
+// Gets a vector with the numbers of the channels as per CAEN specification.
+// Takes into account if the digitizer has groups or not.
+inline std::vector<std::size_t> get_enabled_channels(
+        const CAENDigitizerModelConstants& model_constants,
+        const std::array<CAENGroupConfig, 8>& groups) {
+    std::vector<std::size_t> out;
+    for(std::size_t group_num = 0; group_num < groups.size(); group_num++) {
+        const auto& group = groups[group_num];
+        if (not group.Enabled) {
+            continue;
+        }
+
+        // If the digitizer does not support groups, group_num = ch
+        if(model_constants.NumberOfGroups == 0) {
+            out.push_back(group_num);
+            continue;
+        }
+
+        // Othewise, calculate using the AcquisitionMask
+        for(std::size_t ch = 0; ch < model_constants.NumChannelsPerGroup; ch++) {
+            if(group.AcquisitionMask.at(ch)) {
+                out.push_back(ch + model_constants.NumChannelsPerGroup * group_num);
+            }
+        }
+    }
+    return out;
+}
+
+// Calibration of every channel from the data sheet: VoltageRanges[DCRange]
+// volts over 2^ADCResolution counts, with the DC offset DAC moving the
+// input window from [0, range] (0) to [-range, 0] (0xFFFF). Channels of
+// groups also have their baseline moved up by DCCorrections[ch] counts
+// if use_dc_corrections.
+inline CAENCalibrationTable make_nominal_calibration(
+        const CAENDigitizerModelConstants& model_constants,
+        const std::array<CAENGroupConfig, 8>& groups,
+        const bool& use_dc_corrections = true) {
+    CAENCalibrationTable out(model_constants.NumChannels);
+    const auto& ranges = model_constants.VoltageRanges;
+    const bool has_groups = model_constants.NumberOfGroups != 0;
+    const std::size_t per_group = std::max<std::size_t>(model_constants.NumChannelsPerGroup, 1);
+    for (std::size_t ch = 0; ch < out.size(); ch++) {
+        const std::size_t group_num = has_groups ? ch / per_group : ch;
+        if (group_num >= groups.size() or ranges.empty()) {
+            continue;
+        }
+        const auto& group = groups[group_num];
+        const double range = group.DCRange < ranges.size() ?
+            ranges[group.DCRange] : ranges.front();
+
+        CAENChannelCalibration calibration;
+        calibration.Gain = range / std::exp2(model_constants.ADCResolution);
+        calibration.Offset = -range*group.DCOffset / 0xFFFF;
+        if (has_groups and use_dc_corrections) {
+            calibration.Offset -= calibration.Gain*group.DCCorrections[ch % per_group];
+        }
+        out.set(ch, calibration);
+    }
+    return out;
+}
+
+// Keeps the channels of enabled (CAEN numbers) that are also in subset, in
+// enabled order. An empty subset keeps all of them.
+inline std::vector<std::size_t> select_channels(
+        const std::vector<std::size_t>& enabled,
+        const std::vector<std::size_t>& subset) {
+    if (subset.empty()) {
+        return enabled;
+    }
+
+    std::vector<std::size_t> out;
+    for (const auto& ch : enabled) {
+        if (std::find(subset.begin(), subset.end(), ch) != subset.end()) {
+            out.push_back(ch);
+        }
+    }
+    return out;
+}
+
 // CAENWaveforms is the final stage of the digitizer data. It is optional
 // and the benefit is that it provides a data format which lifetime is not
 // dependent on CAEN API.
 //
 // Default DataType is uint16_t, the other option is uint8_t if memory is a
-// priority in your implementation.
-template <typename DataType = uint16_t>
-//requires std::is_same_v<DataType, uint16_t> or std::is_same_v<DataType, uint8_t>
+// priority in your implementation. uint8_t keeps the 8 most significant
+// bits of the ADC. For 12 and 14 bits packing see CAENPackedWaveforms.
+// Allocator is used for the samples buffer, see CAENArenaAllocator for
+// huge pages backed storage.
+template <typename DataType = uint16_t,
+          typename Allocator = std::allocator<DataType>>
+requires std::is_same_v<DataType, uint16_t> or std::is_same_v<DataType, uint8_t>
 class CAENWaveforms {
     std::vector<std::size_t> _en_chs = {};
     std::size_t _num_en_chs = 0;
     uint32_t _record_length = 0;
+    // Bits dropped from each sample when DataType is smaller than the ADC
+    uint32_t _shift = 0;
     CAEN_DGTZ_EventInfo_t _info = CAEN_DGTZ_EventInfo_t{};
  public:
+    using allocator_type = Allocator;
+    static constexpr uint32_t kBits = 8*sizeof(DataType);
+
     CAENWaveforms() = default;
     CAENWaveforms(const CAENDigitizerModelConstants& model_constants,
                   const CAENGlobalConfig& gp_config,
-                  const std::array<CAENGroupConfig, 8>& groups) :
-            _en_chs{_get_en_chs(model_constants, groups)},
+                  const std::array<CAENGroupConfig, 8>& groups,
+                  const Allocator& alloc = Allocator()) :
+            _en_chs{get_enabled_channels(model_constants, groups)},
             _num_en_chs{_en_chs.size()},
             _record_length{gp_config.RecordLength},
-            _data(_num_en_chs*_record_length)
+            _shift{model_constants.ADCResolution > kBits ?
+                model_constants.ADCResolution - kBits : 0},
+            _data(_num_en_chs*_record_length, alloc)
+    { }
+
+    // Holds only the enabled channels listed in channels (CAEN numbers),
+    // the others are skipped when copying from a CAENEvent. Empty channels
+    // holds all of them.
+    CAENWaveforms(const CAENDigitizerModelConstants& model_constants,
+                  const CAENGlobalConfig& gp_config,
+                  const std::array<CAENGroupConfig, 8>& groups,
+                  const std::vector<std::size_t>& channels,
+                  const Allocator& alloc = Allocator()) :
+            _en_chs{select_channels(get_enabled_channels(model_constants, groups),
+                                    channels)},
+            _num_en_chs{_en_chs.size()},
+            _record_length{gp_config.RecordLength},
+            _shift{model_constants.ADCResolution > kBits ?
+                model_constants.ADCResolution - kBits : 0},
+            _data(_num_en_chs*_record_length, alloc)
     { }
 
     ~CAENWaveforms() = default;
@@ -481,13 +611,37 @@ class CAENWaveforms {
     const std::vector<std::size_t>& getEnabledChannels() const {
         return _en_chs;
     }
+    // Channel index (position in getEnabledChannels()) of the CAEN channel
+    // ch, or getNumEnabledChannels() if it is not held.
+    std::size_t findChannel(const std::size_t& ch) const noexcept {
+        return static_cast<std::size_t>(
+            std::find(_en_chs.begin(), _en_chs.end(), ch) - _en_chs.begin());
+    }
     const CAEN_DGTZ_EventInfo_t& getInfo() const {
         return _info;
     }
+    // Used by the stages that write their own waveforms (decimation)
+    void setInfo(const CAEN_DGTZ_EventInfo_t& info) noexcept {
+        _info = info;
+    }
 
     // Copies values from event into the internal buffer
     // Does not copy if record length does not match the size
     void copy(const std::unique_ptr<CAENEvent>& event) {
+        copy(event, [this](const std::size_t&, std::span<const uint16_t> samples,
+                           DataType* dst) {
+            for(std::size_t i = 0; i < samples.size(); i++) {
+                dst[i] = static_cast<DataType>(samples[i] >> _shift);
+            }
+        });
+    }
+
+    // Same as copy(event), but each channel is copied by
+    // copy_channel(ch_index, samples, dst), which can do more work in the
+    // same pass (e.g. pile-up counting). copy_channel has to store the
+    // samples in dst, shifted as copy(event) does.
+    template<typename ChannelCopy>
+    void copy(const std::unique_ptr<CAENEvent>& event, ChannelCopy&& copy_channel) {
         const CAEN_DGTZ_UINT16_EVENT_t* data = event->getData();
 
         if (data->ChSize[0] != _record_length) {
@@ -506,20 +660,19 @@ class CAENWaveforms {
             auto ch_data = data->DataChannel[en_ch];
 
             // Now we copy to our own structure
-            for(std::size_t i = 0; i < ch_size; i++) {
-                _data[_record_length*ch_index + i] = ch_data[i];
-            }
+            copy_channel(ch_index, std::span<const uint16_t>(ch_data, ch_size),
+                         _data.data() + _record_length*ch_index);
         }
     }
 
     // Does not copy if both waveforms do not match in enabled channels,
     // number of enabled channels or record length
-    void copy(const CAENWaveforms<DataType>& other) {
-        if (other.getNumEnabledChannels() != _en_chs) {
+    void copy(const CAENWaveforms& other) {
+        if (other.getNumEnabledChannels() != _num_en_chs) {
             return;
         }
 
-        if (other.getEnabledChannels() != _num_en_chs) {
+        if (other.getEnabledChannels() != _en_chs) {
             return;
         }
 
@@ -544,40 +697,162 @@ class CAENWaveforms {
         return std::span(_data.data(), _data.size());
     }
 
+    [[nodiscard]] std::span<const DataType> getData() const noexcept {
+        return std::span(_data.data(), _data.size());
+    }
+
+    // Returns a read-only view of channel index ch_index (the position in
+    // getEnabledChannels(), not the CAEN channel number).
+    [[nodiscard]] std::span<const DataType> getChannel(const std::size_t& ch_index) const noexcept {
+        return std::span(_data.data() + _record_length*ch_index, _record_length);
+    }
+
  private:
     // Raw waveform data as one continuous 1-D array
-    std::vector<DataType> _data;
-    // Gets a vector with the numbers of the channels as per CAEN specification.
-    // Takes into account if the digitizer has groups or not.
-    std::vector<std::size_t> _get_en_chs(
-            const CAENDigitizerModelConstants& model_constants,
-            const std::array<CAENGroupConfig, 8>& groups) {
-        std::vector<std::size_t> out;
-        for(std::size_t group_num = 0; group_num < groups.size(); group_num++) {
-            const auto& group = groups[group_num];
-            if (not group.Enabled) {
-                continue;
-            }
+    std::vector<DataType, Allocator> _data;
+};
 
-            // If the digitizer does not support groups, group_num = ch
-            if(model_constants.NumberOfGroups == 0) {
-                out.push_back(group_num);
-                continue;
-            }
+// Same as CAENWaveforms<uint16_t> but the samples are stored sample-major
+// ([sample, channel]), so all the channels of a sample are next to each
+// other. Meant for cross-channel work: group sums, software majority,
+// hit patterns. The decoder order is transposed with SIMD on copy.
+template<typename Allocator = std::allocator<uint16_t>>
+class CAENInterleavedWaveforms {
+    std::vector<std::size_t> _en_chs = {};
+    std::size_t _num_en_chs = 0;
+    uint32_t _record_length = 0;
+    CAEN_DGTZ_EventInfo_t _info = CAEN_DGTZ_EventInfo_t{};
+    // Channel pointers handed to transpose_channels
+    std::vector<const uint16_t*> _sources;
+    // [sample, channel]
+    std::vector<uint16_t, Allocator> _data;
 
-            // Othewise, calculate using the AcquisitionMask
-            for(std::size_t ch = 0; ch < model_constants.NumChannelsPerGroup; ch++) {
-                if(group.AcquisitionMask.at(ch)) {
-                    out.push_back(ch + model_constants.NumChannelsPerGroup * group_num);
-                }
+ public:
+    using allocator_type = Allocator;
+
+    CAENInterleavedWaveforms() = default;
+    // channels works as in CAENWaveforms, empty holds all enabled channels
+    CAENInterleavedWaveforms(const CAENDigitizerModelConstants& model_constants,
+                             const CAENGlobalConfig& gp_config,
+                             const std::array<CAENGroupConfig, 8>& groups,
+                             const std::vector<std::size_t>& channels = {},
+                             const Allocator& alloc = Allocator()) :
+            _en_chs{select_channels(get_enabled_channels(model_constants, groups),
+                                    channels)},
+            _num_en_chs{_en_chs.size()},
+            _record_length{gp_config.RecordLength},
+            _sources(_num_en_chs, nullptr),
+            _data(_num_en_chs*_record_length, alloc)
+    { }
+
+    const uint32_t& getRecordLength() const {
+        return _record_length;
+    }
+    std::size_t getTotalSize() const {
+        return _data.size();
+    }
+    const std::size_t& getNumEnabledChannels() const {
+        return _num_en_chs;
+    }
+    const std::vector<std::size_t>& getEnabledChannels() const {
+        return _en_chs;
+    }
+    // Channel index of the CAEN channel ch, or getNumEnabledChannels()
+    std::size_t findChannel(const std::size_t& ch) const noexcept {
+        return static_cast<std::size_t>(
+            std::find(_en_chs.begin(), _en_chs.end(), ch) - _en_chs.begin());
+    }
+    const CAEN_DGTZ_EventInfo_t& getInfo() const {
+        return _info;
+    }
+
+    // Transposes event into the internal buffer.
+    // Does not copy if any channel is shorter than the record length.
+    void copy(const std::unique_ptr<CAENEvent>& event) noexcept {
+        const CAEN_DGTZ_UINT16_EVENT_t* data = event->getData();
+        for (std::size_t ch_index = 0; ch_index < _num_en_chs; ch_index++) {
+            const auto& en_ch = _en_chs[ch_index];
+            if (data->ChSize[en_ch] < _record_length) {
+                return;
             }
+            _sources[ch_index] = data->DataChannel[en_ch];
         }
-        return out;
+
+        _info = event->getInfo();
+        transpose_channels(_sources, _record_length, _data.data());
+    }
+
+    // Transposes a channel-major event. Does not copy if both waveforms
+    // do not match in enabled channels or record length.
+    template<typename OtherAllocator>
+    void copy(const CAENWaveforms<uint16_t, OtherAllocator>& other) noexcept {
+        if (other.getEnabledChannels() != _en_chs
+            or other.getRecordLength() != _record_length) {
+            return;
+        }
+
+        for (std::size_t ch_index = 0; ch_index < _num_en_chs; ch_index++) {
+            _sources[ch_index] = other.getChannel(ch_index).data();
+        }
+        _info = other.getInfo();
+        transpose_channels(_sources, _record_length, _data.data());
+    }
+
+    // All the channels of sample i, in getEnabledChannels() order
+    [[nodiscard]] std::span<const uint16_t> getSample(const std::size_t& i) const noexcept {
+        return std::span(_data.data() + _num_en_chs*i, _num_en_chs);
+    }
+
+    [[nodiscard]] std::span<const uint16_t> getData() const noexcept {
+        return std::span(_data.data(), _data.size());
+    }
+
+    // Gathers channel index ch_index into out, which must hold at least
+    // the record length. Returns the part of out that was written.
+    std::span<const uint16_t> getChannel(const std::size_t& ch_index,
+                                         std::span<uint16_t> out) const noexcept {
+        const auto n = std::min<std::size_t>(out.size(), _record_length);
+        for (std::size_t i = 0; i < n; i++) {
+            out[i] = _data[_num_en_chs*i + ch_index];
+        }
+        return out.first(n);
+    }
+
+    // out[i] = sum of channel indexes [first, first + count) at sample i.
+    // For example, first = 8*group and count = 8 sums a x740 group.
+    // Writes min(out.size(), record length) samples.
+    void sumChannels(std::span<uint32_t> out, const std::size_t& first = 0,
+                     const std::size_t& count = std::numeric_limits<std::size_t>::max())
+                     const noexcept {
+        if (first >= _num_en_chs) {
+            return;
+        }
+        sum_interleaved(_data.data(), _num_en_chs, first,
+                        std::min(count, _num_en_chs - first),
+                        out.first(std::min<std::size_t>(out.size(), _record_length)));
+    }
+
+    // Sums each group of group_channels consecutive channel indexes (8
+    // for x740 groups) in one pass, also sample-major: out[i*num_groups + g]
+    // is group g at sample i, num_groups = channels / group_channels.
+    // out must hold record length*num_groups values, otherwise nothing
+    // is written.
+    void sumGroups(std::span<uint32_t> out, const std::size_t& group_channels) const noexcept {
+        if (group_channels == 0
+            or out.size() < _record_length*(_num_en_chs / group_channels)) {
+            return;
+        }
+        sum_interleaved_groups(_data.data(), _num_en_chs, group_channels,
+                               _record_length, out.data());
     }
 };
 
+// Allocator is the allocator of the waveforms samples (and of the
+// waveforms themselves). Use CAENArenaAllocator<uint16_t> to back them with
+// huge pages.
 template<typename Logger = iostream_wrapper,
-         size_t EventBufferSize = 1024>
+         size_t EventBufferSize = 1024,
+         typename Allocator = std::allocator<uint16_t>>
 class CAEN {
     // Holds the CAEN raw data, the size of the buffer, the size
     // of the data and number of events
@@ -646,6 +921,14 @@ class CAEN {
     bool _has_error = false;
     bool _has_warning = false;
 
+    // Serialises the CAEN API calls that can happen while other threads
+    // (software trigger pacer) talk to the same board.
+    std::mutex _comm_mtx;
+    // Runs while software triggers are being generated.
+    std::unique_ptr<CAENSoftwareTriggerPacer> _sw_trigger_pacer;
+    // Samples the board occupancy while the acquisition is enabled.
+    std::unique_ptr<CAENLiveTimeMonitor> _live_time_monitor;
+
     // Communicated with the outside world: errors, warnings and debug msgs
     // Assumes it is a pointer of any form and this class does not manage
     // its deletion
@@ -684,8 +967,168 @@ class CAEN {
     std::array<CAENEvent_ptr, EventBufferSize> _events;
     // shared_ptr as anyone can manage this resource even if CAEN
     // is no longer in use. Its lifetime is independent of CAEN
-    using CAENWaveforms_ptr = std::shared_ptr<CAENWaveforms<uint16_t>>;
+    using CAENWaveforms_t = CAENWaveforms<uint16_t, Allocator>;
+    using CAENWaveforms_ptr = std::shared_ptr<CAENWaveforms_t>;
     std::array<CAENWaveforms_ptr, EventBufferSize> _waveforms;
+    // Used for _waveforms, set with SetAllocator(...)
+    Allocator _allocator;
+    // Sample-major copies of _waveforms, only allocated if the layout set
+    // with SetWaveformsLayout(...) is SampleMajor.
+    CAENWaveformsLayout _layout = CAENWaveformsLayout::ChannelMajor;
+    using CAENInterleavedWaveforms_t = CAENInterleavedWaveforms<Allocator>;
+    using CAENInterleavedWaveforms_ptr = std::shared_ptr<CAENInterleavedWaveforms_t>;
+    std::array<CAENInterleavedWaveforms_ptr, EventBufferSize> _interleaved;
+    // CAEN channels copied into _waveforms, set with SetReadoutChannels(...)
+    // Empty means all the enabled channels.
+    std::vector<std::size_t> _readout_channels;
+    // Metadata of the decoded events, filled by DecodeEvent(s)
+    CAENEventInfoTable _event_table{EventBufferSize};
+    // Set with SetCalibration(...). Empty -> the nominal one of the current
+    // configuration.
+    CAENCalibrationTable _calibration;
+
+    // Decoded batches are published here if EnableSharedRing(...) was
+    // called. Recreated at EnableAcquisition() as its slot size depends on
+    // the record length and enabled channels.
+    std::string _shared_ring_name;
+    uint32_t _shared_ring_slots = 0;
+    std::unique_ptr<CAENSharedRingWriter> _shared_ring;
+
+    // Splits the decoded events by trigger source if EnableTriggerRouter(...)
+    // was called.
+    std::unique_ptr<CAENTriggerRouter<CAENWaveforms_ptr>> _trigger_router;
+    // Drops the decoded events that fail its conditions if
+    // EnableCoincidenceFilter(...) was called.
+    std::unique_ptr<CAENCoincidenceFilter> _coincidence_filter;
+    // Counts the pulses of every channel of the decoded events into
+    // _event_table if EnablePileUpDetection(...) was called.
+    std::unique_ptr<CAENPileUpDetector> _pileup_detector;
+    std::vector<uint32_t> _pulses;
+    // With a router or a coincidence filter _waveforms holds only the
+    // events they keep, the first _num_selected of them.
+    std::size_t _num_selected = 0;
+
+    bool _is_selecting() const noexcept {
+        return _trigger_router or _coincidence_filter;
+    }
+
+    // Number of valid entries of _waveforms
+    std::size_t _num_waveforms() const noexcept {
+        if (_is_selecting()) {
+            return _num_selected;
+        }
+        return std::min<std::size_t>(_caen_raw_data->NumEvents, _waveforms.size());
+    }
+
+    void _select_events() noexcept;
+
+    // Copies _events[from] into the waveforms at to. With pile-up
+    // detection the pulses are counted into _pulses in the same pass.
+    void _copy_event(const std::size_t& to, const std::size_t& from) noexcept {
+        if (_pileup_detector and _reserve_pulses(_waveforms[to]->getNumEnabledChannels())) {
+            // Stays 0 if the event is not copied
+            std::fill(_pulses.begin(), _pulses.end(), 0);
+            _waveforms[to]->copy(_events[from], [this](const std::size_t& ch_index,
+                                                       std::span<const uint16_t> samples,
+                                                       uint16_t* dst) {
+                _pulses[ch_index] = _pileup_detector->copyAndCountPulses(samples, dst);
+            });
+        } else {
+            _waveforms[to]->copy(_events[from]);
+        }
+        if (_interleaved[to]) {
+            _interleaved[to]->copy(_events[from]);
+        }
+    }
+
+    // Makes room for the pulse counts of num_channels channels. Disables
+    // pile-up detection and returns false if there is no memory.
+    bool _reserve_pulses(const std::size_t& num_channels) noexcept {
+        if (_event_table.numPulseChannels() == num_channels
+            and _pulses.size() == num_channels) {
+            return true;
+        }
+        try {
+            _event_table.reservePulses(num_channels);
+            _pulses.resize(num_channels);
+        } catch (const std::bad_alloc&) {
+            _has_warning = true;
+            _logger->warn("Not enough memory for the pulse counts, pile-up "
+                          "detection disabled.");
+            _pileup_detector.reset();
+            return false;
+        }
+        return true;
+    }
+
+    // Stores the pulses counted by the last _copy_event(...) into row of
+    // the event table
+    void _detect_pileup(const std::size_t& row) noexcept {
+        if (not _pileup_detector) {
+            return;
+        }
+        _pileup_detector->record(_pulses);
+        _event_table.setPulses(row, _pulses);
+    }
+
+    // Channels _waveforms are allocated with: the readout channels or,
+    // if not set, the union of the channels of the routed streams.
+    std::vector<std::size_t> _decode_channels() const {
+        if (not _readout_channels.empty() or not _trigger_router) {
+            return _readout_channels;
+        }
+
+        const auto& config = _trigger_router->getConfig();
+        std::vector<std::size_t> out;
+        for (std::size_t s = 0; s < kNumTriggerStreams; s++) {
+            if (config.Prescale[s] == 0) {
+                continue;
+            }
+            // A stream that wants everything needs every channel
+            if (config.Channels[s].empty()) {
+                return {};
+            }
+            for (const auto& ch : config.Channels[s]) {
+                if (std::find(out.begin(), out.end(), ch) == out.end()) {
+                    out.push_back(ch);
+                }
+            }
+        }
+        return out;
+    }
+
+    void _create_shared_ring() noexcept {
+        if (_shared_ring_slots == 0 or not _waveforms[0]) {
+            _shared_ring.reset();
+            return;
+        }
+
+        const uint32_t max_events
+            = std::min<uint32_t>(_global_config.MaxEventsPerRead, EventBufferSize);
+        const auto num_channels
+            = static_cast<uint32_t>(_waveforms[0]->getNumEnabledChannels());
+        const uint32_t record_length = _waveforms[0]->getRecordLength();
+        // Same ring, readers keep following it across acquisitions
+        if (_shared_ring and _shared_ring->matches(_shared_ring_name, _shared_ring_slots,
+                                                   max_events, num_channels,
+                                                   record_length)) {
+            return;
+        }
+
+        _shared_ring.reset();
+        try {
+            _shared_ring = std::make_unique<CAENSharedRingWriter>(
+                _shared_ring_name, _shared_ring_slots,
+                max_events, num_channels, record_length);
+            _logger->info("Publishing decoded events to shared ring {} "
+                          "({} bytes).", _shared_ring_name,
+                          _shared_ring->getSize());
+        } catch (const std::exception& e) {
+            _has_warning = true;
+            _logger->warn("Could not create shared ring {}: {}",
+                          _shared_ring_name, e.what());
+        }
+    }
 
     // Translates the connection info data to a single number that should
     // be unique.
@@ -709,12 +1152,31 @@ class CAEN {
     }
 
     // Private helper function to wrap the logic behind checking for an error
-    // and printing the error message
+    // and printing the error message.
+    //
+    // extra_msg can be a string or a callable returning a string. Use the
+    // callable when the message has to be built (std::to_string, etc.) so
+    // it is only built if there is an error.
+    template<typename ExtraMsg = std::string_view>
     void _print_if_err(std::string_view CAEN_func_name,
                        std::string_view location,
-                       std::string_view extra_msg = "") noexcept {
+                       ExtraMsg&& extra_msg = "") noexcept {
+        if (_err_code == CAEN_DGTZ_ErrorCode::CAEN_DGTZ_Success) [[likely]] {
+            return;
+        }
+
+        if constexpr (std::is_invocable_v<ExtraMsg>) {
+            _print_err_msg(CAEN_func_name, location, extra_msg());
+        } else {
+            _print_err_msg(CAEN_func_name, location, extra_msg);
+        }
+    }
 
-        const std::string expression_str =
+    template<typename ExtraMsg>
+    void _print_err_msg(std::string_view CAEN_func_name,
+                        std::string_view location,
+                        const ExtraMsg& extra_msg) noexcept {
+        constexpr std::string_view expression_str =
             "{} at {} in CAEN API function named {} with CAEN API message: {}. "
             "Additional message: {}";
 
@@ -851,6 +1313,9 @@ class CAEN {
     }
 
     ~CAEN() {
+        StopSoftwareTriggerPacer();
+        StopLiveTimeMonitor();
+
         auto id = _hash_connection_info(
             ConnectionType, LinkNum, ConetNode, VMEBaseAddress);
         _connection_info_map.erase(id);
@@ -896,6 +1361,11 @@ class CAEN {
     const auto& GetCurrentPossibleMaxBuffer() noexcept {
         return _current_max_buffers;
     }
+    // Allocator used for the waveforms from the next EnableAcquisition().
+    void SetAllocator(const Allocator& allocator) noexcept {
+        _allocator = allocator;
+    }
+    const Allocator& GetAllocator() const noexcept { return _allocator; }
 
     // Using CAENGlobalConfig and the array of CAENGroupConfig
     // the digitizer is setup to specification.
@@ -926,6 +1396,49 @@ class CAEN {
     // Forces a software trigger in the digitizer.
     // Does not trigger if there are errors.
     void SoftwareTrigger() noexcept;
+    // Starts a thread that sends software triggers following config.
+    // Replaces any running pacer. Does not start if there are errors or
+    // acquisition is not enabled. The pacer is stopped by
+    // DisableAcquisition().
+    void StartSoftwareTriggerPacer(const CAENSoftwareTriggerConfig& config) noexcept;
+    // Stops the software trigger thread, if any.
+    void StopSoftwareTriggerPacer() noexcept;
+    // True while the pacer thread is sending triggers.
+    bool IsSoftwareTriggerPacerRunning() noexcept {
+        return _sw_trigger_pacer and _sw_trigger_pacer->isRunning();
+    }
+    // Counters of the current (or last) pacer. Compare Issued with the
+    // EventCounter of the events to measure the deadtime.
+    CAENSoftwareTriggerStats GetSoftwareTriggerPacerStats() noexcept {
+        if (not _sw_trigger_pacer) {
+            return CAENSoftwareTriggerStats{};
+        }
+        return _sw_trigger_pacer->getStats();
+    }
+    // Starts a thread that samples the events stored and the memory full
+    // flag of the board, to measure the live-time. Replaces any running
+    // monitor. Does not start if there are errors or acquisition is not
+    // enabled. The monitor is stopped by DisableAcquisition().
+    void StartLiveTimeMonitor(const CAENLiveTimeMonitorConfig& config) noexcept;
+    // Stops the live-time monitor thread, if any.
+    void StopLiveTimeMonitor() noexcept;
+    bool IsLiveTimeMonitorRunning() noexcept {
+        return _live_time_monitor and _live_time_monitor->isRunning();
+    }
+    // Stats of the current (or last) monitor.
+    CAENLiveTimeStats GetLiveTimeStats() noexcept {
+        if (not _live_time_monitor) {
+            return CAENLiveTimeStats{};
+        }
+        return _live_time_monitor->getStats();
+    }
+    // Samples per number of events stored, see CAENLiveTimeMonitor.
+    std::vector<uint64_t> GetOccupancyHistogram() {
+        if (not _live_time_monitor) {
+            return {};
+        }
+        return _live_time_monitor->getOccupancyHistogram();
+    }
     // Asks CAEN how many events are in the buffer
     // Returns 0 if there are errors.
     uint32_t GetEventsInBuffer() noexcept;
@@ -948,6 +1461,168 @@ class CAEN {
     // Clears the digitizer buffer. It stops the acquisition and resumes it
     // after clearing the data without doing any reallocation of memory.
     void ClearData() noexcept;
+    // Publishes every batch decoded by DecodeEvents() into the POSIX
+    // shared memory ring name (for example "/red_caen") holding num_slots
+    // batches. Local processes read it with CAENSharedRingReader.
+    void EnableSharedRing(const std::string& name,
+                          const uint32_t& num_slots) noexcept {
+        _shared_ring_name = name;
+        _shared_ring_slots = num_slots;
+        if (_is_acquiring) {
+            _create_shared_ring();
+        }
+    }
+    // Stops publishing and removes the shared memory ring.
+    void DisableSharedRing() noexcept {
+        _shared_ring_slots = 0;
+        _shared_ring.reset();
+    }
+    // Only the enabled channels in channels (CAEN numbers) are copied out
+    // of the decoded events, so GetWaveforms(), the shared ring and the
+    // run files hold just those. Empty reads out all enabled channels.
+    // The full events stay available with GetEvent(i) until the next
+    // ReadData(). Takes effect at the next EnableAcquisition().
+    void SetReadoutChannels(const std::vector<std::size_t>& channels) {
+        _readout_channels = channels;
+    }
+    const std::vector<std::size_t>& GetReadoutChannels() const noexcept {
+        return _readout_channels;
+    }
+    // SampleMajor also keeps every decoded event transposed, see
+    // GetInterleavedWaveformsView(). GetWaveforms() and everything built
+    // on it stay channel-major. Takes effect at the next
+    // EnableAcquisition().
+    void SetWaveformsLayout(const CAENWaveformsLayout& layout) noexcept {
+        _layout = layout;
+    }
+    const CAENWaveformsLayout& GetWaveformsLayout() const noexcept {
+        return _layout;
+    }
+    using TriggerSink = typename CAENTriggerRouter<CAENWaveforms_ptr>::Sink;
+    // Splits the events of every DecodeEvents() by trigger source, see
+    // CAENTriggerRouter. Only the events kept by the prescale of their
+    // stream are decoded; GetWaveformsView() and GetEventsTable() then
+    // hold just those, in read order, and each stream is also handed to
+    // its sink. Replaces any previous router and its sinks.
+    // DecodeEvent(i) ignores the router. Without SetReadoutChannels(...),
+    // the channels of the streams (CAENTriggerRouterConfig::Channels) are
+    // the ones read out from the next EnableAcquisition().
+    void EnableTriggerRouter(const CAENTriggerRouterConfig& config) noexcept {
+        _trigger_router = std::make_unique<CAENTriggerRouter<CAENWaveforms_ptr>>(
+            config, EventBufferSize);
+        _num_selected = 0;
+    }
+    void DisableTriggerRouter() noexcept {
+        _trigger_router.reset();
+    }
+    bool IsTriggerRouterEnabled() const noexcept {
+        return static_cast<bool>(_trigger_router);
+    }
+    // sink gets the events of stream after each DecodeEvents(), valid
+    // only during the call. Called from the thread that decodes, and must
+    // not call back into this CAEN. Does nothing without a router.
+    void SetTriggerStreamSink(const CAENTriggerStream& stream, TriggerSink sink) {
+        if (_trigger_router) {
+            _trigger_router->setSink(stream, std::move(sink));
+        }
+    }
+    // Events of stream from the latest DecodeEvents(). Same lifetime as
+    // GetWaveformsView().
+    std::span<const CAENWaveforms_ptr> GetTriggerStreamView(
+            const CAENTriggerStream& stream) const noexcept {
+        if (not _trigger_router) {
+            return {};
+        }
+        return _trigger_router->getStream(stream);
+    }
+    // Channels the consumers of stream asked for, empty if all. The
+    // events of the stream may hold more, see findChannel(...).
+    std::vector<std::size_t> GetTriggerStreamChannels(const CAENTriggerStream& stream) const {
+        if (not _trigger_router) {
+            return {};
+        }
+        return _trigger_router->getChannels(stream);
+    }
+    CAENTriggerStreamStats GetTriggerStreamStats(const CAENTriggerStream& stream) const noexcept {
+        if (not _trigger_router) {
+            return CAENTriggerStreamStats{};
+        }
+        return _trigger_router->getStats(stream);
+    }
+    // Evaluates the conditions of config on every event DecodeEvents()
+    // decodes (after the trigger router, if any) and drops the events
+    // that fail before they reach GetWaveformsView(), GetEventsTable(),
+    // the shared ring and the trigger streams. Replaces any previous
+    // filter and its stats. DecodeEvent(i) ignores the filter.
+    void EnableCoincidenceFilter(const CAENCoincidenceConfig& config) noexcept {
+        try {
+            _coincidence_filter = std::make_unique<CAENCoincidenceFilter>(config);
+            _num_selected = 0;
+        } catch (const std::exception& e) {
+            _has_warning = true;
+            _logger->warn("Coincidence filter not enabled: {}", e.what());
+        }
+    }
+    void DisableCoincidenceFilter() noexcept {
+        _coincidence_filter.reset();
+    }
+    bool IsCoincidenceFilterEnabled() const noexcept {
+        return static_cast<bool>(_coincidence_filter);
+    }
+    CAENCoincidenceConfig GetCoincidenceConfig() const {
+        if (not _coincidence_filter) {
+            return CAENCoincidenceConfig{};
+        }
+        return _coincidence_filter->getConfig();
+    }
+    CAENCoincidenceStats GetCoincidenceStats() const {
+        if (not _coincidence_filter) {
+            return CAENCoincidenceStats{};
+        }
+        return _coincidence_filter->getStats();
+    }
+    void ResetCoincidenceStats() noexcept {
+        if (_coincidence_filter) {
+            _coincidence_filter->resetStats();
+        }
+    }
+    // Counts the pulses of every channel of the events decoded from now
+    // on (by DecodeEvents() after the router and the coincidence filter,
+    // or by DecodeEvent(i)), see CAENPileUpDetector. The counts go to
+    // GetEventsTable().pulses(ch_index). Replaces any previous detector
+    // and its stats.
+    void EnablePileUpDetection(const CAENPileUpConfig& config) noexcept {
+        try {
+            _pileup_detector = std::make_unique<CAENPileUpDetector>(config);
+        } catch (const std::exception& e) {
+            _has_warning = true;
+            _logger->warn("Pile-up detection not enabled: {}", e.what());
+        }
+    }
+    void DisablePileUpDetection() noexcept {
+        _pileup_detector.reset();
+        _event_table.reservePulses(0);
+    }
+    bool IsPileUpDetectionEnabled() const noexcept {
+        return static_cast<bool>(_pileup_detector);
+    }
+    CAENPileUpConfig GetPileUpConfig() const noexcept {
+        if (not _pileup_detector) {
+            return CAENPileUpConfig{};
+        }
+        return _pileup_detector->getConfig();
+    }
+    CAENPileUpStats GetPileUpStats() const noexcept {
+        if (not _pileup_detector) {
+            return CAENPileUpStats{};
+        }
+        return _pileup_detector->getStats();
+    }
+    void ResetPileUpStats() noexcept {
+        if (_pileup_detector) {
+            _pileup_detector->resetStats();
+        }
+    }
     // Returns a const pointer to the event held @ index i.
     // If i value is higher the latest acquired number of events, it returns
     // the last event. Use GetNumberOfevents() to check for the number
@@ -961,11 +1636,8 @@ class CAEN {
     }
     // return a list of pointers to waveforms with data in it
     auto GetWaveforms() noexcept {
-        uint32_t numEvents = _caen_raw_data->NumEvents;
-        // Make sure we don't exceed the size of the array
-        if (numEvents > _waveforms.size()) {
-            numEvents = _waveforms.size();
-        }
+        // Makes sure we don't exceed the size of the array
+        const std::size_t numEvents = _num_waveforms();
         // create a vector of pointers to the waveforms with data in it
         std::vector<CAENWaveforms_ptr> waveforms_with_data;
         waveforms_with_data.reserve(numEvents);
@@ -975,6 +1647,26 @@ class CAEN {
         return waveforms_with_data;
     }
 
+    // Same as GetWaveforms() but without allocating, a view of the internal
+    // list of waveforms. Invalidated by the next DecodeEvents() or
+    // EnableAcquisition().
+    std::span<const CAENWaveforms_ptr> GetWaveformsView() const noexcept {
+        if (not _caen_raw_data) {
+            return {};
+        }
+        return std::span<const CAENWaveforms_ptr>(_waveforms.data(), _num_waveforms());
+    }
+
+    // Sample-major copies of GetWaveformsView(), same order and lifetime.
+    // Empty unless the layout is SampleMajor.
+    std::span<const CAENInterleavedWaveforms_ptr> GetInterleavedWaveformsView() const noexcept {
+        if (not _caen_raw_data or not _interleaved[0]) {
+            return {};
+        }
+        return std::span<const CAENInterleavedWaveforms_ptr>(_interleaved.data(),
+                                                             _num_waveforms());
+    }
+
     // Returns a const pointer to CAENEvent. Its lifespans its
     // managed by CAEN
     const CAENEvent* GetEvent(const std::size_t& i) noexcept {
@@ -996,6 +1688,12 @@ class CAEN {
         return allEvents;
     }
 
+    // Metadata of the latest decoded events as columns. Overwritten by the
+    // next DecodeEvent(s).
+    const CAENEventInfoTable& GetEventsTable() const noexcept {
+        return _event_table;
+    }
+
     // return a vector of pointers to all events' info
     std::vector<const CAEN_DGTZ_EventInfo_t*> GetEventsInfo() const noexcept {
         std::vector<const CAEN_DGTZ_EventInfo_t*> allInfo;
@@ -1017,6 +1715,40 @@ class CAEN {
         return 0u;
     }
 
+    // Calibration used by GetCalibration(). Channels not in table can not
+    // be converted to volts.
+    void SetCalibration(const CAENCalibrationTable& table) {
+        _calibration = table;
+    }
+    // Goes back to the nominal calibration
+    void ResetCalibration() noexcept {
+        _calibration = CAENCalibrationTable{};
+    }
+    // The calibration set with SetCalibration(...) or, if none, the
+    // nominal one of the current configuration.
+    CAENCalibrationTable GetCalibration() const {
+        if (_calibration.size() > 0) {
+            return _calibration;
+        }
+        return GetNominalCalibration();
+    }
+    CAENCalibrationTable GetNominalCalibration(const bool& use_dc_corrections = true) const {
+        return make_nominal_calibration(ModelConstants, _group_configs, use_dc_corrections);
+    }
+    // Measures the offsets of GetCalibration() on the latest decoded
+    // events, that must be a pedestal run at volts, and keeps the result
+    // as the calibration. See CAENCalibrationTable::measureOffsets(...).
+    void MeasureCalibrationOffsets(const double& volts = 0.0) noexcept {
+        try {
+            auto table = GetCalibration();
+            table.measureOffsets(GetWaveformsView(), volts);
+            _calibration = std::move(table);
+        } catch (const std::exception& e) {
+            _has_warning = true;
+            _logger->warn("Calibration offsets not measured: {}", e.what());
+        }
+    }
+
     // Returns the channel voltage range. If channel does not exist
     // returns 0
     double GetVoltageRange(const uint8_t& gr_n) noexcept {
@@ -1058,8 +1790,8 @@ class CAEN {
 };
 
 /// General CAEN functions
-template<typename T, size_t N>
-void CAEN<T, N>::Reset() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::Reset() noexcept {
     if (_has_error) {
         return;
     }
@@ -1073,8 +1805,8 @@ void CAEN<T, N>::Reset() noexcept {
     }
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::Setup(const CAENGlobalConfig& global_config,
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::Setup(const CAENGlobalConfig& global_config,
     const std::array<CAENGroupConfig, 8>& gr_configs) noexcept {
     if (_has_error or not _is_connected) {
         return;
@@ -1330,8 +2062,8 @@ void CAEN<T, N>::Setup(const CAENGlobalConfig& global_config,
     }
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::EnableAcquisition() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::EnableAcquisition() noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
@@ -1351,14 +2083,63 @@ void CAEN<T, N>::EnableAcquisition() noexcept {
         return std::make_unique<CAENEvent>(h);
     });
 
+    // Old waveforms are released first so an arena allocator that is now
+    // empty can reuse its memory.
+    std::fill(_waveforms.begin(), _waveforms.end(), nullptr);
     std::generate(_waveforms.begin(), _waveforms.end(),
                   [constants = ModelConstants,
                    global = _global_config,
-                   groups = _group_configs]() {
-                    return std::make_shared<CAENWaveforms<uint16_t>>(constants,
+                   groups = _group_configs,
+                   channels = _decode_channels(),
+                   &alloc = _allocator]() {
+                    return std::allocate_shared<CAENWaveforms_t>(alloc,
+                                                   constants,
                                                    global,
-                                                   groups);
+                                                   groups,
+                                                   channels,
+                                                   alloc);
     });
+    std::fill(_interleaved.begin(), _interleaved.end(), nullptr);
+    if (_layout == CAENWaveformsLayout::SampleMajor) {
+        std::generate(_interleaved.begin(), _interleaved.end(),
+                      [constants = ModelConstants,
+                       global = _global_config,
+                       groups = _group_configs,
+                       channels = _decode_channels(),
+                       &alloc = _allocator]() {
+                        return std::allocate_shared<CAENInterleavedWaveforms_t>(alloc,
+                                                       constants,
+                                                       global,
+                                                       groups,
+                                                       channels,
+                                                       alloc);
+        });
+    }
+    if (_waveforms[0]->getNumEnabledChannels() !=
+            get_enabled_channels(ModelConstants, _group_configs).size()) {
+        _logger->info("Reading out {} of the enabled channels.",
+                      _waveforms[0]->getNumEnabledChannels());
+    }
+
+    // Arena allocators fault in their pages now rather than during the
+    // first reads.
+    if constexpr (requires { _allocator.prefault(); }) {
+        _allocator.prefault();
+    }
+    if constexpr (requires { _allocator.getFootprint(); }) {
+        const auto footprint = _allocator.getFootprint();
+        if (footprint.Blocks > 0) {
+            _logger->info("Waveforms arena: {} bytes reserved in {} blocks, "
+                          "{} in use, {} prefaulted, huge page blocks: "
+                          "{} explicit, {} transparent.", footprint.Reserved,
+                          footprint.Blocks, footprint.Live,
+                          footprint.Prefaulted,
+                          footprint.ExplicitHugePageBlocks,
+                          footprint.TransparentHugePageBlocks);
+        }
+    }
+
+    _create_shared_ring();
 
     _err_code = CAEN_DGTZ_ClearData(handle);
     _print_if_err("CAEN_DGTZ_ClearData", __FUNCTION__);
@@ -1377,8 +2158,12 @@ void CAEN<T, N>::EnableAcquisition() noexcept {
     }
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::DisableAcquisition() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::DisableAcquisition() noexcept {
+    // Stop triggering first, even if something went wrong.
+    StopSoftwareTriggerPacer();
+    StopLiveTimeMonitor();
+
     if (_has_error or not _is_connected or not _is_acquiring) {
         return;
     }
@@ -1391,40 +2176,48 @@ void CAEN<T, N>::DisableAcquisition() noexcept {
     }
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::WriteRegister(const uint32_t& addr, const uint32_t& value) noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::WriteRegister(const uint32_t& addr, const uint32_t& value) noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
 
+    std::lock_guard<std::mutex> lock(_comm_mtx);
     _err_code = CAEN_DGTZ_WriteRegister(_caen_api_handle, addr, value);
-    _print_if_err("CAEN_DGTZ_WriteRegister", __FUNCTION__, 
-        "Failed to write " + std::to_string(value) + " to register " + std::to_string(addr));
+    _print_if_err("CAEN_DGTZ_WriteRegister", __FUNCTION__, [&]() {
+        return "Failed to write " + std::to_string(value) + " to register " + std::to_string(addr);
+    });
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::ReadRegister(const uint32_t& addr, uint32_t& value) noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::ReadRegister(const uint32_t& addr, uint32_t& value) noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
 
+    std::lock_guard<std::mutex> lock(_comm_mtx);
     _err_code = CAEN_DGTZ_ReadRegister(_caen_api_handle, addr, &value);
-    _print_if_err("CAEN_DGTZ_ReadRegister", __FUNCTION__, 
-        "Failed to read " + std::to_string(value) + " from register " + std::to_string(addr));
+    _print_if_err("CAEN_DGTZ_ReadRegister", __FUNCTION__, [&]() {
+        return "Failed to read " + std::to_string(value) + " from register " + std::to_string(addr);
+    });
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::WriteBits(const uint32_t& addr,
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::WriteBits(const uint32_t& addr,
     const uint32_t& value, uint8_t pos, uint8_t len) noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
 
+    // Read-modify-write must not be interleaved with other threads
+    std::lock_guard<std::mutex> lock(_comm_mtx);
+
     // First read the register
     uint32_t read_word = 0;
     _err_code = CAEN_DGTZ_ReadRegister(_caen_api_handle, addr, &read_word);
-    _print_if_err("CAEN_DGTZ_ReadRegister", __FUNCTION__, 
-        "Failed to read " + std::to_string(read_word) + " from register " + std::to_string(addr));
+    _print_if_err("CAEN_DGTZ_ReadRegister", __FUNCTION__, [&]() {
+        return "Failed to read " + std::to_string(read_word) + " from register " + std::to_string(addr);
+    });
 
     uint32_t bit_mask = ~(((1 << len) - 1) << pos);
     read_word = read_word & bit_mask; //mask the register value
@@ -1433,22 +2226,121 @@ void CAEN<T, N>::WriteBits(const uint32_t& addr,
     uint32_t value_bits = (value & ((1 << len) - 1)) << pos;
     // Combine masked value read from register with new bits
     _err_code = CAEN_DGTZ_WriteRegister(_caen_api_handle, addr, read_word | value_bits);
-    _print_if_err("CAEN_DGTZ_WriteRegister", __FUNCTION__, 
-        "Failed to write " + std::to_string(read_word | value_bits) + " to register " + std::to_string(addr));
+    _print_if_err("CAEN_DGTZ_WriteRegister", __FUNCTION__, [&]() {
+        return "Failed to write " + std::to_string(read_word | value_bits) + " to register " + std::to_string(addr);
+    });
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::SoftwareTrigger() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::SoftwareTrigger() noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
 
+    std::lock_guard<std::mutex> lock(_comm_mtx);
     _err_code = CAEN_DGTZ_SendSWtrigger(_caen_api_handle);
     _print_if_err("CAEN_DGTZ_SendSWtrigger", __FUNCTION__);
 }
 
-template<typename T, size_t N>
-uint32_t CAEN<T, N>::GetEventsInBuffer() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::StartSoftwareTriggerPacer(
+        const CAENSoftwareTriggerConfig& config) noexcept {
+    StopSoftwareTriggerPacer();
+
+    if (_has_error or not _is_connected) {
+        return;
+    }
+
+    if (not _is_acquiring) {
+        _logger->warn("Software trigger pacer not started: acquisition "
+                      "is not enabled.");
+        return;
+    }
+
+    // The pacer thread does not touch _err_code or _has_error, those
+    // belong to the thread that owns this class.
+    try {
+        _sw_trigger_pacer = std::make_unique<CAENSoftwareTriggerPacer>(config,
+            [this]() {
+                std::lock_guard<std::mutex> lock(_comm_mtx);
+                return CAEN_DGTZ_SendSWtrigger(_caen_api_handle)
+                    == CAEN_DGTZ_ErrorCode::CAEN_DGTZ_Success;
+            });
+    } catch (const std::exception& e) {
+        _logger->warn("Software trigger pacer not started: {}", e.what());
+        _sw_trigger_pacer.reset();
+        return;
+    }
+
+    _logger->info("Software trigger pacer started at {} Hz.", config.Rate);
+}
+
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::StopSoftwareTriggerPacer() noexcept {
+    if (not _sw_trigger_pacer) {
+        return;
+    }
+
+    // Keep the pacer around so its stats can still be read.
+    _sw_trigger_pacer->stop();
+    auto stats = _sw_trigger_pacer->getStats();
+    if (stats.Failed > 0) {
+        _logger->warn("Software trigger pacer had {} failed triggers.",
+                      stats.Failed);
+    }
+}
+
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::StartLiveTimeMonitor(
+        const CAENLiveTimeMonitorConfig& config) noexcept {
+    StopLiveTimeMonitor();
+
+    if (_has_error or not _is_connected) {
+        return;
+    }
+
+    if (not _is_acquiring) {
+        _logger->warn("Live-time monitor not started: acquisition "
+                      "is not enabled.");
+        return;
+    }
+
+    // Same as the pacer: the monitor thread only talks to the board while
+    // holding _comm_mtx and never touches _err_code or _has_error.
+    try {
+        _live_time_monitor = std::make_unique<CAENLiveTimeMonitor>(config,
+            _current_max_buffers, _global_config.TriggerCountingMode,
+            [this](uint32_t addr, uint32_t& value) {
+                std::lock_guard<std::mutex> lock(_comm_mtx);
+                return CAEN_DGTZ_ReadRegister(_caen_api_handle, addr, &value)
+                    == CAEN_DGTZ_ErrorCode::CAEN_DGTZ_Success;
+            });
+    } catch (const std::exception& e) {
+        _logger->warn("Live-time monitor not started: {}", e.what());
+        _live_time_monitor.reset();
+        return;
+    }
+
+    _logger->info("Live-time monitor started at {} Hz.", config.SampleRate);
+}
+
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::StopLiveTimeMonitor() noexcept {
+    if (not _live_time_monitor) {
+        return;
+    }
+
+    // Keep the monitor around so its stats can still be read.
+    _live_time_monitor->stop();
+    auto stats = _live_time_monitor->getStats();
+    if (stats.ReadErrors > 0) {
+        _logger->warn("Live-time monitor failed to read the board {} times.",
+                      stats.ReadErrors);
+    }
+}
+
+template<typename T, size_t N, typename A>
+uint32_t CAEN<T, N, A>::GetEventsInBuffer() noexcept {
     if (_has_error or not _is_connected) {
         return 0;
     }
@@ -1462,14 +2354,15 @@ uint32_t CAEN<T, N>::GetEventsInBuffer() noexcept {
     return events;
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::RetrieveData() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::RetrieveData() noexcept {
     int& handle = _caen_api_handle;
 
     if (_has_error or not _is_connected) {
         return;
     }
 
+    std::lock_guard<std::mutex> lock(_comm_mtx);
     // UNSAFE CODE AHEAD
     _err_code = CAEN_DGTZ_ReadData(handle,
         CAEN_DGTZ_ReadMode_t::CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT,
@@ -1485,8 +2378,8 @@ void CAEN<T, N>::RetrieveData() noexcept {
     _print_if_err("CAEN_DGTZ_GetNumEvents", __FUNCTION__);
 }
 
-template<typename T, size_t N>
-bool CAEN<T, N>::RetrieveDataUntilNEvents(const uint32_t& n) noexcept {
+template<typename T, size_t N, typename A>
+bool CAEN<T, N, A>::RetrieveDataUntilNEvents(const uint32_t& n) noexcept {
     if (n == 0) {
         return false;
     }
@@ -1513,8 +2406,8 @@ bool CAEN<T, N>::RetrieveDataUntilNEvents(const uint32_t& n) noexcept {
     return true;
 }
 
-template<typename T, size_t N>
-auto CAEN<T, N>::DecodeEvent(const uint32_t& i) noexcept {
+template<typename T, size_t N, typename A>
+auto CAEN<T, N, A>::DecodeEvent(const uint32_t& i) noexcept {
     if (i > _caen_raw_data->NumEvents) {
         return _waveforms[_caen_raw_data->NumEvents - 1];
     }
@@ -1528,48 +2421,117 @@ auto CAEN<T, N>::DecodeEvent(const uint32_t& i) noexcept {
                                         i);
     _print_if_err("CAEN_DGTZ_GetEventInfo",
                   __FUNCTION__,
-                  "at event " + std::to_string(i));
+                  [&i]() { return "at event " + std::to_string(i); });
     // Cannot decode without getting event info
     _err_code = _events[i]->decodeEvent();
     _print_if_err("CAEN_DGTZ_DecodeEvent",
                   __FUNCTION__,
-                  "at event " + std::to_string(i));
+                  [&i]() { return "at event " + std::to_string(i); });
 
-    _waveforms[i]->copy(_events[i]);
+    _copy_event(i, i);
+    _event_table.set(i, _events[i]->getInfo());
+    _detect_pileup(i);
 
     return _waveforms[i];
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::DecodeEvents() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::DecodeEvents() noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
 
+    _event_table.clear();
     for (uint32_t i = 0; i < _caen_raw_data->NumEvents; i++) {
         _err_code = _events[i]->getEventInfo(_caen_raw_data->Buffer,
                                             _caen_raw_data->DataSize,
                                             i);
         _print_if_err("CAEN_DGTZ_GetEventInfo",
                       __FUNCTION__,
-                      "at event " + std::to_string(i));
-        // Cannot decode without getting event info
+                      [&i]() { return "at event " + std::to_string(i); });
+        // The router decodes only the events it keeps
+        if (not _is_selecting()) {
+            // Cannot decode without getting event info
+            _err_code = _events[i]->decodeEvent();
+            _print_if_err("CAEN_DGTZ_DecodeEvent",
+                          __FUNCTION__,
+                          [&i]() { return "at event " + std::to_string(i); });
+
+            _copy_event(i, i);
+            _event_table.set(i, _events[i]->getInfo());
+            _detect_pileup(i);
+        } else {
+            _event_table.set(i, _events[i]->getInfo());
+        }
+    }
+
+    // Sees every event counter, including the ones the router drops
+    if (_live_time_monitor) {
+        _live_time_monitor->observe(
+            _event_table.column(CAENEventColumn::EventCounter));
+    }
+
+    if (_is_selecting()) {
+        _select_events();
+    }
+
+    if (_shared_ring) {
+        _shared_ring->publish(GetWaveformsView());
+    }
+
+    if (_trigger_router and not _trigger_router->flush()) {
+        _logger->warn("A trigger stream sink threw while handling the "
+                      "decoded events. See GetTriggerStreamStats().");
+    }
+}
+
+// Decodes the events kept by the router (all of them without one), drops
+// the ones the coincidence filter rejects and moves the rest (and their
+// rows of the event table) to the front, in read order.
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::_select_events() noexcept {
+    if (_trigger_router) {
+        _trigger_router->clear();
+    }
+    _num_selected = 0;
+    const uint32_t num_events = std::min<uint32_t>(_caen_raw_data->NumEvents, N);
+    for (uint32_t i = 0; i < num_events; i++) {
+        const auto& info = _events[i]->getInfo();
+        CAENTriggerStream stream = CAENTriggerStream::SelfTrigger;
+        if (_trigger_router and not _trigger_router->accept(info.Pattern, stream)) {
+            continue;
+        }
+
         _err_code = _events[i]->decodeEvent();
         _print_if_err("CAEN_DGTZ_DecodeEvent",
                       __FUNCTION__,
-                      "at event " + std::to_string(i));
-
-        _waveforms[i]->copy(_events[i]);
+                      [&i]() { return "at event " + std::to_string(i); });
+
+        // _num_selected <= i, so row _num_selected was already read. A
+        // rejected event is overwritten by the next one.
+        _copy_event(_num_selected, i);
+        if (_coincidence_filter
+            and not _coincidence_filter->accept(*_waveforms[_num_selected])) {
+            continue;
+        }
+        _event_table.set(_num_selected, info);
+        _detect_pileup(_num_selected);
+        if (_trigger_router) {
+            _trigger_router->add(stream, _waveforms[_num_selected]);
+        }
+        _num_selected++;
     }
+    _event_table.resize(_num_selected);
 }
 
-template<typename T, size_t N>
-void CAEN<T, N>::ClearData() noexcept {
+template<typename T, size_t N, typename A>
+void CAEN<T, N, A>::ClearData() noexcept {
     if (_has_error or not _is_connected) {
         return;
     }
 
     int& handle = _caen_api_handle;
+    std::lock_guard<std::mutex> lock(_comm_mtx);
     _err_code = CAEN_DGTZ_SWStopAcquisition(handle);
     _print_if_err("CAEN_DGTZ_SWStopAcquisition", __FUNCTION__);
     _err_code = CAEN_DGTZ_ClearData(handle);
@@ -0,0 +1,199 @@
+/*
+    Routing helpers
+    Description: Splits decoded events into streams by trigger source
+    (software, external, channel self-trigger), each with its own prescale
+    and its own sink (a run file, a pipeline, a histogram, ...), so
+    pedestal or baseline events taken with software triggers do not
+    compete with physics events for bandwidth and disk.
+
+    CAEN uses it while decoding: the event info of every event is read
+    first and only the events a stream keeps are decoded and copied.
+*/
+
+#ifndef RD_ROUTING_HELPERS_H
+#define RD_ROUTING_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "table_helpers.hpp"
+
+namespace RedDigitizer {
+
+enum class CAENTriggerStream : std::size_t {
+    Software = 0,
+    External,
+    // Channel (or group) self-triggers and anything without the software
+    // or external bit
+    SelfTrigger,
+    // Not a stream, number of streams
+    Count
+};
+
+constexpr std::size_t kNumTriggerStreams = static_cast<std::size_t>(CAENTriggerStream::Count);
+
+// Stream names in CAENTriggerStream order
+constexpr std::array<std::string_view, kNumTriggerStreams> kTriggerStreamNames = {
+    "Software", "External", "SelfTrigger"
+};
+
+struct CAENTriggerRouterConfig {
+    // Keep 1 out of Prescale events of each stream, in CAENTriggerStream
+    // order. 0 -> the stream is dropped without decoding it.
+    std::array<uint32_t, kNumTriggerStreams> Prescale = {1, 1, 1};
+
+    // Bits of remap_trigger_source(Pattern) set by each source. Events
+    // with both go to the software stream.
+    uint32_t SoftwareMask = 1u << 5;
+    uint32_t ExternalMask = 1u << 4;
+
+    // CAEN channels the consumers of each stream look at, in
+    // CAENTriggerStream order. Empty -> all of them. CAEN reads out only
+    // the union of these (see CAEN::SetReadoutChannels).
+    std::array<std::vector<std::size_t>, kNumTriggerStreams> Channels = {};
+};
+
+struct CAENTriggerStreamStats {
+    // Events read with this trigger source
+    uint64_t Events = 0;
+    // Events decoded and handed to the stream
+    uint64_t Routed = 0;
+    // Events dropped by the prescale (or because the stream is off)
+    uint64_t Prescaled = 0;
+    // Sink calls that threw
+    uint64_t SinkErrors = 0;
+};
+
+// Keeps the events of the last batch per stream and hands them to the
+// sinks. Meant to be driven by whoever decodes (CAEN::DecodeEvents):
+//
+//  clear(); for each event: if (accept(pattern, stream)) add(stream, ev);
+//  flush();
+//
+// Prescale counters run across batches. Nothing allocates after
+// construction as long as batches have at most capacity events.
+template<typename WaveformsPtr>
+class CAENTriggerRouter {
+ public:
+    using Sink = std::function<void(std::span<const WaveformsPtr>)>;
+
+ private:
+    CAENTriggerRouterConfig _config;
+    std::array<Sink, kNumTriggerStreams> _sinks;
+    std::array<std::vector<WaveformsPtr>, kNumTriggerStreams> _streams;
+    std::array<uint64_t, kNumTriggerStreams> _counters = {};
+    std::array<CAENTriggerStreamStats, kNumTriggerStreams> _stats = {};
+
+    static constexpr std::size_t _index(const CAENTriggerStream& stream) noexcept {
+        return static_cast<std::size_t>(stream);
+    }
+
+ public:
+    CAENTriggerRouter(const CAENTriggerRouterConfig& config, const std::size_t& capacity) :
+        _config{config}
+    {
+        for (auto& stream : _streams) {
+            stream.reserve(capacity);
+        }
+    }
+
+    const CAENTriggerRouterConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    // sink is called by flush() with the events kept for stream. The
+    // events are only valid during the call. An empty sink removes it.
+    void setSink(const CAENTriggerStream& stream, Sink sink) {
+        _sinks.at(_index(stream)) = std::move(sink);
+    }
+
+    CAENTriggerStream classify(const uint32_t& pattern) const noexcept {
+        const uint32_t source = remap_trigger_source(pattern);
+        if (source & _config.SoftwareMask) {
+            return CAENTriggerStream::Software;
+        }
+        if (source & _config.ExternalMask) {
+            return CAENTriggerStream::External;
+        }
+        return CAENTriggerStream::SelfTrigger;
+    }
+
+    // Drops the events of the previous batch
+    void clear() noexcept {
+        for (auto& stream : _streams) {
+            stream.clear();
+        }
+    }
+
+    // Sets stream to where the event goes and returns true if it is kept.
+    bool accept(const uint32_t& pattern, CAENTriggerStream& stream) noexcept {
+        stream = classify(pattern);
+        const std::size_t s = _index(stream);
+        const uint32_t prescale = _config.Prescale[s];
+        _stats[s].Events++;
+        if (prescale == 0 or _counters[s]++ % prescale != 0) {
+            _stats[s].Prescaled++;
+            return false;
+        }
+        return true;
+    }
+
+    // Adds an accepted (and decoded) event
+    void add(const CAENTriggerStream& stream, const WaveformsPtr& event) {
+        const std::size_t s = _index(stream);
+        _streams[s].push_back(event);
+        _stats[s].Routed++;
+    }
+
+    // Calls every sink with its stream. Exceptions from the sinks are
+    // counted and swallowed so one bad sink does not stop the others.
+    // Returns false if any sink threw.
+    bool flush() noexcept {
+        bool ok = true;
+        for (std::size_t s = 0; s < kNumTriggerStreams; s++) {
+            if (not _sinks[s] or _streams[s].empty()) {
+                continue;
+            }
+            try {
+                _sinks[s](std::span<const WaveformsPtr>(_streams[s]));
+            } catch (...) {
+                _stats[s].SinkErrors++;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // Events of stream kept from the last batch
+    std::span<const WaveformsPtr> getStream(const CAENTriggerStream& stream) const noexcept {
+        return _streams[_index(stream)];
+    }
+
+    const std::vector<std::size_t>& getChannels(const CAENTriggerStream& stream) const noexcept {
+        return _config.Channels[_index(stream)];
+    }
+
+    const CAENTriggerStreamStats& getStats(const CAENTriggerStream& stream) const noexcept {
+        return _stats[_index(stream)];
+    }
+
+    void resetStats() noexcept {
+        _stats = {};
+        _counters = {};
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,430 @@
+/*
+    Scheduler helpers
+    Description: Runs user written per-event analyses (pulse finding,
+    classification, histogram fills, ...) over decoded events on a pool of
+    threads.
+
+    An analysis is a CAENEventProcessor. Each decoded batch is cut into
+    chunks of ChunkEvents events, the chunks are split between the workers
+    and a worker that runs out steals half of what is left of another
+    worker's share. Every processor gets per-worker scratch state and a
+    result per chunk, and the chunk results are merged one at a time: in
+    event order for the processors that ask for it, as soon as each chunk
+    is done for the rest.
+*/
+
+#ifndef RD_SCHEDULER_HELPERS_H
+#define RD_SCHEDULER_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "queue_helpers.hpp"
+
+namespace RedDigitizer {
+
+// Plug-in interface of the scheduler. WaveformsPtr is what the event list
+// holds, for example std::shared_ptr<CAENWaveforms<>>.
+//
+// For each batch: beginBatch(...) on the thread calling
+// CAENAnalysisScheduler::process(...), then process(...) once per chunk
+// from any worker (several chunks at the same time, but never two with
+// the same worker or chunk index), merge(...) once per chunk (one at a
+// time) and finally endBatch(). Most processors should derive from
+// CAENBasicEventProcessor instead, which keeps the scratch and results.
+template<typename WaveformsPtr>
+class CAENEventProcessor {
+ public:
+    virtual ~CAENEventProcessor() = default;
+
+    // true -> merge(...) is called in event order
+    virtual bool isOrdered() const noexcept {
+        return false;
+    }
+
+    // num_workers is the number of different worker indexes and
+    // num_chunks the number of chunks of this batch.
+    virtual void beginBatch([[maybe_unused]] const std::size_t& num_events,
+                            [[maybe_unused]] const std::size_t& num_workers,
+                            [[maybe_unused]] const std::size_t& num_chunks) { }
+
+    // first_event is the index of events[0] since the scheduler started
+    virtual void process(std::span<const WaveformsPtr> events,
+                         const uint64_t& first_event,
+                         const std::size_t& worker,
+                         const std::size_t& chunk) = 0;
+
+    virtual void merge([[maybe_unused]] const uint64_t& first_event,
+                       [[maybe_unused]] const std::size_t& chunk) { }
+
+    virtual void endBatch() { }
+};
+
+// Keeps one Scratch per worker and one Result per chunk, both default
+// constructed once and reused for every batch (so a Result has to be
+// reset by processChunk). Each lives in its own cache lines so workers do
+// not slow each other down.
+//
+// If beginBatch(...) is overridden, call this one from it.
+template<typename WaveformsPtr, typename Scratch, typename Result>
+class CAENBasicEventProcessor : public CAENEventProcessor<WaveformsPtr> {
+    template<typename T>
+    struct alignas(kCacheLineSize) Padded {
+        T Value;
+    };
+
+    bool _ordered = false;
+    std::vector<Padded<Scratch>> _scratch;
+    std::vector<Padded<Result>> _results;
+
+ protected:
+    // Runs on the workers
+    virtual void processChunk(std::span<const WaveformsPtr> events,
+                              const uint64_t& first_event,
+                              Scratch& scratch, Result& result) = 0;
+
+    // One call at a time, no locking needed
+    virtual void mergeChunk(const uint64_t& first_event, Result& result) = 0;
+
+ public:
+    explicit CAENBasicEventProcessor(const bool& ordered = false) :
+        _ordered{ordered} { }
+
+    bool isOrdered() const noexcept override {
+        return _ordered;
+    }
+
+    void beginBatch(const std::size_t&, const std::size_t& num_workers,
+                    const std::size_t& num_chunks) override {
+        if (_scratch.size() < num_workers) {
+            _scratch.resize(num_workers);
+        }
+        if (_results.size() < num_chunks) {
+            _results.resize(num_chunks);
+        }
+    }
+
+    void process(std::span<const WaveformsPtr> events, const uint64_t& first_event,
+                 const std::size_t& worker, const std::size_t& chunk) final {
+        processChunk(events, first_event, _scratch[worker].Value, _results[chunk].Value);
+    }
+
+    void merge(const uint64_t& first_event, const std::size_t& chunk) final {
+        mergeChunk(first_event, _results[chunk].Value);
+    }
+};
+
+struct CAENSchedulerConfig {
+    // Threads besides the one calling process(...), which works too.
+    // 0 -> everything runs on the caller.
+    std::size_t NumWorkers = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    // Events per unit of work. Smaller chunks balance better, bigger ones
+    // cost less per event.
+    uint32_t ChunkEvents = 64;
+};
+
+struct CAENSchedulerStats {
+    uint64_t Batches = 0;
+    uint64_t Events = 0;
+    uint64_t Chunks = 0;
+    // Times a worker took chunks from another one
+    uint64_t Steals = 0;
+};
+
+// Runs a fixed list of processors over each batch given to process(...).
+// process(...) returns once every chunk was processed and merged, so the
+// events only have to live during the call and batches never overlap.
+//
+// An exception thrown by a processor is rethrown by process(...) after
+// the batch is done. The chunk where it happened is not merged.
+template<typename WaveformsPtr>
+class CAENAnalysisScheduler {
+    using Processor = CAENEventProcessor<WaveformsPtr>;
+
+    // Chunks [begin, end) still to do by a worker, begin in the low 32
+    // bits. The owner takes from the front, thieves take the back half.
+    struct alignas(kCacheLineSize) WorkerRange {
+        std::atomic<uint64_t> Range = 0;
+    };
+
+    enum ChunkStatus : uint8_t { kPending = 0, kDone, kFailed };
+
+    CAENSchedulerConfig _config;
+    std::vector<std::shared_ptr<Processor>> _processors;
+    std::vector<Processor*> _ordered;
+    std::vector<Processor*> _unordered;
+
+    // Workers plus the caller, which is the last one
+    std::size_t _num_participants = 1;
+    std::unique_ptr<WorkerRange[]> _ranges;
+
+    // Current batch. Written by process(...) before waking the workers.
+    std::span<const WaveformsPtr> _events;
+    uint64_t _first_event = 0;
+    std::size_t _num_chunks = 0;
+
+    // Everything below is only touched with _merge_mtx held
+    std::mutex _merge_mtx;
+    std::vector<uint8_t> _chunk_status;
+    std::size_t _next_merge = 0;
+    std::exception_ptr _error;
+
+    std::mutex _mtx;
+    std::condition_variable _start_cv;
+    std::condition_variable _done_cv;
+    uint64_t _generation = 0;
+    std::size_t _active = 0;
+    bool _stop = false;
+    std::vector<std::thread> _workers;
+
+    std::atomic<uint64_t> _steals = 0;
+    CAENSchedulerStats _stats;
+
+    static constexpr uint64_t _pack(const uint64_t& begin, const uint64_t& end) noexcept {
+        return end << 32 | begin;
+    }
+
+    bool _pop(const std::size_t& w, uint32_t& chunk) noexcept {
+        auto& range = _ranges[w].Range;
+        uint64_t r = range.load(std::memory_order_relaxed);
+        while (true) {
+            const uint32_t begin = static_cast<uint32_t>(r);
+            const uint32_t end = static_cast<uint32_t>(r >> 32);
+            if (begin >= end) {
+                return false;
+            }
+            if (range.compare_exchange_weak(r, _pack(begin + 1, end),
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                chunk = begin;
+                return true;
+            }
+        }
+    }
+
+    // Takes the back half of someone else's range, keeps its first chunk
+    // and makes the rest the own range of w (which is empty).
+    bool _steal(const std::size_t& w, uint32_t& chunk) noexcept {
+        for (std::size_t i = 1; i < _num_participants; i++) {
+            auto& range = _ranges[(w + i) % _num_participants].Range;
+            uint64_t r = range.load(std::memory_order_relaxed);
+            while (true) {
+                const uint32_t begin = static_cast<uint32_t>(r);
+                const uint32_t end = static_cast<uint32_t>(r >> 32);
+                if (begin >= end) {
+                    break;
+                }
+                const uint32_t mid = end - (end - begin + 1)/2;
+                if (range.compare_exchange_weak(r, _pack(begin, mid),
+                        std::memory_order_acquire, std::memory_order_relaxed)) {
+                    _ranges[w].Range.store(_pack(mid + 1, end), std::memory_order_relaxed);
+                    _steals.fetch_add(1, std::memory_order_relaxed);
+                    chunk = mid;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void _record_error() noexcept {
+        if (not _error) {
+            _error = std::current_exception();
+        }
+    }
+
+    void _run_chunk(const std::size_t& w, const uint32_t& chunk) {
+        const std::size_t begin = std::size_t{chunk}*_config.ChunkEvents;
+        const std::size_t num = std::min<std::size_t>(_config.ChunkEvents,
+                                                      _events.size() - begin);
+        const uint64_t first_event = _first_event + begin;
+
+        ChunkStatus status = kDone;
+        try {
+            for (auto& processor : _processors) {
+                processor->process(_events.subspan(begin, num), first_event, w, chunk);
+            }
+        } catch (...) {
+            status = kFailed;
+            std::lock_guard<std::mutex> lock(_merge_mtx);
+            _record_error();
+        }
+
+        std::lock_guard<std::mutex> lock(_merge_mtx);
+        _chunk_status[chunk] = status;
+        try {
+            if (status == kDone) {
+                for (auto processor : _unordered) {
+                    processor->merge(first_event, chunk);
+                }
+            }
+            while (_next_merge < _num_chunks and _chunk_status[_next_merge] != kPending) {
+                if (_chunk_status[_next_merge] == kDone) {
+                    for (auto processor : _ordered) {
+                        processor->merge(_first_event + _next_merge*_config.ChunkEvents,
+                                         _next_merge);
+                    }
+                }
+                _next_merge++;
+            }
+        } catch (...) {
+            _record_error();
+        }
+    }
+
+    void _run(const std::size_t& w) {
+        uint32_t chunk = 0;
+        while (_pop(w, chunk) or _steal(w, chunk)) {
+            _run_chunk(w, chunk);
+        }
+    }
+
+    void _worker_loop(const std::size_t& w) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_mtx);
+                _start_cv.wait(lock, [&]() { return _stop or _generation != seen; });
+                if (_stop) {
+                    return;
+                }
+                seen = _generation;
+            }
+
+            _run(w);
+
+            bool last = false;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                last = --_active == 0;
+            }
+            if (last) {
+                _done_cv.notify_one();
+            }
+        }
+    }
+
+ public:
+    // Throws std::invalid_argument if a processor is nullptr or
+    // ChunkEvents is 0.
+    CAENAnalysisScheduler(std::vector<std::shared_ptr<Processor>> processors,
+                          const CAENSchedulerConfig& config = CAENSchedulerConfig{}) :
+        _config{config},
+        _processors{std::move(processors)},
+        _num_participants{config.NumWorkers + 1},
+        _ranges{std::make_unique<WorkerRange[]>(_num_participants)}
+    {
+        if (_config.ChunkEvents == 0) {
+            throw std::invalid_argument("CAENSchedulerConfig::ChunkEvents must be above 0");
+        }
+        for (auto& processor : _processors) {
+            if (not processor) {
+                throw std::invalid_argument("CAENAnalysisScheduler got a nullptr processor");
+            }
+            (processor->isOrdered() ? _ordered : _unordered).push_back(processor.get());
+        }
+
+        _workers.reserve(_config.NumWorkers);
+        for (std::size_t w = 0; w < _config.NumWorkers; w++) {
+            _workers.emplace_back(&CAENAnalysisScheduler::_worker_loop, this, w);
+        }
+    }
+
+    CAENAnalysisScheduler(const CAENAnalysisScheduler&) = delete;
+    CAENAnalysisScheduler& operator=(const CAENAnalysisScheduler&) = delete;
+
+    ~CAENAnalysisScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+        _start_cv.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    // Runs every processor over events. nullptr entries are passed to the
+    // processors as they are. Not to be called from several threads.
+    void process(std::span<const WaveformsPtr> events) {
+        if (events.empty()) {
+            return;
+        }
+
+        const std::size_t num_chunks = (events.size() + _config.ChunkEvents - 1)
+            / _config.ChunkEvents;
+        for (auto& processor : _processors) {
+            processor->beginBatch(events.size(), _num_participants, num_chunks);
+        }
+
+        _chunk_status.assign(num_chunks, kPending);
+        _next_merge = 0;
+        _error = nullptr;
+        for (std::size_t w = 0; w < _num_participants; w++) {
+            _ranges[w].Range.store(_pack(num_chunks*w/_num_participants,
+                                         num_chunks*(w + 1)/_num_participants),
+                                   std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _events = events;
+            _num_chunks = num_chunks;
+            _active = _workers.size();
+            _generation++;
+        }
+        _start_cv.notify_all();
+
+        _run(_num_participants - 1);
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _done_cv.wait(lock, [this]() { return _active == 0; });
+        }
+
+        for (auto& processor : _processors) {
+            processor->endBatch();
+        }
+
+        _first_event += events.size();
+        _stats.Batches++;
+        _stats.Events += events.size();
+        _stats.Chunks += num_chunks;
+        if (_error) {
+            std::rethrow_exception(std::exchange(_error, nullptr));
+        }
+    }
+
+    // Number of different worker indexes a processor sees
+    std::size_t getNumWorkers() const noexcept {
+        return _num_participants;
+    }
+
+    const CAENSchedulerConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    CAENSchedulerStats getStats() const noexcept {
+        CAENSchedulerStats out = _stats;
+        out.Steals = _steals.load(std::memory_order_relaxed);
+        return out;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
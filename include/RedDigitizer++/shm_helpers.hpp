@@ -0,0 +1,534 @@
+/*
+    Shared memory helpers
+    Description: A POSIX shared memory ring of decoded batches (event info
+    plus waveforms). One process (usually the one owning CAEN) writes each
+    batch once, any number of local processes map the ring read-only and
+    read the batches in place.
+
+    Layout: a CAENSharedRingHeader followed by NumSlots slots of SlotSize
+    bytes. Each slot is a CAENSharedSlotHeader followed by the event info
+    columns and the waveforms as [event, channel, sample] uint16_t.
+
+    Every slot has a stamp that works as a sequence lock: 2*seq - 1 while
+    batch seq is being written and 2*seq once it is done. Readers check the
+    stamp before and after using a slot to know if it was overwritten.
+
+    The writer marks the header Retired right before removing the object.
+    A reader still mapping it sees isRetired() and has to open the name
+    again to follow the new ring.
+*/
+
+#ifndef RD_SHM_HELPERS_H
+#define RD_SHM_HELPERS_H
+#pragma once
+
+// C STD includes
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <cstring>
+
+// C 3rd party includes
+#include <CAENDigitizer.h>
+
+// C++ STD includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+// First 8 bytes of the ring: "RDSHRING"
+constexpr uint64_t kSharedRingMagic = 0x474E495248534452ull;
+constexpr uint32_t kSharedRingVersion = 2;
+// Max number of channels a slot can describe (x740 has 64)
+constexpr std::size_t kSharedRingMaxChannels = 64;
+
+struct CAENSharedRingHeader {
+    uint64_t Magic = 0;
+    uint32_t Version = 0;
+    uint32_t NumSlots = 0;
+    uint64_t SlotSize = 0;
+    uint32_t MaxEvents = 0;
+    uint32_t NumChannels = 0;
+    uint32_t RecordLength = 0;
+    uint32_t Reserved = 0;
+    // Last batch fully written. 0 -> nothing written yet.
+    alignas(64) std::atomic<uint64_t> WriteSequence = 0;
+    // 1 once the writer removed this object, nothing else is published
+    std::atomic<uint32_t> Retired = 0;
+};
+
+struct CAENSharedSlotHeader {
+    // See description at the top of the file
+    alignas(64) std::atomic<uint64_t> Stamp = 0;
+    uint32_t NumEvents = 0;
+    uint32_t NumChannels = 0;
+    uint32_t RecordLength = 0;
+    uint32_t Reserved = 0;
+    // CAEN channel numbers of the channels in the waveforms
+    std::array<uint8_t, kSharedRingMaxChannels> Channels = {};
+};
+
+// Where everything is inside a slot, in bytes from the slot start.
+struct CAENSharedSlotLayout {
+    std::size_t EventCounter = 0;
+    std::size_t EventSize = 0;
+    std::size_t BoardId = 0;
+    std::size_t Pattern = 0;
+    std::size_t ChannelMask = 0;
+    std::size_t TriggerTimeTag = 0;
+    std::size_t Waveforms = 0;
+    std::size_t SlotSize = 0;
+
+    CAENSharedSlotLayout() = default;
+    CAENSharedSlotLayout(const uint32_t& max_events,
+                         const uint32_t& num_channels,
+                         const uint32_t& record_length) {
+        auto align = [](std::size_t x) { return (x + 63) & ~std::size_t{63}; };
+        const std::size_t column = align(sizeof(uint32_t)*max_events);
+        EventCounter = align(sizeof(CAENSharedSlotHeader));
+        EventSize = EventCounter + column;
+        BoardId = EventSize + column;
+        Pattern = BoardId + column;
+        ChannelMask = Pattern + column;
+        TriggerTimeTag = ChannelMask + column;
+        Waveforms = TriggerTimeTag + column;
+        SlotSize = align(Waveforms
+            + sizeof(uint16_t)*max_events*num_channels*record_length);
+    }
+};
+
+// A batch as seen by a reader. Everything points into the mapped ring and
+// is only valid while CAENSharedRingReader::isValid(view) is true.
+struct CAENSharedBatchView {
+    uint64_t Sequence = 0;
+    uint32_t NumEvents = 0;
+    uint32_t NumChannels = 0;
+    uint32_t RecordLength = 0;
+    std::span<const uint8_t> Channels;
+    std::span<const uint32_t> EventCounter;
+    std::span<const uint32_t> EventSize;
+    std::span<const uint32_t> BoardId;
+    std::span<const uint32_t> Pattern;
+    std::span<const uint32_t> ChannelMask;
+    std::span<const uint32_t> TriggerTimeTag;
+    // [event, channel, sample]
+    std::span<const uint16_t> Waveforms;
+};
+
+enum class CAENSharedReadStatus {
+    Ok,
+    // The batch has not been published yet
+    NotYetWritten,
+    // The writer already reused the slot for a newer batch
+    Overwritten
+};
+
+namespace detail {
+
+#ifndef _WIN32
+// Maps a shared memory object. Throws std::runtime_error on failure.
+inline void* map_shared_memory(const std::string& name, std::size_t& size,
+                               bool writable, bool create) {
+    const int flags = writable ? (O_RDWR | (create ? O_CREAT : 0)) : O_RDONLY;
+    int fd = shm_open(name.c_str(), flags, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("shm_open(" + name + ") failed: "
+                                 + std::strerror(errno));
+    }
+
+    if (create) {
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error("ftruncate(" + name + ") failed: "
+                                     + std::strerror(err));
+        }
+    } else {
+        struct stat st = {};
+        if (fstat(fd, &st) != 0) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error("fstat(" + name + ") failed: "
+                                     + std::strerror(err));
+        }
+        size = static_cast<std::size_t>(st.st_size);
+        // The writer creates the object before sizing it
+        if (size < sizeof(CAENSharedRingHeader)) {
+            close(fd);
+            throw std::runtime_error(name + " is not a RedDigitizer shared ring "
+                                     "or it is not initialized yet.");
+        }
+    }
+
+    void* ptr = mmap(nullptr, size,
+                     writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("mmap(" + name + ") failed: "
+                                 + std::strerror(errno));
+    }
+    return ptr;
+}
+#endif
+
+}  // namespace detail
+
+// Creates (or recreates) the ring and publishes batches into it.
+// The shared memory object is retired and removed when the writer is
+// destroyed. Keep the writer while the geometry does not change, see
+// matches(...), so readers can keep following it.
+class CAENSharedRingWriter {
+    std::string _name;
+    std::size_t _size = 0;
+    uint8_t* _base = nullptr;
+    CAENSharedRingHeader* _header = nullptr;
+    CAENSharedSlotLayout _layout;
+    uint64_t _sequence = 0;
+
+    uint8_t* _slot(const uint64_t& seq) noexcept {
+        return _base + sizeof(CAENSharedRingHeader)
+            + ((seq - 1) % _header->NumSlots)*_layout.SlotSize;
+    }
+
+    template<typename T>
+    T* _at(uint8_t* slot, const std::size_t& offset) noexcept {
+        return reinterpret_cast<T*>(slot + offset);
+    }
+
+ public:
+    // name -> POSIX shared memory name, for example "/red_caen"
+    // num_slots -> number of batches kept in the ring
+    // max_events -> max events per batch. Bigger batches use more slots.
+    CAENSharedRingWriter(const std::string& name,
+                         const uint32_t& num_slots,
+                         const uint32_t& max_events,
+                         const uint32_t& num_channels,
+                         const uint32_t& record_length) :
+        _name{name},
+        _layout{max_events, num_channels, record_length}
+    {
+        if (num_slots == 0 or max_events == 0) {
+            throw std::invalid_argument("Shared ring needs at least one slot "
+                                        "and one event per slot.");
+        }
+        if (num_channels > kSharedRingMaxChannels) {
+            throw std::invalid_argument("Too many channels for the shared ring.");
+        }
+#ifdef _WIN32
+        throw std::runtime_error("Shared ring is only supported on POSIX systems.");
+#else
+        // Start from scratch in case a previous run left it with another size
+        shm_unlink(_name.c_str());
+        _size = sizeof(CAENSharedRingHeader) + num_slots*_layout.SlotSize;
+        _base = static_cast<uint8_t*>(
+            detail::map_shared_memory(_name, _size, true, true));
+
+        _header = new (_base) CAENSharedRingHeader{};
+        _header->Version = kSharedRingVersion;
+        _header->NumSlots = num_slots;
+        _header->SlotSize = _layout.SlotSize;
+        _header->MaxEvents = max_events;
+        _header->NumChannels = num_channels;
+        _header->RecordLength = record_length;
+        for (uint64_t seq = 1; seq <= num_slots; seq++) {
+            new (_slot(seq)) CAENSharedSlotHeader{};
+        }
+        // Readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        _header->Magic = kSharedRingMagic;
+#endif
+    }
+
+    CAENSharedRingWriter(const CAENSharedRingWriter&) = delete;
+    CAENSharedRingWriter& operator=(const CAENSharedRingWriter&) = delete;
+
+    ~CAENSharedRingWriter() {
+#ifndef _WIN32
+        if (_base) {
+            _header->Retired.store(1, std::memory_order_release);
+            munmap(_base, _size);
+            shm_unlink(_name.c_str());
+        }
+#endif
+    }
+
+    const std::string& getName() const noexcept {
+        return _name;
+    }
+
+    // Last published sequence number
+    const uint64_t& getSequence() const noexcept {
+        return _sequence;
+    }
+
+    // Total bytes of the shared memory object
+    const std::size_t& getSize() const noexcept {
+        return _size;
+    }
+
+    // True if a writer built with these arguments would make the same ring
+    bool matches(const std::string& name,
+                 const uint32_t& num_slots,
+                 const uint32_t& max_events,
+                 const uint32_t& num_channels,
+                 const uint32_t& record_length) const noexcept {
+        return _header and name == _name
+            and num_slots == _header->NumSlots
+            and max_events == _header->MaxEvents
+            and num_channels == _header->NumChannels
+            and record_length == _header->RecordLength;
+    }
+
+    // Publishes the events. Events that do not match the ring geometry
+    // (channels or record length) or are nullptr are skipped.
+    // Batches bigger than max_events are split into several slots.
+    template<typename WaveformsPtr>
+    void publish(std::span<const WaveformsPtr> events) noexcept {
+        std::size_t next = 0;
+        while (next < events.size()) {
+            const uint64_t seq = _sequence + 1;
+            uint8_t* slot = _slot(seq);
+            auto* slot_header = reinterpret_cast<CAENSharedSlotHeader*>(slot);
+
+            slot_header->Stamp.store(2*seq - 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            uint32_t* event_counter = _at<uint32_t>(slot, _layout.EventCounter);
+            uint32_t* event_size = _at<uint32_t>(slot, _layout.EventSize);
+            uint32_t* board_id = _at<uint32_t>(slot, _layout.BoardId);
+            uint32_t* pattern = _at<uint32_t>(slot, _layout.Pattern);
+            uint32_t* channel_mask = _at<uint32_t>(slot, _layout.ChannelMask);
+            uint32_t* ttt = _at<uint32_t>(slot, _layout.TriggerTimeTag);
+            uint16_t* waveforms = _at<uint16_t>(slot, _layout.Waveforms);
+            const std::size_t event_samples
+                = std::size_t{_header->NumChannels}*_header->RecordLength;
+
+            uint32_t num_events = 0;
+            for (; next < events.size() and num_events < _header->MaxEvents; next++) {
+                const auto& event = events[next];
+                if (not event
+                    or event->getNumEnabledChannels() != _header->NumChannels
+                    or event->getRecordLength() != _header->RecordLength) {
+                    continue;
+                }
+
+                if (num_events == 0) {
+                    const auto& chs = event->getEnabledChannels();
+                    for (std::size_t i = 0; i < chs.size(); i++) {
+                        slot_header->Channels[i] = static_cast<uint8_t>(chs[i]);
+                    }
+                }
+
+                const auto& info = event->getInfo();
+                event_counter[num_events] = info.EventCounter;
+                event_size[num_events] = info.EventSize;
+                board_id[num_events] = info.BoardId;
+                pattern[num_events] = info.Pattern;
+                channel_mask[num_events] = info.ChannelMask;
+                ttt[num_events] = info.TriggerTimeTag;
+
+                const auto data = event->getData();
+                std::copy(data.begin(), data.end(),
+                          waveforms + num_events*event_samples);
+                num_events++;
+            }
+
+            slot_header->NumEvents = num_events;
+            slot_header->NumChannels = _header->NumChannels;
+            slot_header->RecordLength = _header->RecordLength;
+
+            slot_header->Stamp.store(2*seq, std::memory_order_release);
+            _header->WriteSequence.store(seq, std::memory_order_release);
+            _sequence = seq;
+        }
+    }
+};
+
+// Maps an existing ring read-only.
+class CAENSharedRingReader {
+    std::string _name;
+    std::size_t _size = 0;
+    const uint8_t* _base = nullptr;
+    const CAENSharedRingHeader* _header = nullptr;
+    CAENSharedSlotLayout _layout;
+    // Next sequence returned by next()
+    uint64_t _next_sequence = 1;
+    // Batches skipped by next() because they were overwritten
+    uint64_t _missed = 0;
+
+    const uint8_t* _slot(const uint64_t& seq) const noexcept {
+        return _base + sizeof(CAENSharedRingHeader)
+            + ((seq - 1) % _header->NumSlots)*_layout.SlotSize;
+    }
+
+    const CAENSharedSlotHeader* _slot_header(const uint64_t& seq) const noexcept {
+        return reinterpret_cast<const CAENSharedSlotHeader*>(_slot(seq));
+    }
+
+    template<typename T>
+    std::span<const T> _column(const uint8_t* slot, const std::size_t& offset,
+                               const std::size_t& n) const noexcept {
+        return std::span<const T>(reinterpret_cast<const T*>(slot + offset), n);
+    }
+
+ public:
+    explicit CAENSharedRingReader(const std::string& name) : _name{name} {
+#ifdef _WIN32
+        throw std::runtime_error("Shared ring is only supported on POSIX systems.");
+#else
+        _base = static_cast<const uint8_t*>(
+            detail::map_shared_memory(_name, _size, false, false));
+        _header = reinterpret_cast<const CAENSharedRingHeader*>(_base);
+
+        if (_header->Magic != kSharedRingMagic
+            or _header->Version != kSharedRingVersion) {
+            munmap(const_cast<uint8_t*>(_base), _size);
+            throw std::runtime_error(_name + " is not a RedDigitizer shared ring "
+                                     "or it is not initialized yet.");
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Do not trust the header to stay inside the mapping
+        _layout = CAENSharedSlotLayout(_header->MaxEvents, _header->NumChannels,
+                                       _header->RecordLength);
+        const std::size_t max_slots = (_size - sizeof(CAENSharedRingHeader))
+            / std::max<std::size_t>(_layout.SlotSize, 1);
+        if (_header->NumSlots == 0 or _header->MaxEvents == 0
+            or _header->NumChannels > kSharedRingMaxChannels
+            or _header->SlotSize != _layout.SlotSize
+            or _header->NumSlots > max_slots) {
+            munmap(const_cast<uint8_t*>(_base), _size);
+            throw std::runtime_error(_name + " has a corrupted header or is "
+                                     "smaller than its slots.");
+        }
+        // Start at the oldest batch still in the ring
+        const uint64_t latest = latestSequence();
+        if (latest > _header->NumSlots) {
+            _next_sequence = latest - _header->NumSlots + 1;
+        }
+#endif
+    }
+
+    CAENSharedRingReader(const CAENSharedRingReader&) = delete;
+    CAENSharedRingReader& operator=(const CAENSharedRingReader&) = delete;
+
+    ~CAENSharedRingReader() {
+#ifndef _WIN32
+        if (_base) {
+            munmap(const_cast<uint8_t*>(_base), _size);
+        }
+#endif
+    }
+
+    const CAENSharedRingHeader& getHeader() const noexcept {
+        return *_header;
+    }
+
+    // Last batch published by the writer
+    uint64_t latestSequence() const noexcept {
+        return _header->WriteSequence.load(std::memory_order_acquire);
+    }
+
+    // True once the writer removed the ring. Batches still in it can be
+    // read, but new ones go to a new ring: open name again to follow it.
+    bool isRetired() const noexcept {
+        return _header->Retired.load(std::memory_order_acquire) != 0;
+    }
+
+    const uint64_t& getMissed() const noexcept {
+        return _missed;
+    }
+
+    // Gets batch seq without copying. Check isValid(view) after using the
+    // data: if false the writer overwrote it while it was being used.
+    CAENSharedReadStatus read(const uint64_t& seq, CAENSharedBatchView& view) const noexcept {
+        if (seq == 0 or seq > latestSequence()) {
+            return CAENSharedReadStatus::NotYetWritten;
+        }
+
+        const auto* slot_header = _slot_header(seq);
+        const uint64_t stamp = slot_header->Stamp.load(std::memory_order_acquire);
+        if (stamp != 2*seq) {
+            return stamp < 2*seq ? CAENSharedReadStatus::NotYetWritten
+                                 : CAENSharedReadStatus::Overwritten;
+        }
+
+        const uint8_t* slot = _slot(seq);
+        view.Sequence = seq;
+        view.NumEvents = std::min(slot_header->NumEvents, _header->MaxEvents);
+        view.NumChannels = _header->NumChannels;
+        view.RecordLength = _header->RecordLength;
+        view.Channels = std::span<const uint8_t>(slot_header->Channels.data(),
+                                                 view.NumChannels);
+        view.EventCounter = _column<uint32_t>(slot, _layout.EventCounter, view.NumEvents);
+        view.EventSize = _column<uint32_t>(slot, _layout.EventSize, view.NumEvents);
+        view.BoardId = _column<uint32_t>(slot, _layout.BoardId, view.NumEvents);
+        view.Pattern = _column<uint32_t>(slot, _layout.Pattern, view.NumEvents);
+        view.ChannelMask = _column<uint32_t>(slot, _layout.ChannelMask, view.NumEvents);
+        view.TriggerTimeTag = _column<uint32_t>(slot, _layout.TriggerTimeTag, view.NumEvents);
+        view.Waveforms = _column<uint16_t>(slot, _layout.Waveforms,
+            std::size_t{view.NumEvents}*view.NumChannels*view.RecordLength);
+
+        // The writer could have started overwriting while we read the header
+        return isValid(view) ? CAENSharedReadStatus::Ok
+                             : CAENSharedReadStatus::Overwritten;
+    }
+
+    // True if the slot of view still holds its batch.
+    bool isValid(const CAENSharedBatchView& view) const noexcept {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return _slot_header(view.Sequence)->Stamp.load(std::memory_order_relaxed)
+            == 2*view.Sequence;
+    }
+
+    // Reads the next batch not read by next(). If the reader fell behind
+    // the writer, skips to the oldest batch available and counts the
+    // skipped batches in getMissed().
+    // Returns false if there is nothing new.
+    bool next(CAENSharedBatchView& view) noexcept {
+        while (true) {
+            const uint64_t latest = latestSequence();
+            if (_next_sequence > latest) {
+                return false;
+            }
+
+            if (latest - _next_sequence >= _header->NumSlots) {
+                const uint64_t oldest = latest - _header->NumSlots + 1;
+                _missed += oldest - _next_sequence;
+                _next_sequence = oldest;
+            }
+
+            auto status = read(_next_sequence, view);
+            if (status == CAENSharedReadStatus::Ok) {
+                _next_sequence++;
+                return true;
+            }
+            if (status == CAENSharedReadStatus::NotYetWritten) {
+                return false;
+            }
+            // Overwritten while reading it: skip it and try again.
+            _missed++;
+            _next_sequence++;
+        }
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,727 @@
+/*
+    Spectrum helpers
+    Description: Running average of the noise power spectral density (PSD)
+    of every channel, computed from baseline events (software triggers by
+    default) with a windowed real FFT, so pickup noise can be followed
+    during a run without exporting the waveforms.
+
+    The FFT is a radix-2 one in float, done as a complex FFT of half the
+    length on the even/odd samples. The butterflies use SSE2 where
+    available. All the tables and scratch buffers are made on
+    construction, processing an event does not allocate.
+
+    CAENNoiseSpectrumWorker feeds a stage from its own thread, so it can
+    sit on the software trigger stream (CAEN::SetTriggerStreamSink(...))
+    without slowing down DecodeEvents().
+*/
+
+#ifndef RD_SPECTRUM_HELPERS_H
+#define RD_SPECTRUM_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RD_SPECTRUM_SSE2 1
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "batch_helpers.hpp"
+#include "pipeline_helpers.hpp"
+#include "red_digitizer_helper.hpp"
+
+namespace RedDigitizer {
+
+enum class CAENSpectrumWindow {
+    // No window. Only for noise that is periodic in the segment.
+    Rectangular,
+    Hann,
+    Hamming,
+    // 4 term Blackman-Harris, for lines next to a much stronger one
+    BlackmanHarris
+};
+
+enum class CAENSpectrumAveraging {
+    // Every event weighs the same, since the last reset
+    Linear,
+    // Each new event weighs Alpha, older ones fade away
+    Exponential
+};
+
+struct CAENNoiseSpectrumConfig {
+    // Samples per FFT, a power of two of at least 4. 0 -> the largest
+    // power of two that fits in the record length. Longer records are cut
+    // in segments overlapping by half and their spectra averaged (Welch).
+    uint32_t SegmentLength = 0;
+
+    CAENSpectrumWindow Window = CAENSpectrumWindow::Hann;
+
+    // Bits of remap_trigger_source(Pattern) an event needs to have one of
+    // to be used. The default takes software triggers only, 0 takes every
+    // event.
+    uint32_t TriggerMask = 1u << 5;
+
+    CAENSpectrumAveraging Averaging = CAENSpectrumAveraging::Linear;
+    // Exponential only. Weight of each new event, between 0 and 1.
+    double Alpha = 0.05;
+};
+
+namespace detail {
+
+inline std::vector<float> make_spectrum_window(const CAENSpectrumWindow& window,
+                                               const std::size_t& n) {
+    std::vector<float> out(n, 1.0f);
+    // Periodic windows, the usual choice for spectral analysis
+    const double step = 2.0*std::numbers::pi / n;
+    for (std::size_t i = 0; i < n; i++) {
+        const double x = step*i;
+        switch (window) {
+        case CAENSpectrumWindow::Hann:
+            out[i] = static_cast<float>(0.5 - 0.5*std::cos(x));
+            break;
+        case CAENSpectrumWindow::Hamming:
+            out[i] = static_cast<float>(0.54 - 0.46*std::cos(x));
+            break;
+        case CAENSpectrumWindow::BlackmanHarris:
+            out[i] = static_cast<float>(0.35875 - 0.48829*std::cos(x)
+                + 0.14128*std::cos(2*x) - 0.01168*std::cos(3*x));
+            break;
+        default:
+        case CAENSpectrumWindow::Rectangular:
+            break;
+        }
+    }
+    return out;
+}
+
+// One radix-2 stage of fft_bit_reversed: butterflies between the two
+// halves of every block of 2h points, with the twiddles of stage h.
+inline void fft_stage_scalar(float* re, float* im, const std::size_t& n,
+                             const std::size_t& h, const float* wr_h,
+                             const float* wi_h) noexcept {
+    for (std::size_t s = 0; s < n; s += 2*h) {
+        for (std::size_t j = 0; j < h; j++) {
+            const std::size_t a = s + j, b = a + h;
+            const float tr = wr_h[j]*re[b] - wi_h[j]*im[b];
+            const float ti = wr_h[j]*im[b] + wi_h[j]*re[b];
+            re[b] = re[a] - tr;
+            im[b] = im[a] - ti;
+            re[a] += tr;
+            im[a] += ti;
+        }
+    }
+}
+
+#ifdef RD_SPECTRUM_SSE2
+// The first two stages of fft_bit_reversed (h = 1 and 2, twiddles 1 and
+// -i) as a single radix-4 pass, 4 points per step. n at least 4.
+inline void fft_radix4_first(float* re, float* im, const std::size_t& n) noexcept {
+    const __m128 alternate = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    const __m128 halves = _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f);
+    for (std::size_t s = 0; s < n; s += 4) {
+        __m128 r = _mm_loadu_ps(re + s), i = _mm_loadu_ps(im + s);
+        // h = 1: {x0 + x1, x0 - x1, x2 + x3, x2 - x3}
+        r = _mm_add_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 2, 0, 0)),
+                       _mm_mul_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 1, 1)), alternate));
+        i = _mm_add_ps(_mm_shuffle_ps(i, i, _MM_SHUFFLE(2, 2, 0, 0)),
+                       _mm_mul_ps(_mm_shuffle_ps(i, i, _MM_SHUFFLE(3, 3, 1, 1)), alternate));
+        // h = 2: x2 times 1, x3 times -i -> (im3, -re3)
+        const __m128 upper = _mm_shuffle_ps(r, i, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m128 tr = _mm_shuffle_ps(upper, upper, _MM_SHUFFLE(3, 0, 3, 0));
+        const __m128 ti = _mm_mul_ps(_mm_shuffle_ps(upper, upper, _MM_SHUFFLE(1, 2, 1, 2)),
+                                     alternate);
+        r = _mm_add_ps(_mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 0, 1, 0)), _mm_mul_ps(tr, halves));
+        i = _mm_add_ps(_mm_shuffle_ps(i, i, _MM_SHUFFLE(1, 0, 1, 0)), _mm_mul_ps(ti, halves));
+        _mm_storeu_ps(re + s, r);
+        _mm_storeu_ps(im + s, i);
+    }
+}
+#endif
+
+// In place complex FFT of n = 2^k points with the input in bit reversed
+// order and the output in order. re/im are the real and imaginary parts.
+// tw_re/tw_im hold the n - 1 factors exp(-i pi j/h), j < h, of every
+// stage h = 1, 2, 4, ... n/2 one after the other (stage h from h - 1).
+inline void fft_bit_reversed(float* re, float* im, const std::size_t& n,
+                             const float* tw_re, const float* tw_im) noexcept {
+    std::size_t h = 1;
+#ifdef RD_SPECTRUM_SSE2
+    if (n >= 4) {
+        fft_radix4_first(re, im, n);
+        h = 4;
+        // 4 butterflies per step
+        for (; h < n; h *= 2) {
+            const float* wr_h = tw_re + h - 1;
+            const float* wi_h = tw_im + h - 1;
+            for (std::size_t s = 0; s < n; s += 2*h) {
+                float* ar = re + s;
+                float* ai = im + s;
+                float* br = ar + h;
+                float* bi = ai + h;
+                for (std::size_t j = 0; j < h; j += 4) {
+                    const __m128 wr = _mm_loadu_ps(wr_h + j), wi = _mm_loadu_ps(wi_h + j);
+                    const __m128 xr = _mm_loadu_ps(br + j), xi = _mm_loadu_ps(bi + j);
+                    const __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, xr), _mm_mul_ps(wi, xi));
+                    const __m128 ti = _mm_add_ps(_mm_mul_ps(wr, xi), _mm_mul_ps(wi, xr));
+                    const __m128 yr = _mm_loadu_ps(ar + j), yi = _mm_loadu_ps(ai + j);
+                    _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+                    _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+                    _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+                    _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+                }
+            }
+        }
+    }
+#endif
+    for (; h < n; h *= 2) {
+        fft_stage_scalar(re, im, n, h, tw_re + h - 1, tw_im + h - 1);
+    }
+}
+
+// Sum of the first n samples
+template<typename DataType>
+inline uint64_t sum_samples(const DataType* x, const std::size_t& n) noexcept {
+    uint64_t sum = 0;
+    std::size_t i = 0;
+#ifdef RD_SPECTRUM_SSE2
+    if constexpr (std::is_same_v<DataType, uint16_t>) {
+        const __m128i zero = _mm_setzero_si128();
+        // Each 32 bit lane gets 2 samples per step, so it can not
+        // overflow in kChunk steps.
+        constexpr std::size_t kChunk = 1 << 14;
+        while (n - i >= 8) {
+            const std::size_t steps = std::min((n - i) / 8, kChunk);
+            __m128i acc = zero;
+            for (std::size_t k = 0; k < steps; k++, i += 8) {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+                acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero),
+                                                       _mm_unpackhi_epi16(v, zero)));
+            }
+            alignas(16) uint32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+            sum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        sum += x[i];
+    }
+    return sum;
+}
+
+// (x[i] - mean)*window[i] for the first n samples, split in the even
+// (into even[i/2]) and odd (into odd[i/2]) samples. n is even.
+template<typename DataType>
+inline void window_samples(const DataType* x, const std::size_t& n, const float& mean,
+                           const float* window, float* even, float* odd) noexcept {
+    std::size_t i = 0;
+#ifdef RD_SPECTRUM_SSE2
+    if constexpr (std::is_same_v<DataType, uint16_t>) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 m = _mm_set1_ps(mean);
+        for (const std::size_t full = n / 8 * 8; i < full; i += 8) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+            const __m128 lo = _mm_mul_ps(_mm_sub_ps(
+                _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), m), _mm_loadu_ps(window + i));
+            const __m128 hi = _mm_mul_ps(_mm_sub_ps(
+                _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), m), _mm_loadu_ps(window + i + 4));
+            _mm_storeu_ps(even + i / 2, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(odd + i / 2, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+    }
+#endif
+    for (; i < n; i += 2) {
+        even[i / 2] = (static_cast<float>(x[i]) - mean)*window[i];
+        odd[i / 2] = (static_cast<float>(x[i + 1]) - mean)*window[i + 1];
+    }
+}
+
+// Adds |X[k]|^2, k = 0 .. m, of the real FFT X of 2m points to power,
+// from the complex FFT Z of m points of z[j] = x[2j] + i x[2j + 1]:
+//   X[k] = E[k] + exp(-2 pi i k/2m) O[k], with E and O the FFTs of the
+//   even and odd samples,
+//   E[k] = (Z[k] + conj(Z[m - k]))/2, O[k] = (Z[k] - conj(Z[m - k]))/2i
+// split_re/split_im hold exp(-2 pi i k/2m), k < m.
+inline void add_real_fft_power(const float* re, const float* im, const std::size_t& m,
+                               const float* split_re, const float* split_im,
+                               float* power) noexcept {
+    power[0] += (re[0] + im[0])*(re[0] + im[0]);
+    power[m] += (re[0] - im[0])*(re[0] - im[0]);
+    std::size_t k = 1;
+#ifdef RD_SPECTRUM_SSE2
+    const __m128 half = _mm_set1_ps(0.5f);
+    auto reversed = [](const __m128& v) {
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3));
+    };
+    // Z[k .. k + 3] against Z[m - k .. m - k - 3]
+    for (const std::size_t full = 1 + (m - 1) / 4 * 4; k < full; k += 4) {
+        const __m128 zr = _mm_loadu_ps(re + k), zi = _mm_loadu_ps(im + k);
+        const __m128 cr = reversed(_mm_loadu_ps(re + m - k - 3));
+        const __m128 ci = reversed(_mm_loadu_ps(im + m - k - 3));
+        const __m128 er = _mm_mul_ps(half, _mm_add_ps(zr, cr));
+        const __m128 ei = _mm_mul_ps(half, _mm_sub_ps(zi, ci));
+        const __m128 or_ = _mm_mul_ps(half, _mm_add_ps(zi, ci));
+        const __m128 oi = _mm_mul_ps(half, _mm_sub_ps(cr, zr));
+        const __m128 wr = _mm_loadu_ps(split_re + k), wi = _mm_loadu_ps(split_im + k);
+        const __m128 xr = _mm_add_ps(er, _mm_sub_ps(_mm_mul_ps(wr, or_), _mm_mul_ps(wi, oi)));
+        const __m128 xi = _mm_add_ps(ei, _mm_add_ps(_mm_mul_ps(wr, oi), _mm_mul_ps(wi, or_)));
+        _mm_storeu_ps(power + k, _mm_add_ps(_mm_loadu_ps(power + k),
+            _mm_add_ps(_mm_mul_ps(xr, xr), _mm_mul_ps(xi, xi))));
+    }
+#endif
+    for (; k < m; k++) {
+        const float zr = re[k], zi = im[k];
+        const float cr = re[m - k], ci = im[m - k];
+        const float er = 0.5f*(zr + cr), ei = 0.5f*(zi - ci);
+        const float or_ = 0.5f*(zi + ci), oi = 0.5f*(cr - zr);
+        const float xr = er + split_re[k]*or_ - split_im[k]*oi;
+        const float xi = ei + split_re[k]*oi + split_im[k]*or_;
+        power[k] += xr*xr + xi*xi;
+    }
+}
+
+}  // namespace detail
+
+// Windowed real FFT of a fixed length that adds |X[k]|^2, k = 0 .. n/2,
+// of segments of samples to a power buffer.
+//
+// Not thread-safe, each thread needs its own.
+class CAENRealFFT {
+    std::size_t _n = 0;
+    // Complex FFT of _n/2 points: z[m] = x[2m] + i x[2m + 1]
+    std::size_t _m = 0;
+    std::vector<float> _window;
+    double _window_power = 0.0;
+    std::vector<uint32_t> _bit_reversed;
+    std::vector<float> _tw_re;
+    std::vector<float> _tw_im;
+    // exp(-2 pi i k/n), k < _m, to split the half length FFT
+    std::vector<float> _split_re;
+    std::vector<float> _split_im;
+    // Windowed even and odd samples, in order
+    std::vector<float> _even;
+    std::vector<float> _odd;
+    // FFT buffers, the input in bit reversed order
+    std::vector<float> _re;
+    std::vector<float> _im;
+
+ public:
+    // Throws std::invalid_argument if n is not a power of two of at least 4
+    CAENRealFFT(const std::size_t& n, const CAENSpectrumWindow& window) :
+        _n{n}, _m{n / 2}
+    {
+        if (n < 4 or not std::has_single_bit(n)) {
+            throw std::invalid_argument("The FFT length must be a power of two "
+                                        "of at least 4.");
+        }
+        _window = detail::make_spectrum_window(window, _n);
+        for (const auto& w : _window) {
+            _window_power += static_cast<double>(w)*w;
+        }
+
+        const int bits = std::countr_zero(_m);
+        _bit_reversed.resize(_m);
+        for (std::size_t i = 0; i < _m; i++) {
+            uint32_t r = 0;
+            for (int b = 0; b < bits; b++) {
+                r |= ((i >> b) & 1u) << (bits - 1 - b);
+            }
+            _bit_reversed[i] = r;
+        }
+
+        _tw_re.resize(_m - 1);
+        _tw_im.resize(_m - 1);
+        for (std::size_t h = 1; h < _m; h *= 2) {
+            for (std::size_t j = 0; j < h; j++) {
+                const double angle = -std::numbers::pi*j / h;
+                _tw_re[h - 1 + j] = static_cast<float>(std::cos(angle));
+                _tw_im[h - 1 + j] = static_cast<float>(std::sin(angle));
+            }
+        }
+        _split_re.resize(_m);
+        _split_im.resize(_m);
+        for (std::size_t k = 0; k < _m; k++) {
+            const double angle = -2.0*std::numbers::pi*k / _n;
+            _split_re[k] = static_cast<float>(std::cos(angle));
+            _split_im[k] = static_cast<float>(std::sin(angle));
+        }
+        _even.resize(_m);
+        _odd.resize(_m);
+        _re.resize(_m);
+        _im.resize(_m);
+    }
+
+    const std::size_t& size() const noexcept {
+        return _n;
+    }
+
+    std::size_t getNumBins() const noexcept {
+        return _m + 1;
+    }
+
+    // Sum of the squares of the window, to normalise the power
+    const double& getWindowPower() const noexcept {
+        return _window_power;
+    }
+
+    // Removes the mean of the first size() samples, windows them and adds
+    // |X[k]|^2 to power, which must hold getNumBins() values.
+    template<typename DataType>
+    void addPower(const DataType* samples, float* power) noexcept {
+        const float mean = static_cast<float>(
+            static_cast<double>(detail::sum_samples(samples, _n)) / _n);
+        detail::window_samples(samples, _n, mean, _window.data(),
+                               _even.data(), _odd.data());
+        for (std::size_t m = 0; m < _m; m++) {
+            const uint32_t r = _bit_reversed[m];
+            _re[r] = _even[m];
+            _im[r] = _odd[m];
+        }
+        detail::fft_bit_reversed(_re.data(), _im.data(), _m,
+                                 _tw_re.data(), _tw_im.data());
+        detail::add_real_fft_power(_re.data(), _im.data(), _m,
+                                   _split_re.data(), _split_im.data(), power);
+    }
+};
+
+// Averages the one-sided PSD of every channel over the events that pass
+// CAENNoiseSpectrumConfig::TriggerMask. Channels are indexed by CAEN
+// channel number. The PSD is in ADC counts^2/Hz, multiply by the square
+// of the calibration gain (CAENChannelCalibration) for V^2/Hz.
+//
+// process(...) can be called from several threads, events are added one
+// at a time. The spectra can be read from any thread while it runs.
+class CAENNoiseSpectrumStage {
+    CAENNoiseSpectrumConfig _config;
+    std::size_t _num_channels = 0;
+    uint32_t _record_length = 0;
+    // In Hz
+    double _sample_rate = 0.0;
+
+    // Guards _fft and _power, the scratch space of process(...)
+    std::mutex _process_mtx;
+    CAENRealFFT _fft;
+    std::size_t _num_bins = 0;
+    // Per channel index, sum of the |X[k]|^2 of the segments of an event
+    std::vector<float> _power;
+
+    mutable std::mutex _mtx;
+    // [channel, bin]
+    std::vector<double> _psd;
+    std::vector<uint64_t> _num_averaged;
+    uint64_t _num_events = 0;
+
+    static std::size_t _segment_length(const CAENNoiseSpectrumConfig& config,
+                                       const uint32_t& record_length) {
+        if (config.SegmentLength == 0) {
+            return record_length < 4 ? 0 : std::bit_floor(record_length);
+        }
+        if (config.SegmentLength > record_length) {
+            throw std::invalid_argument("The noise spectrum SegmentLength is "
+                                        "longer than the record length.");
+        }
+        return config.SegmentLength;
+    }
+
+    // channel(ch_index) points to the _record_length samples of the
+    // channel at ch_index of en_chs
+    template<typename ChannelFn>
+    void _add_event(const std::vector<std::size_t>& en_chs,
+                    ChannelFn&& channel) noexcept {
+        std::lock_guard<std::mutex> process_lock(_process_mtx);
+        const std::size_t n = _fft.size();
+        const std::size_t num_segments = (_record_length - n) / (n / 2) + 1;
+        const std::size_t num_chs = std::min(en_chs.size(), _num_channels);
+        std::fill_n(_power.begin(), num_chs*_num_bins, 0.0f);
+        for (std::size_t ch_index = 0; ch_index < num_chs; ch_index++) {
+            const auto* samples = channel(ch_index);
+            float* power = _power.data() + ch_index*_num_bins;
+            for (std::size_t s = 0; s < num_segments; s++) {
+                _fft.addPower(samples + s*(n / 2), power);
+            }
+        }
+
+        // One-sided: every bin but DC and Nyquist also holds the negative
+        // frequency.
+        const double scale = 2.0 / (_sample_rate*_fft.getWindowPower()*num_segments);
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (std::size_t ch_index = 0; ch_index < num_chs; ch_index++) {
+            const std::size_t ch = en_chs[ch_index];
+            if (ch >= _num_channels) {
+                continue;
+            }
+            const float* power = _power.data() + ch_index*_num_bins;
+            double* psd = _psd.data() + ch*_num_bins;
+            const double weight = _config.Averaging == CAENSpectrumAveraging::Linear ?
+                1.0 / (_num_averaged[ch] + 1) :
+                (_num_averaged[ch] == 0 ? 1.0 : _config.Alpha);
+            for (std::size_t k = 0; k < _num_bins; k++) {
+                const double edge = k == 0 or k + 1 == _num_bins ? 0.5 : 1.0;
+                psd[k] += weight*(edge*scale*power[k] - psd[k]);
+            }
+            _num_averaged[ch]++;
+        }
+        _num_events++;
+    }
+
+ public:
+    // Throws std::invalid_argument if the segment length is not a power of
+    // two of at least 4 that fits in the record length, or if Alpha is
+    // not between 0 and 1.
+    CAENNoiseSpectrumStage(const CAENDigitizerModelConstants& model_constants,
+                           const CAENGlobalConfig& global_config,
+                           const CAENNoiseSpectrumConfig& config) :
+        _config{config},
+        _num_channels{model_constants.NumChannels},
+        _record_length{global_config.RecordLength},
+        _sample_rate{model_constants.AcquisitionRate
+            / std::max<uint16_t>(global_config.DecimationFactor, 1)},
+        _fft{_segment_length(config, global_config.RecordLength), config.Window},
+        _num_bins{_fft.getNumBins()},
+        _psd(_num_channels*_num_bins, 0.0),
+        _num_averaged(_num_channels, 0)
+    {
+        if (_config.Averaging == CAENSpectrumAveraging::Exponential
+            and not (_config.Alpha > 0.0 and _config.Alpha <= 1.0)) {
+            throw std::invalid_argument("The noise spectrum Alpha has to be "
+                                        "between 0 and 1.");
+        }
+        _power.resize(_num_channels*_num_bins);
+    }
+
+    const CAENNoiseSpectrumConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    const std::size_t& getNumChannels() const noexcept {
+        return _num_channels;
+    }
+
+    std::size_t getSegmentLength() const noexcept {
+        return _fft.size();
+    }
+
+    const std::size_t& getNumBins() const noexcept {
+        return _num_bins;
+    }
+
+    // In Hz, of every bin
+    std::vector<double> getFrequencies() const {
+        std::vector<double> out(_num_bins);
+        for (std::size_t k = 0; k < _num_bins; k++) {
+            out[k] = _sample_rate*k / _fft.size();
+        }
+        return out;
+    }
+
+    bool accepts(const uint32_t& pattern) const noexcept {
+        return _config.TriggerMask == 0
+            or (remap_trigger_source(pattern) & _config.TriggerMask);
+    }
+
+    // Adds the spectra of every channel of event if it passes the
+    // trigger mask. Events with another record length are skipped.
+    // Returns whether it was used.
+    template<typename DataType, typename Allocator>
+    bool process(const CAENWaveforms<DataType, Allocator>& event) noexcept {
+        if (not accepts(event.getInfo().Pattern)
+            or event.getRecordLength() != _record_length) {
+            return false;
+        }
+        _add_event(event.getEnabledChannels(), [&event](const std::size_t& ch_index) {
+            return event.getChannel(ch_index).data();
+        });
+        return true;
+    }
+
+    // Processes every event in the list, nullptr are skipped
+    template<typename WaveformsPtr>
+    void process(std::span<const WaveformsPtr> events) noexcept {
+        for (const auto& event : events) {
+            if (event) {
+                process(*event);
+            }
+        }
+    }
+
+    // Processes the events of batch that pass the trigger mask. Returns
+    // how many were used.
+    std::size_t process(const CAENBatch& batch) noexcept {
+        if (not batch.HasWaveforms or batch.RecordLength != _record_length) {
+            return 0;
+        }
+        std::size_t used = 0;
+        const std::size_t event_samples = batch.getEventSamples();
+        for (std::size_t i = 0; i < batch.NumEvents; i++) {
+            if (not accepts(batch.Pattern[i])) {
+                continue;
+            }
+            const uint16_t* event = batch.Waveforms.data() + i*event_samples;
+            _add_event(batch.Channels, [this, event](const std::size_t& ch_index) {
+                return event + ch_index*_record_length;
+            });
+            used++;
+        }
+        return used;
+    }
+
+    // Copy of the PSD of every channel as [channel, bin]. Channels
+    // without events are 0.
+    std::vector<double> snapshot() const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _psd;
+    }
+
+    // Copy of the PSD of the CAEN channel ch. Throws std::out_of_range if
+    // ch is not a channel of this digitizer.
+    std::vector<double> snapshot(const std::size_t& ch) const {
+        if (ch >= _num_channels) {
+            throw std::out_of_range("Channel " + std::to_string(ch)
+                                    + " is not a channel of this digitizer.");
+        }
+        std::lock_guard<std::mutex> lock(_mtx);
+        return {_psd.begin() + ch*_num_bins, _psd.begin() + (ch + 1)*_num_bins};
+    }
+
+    // Events in the average of each channel
+    std::vector<uint64_t> getNumAveraged() const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _num_averaged;
+    }
+
+    // Events used
+    uint64_t getNumEvents() const noexcept {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _num_events;
+    }
+
+    void reset() noexcept {
+        std::lock_guard<std::mutex> lock(_mtx);
+        std::fill(_psd.begin(), _psd.end(), 0.0);
+        std::fill(_num_averaged.begin(), _num_averaged.end(), 0);
+        _num_events = 0;
+    }
+};
+
+struct CAENNoiseSpectrumWorkerConfig {
+    // Buffers between the decoding thread and the worker. When all are
+    // waiting the oldest one is dropped, the decoding never waits.
+    std::size_t NumBuffers = 4;
+    // Events per buffer
+    uint32_t BatchCapacity = 64;
+};
+
+// Runs a CAENNoiseSpectrumStage on its own thread. push(...) only copies
+// the events that pass the trigger mask into preallocated buffers, the
+// FFTs are done by the worker. num_channels and record_length are the
+// geometry of the events that will be pushed.
+class CAENNoiseSpectrumWorker {
+    std::shared_ptr<CAENNoiseSpectrumStage> _stage;
+    CAENPipeline _pipeline;
+    std::thread _thread;
+
+    static CAENPipelineConfig _pipeline_config(const CAENNoiseSpectrumWorkerConfig& config) {
+        CAENPipelineConfig out;
+        out.Policy = CAENBackpressurePolicy::DropOldest;
+        out.NumBuffers = config.NumBuffers;
+        out.BatchCapacity = config.BatchCapacity;
+        return out;
+    }
+
+    void _loop() noexcept {
+        // Once closed, pop() still hands out whatever was queued
+        while (not _pipeline.isDone()) {
+            auto handle = _pipeline.pop(std::chrono::milliseconds(100));
+            if (handle) {
+                _stage->process(*handle);
+            }
+        }
+    }
+
+ public:
+    // Throws std::invalid_argument if stage is empty or the buffers have
+    // no room.
+    CAENNoiseSpectrumWorker(std::shared_ptr<CAENNoiseSpectrumStage> stage,
+                            const uint32_t& num_channels,
+                            const uint32_t& record_length,
+                            const CAENNoiseSpectrumWorkerConfig& config = {}) :
+        _stage{std::move(stage)},
+        _pipeline{_pipeline_config(config), num_channels, record_length}
+    {
+        if (not _stage) {
+            throw std::invalid_argument("Noise spectrum worker needs a stage.");
+        }
+        _thread = std::thread(&CAENNoiseSpectrumWorker::_loop, this);
+    }
+
+    CAENNoiseSpectrumWorker(const CAENNoiseSpectrumWorker&) = delete;
+    CAENNoiseSpectrumWorker& operator=(const CAENNoiseSpectrumWorker&) = delete;
+
+    ~CAENNoiseSpectrumWorker() {
+        stop();
+    }
+
+    // Copies the events accepted by the stage. Runs of rejected events
+    // are skipped without copying them. Never waits for the worker.
+    template<typename WaveformsPtr>
+    void push(std::span<const WaveformsPtr> events) {
+        std::size_t i = 0;
+        while (i < events.size()) {
+            for (; i < events.size(); i++) {
+                if (events[i] and _stage->accepts(events[i]->getInfo().Pattern)) {
+                    break;
+                }
+            }
+            const std::size_t first = i;
+            for (; i < events.size(); i++) {
+                if (not events[i] or not _stage->accepts(events[i]->getInfo().Pattern)) {
+                    break;
+                }
+            }
+            if (i > first and not _pipeline.push(events.subspan(first, i - first))) {
+                return;
+            }
+        }
+    }
+
+    // Stops taking events, processes the ones already copied and joins
+    // the thread. Safe to call more than once.
+    void stop() noexcept {
+        _pipeline.close();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    const std::shared_ptr<CAENNoiseSpectrumStage>& getStage() const noexcept {
+        return _stage;
+    }
+
+    // Events copied, and dropped because the worker fell behind
+    // (DroppedOldest and DroppedOverflow)
+    CAENPipelineStats getStats() {
+        return _pipeline.getStats();
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
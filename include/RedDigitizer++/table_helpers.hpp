@@ -0,0 +1,174 @@
+/*
+    Table helpers
+    Description: Event metadata kept as a struct-of-arrays table, one
+    uint32_t column per field in a single allocation. CAEN fills it while
+    decoding so Python (or any consumer) can read whole columns without
+    walking the events. With pile-up detection on it also keeps the
+    number of pulses of each channel of each event.
+*/
+
+#ifndef RD_TABLE_HELPERS_H
+#define RD_TABLE_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// C++ 3rd party includes
+#include <CAENDigitizer.h>
+
+// my includes
+
+namespace RedDigitizer {
+
+enum class CAENEventColumn : std::size_t {
+    EventCounter = 0,
+    EventSize,
+    BoardId,
+    Pattern,
+    ChannelMask,
+    TriggerTimeTag,
+    // Pattern with the software and external trigger bits (10-11) moved to
+    // bits 4-5, see remap_trigger_source(...)
+    TriggerSource,
+    // Not a column, number of columns
+    Count
+};
+
+constexpr std::size_t kNumEventColumns = static_cast<std::size_t>(CAENEventColumn::Count);
+
+// Column names in CAENEventColumn order
+constexpr std::array<std::string_view, kNumEventColumns> kEventColumnNames = {
+    "EventCounter", "EventSize", "BoardId", "Pattern", "ChannelMask",
+    "TriggerTimeTag", "TriggerSource"
+};
+
+// Moves the software and external trigger bits of the pattern (bits 10-11)
+// to bits 4-5, next to the channel trigger bits.
+constexpr uint32_t remap_trigger_source(const uint32_t& pattern) noexcept {
+    const uint32_t extracted = (pattern >> 6) & (0b11 << 4);
+    return (pattern & ~(0b11u << 10 | 0b11u << 4)) | extracted;
+}
+
+// Up to Capacity events of metadata stored as [column, event]. Memory is
+// allocated on construction or reserve(...) only.
+class CAENEventInfoTable {
+    std::size_t _capacity = 0;
+    std::size_t _size = 0;
+    std::vector<uint32_t> _data;
+
+    // Pulses of each channel and event, [channel, capacity], only with
+    // pile-up detection on. See CAENPileUpDetector.
+    std::size_t _num_pulse_channels = 0;
+    std::vector<uint32_t> _pulses;
+
+    uint32_t* _column_ptr(const CAENEventColumn& column) noexcept {
+        return _data.data() + static_cast<std::size_t>(column)*_capacity;
+    }
+
+ public:
+    CAENEventInfoTable() = default;
+    explicit CAENEventInfoTable(const std::size_t& capacity) {
+        reserve(capacity);
+    }
+
+    // Drops the contents
+    void reserve(const std::size_t& capacity) {
+        _capacity = capacity;
+        _size = 0;
+        _data.assign(kNumEventColumns*capacity, 0);
+        _pulses.assign(_num_pulse_channels*capacity, 0);
+    }
+
+    // Keeps pulse counts of num_channels channels per event, 0 drops them.
+    // Clears the counts but not the rest of the table.
+    void reservePulses(const std::size_t& num_channels) {
+        _num_pulse_channels = num_channels;
+        _pulses.assign(_num_pulse_channels*_capacity, 0);
+    }
+
+    void clear() noexcept {
+        _size = 0;
+    }
+
+    // Rows beyond the capacity are ignored
+    void resize(const std::size_t& size) noexcept {
+        _size = std::min(size, _capacity);
+    }
+
+    // Writes row i, growing the table up to i + 1 rows if needed.
+    void set(const std::size_t& i, const CAEN_DGTZ_EventInfo_t& info) noexcept {
+        if (i >= _capacity) {
+            return;
+        }
+        _column_ptr(CAENEventColumn::EventCounter)[i] = info.EventCounter;
+        _column_ptr(CAENEventColumn::EventSize)[i] = info.EventSize;
+        _column_ptr(CAENEventColumn::BoardId)[i] = info.BoardId;
+        _column_ptr(CAENEventColumn::Pattern)[i] = info.Pattern;
+        _column_ptr(CAENEventColumn::ChannelMask)[i] = info.ChannelMask;
+        _column_ptr(CAENEventColumn::TriggerTimeTag)[i] = info.TriggerTimeTag;
+        _column_ptr(CAENEventColumn::TriggerSource)[i] = remap_trigger_source(info.Pattern);
+        _size = std::max(_size, i + 1);
+    }
+
+    // Sets the pulses of every channel of row i. Call after set(i, ...).
+    void setPulses(const std::size_t& i, std::span<const uint32_t> pulses) noexcept {
+        if (i >= _capacity) {
+            return;
+        }
+        const std::size_t n = std::min(pulses.size(), _num_pulse_channels);
+        for (std::size_t ch = 0; ch < n; ch++) {
+            _pulses[ch*_capacity + i] = pulses[ch];
+        }
+    }
+
+    const std::size_t& size() const noexcept {
+        return _size;
+    }
+
+    const std::size_t& capacity() const noexcept {
+        return _capacity;
+    }
+
+    // The first size() values of column
+    std::span<const uint32_t> column(const CAENEventColumn& column) const noexcept {
+        return std::span<const uint32_t>(
+            _data.data() + static_cast<std::size_t>(column)*_capacity, _size);
+    }
+
+    const std::size_t& numPulseChannels() const noexcept {
+        return _num_pulse_channels;
+    }
+
+    // Pulses of channel index ch_index (position in the enabled channels
+    // of the events) of the first size() events. More than 1 -> pile-up.
+    std::span<const uint32_t> pulses(const std::size_t& ch_index) const noexcept {
+        return std::span<const uint32_t>(_pulses.data() + ch_index*_capacity, _size);
+    }
+
+    bool isPiledUp(const std::size_t& ch_index, const std::size_t& i) const noexcept {
+        return _pulses[ch_index*_capacity + i] > 1;
+    }
+
+    // Whole pulses storage, [channel, capacity]
+    std::span<const uint32_t> pulsesData() const noexcept {
+        return _pulses;
+    }
+
+    // Whole storage, [column, capacity]. Only the first size() values of
+    // each column are valid.
+    std::span<const uint32_t> data() const noexcept {
+        return _data;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,377 @@
+/*
+    Timing helpers
+    Description: Sub-sample pulse timing over decoded CAENWaveforms using a
+    digital constant fraction discriminator (CFD) or a leading edge
+    discriminator with linear interpolation between samples.
+
+    The waveforms are read in place; the only copies are into a small
+    per-stage float scratch buffer sized to one record length. The loops
+    over the record (baseline subtraction, CFD signal and the threshold
+    and zero crossing searches) use SSE2 where available.
+*/
+
+#ifndef RD_TIMING_HELPERS_H
+#define RD_TIMING_HELPERS_H
+#pragma once
+
+// C STD includes
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RD_TIMING_SSE2 1
+#endif
+
+// C 3rd party includes
+// C++ STD includes
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// C++ 3rd party includes
+// my includes
+#include "red_digitizer_helper.hpp"
+
+namespace RedDigitizer {
+
+enum class CAENTimingMethod {
+    // Zero crossing of Fraction*pulse(t) - pulse(t - Delay)
+    CFD,
+    // Crossing of Threshold
+    LeadingEdge
+};
+
+struct CAENTimingConfig {
+    CAENTimingMethod Method = CAENTimingMethod::CFD;
+
+    // CFD only. Attenuation of the undelayed pulse, between 0 and 1.
+    float Fraction = 0.3f;
+    // CFD only. Delay of the delayed pulse in samples.
+    uint32_t Delay = 4;
+
+    // Baseline subtracted ADC counts the pulse has to reach to be timed.
+    // For LeadingEdge it is also the timing threshold.
+    float Threshold = 50.0f;
+
+    // Number of samples at the start of the waveform used for the baseline.
+    uint32_t BaselineSamples = 16;
+
+    // true -> pulses go below the baseline
+    bool NegativePolarity = true;
+};
+
+namespace detail {
+
+// pulse[i] = polarity*(x[i] - baseline)
+template<typename DataType>
+inline void timing_pulse(const DataType* x, const std::size_t& n,
+                         const float& baseline, const float& polarity,
+                         float* pulse) noexcept {
+    std::size_t i = 0;
+#ifdef RD_TIMING_SSE2
+    if constexpr (std::is_same_v<DataType, uint16_t>) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 b = _mm_set1_ps(baseline);
+        const __m128 p = _mm_set1_ps(polarity);
+        for (const std::size_t full = n / 8 * 8; i < full; i += 8) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+            _mm_storeu_ps(pulse + i, _mm_mul_ps(p, _mm_sub_ps(
+                _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), b)));
+            _mm_storeu_ps(pulse + i + 4, _mm_mul_ps(p, _mm_sub_ps(
+                _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), b)));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        pulse[i] = polarity*(static_cast<float>(x[i]) - baseline);
+    }
+}
+
+// cfd[i] = fraction*pulse[i] - pulse[i - delay], with pulse 0 before the
+// record. delay < n.
+inline void timing_cfd(const float* pulse, const std::size_t& n,
+                       const std::size_t& delay, const float& fraction,
+                       float* cfd) noexcept {
+    for (std::size_t i = 0; i < delay; i++) {
+        cfd[i] = fraction*pulse[i];
+    }
+    std::size_t i = delay;
+#ifdef RD_TIMING_SSE2
+    const __m128 f = _mm_set1_ps(fraction);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(cfd + i, _mm_sub_ps(_mm_mul_ps(f, _mm_loadu_ps(pulse + i)),
+                                          _mm_loadu_ps(pulse + i - delay)));
+    }
+#endif
+    for (; i < n; i++) {
+        cfd[i] = fraction*pulse[i] - pulse[i - delay];
+    }
+}
+
+// First i in [first, n) with x[i] >= threshold, n if none
+inline std::size_t timing_find_at_or_above(const float* x, std::size_t first,
+                                           const std::size_t& n,
+                                           const float& threshold) noexcept {
+#ifdef RD_TIMING_SSE2
+    const __m128 t = _mm_set1_ps(threshold);
+    for (; first + 4 <= n; first += 4) {
+        const int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(x + first), t));
+        if (mask != 0) {
+            return first + std::countr_zero(static_cast<unsigned>(mask));
+        }
+    }
+#endif
+    for (; first < n; first++) {
+        if (x[first] >= threshold) {
+            return first;
+        }
+    }
+    return n;
+}
+
+// First i in [first, n) with x[i] <= threshold, n if none
+inline std::size_t timing_find_at_or_below(const float* x, std::size_t first,
+                                           const std::size_t& n,
+                                           const float& threshold) noexcept {
+#ifdef RD_TIMING_SSE2
+    const __m128 t = _mm_set1_ps(threshold);
+    for (; first + 4 <= n; first += 4) {
+        const int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(x + first), t));
+        if (mask != 0) {
+            return first + std::countr_zero(static_cast<unsigned>(mask));
+        }
+    }
+#endif
+    for (; first < n; first++) {
+        if (x[first] <= threshold) {
+            return first;
+        }
+    }
+    return n;
+}
+
+// First i in [first, n) where x crosses threshold upwards,
+// x[i - 1] < threshold <= x[i], n if none. first >= 1.
+inline std::size_t timing_find_rising(const float* x, const std::size_t& first,
+                                      const std::size_t& n,
+                                      const float& threshold) noexcept {
+    std::size_t i = timing_find_at_or_above(x, first, n, threshold);
+    while (i < n and x[i - 1] >= threshold) {
+        // Already over threshold before i, skip to where it drops below
+        while (i < n and x[i] >= threshold) {
+            i++;
+        }
+        i = timing_find_at_or_above(x, i, n, threshold);
+    }
+    return i;
+}
+
+}  // namespace detail
+
+// Runs a CAENTimingConfig over blocks of events and keeps the results as
+// [event, channel index] tables, channel index being the position in
+// CAENWaveforms::getEnabledChannels().
+//
+// Channels with no pulse crossing the threshold from below get NaN.
+class CAENTimingStage {
+    CAENTimingConfig _config;
+    // In ns
+    double _sample_period = 1.0;
+    double _ttt_lsb = 8.0;
+    // In ns, part of the record before the trigger
+    double _pre_trigger = 0.0;
+
+    // Extended trigger time tag. TTT is a 31 bit counter, so every time
+    // it goes backwards we add 2^31.
+    uint64_t _ttt_rollovers = 0;
+    uint32_t _last_ttt = 0;
+    bool _has_last_ttt = false;
+
+    std::size_t _num_events = 0;
+    std::size_t _num_channels = 0;
+    // In samples, from the start of the record
+    std::vector<float> _sample_times;
+    // In ns: extended trigger time tag + sample time
+    std::vector<double> _times;
+
+    // Scratch buffers of one record length
+    std::vector<float> _pulse;
+    std::vector<float> _cfd;
+
+    static constexpr float kNaN = std::numeric_limits<float>::quiet_NaN();
+
+    template<typename DataType>
+    float _time_channel(std::span<const DataType> samples) noexcept {
+        const std::size_t n = samples.size();
+        if (n < 2) {
+            return kNaN;
+        }
+        _pulse.resize(n);
+        _cfd.resize(n);
+
+        const std::size_t num_baseline = std::clamp<std::size_t>(
+            _config.BaselineSamples, 1, n);
+        uint64_t base_sum = 0;
+        for (std::size_t i = 0; i < num_baseline; i++) {
+            base_sum += samples[i];
+        }
+        const float baseline = static_cast<float>(base_sum) / num_baseline;
+        const float polarity = _config.NegativePolarity ? -1.0f : 1.0f;
+
+        // Baseline subtracted and positive pulse
+        float* pulse = _pulse.data();
+        detail::timing_pulse(samples.data(), n, baseline, polarity, pulse);
+
+        // Arming: first sample over threshold coming from below it, so a
+        // record that starts over threshold (e.g. a pile-up tail) waits
+        // for the next pulse
+        const std::size_t arm = detail::timing_find_rising(pulse, 1, n,
+                                                           _config.Threshold);
+        if (arm == n) {
+            return kNaN;
+        }
+
+        if (_config.Method == CAENTimingMethod::LeadingEdge) {
+            const float below = pulse[arm - 1];
+            const float above = pulse[arm];
+            return (arm - 1) + (_config.Threshold - below) / (above - below);
+        }
+
+        const std::size_t delay = std::min<std::size_t>(_config.Delay, n - 1);
+        const float fraction = _config.Fraction;
+        float* cfd = _cfd.data();
+        detail::timing_cfd(pulse, n, delay, fraction, cfd);
+
+        // The CFD goes from positive to negative on the leading edge. If it
+        // is still positive at the arming point the crossing is ahead,
+        // otherwise it already happened.
+        std::size_t cross = 0;
+        if (cfd[arm] > 0.0f) {
+            cross = detail::timing_find_at_or_below(cfd, arm + 1, n, 0.0f);
+            if (cross == n) {
+                cross = 0;
+            }
+        } else {
+            for (std::size_t i = arm; i > 0; i--) {
+                if (cfd[i - 1] > 0.0f) {
+                    cross = i;
+                    break;
+                }
+            }
+        }
+        if (cross == 0) {
+            return kNaN;
+        }
+
+        const float before = cfd[cross - 1];
+        const float after = cfd[cross];
+        return (cross - 1) + before / (before - after);
+    }
+
+    uint64_t _extend_ttt(const uint32_t& ttt) noexcept {
+        const uint32_t count = ttt & 0x7FFFFFFF;
+        if (_has_last_ttt and count < _last_ttt) {
+            _ttt_rollovers++;
+        }
+        _last_ttt = count;
+        _has_last_ttt = true;
+        return (_ttt_rollovers << 31) | count;
+    }
+
+ public:
+    CAENTimingStage(const CAENDigitizerModelConstants& model_constants,
+                    const CAENGlobalConfig& global_config,
+                    const CAENTimingConfig& config) :
+        _config{config},
+        _sample_period{1e9 / model_constants.AcquisitionRate
+            * std::max<uint16_t>(global_config.DecimationFactor, 1)},
+        _ttt_lsb{model_constants.TriggerTimeTagLSB},
+        _pre_trigger{0.01*(100 - std::min<uint32_t>(global_config.PostTriggerPorcentage, 100))
+            * global_config.RecordLength*_sample_period},
+        _pulse(global_config.RecordLength),
+        _cfd(global_config.RecordLength)
+    { }
+
+    const CAENTimingConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    // In ns
+    const double& getSamplePeriod() const noexcept {
+        return _sample_period;
+    }
+
+    // In ns, from the start of the record to the trigger
+    const double& getPreTrigger() const noexcept {
+        return _pre_trigger;
+    }
+
+    const std::size_t& getNumEvents() const noexcept {
+        return _num_events;
+    }
+
+    const std::size_t& getNumChannels() const noexcept {
+        return _num_channels;
+    }
+
+    // [event, channel index], in samples from the start of the record
+    std::span<const float> getSampleTimes() const noexcept {
+        return _sample_times;
+    }
+
+    // [event, channel index], in ns since the trigger time tag was reset
+    std::span<const double> getTimes() const noexcept {
+        return _times;
+    }
+
+    // Forgets the trigger time tag history. Call it when a new
+    // acquisition starts.
+    void reset() noexcept {
+        _ttt_rollovers = 0;
+        _last_ttt = 0;
+        _has_last_ttt = false;
+    }
+
+    // Times every channel of every event. Events must be in acquisition
+    // order for the extended trigger time tag to be correct.
+    // nullptr events get NaN in all channels.
+    template<typename WaveformsPtr>
+    void process(std::span<const WaveformsPtr> events) {
+        _num_events = events.size();
+        _num_channels = 0;
+        for (const auto& event : events) {
+            if (event) {
+                _num_channels = event->getNumEnabledChannels();
+                break;
+            }
+        }
+
+        _sample_times.assign(_num_events*_num_channels, kNaN);
+        _times.assign(_num_events*_num_channels,
+                      std::numeric_limits<double>::quiet_NaN());
+
+        for (std::size_t ev = 0; ev < _num_events; ev++) {
+            const auto& event = events[ev];
+            if (not event or event->getNumEnabledChannels() != _num_channels) {
+                continue;
+            }
+
+            // The record starts PostTriggerPorcentage before the trigger
+            const double record_start = _ttt_lsb
+                * static_cast<double>(_extend_ttt(event->getInfo().TriggerTimeTag))
+                - _pre_trigger;
+            for (std::size_t ch = 0; ch < _num_channels; ch++) {
+                const float t = _time_channel(event->getChannel(ch));
+                _sample_times[ev*_num_channels + ch] = t;
+                _times[ev*_num_channels + ch] = record_start + t*_sample_period;
+            }
+        }
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -0,0 +1,284 @@
+/*
+    Trigger helpers
+    Description: A software trigger generator that runs on its own thread.
+    Used by CAEN to send software triggers at a precise rate, or following
+    Poisson or burst patterns, for deadtime and throughput tests.
+
+    This file does not depend on the CAEN API, the trigger itself is a
+    callable provided by the user (CAEN uses CAEN_DGTZ_SendSWtrigger).
+*/
+
+#ifndef RD_TRIGGER_HELPERS_H
+#define RD_TRIGGER_HELPERS_H
+#pragma once
+
+// C STD includes
+// C 3rd party includes
+// C++ STD includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+// C++ 3rd party includes
+// my includes
+
+namespace RedDigitizer {
+
+enum class CAENTriggerPattern {
+    // One trigger every 1/Rate seconds
+    Periodic,
+    // Exponentially distributed times between triggers with mean 1/Rate
+    Poisson,
+    // BurstSize triggers separated by 1/Rate, one burst every 1/BurstRate
+    Burst
+};
+
+struct CAENSoftwareTriggerConfig {
+    CAENTriggerPattern Pattern = CAENTriggerPattern::Periodic;
+
+    // In Hz. For Burst, it is the rate of the triggers inside a burst.
+    double Rate = 1000.0;
+
+    // Only for Burst. Number of triggers per burst.
+    uint32_t BurstSize = 10;
+    // Only for Burst. Bursts per second, in Hz.
+    double BurstRate = 1.0;
+
+    // The pacer stops by itself after this many triggers.
+    // 0 -> runs until stopped.
+    uint64_t MaxTriggers = 0;
+
+    // Seed for the Poisson pattern. 0 -> a random seed.
+    uint32_t Seed = 0;
+
+    // The thread sleeps until SpinMicroseconds before the next trigger and
+    // then busy waits. Higher values = less jitter but more CPU usage.
+    uint32_t SpinMicroseconds = 200;
+};
+
+struct CAENSoftwareTriggerStats {
+    // Triggers sent successfully
+    uint64_t Issued = 0;
+    // Triggers the trigger function reported as failed
+    uint64_t Failed = 0;
+    // Triggers sent more than one period after their scheduled time.
+    // The schedule is restarted after a late trigger so the pacer does not
+    // try to catch up with a burst of triggers.
+    uint64_t Late = 0;
+    // Worst delay between the scheduled time and the trigger, in ns
+    int64_t MaxLatenessNs = 0;
+    // Time since the pacer started (or ran), in seconds
+    double ElapsedSeconds = 0.0;
+    // Issued / ElapsedSeconds
+    double AchievedRate = 0.0;
+};
+
+// Calls a trigger function following a CAENSoftwareTriggerConfig from a
+// dedicated thread. The thread starts on construction and stops on stop(),
+// on destruction, after MaxTriggers, or after too many consecutive
+// failures of the trigger function.
+class CAENSoftwareTriggerPacer {
+ public:
+    // Returns true if the trigger was sent
+    using TriggerFunc = std::function<bool()>;
+
+    // The pacer gives up after this many failed triggers in a row.
+    static constexpr uint32_t kMaxConsecutiveFailures = 10;
+    // Slowest Rate and BurstRate, in Hz. About one trigger every 11 days,
+    // far from overflowing the nanosecond schedule even with the long
+    // tail of the Poisson pattern.
+    static constexpr double kMinRate = 1e-6;
+
+ private:
+    using clock = std::chrono::steady_clock;
+
+    CAENSoftwareTriggerConfig _config;
+    TriggerFunc _trigger;
+
+    std::atomic<bool> _running = true;
+    std::atomic<uint64_t> _issued = 0;
+    std::atomic<uint64_t> _failed = 0;
+    std::atomic<uint64_t> _late = 0;
+    std::atomic<int64_t> _max_lateness_ns = 0;
+    std::atomic<int64_t> _elapsed_ns = 0;
+
+    clock::time_point _start;
+    std::thread _thread;
+    // Wakes the thread up from its sleep when stopped
+    std::mutex _mtx;
+    std::condition_variable _cv;
+
+    void _wait_until(const clock::time_point& deadline) noexcept {
+        const auto spin = std::chrono::microseconds(_config.SpinMicroseconds);
+        auto now = clock::now();
+        if (deadline - now > spin) {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait_until(lock, deadline - spin, [this]() {
+                return not _running.load(std::memory_order_relaxed);
+            });
+        }
+
+        while (clock::now() < deadline) {
+            if (not _running.load(std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    void _loop() {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        using dseconds = std::chrono::duration<double>;
+
+        std::mt19937_64 rng(_config.Seed ? _config.Seed : std::random_device{}());
+        std::exponential_distribution<double> exp_dist(_config.Rate);
+
+        const auto period = duration_cast<nanoseconds>(dseconds(1.0 / _config.Rate));
+        // BurstRate is only checked for the Burst pattern
+        const auto burst_period = _config.Pattern == CAENTriggerPattern::Burst ?
+            duration_cast<nanoseconds>(dseconds(1.0 / _config.BurstRate)) : period;
+
+        auto next = _start;
+        auto burst_start = _start;
+        uint32_t in_burst = 0;
+        uint32_t consecutive_failures = 0;
+
+        while (_running.load(std::memory_order_relaxed)) {
+            _wait_until(next);
+            if (not _running.load(std::memory_order_relaxed)) {
+                break;
+            }
+
+            const auto now = clock::now();
+            const auto lateness = duration_cast<nanoseconds>(now - next).count();
+            if (lateness > _max_lateness_ns.load(std::memory_order_relaxed)) {
+                _max_lateness_ns.store(lateness, std::memory_order_relaxed);
+            }
+
+            if (_trigger()) {
+                _issued.fetch_add(1, std::memory_order_relaxed);
+                consecutive_failures = 0;
+            } else {
+                _failed.fetch_add(1, std::memory_order_relaxed);
+                if (++consecutive_failures >= kMaxConsecutiveFailures) {
+                    break;
+                }
+            }
+            _elapsed_ns.store(duration_cast<nanoseconds>(clock::now() - _start).count(),
+                              std::memory_order_relaxed);
+
+            if (_config.MaxTriggers > 0
+                and _issued.load(std::memory_order_relaxed) >= _config.MaxTriggers) {
+                break;
+            }
+
+            // Next deadline. Always from the schedule, not from now,
+            // so the rate does not drift.
+            switch (_config.Pattern) {
+            case CAENTriggerPattern::Poisson:
+                next += duration_cast<nanoseconds>(dseconds(exp_dist(rng)));
+            break;
+            case CAENTriggerPattern::Burst:
+                if (++in_burst >= _config.BurstSize) {
+                    in_burst = 0;
+                    burst_start += burst_period;
+                    next = burst_start;
+                } else {
+                    next += period;
+                }
+            break;
+            case CAENTriggerPattern::Periodic:
+            default:
+                next += period;
+            break;
+            }
+
+            // If we are more than one period behind, restart the schedule.
+            if (clock::now() - next > period) {
+                _late.fetch_add(1, std::memory_order_relaxed);
+                next = clock::now();
+                burst_start = next;
+                in_burst = 0;
+            }
+        }
+
+        _elapsed_ns.store(duration_cast<nanoseconds>(clock::now() - _start).count(),
+                          std::memory_order_relaxed);
+        _running.store(false, std::memory_order_relaxed);
+    }
+
+ public:
+    CAENSoftwareTriggerPacer(const CAENSoftwareTriggerConfig& config,
+                             TriggerFunc trigger) :
+        _config{config},
+        _trigger{std::move(trigger)}
+    {
+        if (not _trigger) {
+            throw std::invalid_argument("Trigger function is empty.");
+        }
+        if (not (_config.Rate >= kMinRate)) {
+            throw std::invalid_argument("Trigger rate must be at least "
+                                        "1e-6 Hz.");
+        }
+        if (_config.Pattern == CAENTriggerPattern::Burst
+            and (not (_config.BurstRate >= kMinRate) or _config.BurstSize == 0)) {
+            throw std::invalid_argument("Burst rate must be at least 1e-6 Hz "
+                                        "and burst size positive.");
+        }
+
+        _start = clock::now();
+        _thread = std::thread(&CAENSoftwareTriggerPacer::_loop, this);
+    }
+
+    CAENSoftwareTriggerPacer(const CAENSoftwareTriggerPacer&) = delete;
+    CAENSoftwareTriggerPacer& operator=(const CAENSoftwareTriggerPacer&) = delete;
+
+    ~CAENSoftwareTriggerPacer() {
+        stop();
+    }
+
+    // Stops and joins the thread. Safe to call more than once.
+    void stop() noexcept {
+        {
+            // Under the lock so the thread can not miss the notification
+            // between checking _running and going to sleep
+            std::lock_guard<std::mutex> lock(_mtx);
+            _running.store(false, std::memory_order_relaxed);
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    // False after stop() or if the pacer stopped by itself.
+    bool isRunning() const noexcept {
+        return _running.load(std::memory_order_relaxed);
+    }
+
+    const CAENSoftwareTriggerConfig& getConfig() const noexcept {
+        return _config;
+    }
+
+    CAENSoftwareTriggerStats getStats() const noexcept {
+        CAENSoftwareTriggerStats out;
+        out.Issued = _issued.load(std::memory_order_relaxed);
+        out.Failed = _failed.load(std::memory_order_relaxed);
+        out.Late = _late.load(std::memory_order_relaxed);
+        out.MaxLatenessNs = _max_lateness_ns.load(std::memory_order_relaxed);
+        out.ElapsedSeconds = 1e-9*_elapsed_ns.load(std::memory_order_relaxed);
+        if (out.ElapsedSeconds > 0.0) {
+            out.AchievedRate = out.Issued / out.ElapsedSeconds;
+        }
+        return out;
+    }
+};
+
+}  // namespace RedDigitizer
+
+#endif
@@ -3,9 +3,77 @@
 #include <pybind11/numpy.h>
 #include <span>
 #include "include/RedDigitizer++/red_digitizer_helper.hpp"
+#include "include/RedDigitizer++/histogram_helpers.hpp"
+#include "include/RedDigitizer++/timing_helpers.hpp"
+#include "include/RedDigitizer++/spectrum_helpers.hpp"
+#include "include/RedDigitizer++/batch_helpers.hpp"
+#include "include/RedDigitizer++/packing_helpers.hpp"
+#include "include/RedDigitizer++/filter_helpers.hpp"
+#include "include/RedDigitizer++/pipeline_helpers.hpp"
+#include "include/RedDigitizer++/file_helpers.hpp"
+#include <chrono>
+#include <thread>
 
 namespace py = pybind11;
 
+// The module uses the arena allocator for the waveforms. Until UseArena(...)
+// is called it has no arena and allocates from the heap as usual.
+using PyCAEN = RedDigitizer::CAEN<RedDigitizer::iostream_wrapper, 1024,
+                                  RedDigitizer::CAENArenaAllocator<uint16_t>>;
+using PyCAENWaveforms = RedDigitizer::CAENWaveforms<uint16_t,
+                                  RedDigitizer::CAENArenaAllocator<uint16_t>>;
+
+py::dict arena_footprint_to_dict(const RedDigitizer::CAENArenaFootprint& footprint) {
+    py::dict out;
+    out["Reserved"] = footprint.Reserved;
+    out["Used"] = footprint.Used;
+    out["Live"] = footprint.Live;
+    out["Peak"] = footprint.Peak;
+    out["Blocks"] = footprint.Blocks;
+    out["ExplicitHugePageBlocks"] = footprint.ExplicitHugePageBlocks;
+    out["TransparentHugePageBlocks"] = footprint.TransparentHugePageBlocks;
+    out["Prefaulted"] = footprint.Prefaulted;
+    return out;
+}
+
+// Wraps a read-only buffer into a NumPy array without copying. base keeps
+// the owner of the memory alive while the array exists.
+template<typename T>
+py::array make_readonly_view(const T* data, py::array::ShapeContainer shape,
+                             py::handle base) {
+    py::array out(py::dtype::of<T>(), std::move(shape), data, base);
+    out.attr("setflags")(py::arg("write") = false);
+    return out;
+}
+
+// Same as above for a strided buffer, strides in bytes
+template<typename T>
+py::array make_readonly_view(const T* data, py::array::ShapeContainer shape,
+                             py::array::StridesContainer strides, py::handle base) {
+    py::array out(py::dtype::of<T>(), std::move(shape), std::move(strides), data, base);
+    out.attr("setflags")(py::arg("write") = false);
+    return out;
+}
+
+// Turns a shared ring batch into a dict of NumPy views into the ring
+py::dict shared_batch_to_dict(const RedDigitizer::CAENSharedBatchView& view, py::handle base) {
+    const auto n = static_cast<py::ssize_t>(view.NumEvents);
+    py::dict out;
+    out["Sequence"] = view.Sequence;
+    out["Channels"] = make_readonly_view(view.Channels.data(),
+        {static_cast<py::ssize_t>(view.NumChannels)}, base);
+    out["EventCounter"] = make_readonly_view(view.EventCounter.data(), {n}, base);
+    out["EventSize"] = make_readonly_view(view.EventSize.data(), {n}, base);
+    out["BoardId"] = make_readonly_view(view.BoardId.data(), {n}, base);
+    out["Pattern"] = make_readonly_view(view.Pattern.data(), {n}, base);
+    out["ChannelMask"] = make_readonly_view(view.ChannelMask.data(), {n}, base);
+    out["TriggerTimeTag"] = make_readonly_view(view.TriggerTimeTag.data(), {n}, base);
+    out["Waveforms"] = make_readonly_view(view.Waveforms.data(),
+        {n, static_cast<py::ssize_t>(view.NumChannels),
+         static_cast<py::ssize_t>(view.RecordLength)}, base);
+    return out;
+}
+
 struct CAEN_DGTZ_UINT16_EVENT_Python {
     std::vector<uint32_t> ch_size;
     std::vector<std::vector<uint16_t>> data_channel;
@@ -23,6 +91,524 @@ CAEN_DGTZ_UINT16_EVENT_Python convertToPythonData(const CAEN_DGTZ_UINT16_EVENT_t
     return pyData;
 }
 
+// A batch handed out by CAEN.stream(...). Its arrays are views into a
+// pooled buffer. Every array shares the handle, so the buffer goes back
+// to the pool only once this object is released (or garbage collected)
+// and no array taken from it is left.
+struct PyCAENStreamBatch {
+    std::shared_ptr<RedDigitizer::CAENBatchHandle> Handle;
+
+    explicit PyCAENStreamBatch(RedDigitizer::CAENBatchHandle&& handle) :
+        Handle{std::make_shared<RedDigitizer::CAENBatchHandle>(std::move(handle))} { }
+
+    RedDigitizer::CAENBatch& get() {
+        if (not Handle) {
+            throw std::runtime_error("Batch was already released.");
+        }
+        return **Handle;
+    }
+};
+
+// Iterator returned by CAEN.stream(...). Each step waits for batch_events
+// events, decodes them and copies them into a free buffer of a fixed pool.
+class PyCAENStream {
+    std::shared_ptr<PyCAEN> _caen;
+    std::shared_ptr<RedDigitizer::CAENBatchPool> _pool;
+    uint32_t _batch_events = 0;
+    // In seconds. Negative -> waits forever
+    double _timeout = -1.0;
+    double _poll_interval = 1e-3;
+    // Events of the latest decode already handed out. A read can return
+    // more events than a batch holds, the rest go in the next batches.
+    std::size_t _handed_out = 0;
+
+ public:
+    PyCAENStream(std::shared_ptr<PyCAEN> caen,
+                 uint32_t batch_events, std::size_t n_buffers,
+                 double timeout, double poll_interval) :
+        _caen{std::move(caen)},
+        _batch_events{batch_events},
+        _timeout{timeout},
+        _poll_interval{poll_interval}
+    {
+        if (batch_events == 0 or n_buffers == 0) {
+            throw std::invalid_argument("batch_events and n_buffers must be positive.");
+        }
+        if (_caen->GetCurrentPossibleMaxBuffer() == 0 or not _caen->GetWaveform(0)) {
+            throw std::runtime_error("Call EnableAcquisition() before stream().");
+        }
+
+        // A single read can return up to MaxEventsPerRead events
+        auto first = _caen->GetWaveform(0);
+        const uint32_t capacity = std::max(batch_events,
+            _caen->GetGlobalConfiguration().MaxEventsPerRead);
+        _pool = RedDigitizer::CAENBatchPool::create(n_buffers,
+            std::min<uint32_t>(capacity, 1024),
+            static_cast<uint32_t>(first->getNumEnabledChannels()),
+            first->getRecordLength());
+        // Only events decoded from now on
+        _handed_out = _caen->GetWaveformsView().size();
+    }
+
+    std::size_t available() {
+        return _pool->available();
+    }
+
+    PyCAENStreamBatch next() {
+        // Take the buffer first so no data is read if there is nowhere
+        // to put it.
+        auto handle = _pool->acquire();
+        if (not handle) {
+            throw std::runtime_error("All stream buffers are in use. Release "
+                                     "old batches (del or release()) and the "
+                                     "arrays taken from them, or use more "
+                                     "n_buffers.");
+        }
+
+        const auto pending = _caen->GetWaveformsView();
+        if (_handed_out < pending.size()) {
+            {
+                py::gil_scoped_release release;
+                _handed_out += handle->fill(pending.subspan(_handed_out));
+            }
+            return PyCAENStreamBatch{std::move(handle)};
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        while (true) {
+            bool retrieved = false;
+            {
+                py::gil_scoped_release release;
+                retrieved = _caen->RetrieveDataUntilNEvents(_batch_events);
+                if (retrieved) {
+                    _caen->DecodeEvents();
+                    _handed_out = handle->fill(_caen->GetWaveformsView());
+                }
+            }
+
+            if (retrieved) {
+                return PyCAENStreamBatch{std::move(handle)};
+            }
+
+            if (_caen->HasError()) {
+                throw py::stop_iteration();
+            }
+
+            const std::chrono::duration<double> elapsed
+                = std::chrono::steady_clock::now() - start;
+            if (_timeout >= 0.0 and elapsed.count() > _timeout) {
+                throw py::stop_iteration();
+            }
+
+            // Lets Ctrl+C stop the loop
+            if (PyErr_CheckSignals() != 0) {
+                throw py::error_already_set();
+            }
+
+            py::gil_scoped_release release;
+            std::this_thread::sleep_for(std::chrono::duration<double>(_poll_interval));
+        }
+    }
+};
+
+// Returned by CAEN.pipeline(...). A readout thread drains the digitizer
+// into a CAENPipeline and iterating pops its batches. Stops once the
+// readout ended (Stop() or a digitizer error) and the queue is empty.
+class PyCAENPipeline {
+    std::shared_ptr<RedDigitizer::CAENPipeline> _pipeline;
+    std::unique_ptr<RedDigitizer::CAENReadoutThread<PyCAEN>> _readout;
+    // In seconds. Negative -> waits forever
+    double _timeout = -1.0;
+
+ public:
+    PyCAENPipeline(std::shared_ptr<PyCAEN> caen,
+                   const RedDigitizer::CAENPipelineConfig& config,
+                   uint32_t batch_events, double timeout, double poll_interval) :
+        _timeout{timeout}
+    {
+        if (caen->GetCurrentPossibleMaxBuffer() == 0 or not caen->GetWaveform(0)) {
+            throw std::runtime_error("Call EnableAcquisition() before pipeline().");
+        }
+
+        auto first = caen->GetWaveform(0);
+        _pipeline = std::make_shared<RedDigitizer::CAENPipeline>(config,
+            static_cast<uint32_t>(first->getNumEnabledChannels()),
+            first->getRecordLength());
+        _readout = std::make_unique<RedDigitizer::CAENReadoutThread<PyCAEN>>(
+            std::move(caen), _pipeline, batch_events, poll_interval);
+    }
+
+    PyCAENStreamBatch next() {
+        const auto start = std::chrono::steady_clock::now();
+        while (true) {
+            RedDigitizer::CAENBatchHandle handle;
+            {
+                py::gil_scoped_release release;
+                handle = _pipeline->pop(std::chrono::milliseconds(50));
+            }
+            if (handle) {
+                return PyCAENStreamBatch{std::move(handle)};
+            }
+
+            if (_pipeline->isDone()) {
+                throw py::stop_iteration();
+            }
+
+            const std::chrono::duration<double> elapsed
+                = std::chrono::steady_clock::now() - start;
+            if (_timeout >= 0.0 and elapsed.count() > _timeout) {
+                throw py::stop_iteration();
+            }
+
+            // Lets Ctrl+C stop the loop
+            if (PyErr_CheckSignals() != 0) {
+                throw py::error_already_set();
+            }
+        }
+    }
+
+    // Stops the readout thread. Queued batches can still be iterated.
+    void stop() {
+        py::gil_scoped_release release;
+        _readout->stop();
+    }
+
+    bool isRunning() const {
+        return _readout->isRunning();
+    }
+
+    RedDigitizer::CAENPipelineStats getStats() {
+        return _pipeline->getStats();
+    }
+};
+
+// View of a column of a stream batch. The array holds a share of the
+// batch handle, so the buffer is not recycled while the array exists.
+template<typename T>
+py::array_t<T> stream_batch_view(PyCAENStreamBatch& batch, std::vector<T>& column,
+                                 py::array::ShapeContainer shape) {
+    using Owner = std::shared_ptr<RedDigitizer::CAENBatchHandle>;
+    py::capsule base(new Owner(batch.Handle), [](void* owner) {
+        delete static_cast<Owner*>(owner);
+    });
+    return py::array_t<T>(std::move(shape), column.data(), base);
+}
+
+// Binds CAENPackedWaveforms<Bits> as name. Samples come back unpacked as
+// uint16 NumPy arrays.
+template<uint32_t Bits>
+void bind_packed_waveforms(py::module_& m, const char* name) {
+    using Packed = RedDigitizer::CAENPackedWaveforms<Bits>;
+    py::class_<Packed, std::shared_ptr<Packed>>(m, name)
+        .def("GetRecordLength", &Packed::getRecordLength)
+        .def("GetTotalSize", &Packed::getTotalSize)
+        .def("GetPackedSize", &Packed::getPackedSize)
+        .def("GetNumEnabledChannels", &Packed::getNumEnabledChannels)
+        .def("GetEnabledChannels", &Packed::getEnabledChannels)
+        .def("GetInfo", &Packed::getInfo, py::return_value_policy::copy)
+        .def("GetChannel", [](const Packed& self, std::size_t ch_index) {
+            if (ch_index >= self.getNumEnabledChannels()) {
+                throw py::index_error("Channel index out of range.");
+            }
+            py::array_t<uint16_t> out(self.getRecordLength());
+            self.getChannel(ch_index, std::span<uint16_t>(out.mutable_data(), out.size()));
+            return out;
+        }, py::arg("ch_index"))
+        // [channel, sample]
+        .def("GetData", [](const Packed& self) {
+            py::array_t<uint16_t> out({static_cast<py::ssize_t>(self.getNumEnabledChannels()),
+                                       static_cast<py::ssize_t>(self.getRecordLength())});
+            self.unpack(std::span<uint16_t>(out.mutable_data(), out.size()));
+            return out;
+        })
+        ;
+}
+
+// Packs every decoded event of caen with Bits bits per sample
+template<uint32_t Bits>
+py::list pack_waveforms(PyCAEN& caen) {
+    using Packed = RedDigitizer::CAENPackedWaveforms<Bits>;
+    std::vector<std::shared_ptr<Packed>> packed;
+    {
+        py::gil_scoped_release release;
+        const auto waveforms = caen.GetWaveformsView();
+        packed.reserve(waveforms.size());
+        for (const auto& waveform : waveforms) {
+            // Same channels as the decoded event, e.g. a readout subset
+            auto event = std::make_shared<Packed>(caen.ModelConstants,
+                caen.GetGlobalConfiguration(), caen.GetGroupConfigurations(),
+                waveform ? waveform->getEnabledChannels() : std::vector<std::size_t>{});
+            if (waveform) {
+                event->copy(*waveform);
+            }
+            packed.push_back(std::move(event));
+        }
+    }
+
+    py::list out;
+    for (auto& event : packed) {
+        out.append(py::cast(std::move(event)));
+    }
+    return out;
+}
+
+// With pile-up detection on, adds "Pulses" ([channel, event], a copy if
+// out has no "Pulses" yet) and "PileUp" (Pulses > 1) to out.
+void add_pileup_flags(py::dict& out, const RedDigitizer::CAENEventInfoTable& table) {
+    const std::size_t num_channels = table.numPulseChannels();
+    if (num_channels == 0) {
+        return;
+    }
+    const std::size_t n = table.size();
+    if (not out.contains("Pulses")) {
+        py::array_t<uint32_t> pulses({num_channels, n});
+        for (std::size_t ch = 0; ch < num_channels; ch++) {
+            const auto column = table.pulses(ch);
+            std::copy(column.begin(), column.end(), pulses.mutable_data() + ch*n);
+        }
+        out["Pulses"] = pulses;
+    }
+    py::array_t<bool> pile_up({num_channels, n});
+    bool* flags = pile_up.mutable_data();
+    for (std::size_t ch = 0; ch < num_channels; ch++) {
+        for (std::size_t i = 0; i < n; i++) {
+            flags[ch*n + i] = table.isPiledUp(ch, i);
+        }
+    }
+    out["PileUp"] = pile_up;
+}
+
+// Copies the columns of table into a single [columns, events] array and
+// returns its rows as a dict keyed by column name.
+py::dict event_table_to_dict(const RedDigitizer::CAENEventInfoTable& table) {
+    const std::size_t n = table.size();
+    py::array_t<uint32_t> block({RedDigitizer::kNumEventColumns, n});
+    uint32_t* dst = block.mutable_data();
+    py::dict out;
+    for (std::size_t c = 0; c < RedDigitizer::kNumEventColumns; c++) {
+        const auto column = table.column(static_cast<RedDigitizer::CAENEventColumn>(c));
+        std::copy(column.begin(), column.end(), dst + c*n);
+        out[py::str(RedDigitizer::kEventColumnNames[c].data())]
+            = block[py::int_(c)];
+    }
+    add_pileup_flags(out, table);
+    return out;
+}
+
+// Turns a chunk of a mapped run file into a dict of NumPy views into the
+// mapping. base keeps the mapping alive.
+py::dict run_chunk_to_dict(const RedDigitizer::CAENRunChunkView& chunk, py::handle base) {
+    const auto n = static_cast<py::ssize_t>(chunk.NumEvents);
+    py::dict out;
+    out["FirstEvent"] = chunk.FirstEvent;
+    for (std::size_t c = 0; c < RedDigitizer::kNumEventColumns; c++) {
+        out[py::str(RedDigitizer::kEventColumnNames[c].data())]
+            = make_readonly_view(chunk.Columns[c].data(), {n}, base);
+    }
+    out["ExtendedCounter"] = make_readonly_view(chunk.ExtendedCounter.data(), {n}, base);
+    out["ExtendedTriggerTimeTag"] = make_readonly_view(
+        chunk.ExtendedTriggerTimeTag.data(), {n}, base);
+    const auto rl = static_cast<py::ssize_t>(chunk.RecordLength);
+    out["Waveforms"] = make_readonly_view(chunk.Samples,
+        {static_cast<py::ssize_t>(chunk.NumChannels), n, rl},
+        {static_cast<py::ssize_t>(sizeof(uint16_t)*chunk.ChannelStride),
+         static_cast<py::ssize_t>(sizeof(uint16_t))*rl,
+         static_cast<py::ssize_t>(sizeof(uint16_t))}, base);
+    return out;
+}
+
+// Builds the dict of CAEN.GetDataDict() for events. Every output array is
+// allocated first, then a single pass over the events (without the GIL)
+// fills the waveforms, the event info columns and the remapped trigger
+// source. Only the read out channels that are in subset (CAEN numbers, all
+// if empty) are exported.
+py::dict events_data_dict(PyCAEN& self,
+                          std::span<const std::shared_ptr<PyCAENWaveforms>> events,
+                          const std::vector<std::size_t>& subset = {}) {
+    const auto& group_configs = self.GetGroupConfigurations();
+    const std::size_t n = events.size();
+    const auto first = std::find_if(events.begin(), events.end(),
+        [](const auto& event) { return static_cast<bool>(event); });
+    const std::vector<std::size_t> ch_numbers = RedDigitizer::select_channels(
+        first != events.end() ? (*first)->getEnabledChannels()
+            : RedDigitizer::select_channels(RedDigitizer::get_enabled_channels(
+                self.ModelConstants, group_configs), self.GetReadoutChannels()),
+        subset);
+    const std::size_t channels = ch_numbers.size();
+    const std::size_t record_length = self.GetGlobalConfiguration().RecordLength;
+    const std::size_t event_samples = channels*record_length;
+
+    py::array_t<uint16_t> waveforms({n, channels, record_length});
+    py::array_t<uint32_t> event_counter(n);
+    py::array_t<uint32_t> trigger_source(n);
+    py::array_t<uint32_t> group_mask(n);
+    py::array_t<uint32_t> trigger_time_tag(n);
+    {
+        uint16_t* wf = waveforms.mutable_data();
+        uint32_t* ec = event_counter.mutable_data();
+        uint32_t* ts = trigger_source.mutable_data();
+        uint32_t* gm = group_mask.mutable_data();
+        uint32_t* ttt = trigger_time_tag.mutable_data();
+
+        py::gil_scoped_release release;
+        std::vector<std::size_t> ch_indexes(channels);
+        for (std::size_t i = 0; i < n; i++) {
+            const auto& event = events[i];
+            uint16_t* dst = wf + i*event_samples;
+            bool missing = not event or event->getRecordLength() != record_length;
+            for (std::size_t ch = 0; ch < channels and not missing; ch++) {
+                ch_indexes[ch] = event->findChannel(ch_numbers[ch]);
+                missing = ch_indexes[ch] >= event->getNumEnabledChannels();
+            }
+            if (missing) {
+                std::fill_n(dst, event_samples, 0);
+                ec[i] = ts[i] = gm[i] = ttt[i] = 0;
+                continue;
+            }
+            for (std::size_t ch = 0; ch < channels; ch++) {
+                const auto samples = event->getChannel(ch_indexes[ch]);
+                std::copy(samples.begin(), samples.end(), dst + ch*record_length);
+            }
+
+            const auto& info = event->getInfo();
+            ec[i] = info.EventCounter;
+            ts[i] = RedDigitizer::remap_trigger_source(info.Pattern);
+            gm[i] = info.ChannelMask;
+            ttt[i] = info.TriggerTimeTag;
+        }
+    }
+
+    uint32_t trig_mask = 0;
+    uint32_t acq_mask = 0;
+    int ch_per_group = self.ModelConstants.NumChannelsPerGroup;
+    if (self.ModelConstants.NumberOfGroups == 0) {
+        trig_mask = group_configs[0].TriggerMask.get();
+        acq_mask = group_configs[0].AcquisitionMask.get();
+    } else {
+        for (int group = 0; group < self.ModelConstants.NumberOfGroups; group++) {
+            if (group_configs[group].Enabled) {
+                trig_mask |= group_configs[group].TriggerMask.get() << (group * ch_per_group);
+                acq_mask |= group_configs[group].AcquisitionMask.get() << (group * ch_per_group);
+            }
+        }
+    }
+
+    py::dict out;
+    out["EventCounter"] = event_counter;
+    out["TriggerSource"] = trigger_source;
+    out["GroupMask"] = group_mask;
+    out["TriggerMask"] = trig_mask;
+    out["AcquisitionMask"] = acq_mask;
+    out["TriggerTimeTag"] = trigger_time_tag;
+    out["Channels"] = ch_numbers;
+    out["Waveforms"] = waveforms;
+    return out;
+}
+
+py::dict data_dict(PyCAEN& self, const std::vector<std::size_t>& channels) {
+    return events_data_dict(self, self.GetWaveformsView(), channels);
+}
+
+// Sample-major waveforms of the latest decoded events as
+// [events, samples, channels]. Empty unless the layout is SampleMajor.
+py::array_t<uint16_t> sample_major_waveforms(PyCAEN& self) {
+    const auto events = self.GetInterleavedWaveformsView();
+    const std::size_t n = events.size();
+    const std::size_t channels = n > 0 ? events[0]->getNumEnabledChannels() : 0;
+    const std::size_t record_length = self.GetGlobalConfiguration().RecordLength;
+    const std::size_t event_samples = channels*record_length;
+
+    py::array_t<uint16_t> out({n, record_length, channels});
+    uint16_t* dst = out.mutable_data();
+    py::gil_scoped_release release;
+    for (std::size_t i = 0; i < n; i++, dst += event_samples) {
+        const auto data = events[i]->getData();
+        if (data.size() != event_samples) {
+            std::fill_n(dst, event_samples, 0);
+            continue;
+        }
+        std::copy(data.begin(), data.end(), dst);
+    }
+    return out;
+}
+
+// The latest decoded waveforms in volts, [events, channels, samples],
+// converted with GetCalibration(). T is float for float32 or uint16_t for
+// the bits of float16. Written into out if it is not None, that must be
+// a writeable C-contiguous array of that shape and dtype.
+template<typename T>
+py::array waveforms_to_volts(PyCAEN& self, const py::dtype& dtype, const py::object& out) {
+    const auto events = self.GetWaveformsView();
+    const auto calibration = self.GetCalibration();
+    const std::size_t n = events.size();
+    const std::size_t channels = n > 0 ? events[0]->getNumEnabledChannels() : 0;
+    const std::size_t record_length = self.GetGlobalConfiguration().RecordLength;
+    const std::size_t event_samples = channels*record_length;
+    const std::vector<py::ssize_t> shape = {static_cast<py::ssize_t>(n),
+        static_cast<py::ssize_t>(channels), static_cast<py::ssize_t>(record_length)};
+
+    py::array volts;
+    if (out.is_none()) {
+        volts = py::array(dtype, shape);
+    } else {
+        if (not py::isinstance<py::array>(out)) {
+            throw py::type_error("out must be a NumPy array.");
+        }
+        volts = out.cast<py::array>();
+        const bool same_shape = volts.ndim() == 3 and volts.shape(0) == shape[0]
+            and volts.shape(1) == shape[1] and volts.shape(2) == shape[2];
+        if (not volts.dtype().equal(dtype) or not same_shape
+            or not (volts.flags() & py::array::c_style) or not volts.writeable()) {
+            throw py::value_error("out must be a writeable C-contiguous array "
+                                  "of shape (events, channels, samples) and the "
+                                  "requested dtype.");
+        }
+    }
+
+    T* dst = static_cast<T*>(volts.mutable_data());
+    py::gil_scoped_release release;
+    for (std::size_t i = 0; i < n; i++) {
+        std::span<T> event_out(dst + i*event_samples, event_samples);
+        if (events[i]->getTotalSize() != event_samples) {
+            std::fill(event_out.begin(), event_out.end(), T{});
+            continue;
+        }
+        if constexpr (std::is_same_v<T, float>) {
+            calibration.toVolts(*events[i], event_out);
+        } else {
+            calibration.toVoltsHalf(*events[i], event_out);
+        }
+    }
+    return volts;
+}
+
+// Sum of all channels ([events, samples]) or of each group of
+// group_channels channels ([events, samples, groups]) of the latest
+// decoded events, computed on the sample-major copies.
+py::array_t<uint32_t> channel_sums(PyCAEN& self, const std::size_t& group_channels) {
+    const auto events = self.GetInterleavedWaveformsView();
+    const std::size_t n = events.size();
+    const std::size_t channels = n > 0 ? events[0]->getNumEnabledChannels() : 0;
+    const std::size_t record_length = self.GetGlobalConfiguration().RecordLength;
+    const std::size_t groups = group_channels > 0 ? channels / group_channels : 1;
+
+    py::array_t<uint32_t> out = group_channels > 0 ?
+        py::array_t<uint32_t>({n, record_length, groups}) :
+        py::array_t<uint32_t>({n, record_length});
+    uint32_t* dst = out.mutable_data();
+    py::gil_scoped_release release;
+    for (std::size_t i = 0; i < n; i++) {
+        std::span<uint32_t> event_out(dst + i*record_length*groups, record_length*groups);
+        std::fill(event_out.begin(), event_out.end(), 0);
+        if (group_channels > 0) {
+            events[i]->sumGroups(event_out, group_channels);
+        } else {
+            events[i]->sumChannels(event_out);
+        }
+    }
+    return out;
+}
+
 PYBIND11_MODULE(red_caen, m) {
     m.doc() = "Python bindings for RedDigitizer++";
     m.attr("__version__") = VERSION;
@@ -36,7 +622,8 @@ PYBIND11_MODULE(red_caen, m) {
         .def_readonly("NumChannelsPerGroup", &RedDigitizer::CAENDigitizerModelConstants::NumChannelsPerGroup)
         .def_readonly("MaxNumBuffers", &RedDigitizer::CAENDigitizerModelConstants::MaxNumBuffers)
         .def_readonly("NLOCToRecordLength", &RedDigitizer::CAENDigitizerModelConstants::NLOCToRecordLength)
-        .def_readonly("VoltageRanges", &RedDigitizer::CAENDigitizerModelConstants::VoltageRanges);
+        .def_readonly("VoltageRanges", &RedDigitizer::CAENDigitizerModelConstants::VoltageRanges)
+        .def_readonly("TriggerTimeTagLSB", &RedDigitizer::CAENDigitizerModelConstants::TriggerTimeTagLSB);
 
     // Bind the getter function to access the map as a dictionary
     m.def("GetCAENDigitizerModelConstants", &RedDigitizer::GetCAENDigitizerModelConstants);
@@ -115,6 +702,264 @@ PYBIND11_MODULE(red_caen, m) {
         .value("TTL", CAEN_DGTZ_IOLevel_t::CAEN_DGTZ_IOLevel_TTL)
         ;
     
+    py::enum_<RedDigitizer::CAENTriggerPattern>(m, "CAENTriggerPattern")
+        .value("Periodic", RedDigitizer::CAENTriggerPattern::Periodic)
+        .value("Poisson", RedDigitizer::CAENTriggerPattern::Poisson)
+        .value("Burst", RedDigitizer::CAENTriggerPattern::Burst)
+        ;
+
+    py::class_<RedDigitizer::CAENSoftwareTriggerConfig>(m, "CAENSoftwareTriggerConfig")
+        .def(py::init<>())
+        .def_readwrite("Pattern", &RedDigitizer::CAENSoftwareTriggerConfig::Pattern)
+        .def_readwrite("Rate", &RedDigitizer::CAENSoftwareTriggerConfig::Rate)
+        .def_readwrite("BurstSize", &RedDigitizer::CAENSoftwareTriggerConfig::BurstSize)
+        .def_readwrite("BurstRate", &RedDigitizer::CAENSoftwareTriggerConfig::BurstRate)
+        .def_readwrite("MaxTriggers", &RedDigitizer::CAENSoftwareTriggerConfig::MaxTriggers)
+        .def_readwrite("Seed", &RedDigitizer::CAENSoftwareTriggerConfig::Seed)
+        .def_readwrite("SpinMicroseconds", &RedDigitizer::CAENSoftwareTriggerConfig::SpinMicroseconds)
+        ;
+
+    py::class_<RedDigitizer::CAENSoftwareTriggerStats>(m, "CAENSoftwareTriggerStats")
+        .def_readonly("Issued", &RedDigitizer::CAENSoftwareTriggerStats::Issued)
+        .def_readonly("Failed", &RedDigitizer::CAENSoftwareTriggerStats::Failed)
+        .def_readonly("Late", &RedDigitizer::CAENSoftwareTriggerStats::Late)
+        .def_readonly("MaxLatenessNs", &RedDigitizer::CAENSoftwareTriggerStats::MaxLatenessNs)
+        .def_readonly("ElapsedSeconds", &RedDigitizer::CAENSoftwareTriggerStats::ElapsedSeconds)
+        .def_readonly("AchievedRate", &RedDigitizer::CAENSoftwareTriggerStats::AchievedRate)
+        .def("__str__", [](const RedDigitizer::CAENSoftwareTriggerStats &stats) {
+            std::ostringstream oss;
+            oss << "Software Trigger Stats:\n"
+                << "  Issued: \t\t" << stats.Issued << "\n"
+                << "  Failed: \t\t" << stats.Failed << "\n"
+                << "  Late: \t\t" << stats.Late << "\n"
+                << "  MaxLatenessNs: \t" << stats.MaxLatenessNs << "\n"
+                << "  ElapsedSeconds: \t" << stats.ElapsedSeconds << "\n"
+                << "  AchievedRate: \t" << stats.AchievedRate << "\n";
+            return oss.str();
+        })
+        ;
+
+    py::enum_<RedDigitizer::CAENWaveformsLayout>(m, "CAENWaveformsLayout")
+        .value("ChannelMajor", RedDigitizer::CAENWaveformsLayout::ChannelMajor)
+        .value("SampleMajor", RedDigitizer::CAENWaveformsLayout::SampleMajor)
+        ;
+
+    py::enum_<RedDigitizer::CAENTriggerStream>(m, "CAENTriggerStream")
+        .value("Software", RedDigitizer::CAENTriggerStream::Software)
+        .value("External", RedDigitizer::CAENTriggerStream::External)
+        .value("SelfTrigger", RedDigitizer::CAENTriggerStream::SelfTrigger)
+        ;
+
+    py::class_<RedDigitizer::CAENTriggerRouterConfig>(m, "CAENTriggerRouterConfig")
+        .def(py::init<>())
+        // [Software, External, SelfTrigger]. 0 drops the stream.
+        .def_readwrite("Prescale", &RedDigitizer::CAENTriggerRouterConfig::Prescale)
+        .def_readwrite("SoftwareMask", &RedDigitizer::CAENTriggerRouterConfig::SoftwareMask)
+        .def_readwrite("ExternalMask", &RedDigitizer::CAENTriggerRouterConfig::ExternalMask)
+        // [Software, External, SelfTrigger] lists of CAEN channels
+        .def_readwrite("Channels", &RedDigitizer::CAENTriggerRouterConfig::Channels)
+        ;
+
+    py::class_<RedDigitizer::CAENTriggerStreamStats>(m, "CAENTriggerStreamStats")
+        .def_readonly("Events", &RedDigitizer::CAENTriggerStreamStats::Events)
+        .def_readonly("Routed", &RedDigitizer::CAENTriggerStreamStats::Routed)
+        .def_readonly("Prescaled", &RedDigitizer::CAENTriggerStreamStats::Prescaled)
+        .def_readonly("SinkErrors", &RedDigitizer::CAENTriggerStreamStats::SinkErrors)
+        .def("__str__", [](const RedDigitizer::CAENTriggerStreamStats &stats) {
+            std::ostringstream oss;
+            oss << "Trigger Stream Stats:\n"
+                << "  Events: \t\t" << stats.Events << "\n"
+                << "  Routed: \t\t" << stats.Routed << "\n"
+                << "  Prescaled: \t\t" << stats.Prescaled << "\n"
+                << "  SinkErrors: \t\t" << stats.SinkErrors << "\n";
+            return oss.str();
+        })
+        ;
+
+    py::class_<RedDigitizer::CAENCoincidenceCondition>(m, "CAENCoincidenceCondition")
+        .def(py::init<>())
+        .def(py::init([](const std::string& name, const std::vector<std::size_t>& channels,
+                         uint32_t multiplicity, uint32_t threshold, uint32_t window) {
+            return RedDigitizer::CAENCoincidenceCondition{name, channels, multiplicity,
+                                                          threshold, window};
+        }), py::arg("name"), py::arg("channels"), py::arg("multiplicity") = 2,
+            py::arg("threshold") = 50, py::arg("window") = 16)
+        .def_readwrite("Name", &RedDigitizer::CAENCoincidenceCondition::Name)
+        .def_readwrite("Channels", &RedDigitizer::CAENCoincidenceCondition::Channels)
+        .def_readwrite("Multiplicity", &RedDigitizer::CAENCoincidenceCondition::Multiplicity)
+        .def_readwrite("Threshold", &RedDigitizer::CAENCoincidenceCondition::Threshold)
+        .def_readwrite("Window", &RedDigitizer::CAENCoincidenceCondition::Window)
+        ;
+
+    py::class_<RedDigitizer::CAENCoincidenceConfig>(m, "CAENCoincidenceConfig")
+        .def(py::init<>())
+        .def_readwrite("Conditions", &RedDigitizer::CAENCoincidenceConfig::Conditions)
+        .def_readwrite("RequireAll", &RedDigitizer::CAENCoincidenceConfig::RequireAll)
+        .def_readwrite("BaselineSamples", &RedDigitizer::CAENCoincidenceConfig::BaselineSamples)
+        .def_readwrite("NegativePolarity", &RedDigitizer::CAENCoincidenceConfig::NegativePolarity)
+        ;
+
+    py::class_<RedDigitizer::CAENCoincidenceStats>(m, "CAENCoincidenceStats")
+        .def_readonly("Events", &RedDigitizer::CAENCoincidenceStats::Events)
+        .def_readonly("Kept", &RedDigitizer::CAENCoincidenceStats::Kept)
+        .def_readonly("Passed", &RedDigitizer::CAENCoincidenceStats::Passed)
+        .def("__str__", [](const RedDigitizer::CAENCoincidenceStats &stats) {
+            std::ostringstream oss;
+            oss << "Coincidence Stats:\n"
+                << "  Events: \t\t" << stats.Events << "\n"
+                << "  Kept: \t\t" << stats.Kept << "\n"
+                << "  Passed: \t\t";
+            for (const auto& passed : stats.Passed) {
+                oss << passed << " ";
+            }
+            oss << "\n";
+            return oss.str();
+        })
+        ;
+
+    py::class_<RedDigitizer::CAENPileUpConfig>(m, "CAENPileUpConfig")
+        .def(py::init<>())
+        .def_readwrite("RiseSamples", &RedDigitizer::CAENPileUpConfig::RiseSamples)
+        .def_readwrite("Threshold", &RedDigitizer::CAENPileUpConfig::Threshold)
+        .def_readwrite("Holdoff", &RedDigitizer::CAENPileUpConfig::Holdoff)
+        .def_readwrite("NegativePolarity", &RedDigitizer::CAENPileUpConfig::NegativePolarity)
+        ;
+
+    py::class_<RedDigitizer::CAENPileUpStats>(m, "CAENPileUpStats")
+        .def_readonly("Events", &RedDigitizer::CAENPileUpStats::Events)
+        .def_readonly("PileUpEvents", &RedDigitizer::CAENPileUpStats::PileUpEvents)
+        .def_readonly("Pulses", &RedDigitizer::CAENPileUpStats::Pulses)
+        .def("__str__", [](const RedDigitizer::CAENPileUpStats &stats) {
+            std::ostringstream oss;
+            oss << "Pile-up Stats:\n"
+                << "  Events: \t\t" << stats.Events << "\n"
+                << "  PileUpEvents: \t" << stats.PileUpEvents << "\n"
+                << "  Pulses: \t\t" << stats.Pulses << "\n";
+            return oss.str();
+        })
+        ;
+
+    py::class_<RedDigitizer::CAENChannelCalibration>(m, "CAENChannelCalibration")
+        .def(py::init<>())
+        .def(py::init([](double gain, double offset) {
+            return RedDigitizer::CAENChannelCalibration{gain, offset};
+        }), py::arg("gain"), py::arg("offset"))
+        // Volts per ADC count
+        .def_readwrite("Gain", &RedDigitizer::CAENChannelCalibration::Gain)
+        // Volts at 0 ADC counts
+        .def_readwrite("Offset", &RedDigitizer::CAENChannelCalibration::Offset)
+        ;
+
+    // Per CAEN channel number, volts = Gain*counts + Offset
+    py::class_<RedDigitizer::CAENCalibrationTable>(m, "CAENCalibrationTable")
+        .def(py::init<>())
+        .def(py::init<std::size_t>(), py::arg("num_channels"))
+        .def("__len__", &RedDigitizer::CAENCalibrationTable::size)
+        .def("__getitem__", &RedDigitizer::CAENCalibrationTable::at, py::arg("ch"))
+        .def("__setitem__", &RedDigitizer::CAENCalibrationTable::set,
+            py::arg("ch"), py::arg("calibration"))
+        .def("ToVolts", py::overload_cast<const std::size_t&, const double&>(
+            &RedDigitizer::CAENCalibrationTable::toVolts, py::const_),
+            py::arg("ch"), py::arg("counts"))
+        .def("ToCounts", &RedDigitizer::CAENCalibrationTable::toCounts,
+            py::arg("ch"), py::arg("volts"))
+        .def("MeasureTwoPoint", &RedDigitizer::CAENCalibrationTable::measureTwoPoint,
+            py::arg("ch"), py::arg("counts_a"), py::arg("volts_a"),
+            py::arg("counts_b"), py::arg("volts_b"))
+        .def("Save", &RedDigitizer::CAENCalibrationTable::save, py::arg("path"))
+        .def("Load", &RedDigitizer::CAENCalibrationTable::load, py::arg("path"))
+        ;
+
+    py::enum_<RedDigitizer::CAENBackpressurePolicy>(m, "CAENBackpressurePolicy")
+        .value("Block", RedDigitizer::CAENBackpressurePolicy::Block)
+        .value("DropOldest", RedDigitizer::CAENBackpressurePolicy::DropOldest)
+        .value("DropWaveforms", RedDigitizer::CAENBackpressurePolicy::DropWaveforms)
+        .value("Prescale", RedDigitizer::CAENBackpressurePolicy::Prescale)
+        ;
+
+    py::class_<RedDigitizer::CAENPipelineConfig>(m, "CAENPipelineConfig")
+        .def(py::init<>())
+        .def_readwrite("Policy", &RedDigitizer::CAENPipelineConfig::Policy)
+        .def_readwrite("NumBuffers", &RedDigitizer::CAENPipelineConfig::NumBuffers)
+        .def_readwrite("BatchCapacity", &RedDigitizer::CAENPipelineConfig::BatchCapacity)
+        .def_readwrite("HighWater", &RedDigitizer::CAENPipelineConfig::HighWater)
+        .def_readwrite("NumMetadataBuffers", &RedDigitizer::CAENPipelineConfig::NumMetadataBuffers)
+        .def_readwrite("PrescaleFactor", &RedDigitizer::CAENPipelineConfig::PrescaleFactor)
+        ;
+
+    py::class_<RedDigitizer::CAENPipelineStats>(m, "CAENPipelineStats")
+        .def_readonly("EventsPushed", &RedDigitizer::CAENPipelineStats::EventsPushed)
+        .def_readonly("EventsQueued", &RedDigitizer::CAENPipelineStats::EventsQueued)
+        .def_readonly("BatchesQueued", &RedDigitizer::CAENPipelineStats::BatchesQueued)
+        .def_readonly("BatchesPopped", &RedDigitizer::CAENPipelineStats::BatchesPopped)
+        .def_readonly("WaveformsDropped", &RedDigitizer::CAENPipelineStats::WaveformsDropped)
+        .def_readonly("DroppedOldest", &RedDigitizer::CAENPipelineStats::DroppedOldest)
+        .def_readonly("DroppedPrescale", &RedDigitizer::CAENPipelineStats::DroppedPrescale)
+        .def_readonly("DroppedOverflow", &RedDigitizer::CAENPipelineStats::DroppedOverflow)
+        .def_readonly("BlockedSeconds", &RedDigitizer::CAENPipelineStats::BlockedSeconds)
+        .def_readonly("BlockEpisodes", &RedDigitizer::CAENPipelineStats::BlockEpisodes)
+        .def_readonly("QueueDepth", &RedDigitizer::CAENPipelineStats::QueueDepth)
+        .def_readonly("MaxQueueDepth", &RedDigitizer::CAENPipelineStats::MaxQueueDepth)
+        .def("__str__", [](const RedDigitizer::CAENPipelineStats &stats) {
+            std::ostringstream oss;
+            oss << "Pipeline Stats:\n"
+                << "  EventsPushed: \t\t" << stats.EventsPushed << "\n"
+                << "  EventsQueued: \t\t" << stats.EventsQueued << "\n"
+                << "  BatchesQueued: \t" << stats.BatchesQueued << "\n"
+                << "  BatchesPopped: \t" << stats.BatchesPopped << "\n"
+                << "  WaveformsDropped: \t" << stats.WaveformsDropped << "\n"
+                << "  DroppedOldest: \t" << stats.DroppedOldest << "\n"
+                << "  DroppedPrescale: \t" << stats.DroppedPrescale << "\n"
+                << "  DroppedOverflow: \t" << stats.DroppedOverflow << "\n"
+                << "  BlockedSeconds: \t" << stats.BlockedSeconds << "\n"
+                << "  BlockEpisodes: \t" << stats.BlockEpisodes << "\n"
+                << "  QueueDepth: \t\t" << stats.QueueDepth << "\n"
+                << "  MaxQueueDepth: \t" << stats.MaxQueueDepth << "\n";
+            return oss.str();
+        })
+        ;
+
+    py::class_<RedDigitizer::CAENLiveTimeMonitorConfig>(m, "CAENLiveTimeMonitorConfig")
+        .def(py::init<>())
+        .def_readwrite("SampleRate", &RedDigitizer::CAENLiveTimeMonitorConfig::SampleRate)
+        .def_readwrite("EventStoredRegister", &RedDigitizer::CAENLiveTimeMonitorConfig::EventStoredRegister)
+        .def_readwrite("AcquisitionStatusRegister", &RedDigitizer::CAENLiveTimeMonitorConfig::AcquisitionStatusRegister)
+        .def_readwrite("MemoryFullBit", &RedDigitizer::CAENLiveTimeMonitorConfig::MemoryFullBit)
+        ;
+
+    py::class_<RedDigitizer::CAENLiveTimeStats>(m, "CAENLiveTimeStats")
+        .def_readonly("Samples", &RedDigitizer::CAENLiveTimeStats::Samples)
+        .def_readonly("ReadErrors", &RedDigitizer::CAENLiveTimeStats::ReadErrors)
+        .def_readonly("ElapsedSeconds", &RedDigitizer::CAENLiveTimeStats::ElapsedSeconds)
+        .def_readonly("FullSeconds", &RedDigitizer::CAENLiveTimeStats::FullSeconds)
+        .def_readonly("AcceptingSeconds", &RedDigitizer::CAENLiveTimeStats::AcceptingSeconds)
+        .def_readonly("LiveFraction", &RedDigitizer::CAENLiveTimeStats::LiveFraction)
+        .def_readonly("FullEpisodes", &RedDigitizer::CAENLiveTimeStats::FullEpisodes)
+        .def_readonly("MeanOccupancy", &RedDigitizer::CAENLiveTimeStats::MeanOccupancy)
+        .def_readonly("MaxOccupancy", &RedDigitizer::CAENLiveTimeStats::MaxOccupancy)
+        .def_readonly("EventsSeen", &RedDigitizer::CAENLiveTimeStats::EventsSeen)
+        .def_readonly("CounterGaps", &RedDigitizer::CAENLiveTimeStats::CounterGaps)
+        .def_readonly("CountsAllTriggers", &RedDigitizer::CAENLiveTimeStats::CountsAllTriggers)
+        .def_readonly("TriggerLiveFraction", &RedDigitizer::CAENLiveTimeStats::TriggerLiveFraction)
+        .def("__str__", [](const RedDigitizer::CAENLiveTimeStats &stats) {
+            std::ostringstream oss;
+            oss << "Live Time Stats:\n"
+                << "  Samples: \t\t" << stats.Samples << "\n"
+                << "  ReadErrors: \t\t" << stats.ReadErrors << "\n"
+                << "  ElapsedSeconds: \t" << stats.ElapsedSeconds << "\n"
+                << "  FullSeconds: \t\t" << stats.FullSeconds << "\n"
+                << "  LiveFraction: \t" << stats.LiveFraction << "\n"
+                << "  FullEpisodes: \t" << stats.FullEpisodes << "\n"
+                << "  MeanOccupancy: \t" << stats.MeanOccupancy << "\n"
+                << "  MaxOccupancy: \t" << stats.MaxOccupancy << "\n"
+                << "  EventsSeen: \t\t" << stats.EventsSeen << "\n"
+                << "  CounterGaps: \t\t" << stats.CounterGaps
+                << (stats.CountsAllTriggers ? " (lost triggers)" : " (lost events)") << "\n"
+                << "  TriggerLiveFraction: \t" << stats.TriggerLiveFraction << "\n";
+            return oss.str();
+        })
+        ;
+
     py::class_<CAEN_DGTZ_EventInfo_t>(m, "EventInfo")
         .def_readwrite("EventSize", &CAEN_DGTZ_EventInfo_t::EventSize)
         .def_readwrite("BoardId", &CAEN_DGTZ_EventInfo_t::BoardId)
@@ -136,10 +981,10 @@ PYBIND11_MODULE(red_caen, m) {
         })
         ;
 
-    py::class_<RedDigitizer::CAENWaveforms<uint16_t>>(m, "CAENWaveforms")
-        .def("GetRecordLength", &RedDigitizer::CAENWaveforms<uint16_t>::getRecordLength)
-        .def("GetTotalSize", &RedDigitizer::CAENWaveforms<uint16_t>::getTotalSize)
-        .def("GetData", &RedDigitizer::CAENWaveforms<uint16_t>::getData, py::return_value_policy::reference);
+    py::class_<PyCAENWaveforms>(m, "CAENWaveforms")
+        .def("GetRecordLength", &PyCAENWaveforms::getRecordLength)
+        .def("GetTotalSize", &PyCAENWaveforms::getTotalSize)
+        .def("GetData", py::overload_cast<>(&PyCAENWaveforms::getData), py::return_value_policy::reference);
 
 
     py::class_<RedDigitizer::CAENGlobalConfig>(m, "CAENGlobalConfig")
@@ -251,101 +1096,79 @@ PYBIND11_MODULE(red_caen, m) {
     })
     ;
 
-    py::class_<RedDigitizer::CAEN<>, std::shared_ptr<RedDigitizer::CAEN<>>>(m, "CAEN")
+    py::enum_<RedDigitizer::CAENHugePages>(m, "CAENHugePages")
+        .value("Off", RedDigitizer::CAENHugePages::Off)
+        .value("Transparent", RedDigitizer::CAENHugePages::Transparent)
+        .value("Explicit", RedDigitizer::CAENHugePages::Explicit)
+        .export_values();
+
+    py::class_<PyCAEN, std::shared_ptr<PyCAEN>>(m, "CAEN")
         .def(py::init<std::shared_ptr<RedDigitizer::iostream_wrapper>, RedDigitizer::CAENDigitizerModel, RedDigitizer::CAENConnectionType, int, int, uint32_t>())
-        .def("IsConnected", &RedDigitizer::CAEN<>::IsConnected)
-        .def("Setup", &RedDigitizer::CAEN<>::Setup,
+        .def("IsConnected", &PyCAEN::IsConnected)
+        .def("Setup", &PyCAEN::Setup,
             py::arg("global_config"), py::arg("group_configs"))
-        .def("GetGlobalConfiguration", &RedDigitizer::CAEN<>::GetGlobalConfiguration, py::return_value_policy::copy)
-        .def("GetGroupConfigurations", &RedDigitizer::CAEN<>::GetGroupConfigurations, py::return_value_policy::copy)
-        .def("SoftwareTrigger", &RedDigitizer::CAEN<>::SoftwareTrigger)
-        .def("GetBoardInfo", &RedDigitizer::CAEN<>::GetBoardInfo, py::return_value_policy::reference_internal)
-        .def("RetrieveData", &RedDigitizer::CAEN<>::RetrieveData)
-        .def("RetrieveDataUntilNEvents", &RedDigitizer::CAEN<>::RetrieveDataUntilNEvents,
+        .def("GetGlobalConfiguration", &PyCAEN::GetGlobalConfiguration, py::return_value_policy::copy)
+        .def("GetGroupConfigurations", &PyCAEN::GetGroupConfigurations, py::return_value_policy::copy)
+        .def("SoftwareTrigger", &PyCAEN::SoftwareTrigger)
+        .def("StartSoftwareTriggerPacer", &PyCAEN::StartSoftwareTriggerPacer,
+            py::arg("config"))
+        .def("StopSoftwareTriggerPacer", &PyCAEN::StopSoftwareTriggerPacer,
+            py::call_guard<py::gil_scoped_release>())
+        .def("IsSoftwareTriggerPacerRunning", &PyCAEN::IsSoftwareTriggerPacerRunning)
+        .def("GetSoftwareTriggerPacerStats", &PyCAEN::GetSoftwareTriggerPacerStats)
+        .def("StartLiveTimeMonitor", &PyCAEN::StartLiveTimeMonitor,
+            py::arg("config"))
+        .def("StopLiveTimeMonitor", &PyCAEN::StopLiveTimeMonitor,
+            py::call_guard<py::gil_scoped_release>())
+        .def("IsLiveTimeMonitorRunning", &PyCAEN::IsLiveTimeMonitorRunning)
+        .def("GetLiveTimeStats", &PyCAEN::GetLiveTimeStats)
+        .def("GetOccupancyHistogram", [](PyCAEN& self) {
+            auto hist = self.GetOccupancyHistogram();
+            return py::array_t<uint64_t>(hist.size(), hist.data());
+        })
+        .def("GetBoardInfo", &PyCAEN::GetBoardInfo, py::return_value_policy::reference_internal)
+        .def("RetrieveData", &PyCAEN::RetrieveData)
+        .def("RetrieveDataUntilNEvents", &PyCAEN::RetrieveDataUntilNEvents,
             py::arg("n"))
-        .def("DecodeEvents", &RedDigitizer::CAEN<>::DecodeEvents)
-        .def("ClearData", &RedDigitizer::CAEN<>::ClearData)
-        .def("GetNumberOfEvents", &RedDigitizer::CAEN<>::GetNumberOfEvents)
-        .def("GetCurrentPossibleMaxBuffer", &RedDigitizer::CAEN<>::GetCurrentPossibleMaxBuffer)
-        .def("GetEvent", &RedDigitizer::CAEN<>::GetEvent,
+        .def("DecodeEvents", &PyCAEN::DecodeEvents)
+        .def("ClearData", &PyCAEN::ClearData)
+        .def("GetNumberOfEvents", &PyCAEN::GetNumberOfEvents)
+        .def("GetCurrentPossibleMaxBuffer", &PyCAEN::GetCurrentPossibleMaxBuffer)
+        .def("GetEvent", &PyCAEN::GetEvent,
             py::arg("i"), py::return_value_policy::reference_internal)
-        .def("GetEvents", &RedDigitizer::CAEN<>::GetEvents,
+        .def("GetEvents", &PyCAEN::GetEvents,
             py::return_value_policy::reference_internal)
-        .def("GetEventsInfo", &RedDigitizer::CAEN<>::GetEventsInfo,
+        .def("GetEventsInfo", &PyCAEN::GetEventsInfo,
             py::return_value_policy::reference_internal)
-        .def("GetEventsInfoDict", [](RedDigitizer::CAEN<>& self) -> py::dict {
-            auto events_info = self.GetEventsInfo();
-
-            // creates temperary arrays to store the data
-            const size_t size = events_info.size();
-            uint32_t* event_counters = new uint32_t[size];
-            uint32_t* event_sizes = new uint32_t[size];
-            uint32_t* board_ids = new uint32_t[size];
-            uint32_t* patterns = new uint32_t[size];
-            uint32_t* channel_masks = new uint32_t[size];
-            uint32_t* trigger_time_tags = new uint32_t[size];
-
-            // loop through events to extract info
-            for (size_t i = 0; i < size; i++) {
-                auto info = events_info[i];
-                event_counters[i] = info->EventCounter;
-                event_sizes[i] = info->EventSize;
-                board_ids[i] = info->BoardId;
-                patterns[i] = info->Pattern;
-                channel_masks[i] = info->ChannelMask;
-                trigger_time_tags[i] = info->TriggerTimeTag;
-            }
-
-            // Create a capsule for each buffer so that Python frees it when the NumPy array is deleted.
-            py::capsule cap_event_counter(event_counters, [](void *f) {
-                uint32_t* buf = reinterpret_cast<uint32_t*>(f);
-                delete[] buf;
-            });
-            py::capsule cap_event_size(event_sizes, [](void *f) {
-                uint32_t* buf = reinterpret_cast<uint32_t*>(f);
-                delete[] buf;
-            });
-            py::capsule cap_board_id(board_ids, [](void *f) {
-                uint32_t* buf = reinterpret_cast<uint32_t*>(f);
-                delete[] buf;
-            });
-            py::capsule cap_pattern(patterns, [](void *f) {
-                uint32_t* buf = reinterpret_cast<uint32_t*>(f);
-                delete[] buf;
-            });
-            py::capsule cap_channel_mask(channel_masks, [](void *f) {
-                uint32_t* buf = reinterpret_cast<uint32_t*>(f);
-                delete[] buf;
-            });
-            py::capsule cap_trigger_time_tag(trigger_time_tags, [](void *f) {
-                uint32_t* buf = reinterpret_cast<uint32_t*>(f);
-                delete[] buf;
-            });
-            
-            // Create shape and strides for a 1D array of length n.
-            py::array::ShapeContainer shape = { static_cast<py::ssize_t>(size) };
-            py::array::StridesContainer strides = { static_cast<py::ssize_t>(sizeof(uint32_t)) };
-
-            // Create NumPy arrays that wrap the buffers.
-            py::array_t<uint32_t> arr_event_counter(shape, strides, event_counters, cap_event_counter);
-            py::array_t<uint32_t> arr_event_size(shape, strides, event_sizes, cap_event_size);
-            py::array_t<uint32_t> arr_board_id(shape, strides, board_ids, cap_board_id);
-            py::array_t<uint32_t> arr_pattern(shape, strides, patterns, cap_pattern);
-            py::array_t<uint32_t> arr_channel_mask(shape, strides, channel_masks, cap_channel_mask);
-            py::array_t<uint32_t> arr_trigger_time_tag(shape, strides, trigger_time_tags, cap_trigger_time_tag);
-
-            // save data in a dictionary
-            py::dict info_dict;
-            info_dict["EventCounter"] = arr_event_counter;
-            info_dict["EventSize"] = arr_event_size;
-            info_dict["BoardId"] = arr_board_id;
-            info_dict["Pattern"] = arr_pattern;
-            info_dict["ChannelMask"] = arr_channel_mask;
-            info_dict["TriggerTimeTag"] = arr_trigger_time_tag;
-            return info_dict;
+        // Copy of the metadata of the latest decoded events, one array
+        // per field. All of them share a single allocation.
+        .def("GetEventsInfoDict", [](PyCAEN& self) -> py::dict {
+            return event_table_to_dict(self.GetEventsTable());
+        })
+        // Same as GetEventsInfoDict but without copying: read-only views
+        // into the table kept by CAEN. They are overwritten by the next
+        // DecodeEvents(); use GetEventsInfoDict() to keep the values.
+        .def("GetEventsTable", [](py::object self_obj) -> py::dict {
+            const auto& table = self_obj.cast<PyCAEN&>().GetEventsTable();
+            const auto n = static_cast<py::ssize_t>(table.size());
+            py::dict out;
+            for (std::size_t c = 0; c < RedDigitizer::kNumEventColumns; c++) {
+                const auto column = table.column(static_cast<RedDigitizer::CAENEventColumn>(c));
+                out[py::str(RedDigitizer::kEventColumnNames[c].data())]
+                    = make_readonly_view(column.data(), {n}, self_obj);
+            }
+            if (table.numPulseChannels() > 0) {
+                out["Pulses"] = make_readonly_view(table.pulsesData().data(),
+                    {static_cast<py::ssize_t>(table.numPulseChannels()), n},
+                    {static_cast<py::ssize_t>(sizeof(uint32_t)*table.capacity()),
+                     static_cast<py::ssize_t>(sizeof(uint32_t))}, self_obj);
+            }
+            // PileUp is always a copy
+            add_pileup_flags(out, table);
+            return out;
         })
-        .def("GetEventsInBuffer", &RedDigitizer::CAEN<>::GetEventsInBuffer)
-        .def("GetWaveform", [](RedDigitizer::CAEN<>& self, std::size_t i) {
+        .def("GetEventsInBuffer", &PyCAEN::GetEventsInBuffer)
+        .def("GetWaveform", [](PyCAEN& self, std::size_t i) {
             auto waveform = self.GetWaveform(i);
             if (waveform) {
                 auto data = waveform->getData();  // Get the std::span<uint16_t>
@@ -363,7 +1186,7 @@ PYBIND11_MODULE(red_caen, m) {
             }
             return py::array_t<uint16_t>();
         })
-        .def("GetWaveforms", [](RedDigitizer::CAEN<>& self) -> py::array_t<uint16_t> {
+        .def("GetWaveforms", [](PyCAEN& self) -> py::array_t<uint16_t> {
             // Get the array of waveform pointers
             auto waveforms = self.GetWaveforms(); // std::array<std::shared_ptr<...>, N>
             const size_t num_waveforms = waveforms.size();
@@ -436,60 +1259,735 @@ PYBIND11_MODULE(red_caen, m) {
             // Return a NumPy array that takes ownership of the buffer.
             return py::array_t<uint16_t>(shape, strides, buffer, free_buffer);
         })
-        .def("GetDataDict", [](RedDigitizer::CAEN<>& self) -> py::dict {
-            // Get access to python functions defined here
-            py::object py_self = py::cast(self);
-            py::object GetEventsInfoDict = py_self.attr("GetEventsInfoDict");
-            py::object GetWaveforms = py_self.attr("GetWaveforms");
-            py::dict data_dict;
-
-            // Get data fro those functions
-            py::dict events_info = GetEventsInfoDict().cast<py::dict>();
-            py::array waveforms = GetWaveforms().cast<py::array>();
-            const auto& group_configs = self.GetGroupConfigurations();
-            uint32_t trig_mask = 0;
-            uint32_t acq_mask = 0;
-
-            // iterate over the groups
-            int ch_per_group = self.ModelConstants.NumChannelsPerGroup;
-            if (self.ModelConstants.NumberOfGroups == 0) {
-                trig_mask = group_configs[0].TriggerMask.get();
-                acq_mask = group_configs[0].AcquisitionMask.get();
-            } else {
-                for (int group = 0; group < self.ModelConstants.NumberOfGroups; group++) {
-                    if (group_configs[group].Enabled) {
-                        trig_mask |= group_configs[group].TriggerMask.get() << (group * ch_per_group);
-                        acq_mask |= group_configs[group].AcquisitionMask.get() << (group * ch_per_group);
-                    }
+        // Waveforms [events, channels, samples] and event info of the latest
+        // decoded events, filled in a single pass over the events. channels
+        // (CAEN numbers) picks which of the read out channels to export.
+        .def("GetDataDict", &data_dict,
+            py::arg("channels") = std::vector<std::size_t>{})
+        // Iterator over batches of at least batch_events events, backed by
+        // n_buffers preallocated buffers that are recycled as batches are
+        // released. Stops after timeout seconds without a batch (negative
+        // waits forever) or if the digitizer has an error.
+        .def("stream", [](std::shared_ptr<PyCAEN> self, uint32_t batch_events,
+                          std::size_t n_buffers, double timeout, double poll_interval) {
+            return PyCAENStream(std::move(self), batch_events, n_buffers, timeout, poll_interval);
+        }, py::arg("batch_events"), py::arg("n_buffers") = 4, py::arg("timeout") = -1.0,
+           py::arg("poll_interval") = 1e-3)
+        // Starts a readout thread that pushes batches of at least
+        // batch_events events into a queue with the backpressure policy of
+        // config. Iterate the returned CAENPipeline to consume them. Do not
+        // read data from this CAEN by other means until it is stopped.
+        .def("pipeline", [](std::shared_ptr<PyCAEN> self, uint32_t batch_events,
+                            const RedDigitizer::CAENPipelineConfig& config,
+                            double timeout, double poll_interval) {
+            return std::make_unique<PyCAENPipeline>(std::move(self), config,
+                batch_events, timeout, poll_interval);
+        }, py::arg("batch_events"),
+           py::arg("config") = RedDigitizer::CAENPipelineConfig{},
+           py::arg("timeout") = -1.0, py::arg("poll_interval") = 1e-3)
+        // Returns the decoded events bit packed with bits bits per sample
+        // (8, 12, 14 or 16). 0 -> the ADC resolution of the digitizer.
+        .def("GetPackedWaveforms", [](PyCAEN& self, uint32_t bits) -> py::list {
+            if (bits == 0) {
+                bits = self.ModelConstants.ADCResolution;
+            }
+            switch (bits) {
+            case 8:
+                return pack_waveforms<8>(self);
+            case 12:
+                return pack_waveforms<12>(self);
+            case 14:
+                return pack_waveforms<14>(self);
+            case 16:
+                return pack_waveforms<16>(self);
+            default:
+                throw py::value_error("bits must be 8, 12, 14 or 16.");
+            }
+        }, py::arg("bits") = 0)
+        // Backs the waveforms with a new arena from the next
+        // EnableAcquisition(). block_size in bytes.
+        .def("UseArena", [](PyCAEN& self, RedDigitizer::CAENHugePages huge_pages,
+                            std::size_t block_size, bool prefault) {
+            RedDigitizer::CAENArenaConfig config;
+            config.HugePages = huge_pages;
+            config.BlockSize = block_size;
+            config.Prefault = prefault;
+            self.SetAllocator(RedDigitizer::CAENArenaAllocator<uint16_t>(
+                std::make_shared<RedDigitizer::CAENArena>(config)));
+        }, py::arg("huge_pages") = RedDigitizer::CAENHugePages::Transparent,
+           py::arg("block_size") = RedDigitizer::CAENArenaConfig{}.BlockSize,
+           py::arg("prefault") = true)
+        // Goes back to heap allocated waveforms
+        .def("UseHeap", [](PyCAEN& self) {
+            self.SetAllocator(RedDigitizer::CAENArenaAllocator<uint16_t>());
+        })
+        .def("GetMemoryFootprint", [](PyCAEN& self) {
+            return arena_footprint_to_dict(self.GetAllocator().getFootprint());
+        })
+        .def("EnableSharedRing", &PyCAEN::EnableSharedRing,
+            py::arg("name"), py::arg("num_slots"))
+        .def("DisableSharedRing", &PyCAEN::DisableSharedRing)
+        // Takes effect at the next EnableAcquisition()
+        .def("SetReadoutChannels", &PyCAEN::SetReadoutChannels,
+            py::arg("channels"))
+        .def("GetReadoutChannels", &PyCAEN::GetReadoutChannels)
+        // SampleMajor also keeps the decoded events transposed for the
+        // cross-channel getters below. Takes effect at the next
+        // EnableAcquisition()
+        .def("SetWaveformsLayout", &PyCAEN::SetWaveformsLayout,
+            py::arg("layout"))
+        .def("GetWaveformsLayout", &PyCAEN::GetWaveformsLayout)
+        // [events, samples, channels]
+        .def("GetSampleMajorWaveforms", &sample_major_waveforms)
+        // [events, samples] or, with group_channels, [events, samples, groups]
+        .def("GetChannelSums", &channel_sums,
+            py::arg("group_channels") = 0)
+        // With a router, GetDataDict() and the other getters only see the
+        // events kept by the prescale of their trigger stream.
+        .def("EnableTriggerRouter", &PyCAEN::EnableTriggerRouter,
+            py::arg("config") = RedDigitizer::CAENTriggerRouterConfig{})
+        .def("DisableTriggerRouter", &PyCAEN::DisableTriggerRouter)
+        .def("IsTriggerRouterEnabled", &PyCAEN::IsTriggerRouterEnabled)
+        .def("GetTriggerStreamStats", &PyCAEN::GetTriggerStreamStats,
+            py::arg("stream"))
+        .def("GetTriggerStreamChannels", &PyCAEN::GetTriggerStreamChannels,
+            py::arg("stream"))
+        // Same as GetDataDict() with the events and channels of one stream
+        .def("GetTriggerStreamDataDict", [](PyCAEN& self,
+                                            const RedDigitizer::CAENTriggerStream& stream) {
+            return events_data_dict(self, self.GetTriggerStreamView(stream),
+                                    self.GetTriggerStreamChannels(stream));
+        }, py::arg("stream"))
+        // Every DecodeEvents() appends the events of stream to writer,
+        // without going through Python. writer is kept alive by this CAEN.
+        // Create the writer with the channels of the stream to store only
+        // those.
+        .def("SetTriggerStreamWriter", [](PyCAEN& self,
+                                          const RedDigitizer::CAENTriggerStream& stream,
+                                          RedDigitizer::CAENRunFileWriter& writer) {
+            self.SetTriggerStreamSink(stream, [&writer](auto events) {
+                writer.write(events);
+            });
+        }, py::arg("stream"), py::arg("writer"), py::keep_alive<1, 3>())
+        // Every DecodeEvents() copies the events of stream that pass the
+        // trigger mask of stage, and a worker thread adds them to its
+        // noise spectra. Usually the software trigger stream. Call after
+        // EnableAcquisition(). Returns the worker, its stats count the
+        // events dropped because it fell behind.
+        .def("SetTriggerStreamSpectrum", [](PyCAEN& self,
+                                            const RedDigitizer::CAENTriggerStream& stream,
+                                            std::shared_ptr<RedDigitizer::CAENNoiseSpectrumStage> stage,
+                                            const RedDigitizer::CAENNoiseSpectrumWorkerConfig& config) {
+            if (self.GetCurrentPossibleMaxBuffer() == 0 or not self.GetWaveform(0)) {
+                throw std::runtime_error("Call EnableAcquisition() before "
+                                         "SetTriggerStreamSpectrum().");
+            }
+            auto first = self.GetWaveform(0);
+            auto worker = std::make_shared<RedDigitizer::CAENNoiseSpectrumWorker>(
+                std::move(stage), static_cast<uint32_t>(first->getNumEnabledChannels()),
+                first->getRecordLength(), config);
+            self.SetTriggerStreamSink(stream, [worker](auto events) {
+                worker->push(events);
+            });
+            return worker;
+        }, py::arg("stream"), py::arg("stage"),
+           py::arg("config") = RedDigitizer::CAENNoiseSpectrumWorkerConfig{})
+        .def("ClearTriggerStreamSink", [](PyCAEN& self,
+                                          const RedDigitizer::CAENTriggerStream& stream) {
+            self.SetTriggerStreamSink(stream, nullptr);
+        }, py::arg("stream"))
+        // Events failing the coincidence conditions are dropped right after
+        // decoding, before GetDataDict(), the trigger streams and the
+        // shared ring see them.
+        .def("EnableCoincidenceFilter", &PyCAEN::EnableCoincidenceFilter,
+            py::arg("config"))
+        .def("DisableCoincidenceFilter", &PyCAEN::DisableCoincidenceFilter)
+        .def("IsCoincidenceFilterEnabled", &PyCAEN::IsCoincidenceFilterEnabled)
+        .def("GetCoincidenceStats", &PyCAEN::GetCoincidenceStats)
+        .def("ResetCoincidenceStats", &PyCAEN::ResetCoincidenceStats)
+        .def("GetCoincidenceConfig", &PyCAEN::GetCoincidenceConfig)
+        // {condition name: fraction of the events that passed it}
+        .def("GetCoincidencePassRates", [](PyCAEN& self) {
+            const auto config = self.GetCoincidenceConfig();
+            const auto stats = self.GetCoincidenceStats();
+            py::dict out;
+            for (std::size_t c = 0; c < config.Conditions.size() and c < stats.Passed.size(); c++) {
+                out[py::str(config.Conditions[c].Name)] = stats.Events > 0 ?
+                    static_cast<double>(stats.Passed[c]) / stats.Events : 0.0;
+            }
+            return out;
+        })
+        // Pulse counts per channel of every decoded event. They show up in
+        // GetEventsTable() and GetEventsInfoDict() as "Pulses" and
+        // "PileUp", [channel, event] with the channels in the order of
+        // GetDataDict()["Channels"].
+        .def("EnablePileUpDetection", &PyCAEN::EnablePileUpDetection,
+            py::arg("config"))
+        .def("DisablePileUpDetection", &PyCAEN::DisablePileUpDetection)
+        .def("IsPileUpDetectionEnabled", &PyCAEN::IsPileUpDetectionEnabled)
+        .def("GetPileUpConfig", &PyCAEN::GetPileUpConfig)
+        .def("GetPileUpStats", &PyCAEN::GetPileUpStats)
+        .def("ResetPileUpStats", &PyCAEN::ResetPileUpStats)
+        .def("SetCalibration", &PyCAEN::SetCalibration, py::arg("table"))
+        .def("ResetCalibration", &PyCAEN::ResetCalibration)
+        .def("GetCalibration", &PyCAEN::GetCalibration)
+        .def("GetNominalCalibration", &PyCAEN::GetNominalCalibration,
+            py::arg("use_dc_corrections") = true)
+        // The latest decoded events must be a pedestal run at volts
+        .def("MeasureCalibrationOffsets", &PyCAEN::MeasureCalibrationOffsets,
+            py::arg("volts") = 0.0)
+        // Latest decoded waveforms in volts, [events, channels, samples],
+        // with GetCalibration(). dtype is "float32" or "float16". Fills
+        // out instead of allocating if given.
+        .def("GetVolts", [](PyCAEN& self, const std::string& dtype,
+                            const py::object& out) -> py::array {
+            if (dtype == "float32") {
+                return waveforms_to_volts<float>(self, py::dtype::of<float>(), out);
+            }
+            if (dtype == "float16") {
+                return waveforms_to_volts<uint16_t>(self, py::dtype("float16"), out);
+            }
+            throw py::value_error("dtype must be \"float32\" or \"float16\".");
+        }, py::arg("dtype") = "float32", py::arg("out") = py::none())
+        .def("EnableAcquisition", &PyCAEN::EnableAcquisition)
+        .def("DisableAcquisition", &PyCAEN::DisableAcquisition)
+        ;
+
+    py::class_<RedDigitizer::CAENHistogramBinning>(m, "CAENHistogramBinning")
+        .def(py::init<>())
+        .def(py::init([](uint32_t num_bins, double low, double high) {
+            return RedDigitizer::CAENHistogramBinning{num_bins, low, high};
+        }), py::arg("num_bins"), py::arg("low"), py::arg("high"))
+        .def_readwrite("NumBins", &RedDigitizer::CAENHistogramBinning::NumBins)
+        .def_readwrite("Low", &RedDigitizer::CAENHistogramBinning::Low)
+        .def_readwrite("High", &RedDigitizer::CAENHistogramBinning::High)
+        ;
+
+    py::enum_<RedDigitizer::CAENHistogramType>(m, "CAENHistogramType")
+        .value("Amplitude", RedDigitizer::CAENHistogramType::Amplitude)
+        .value("Integral", RedDigitizer::CAENHistogramType::Integral)
+        .value("BaselineRMS", RedDigitizer::CAENHistogramType::BaselineRMS)
+        .value("TTTDelta", RedDigitizer::CAENHistogramType::TTTDelta)
+        ;
+
+    py::class_<RedDigitizer::CAENHistogramConfig>(m, "CAENHistogramConfig")
+        .def(py::init<>())
+        .def_readwrite("Amplitude", &RedDigitizer::CAENHistogramConfig::Amplitude)
+        .def_readwrite("Integral", &RedDigitizer::CAENHistogramConfig::Integral)
+        .def_readwrite("BaselineRMS", &RedDigitizer::CAENHistogramConfig::BaselineRMS)
+        .def_readwrite("TTTDelta", &RedDigitizer::CAENHistogramConfig::TTTDelta)
+        .def_readwrite("BaselineSamples", &RedDigitizer::CAENHistogramConfig::BaselineSamples)
+        .def_readwrite("NegativePolarity", &RedDigitizer::CAENHistogramConfig::NegativePolarity)
+        ;
+
+    py::class_<RedDigitizer::CAENHistogramService, std::shared_ptr<RedDigitizer::CAENHistogramService>>(m, "CAENHistogramService")
+        .def(py::init([](RedDigitizer::CAENDigitizerModel model, const RedDigitizer::CAENHistogramConfig& config) {
+            return std::make_shared<RedDigitizer::CAENHistogramService>(
+                RedDigitizer::CAENDigitizerModelsConstantsMap.at(model), config);
+        }), py::arg("model"), py::arg("config"))
+        // Fills with the latest decoded events. The GIL is released so other
+        // python threads keep running while this is filled.
+        .def("Fill", [](RedDigitizer::CAENHistogramService& self, PyCAEN& caen) {
+            auto waveforms = caen.GetWaveforms();
+            py::gil_scoped_release release;
+            self.fill(std::span<const std::shared_ptr<PyCAENWaveforms>>(waveforms));
+        }, py::arg("caen"))
+        .def("Clear", &RedDigitizer::CAENHistogramService::clear)
+        .def("GetHistogram", [](const RedDigitizer::CAENHistogramService& self,
+                                RedDigitizer::CAENHistogramType type, std::size_t ch) {
+            const auto& hist = self.get(type, ch);
+            py::array_t<uint64_t> out(hist.getBinning().NumBins);
+            hist.snapshot(std::span<uint64_t>(out.mutable_data(), out.size()));
+            return out;
+        }, py::arg("type"), py::arg("ch") = 0)
+        .def("GetBinEdges", [](const RedDigitizer::CAENHistogramService& self,
+                               RedDigitizer::CAENHistogramType type) {
+            auto edges = self.get(type).getBinEdges();
+            return py::array_t<double>(edges.size(), edges.data());
+        }, py::arg("type"))
+        .def("GetUnderflow", [](const RedDigitizer::CAENHistogramService& self,
+                                RedDigitizer::CAENHistogramType type, std::size_t ch) {
+            return self.get(type, ch).getUnderflow();
+        }, py::arg("type"), py::arg("ch") = 0)
+        .def("GetOverflow", [](const RedDigitizer::CAENHistogramService& self,
+                               RedDigitizer::CAENHistogramType type, std::size_t ch) {
+            return self.get(type, ch).getOverflow();
+        }, py::arg("type"), py::arg("ch") = 0)
+        // Returns a dict with one [channels, bins] array per per-channel
+        // histogram type, and a 1D array for TTTDelta.
+        .def("GetSnapshot", [](const RedDigitizer::CAENHistogramService& self) -> py::dict {
+            using Type = RedDigitizer::CAENHistogramType;
+            py::dict out;
+            const std::size_t num_chs = self.getNumChannels();
+            for (auto [name, type] : {std::pair{"Amplitude", Type::Amplitude},
+                                      std::pair{"Integral", Type::Integral},
+                                      std::pair{"BaselineRMS", Type::BaselineRMS}}) {
+                const std::size_t num_bins = self.get(type).getBinning().NumBins;
+                py::array_t<uint64_t> arr({num_chs, num_bins});
+                for (std::size_t ch = 0; ch < num_chs; ch++) {
+                    self.get(type, ch).snapshot(
+                        std::span<uint64_t>(arr.mutable_data(ch, 0), num_bins));
+                }
+                out[name] = arr;
+            }
+
+            const auto& ttt = self.get(Type::TTTDelta);
+            py::array_t<uint64_t> ttt_arr(ttt.getBinning().NumBins);
+            ttt.snapshot(std::span<uint64_t>(ttt_arr.mutable_data(), ttt_arr.size()));
+            out["TTTDelta"] = ttt_arr;
+            return out;
+        })
+        ;
+
+    py::enum_<RedDigitizer::CAENTimingMethod>(m, "CAENTimingMethod")
+        .value("CFD", RedDigitizer::CAENTimingMethod::CFD)
+        .value("LeadingEdge", RedDigitizer::CAENTimingMethod::LeadingEdge)
+        ;
+
+    py::class_<RedDigitizer::CAENTimingConfig>(m, "CAENTimingConfig")
+        .def(py::init<>())
+        .def_readwrite("Method", &RedDigitizer::CAENTimingConfig::Method)
+        .def_readwrite("Fraction", &RedDigitizer::CAENTimingConfig::Fraction)
+        .def_readwrite("Delay", &RedDigitizer::CAENTimingConfig::Delay)
+        .def_readwrite("Threshold", &RedDigitizer::CAENTimingConfig::Threshold)
+        .def_readwrite("BaselineSamples", &RedDigitizer::CAENTimingConfig::BaselineSamples)
+        .def_readwrite("NegativePolarity", &RedDigitizer::CAENTimingConfig::NegativePolarity)
+        ;
+
+    py::class_<RedDigitizer::CAENTimingStage, std::shared_ptr<RedDigitizer::CAENTimingStage>>(m, "CAENTimingStage")
+        // Uses the current setup of caen, so create it after Setup(...)
+        .def(py::init([](PyCAEN& caen, const RedDigitizer::CAENTimingConfig& config) {
+            return std::make_shared<RedDigitizer::CAENTimingStage>(
+                caen.ModelConstants, caen.GetGlobalConfiguration(), config);
+        }), py::arg("caen"), py::arg("config"))
+        .def("GetSamplePeriod", &RedDigitizer::CAENTimingStage::getSamplePeriod)
+        // In ns, subtracted from the trigger time tag to get the start of
+        // the record
+        .def("GetPreTrigger", &RedDigitizer::CAENTimingStage::getPreTrigger)
+        .def("Reset", &RedDigitizer::CAENTimingStage::reset)
+        // Times the latest decoded events. Returns a dict with
+        // "SampleTimes" (float32, samples) and "Times" (float64, ns), both
+        // with shape [events, channels].
+        .def("Process", [](RedDigitizer::CAENTimingStage& self, PyCAEN& caen) -> py::dict {
+            auto waveforms = caen.GetWaveforms();
+            {
+                py::gil_scoped_release release;
+                self.process(std::span<const std::shared_ptr<PyCAENWaveforms>>(waveforms));
+            }
+
+            const std::size_t num_events = self.getNumEvents();
+            const std::size_t num_chs = self.getNumChannels();
+            py::array_t<float> sample_times({num_events, num_chs});
+            py::array_t<double> times({num_events, num_chs});
+            std::copy(self.getSampleTimes().begin(), self.getSampleTimes().end(),
+                      sample_times.mutable_data());
+            std::copy(self.getTimes().begin(), self.getTimes().end(),
+                      times.mutable_data());
+
+            py::dict out;
+            out["SampleTimes"] = sample_times;
+            out["Times"] = times;
+            return out;
+        }, py::arg("caen"))
+        ;
+
+    py::enum_<RedDigitizer::CAENDecimationFilter>(m, "CAENDecimationFilter")
+        .value("Boxcar", RedDigitizer::CAENDecimationFilter::Boxcar)
+        .value("FIR", RedDigitizer::CAENDecimationFilter::FIR)
+        ;
+
+    py::class_<RedDigitizer::CAENDecimationConfig>(m, "CAENDecimationConfig")
+        .def(py::init<>())
+        .def_readwrite("Factor", &RedDigitizer::CAENDecimationConfig::Factor)
+        .def_readwrite("Filter", &RedDigitizer::CAENDecimationConfig::Filter)
+        .def_readwrite("NumTaps", &RedDigitizer::CAENDecimationConfig::NumTaps)
+        .def_readwrite("Cutoff", &RedDigitizer::CAENDecimationConfig::Cutoff)
+        .def_readwrite("Taps", &RedDigitizer::CAENDecimationConfig::Taps)
+        ;
+
+    py::class_<RedDigitizer::CAENDecimationStage, std::shared_ptr<RedDigitizer::CAENDecimationStage>>(m, "CAENDecimationStage")
+        // Uses the current setup of caen, so create it after Setup(...)
+        .def(py::init([](PyCAEN& caen, const RedDigitizer::CAENDecimationConfig& config) {
+            return std::make_shared<RedDigitizer::CAENDecimationStage>(
+                caen.ModelConstants, caen.GetGlobalConfiguration(),
+                caen.GetGroupConfigurations(), config);
+        }), py::arg("caen"), py::arg("config"))
+        .def("GetOutputConfig", &RedDigitizer::CAENDecimationStage::getOutputConfig,
+             py::return_value_policy::copy)
+        .def("GetOutputRecordLength", &RedDigitizer::CAENDecimationStage::getOutputRecordLength)
+        .def("GetSamplePeriod", &RedDigitizer::CAENDecimationStage::getSamplePeriod)
+        .def("GetTaps", &RedDigitizer::CAENDecimationStage::getTaps)
+        // Decimates the latest decoded events. Returns a uint16 array with
+        // shape [events, channels, output samples].
+        .def("Process", [](RedDigitizer::CAENDecimationStage& self, PyCAEN& caen) -> py::array_t<uint16_t> {
+            std::span<const std::shared_ptr<RedDigitizer::CAENWaveforms<uint16_t>>> outputs;
+            {
+                py::gil_scoped_release release;
+                outputs = self.process(caen.GetWaveformsView());
+            }
+
+            std::size_t num_chs = 0;
+            for (const auto& waveform : outputs) {
+                if (waveform) {
+                    num_chs = waveform->getNumEnabledChannels();
+                    break;
                 }
             }
+            const std::size_t record_length = self.getOutputRecordLength();
+            py::array_t<uint16_t> out({outputs.size(), num_chs, record_length});
+            uint16_t* dst = out.mutable_data();
+            for (const auto& waveform : outputs) {
+                const std::size_t event_size = num_chs*record_length;
+                if (waveform and waveform->getTotalSize() == event_size) {
+                    const auto data = waveform->getData();
+                    std::copy(data.begin(), data.end(), dst);
+                } else {
+                    std::fill_n(dst, event_size, 0);
+                }
+                dst += event_size;
+            }
+            return out;
+        }, py::arg("caen"))
+        ;
+
+    py::enum_<RedDigitizer::CAENSpectrumWindow>(m, "CAENSpectrumWindow")
+        .value("Rectangular", RedDigitizer::CAENSpectrumWindow::Rectangular)
+        .value("Hann", RedDigitizer::CAENSpectrumWindow::Hann)
+        .value("Hamming", RedDigitizer::CAENSpectrumWindow::Hamming)
+        .value("BlackmanHarris", RedDigitizer::CAENSpectrumWindow::BlackmanHarris)
+        ;
+
+    py::enum_<RedDigitizer::CAENSpectrumAveraging>(m, "CAENSpectrumAveraging")
+        .value("Linear", RedDigitizer::CAENSpectrumAveraging::Linear)
+        .value("Exponential", RedDigitizer::CAENSpectrumAveraging::Exponential)
+        ;
+
+    py::class_<RedDigitizer::CAENNoiseSpectrumConfig>(m, "CAENNoiseSpectrumConfig")
+        .def(py::init<>())
+        .def_readwrite("SegmentLength", &RedDigitizer::CAENNoiseSpectrumConfig::SegmentLength)
+        .def_readwrite("Window", &RedDigitizer::CAENNoiseSpectrumConfig::Window)
+        .def_readwrite("TriggerMask", &RedDigitizer::CAENNoiseSpectrumConfig::TriggerMask)
+        .def_readwrite("Averaging", &RedDigitizer::CAENNoiseSpectrumConfig::Averaging)
+        .def_readwrite("Alpha", &RedDigitizer::CAENNoiseSpectrumConfig::Alpha)
+        ;
+
+    py::class_<RedDigitizer::CAENNoiseSpectrumStage, std::shared_ptr<RedDigitizer::CAENNoiseSpectrumStage>>(m, "CAENNoiseSpectrumStage")
+        // Uses the current setup of caen, so create it after Setup(...)
+        .def(py::init([](PyCAEN& caen, const RedDigitizer::CAENNoiseSpectrumConfig& config) {
+            return std::make_shared<RedDigitizer::CAENNoiseSpectrumStage>(
+                caen.ModelConstants, caen.GetGlobalConfiguration(), config);
+        }), py::arg("caen"), py::arg("config") = RedDigitizer::CAENNoiseSpectrumConfig{})
+        .def("GetConfig", &RedDigitizer::CAENNoiseSpectrumStage::getConfig,
+             py::return_value_policy::copy)
+        .def("GetSegmentLength", &RedDigitizer::CAENNoiseSpectrumStage::getSegmentLength)
+        .def("GetNumEvents", &RedDigitizer::CAENNoiseSpectrumStage::getNumEvents)
+        .def("Reset", &RedDigitizer::CAENNoiseSpectrumStage::reset)
+        // Adds the latest decoded events that pass the trigger mask. Not
+        // needed with CAEN.SetTriggerStreamSpectrum(...), but safe to mix
+        // with it.
+        .def("Process", [](RedDigitizer::CAENNoiseSpectrumStage& self, PyCAEN& caen) {
+            py::gil_scoped_release release;
+            self.process(caen.GetWaveformsView());
+        }, py::arg("caen"))
+        // In Hz, of every bin of GetPSD()
+        .def("GetFrequencies", [](const RedDigitizer::CAENNoiseSpectrumStage& self) {
+            const auto frequencies = self.getFrequencies();
+            return py::array_t<double>(frequencies.size(), frequencies.data());
+        })
+        // Average one-sided PSD in ADC counts^2/Hz, float64 with shape
+        // [channel, frequency]. Rows are CAEN channels, 0 if not averaged.
+        .def("GetPSD", [](const RedDigitizer::CAENNoiseSpectrumStage& self) {
+            const auto psd = self.snapshot();
+            py::array_t<double> out({self.getNumChannels(), self.getNumBins()});
+            std::copy(psd.begin(), psd.end(), out.mutable_data());
+            return out;
+        })
+        // Events averaged in each channel
+        .def("GetNumAveraged", [](const RedDigitizer::CAENNoiseSpectrumStage& self) {
+            const auto num_averaged = self.getNumAveraged();
+            return py::array_t<uint64_t>(num_averaged.size(), num_averaged.data());
+        })
+        ;
+
+    py::class_<RedDigitizer::CAENNoiseSpectrumWorkerConfig>(m, "CAENNoiseSpectrumWorkerConfig")
+        .def(py::init<>())
+        .def_readwrite("NumBuffers", &RedDigitizer::CAENNoiseSpectrumWorkerConfig::NumBuffers)
+        .def_readwrite("BatchCapacity", &RedDigitizer::CAENNoiseSpectrumWorkerConfig::BatchCapacity)
+        ;
+
+    py::class_<RedDigitizer::CAENNoiseSpectrumWorker, std::shared_ptr<RedDigitizer::CAENNoiseSpectrumWorker>>(m, "CAENNoiseSpectrumWorker")
+        .def("GetStage", &RedDigitizer::CAENNoiseSpectrumWorker::getStage)
+        // EventsPushed were copied, DroppedOldest and DroppedOverflow
+        // were lost because the worker fell behind
+        .def("GetStats", &RedDigitizer::CAENNoiseSpectrumWorker::getStats)
+        // Processes what was already copied and stops. Clear the trigger
+        // stream sink afterwards.
+        .def("Stop", &RedDigitizer::CAENNoiseSpectrumWorker::stop,
+             py::call_guard<py::gil_scoped_release>())
+        ;
+
+    py::class_<RedDigitizer::CAENRunFileConfig>(m, "CAENRunFileConfig")
+        .def(py::init<>())
+        .def_readwrite("ChunkEvents", &RedDigitizer::CAENRunFileConfig::ChunkEvents)
+        .def_readwrite("TriggerTimeTagBits", &RedDigitizer::CAENRunFileConfig::TriggerTimeTagBits)
+        ;
+
+    // Native replacement for writing rows with sbcbinaryformat: events are
+    // written in C++ as chunked columns with an index at the end.
+    py::class_<RedDigitizer::CAENRunFileWriter>(m, "CAENRunFileWriter")
+        // Uses the current setup of caen, so create it after Setup(...)
+        // channels (CAEN numbers) stores only those, empty stores all the
+        // enabled ones.
+        .def(py::init([](const std::string& path, PyCAEN& caen,
+                         const RedDigitizer::CAENRunFileConfig& config,
+                         const std::vector<std::size_t>& channels) {
+            return std::make_unique<RedDigitizer::CAENRunFileWriter>(path,
+                caen.ModelConstants, caen.GetGlobalConfiguration(),
+                caen.GetGroupConfigurations(), config, channels);
+        }), py::arg("path"), py::arg("caen"),
+            py::arg("config") = RedDigitizer::CAENRunFileConfig{},
+            py::arg("channels") = std::vector<std::size_t>{})
+        // Appends the latest decoded events of caen
+        .def("Write", [](RedDigitizer::CAENRunFileWriter& self, PyCAEN& caen) {
+            py::gil_scoped_release release;
+            return self.write(caen.GetWaveformsView());
+        }, py::arg("caen"))
+        // Appends a batch from CAEN.stream(...) or CAEN.pipeline(...)
+        .def("WriteBatch", [](RedDigitizer::CAENRunFileWriter& self, PyCAENStreamBatch& batch) {
+            auto& data = batch.get();
+            py::gil_scoped_release release;
+            return self.write(data);
+        }, py::arg("batch"))
+        .def("Flush", &RedDigitizer::CAENRunFileWriter::flush,
+             py::call_guard<py::gil_scoped_release>())
+        .def("Close", &RedDigitizer::CAENRunFileWriter::close,
+             py::call_guard<py::gil_scoped_release>())
+        .def("IsOpen", &RedDigitizer::CAENRunFileWriter::isOpen)
+        .def("GetNumEvents", &RedDigitizer::CAENRunFileWriter::getNumEvents)
+        .def("GetNumChunks", &RedDigitizer::CAENRunFileWriter::getNumChunks)
+        .def("__enter__", [](py::object self) { return self; })
+        .def("__exit__", [](RedDigitizer::CAENRunFileWriter& self, py::args) { self.close(); })
+        ;
+
+    py::enum_<RedDigitizer::CAENRunFileAccess>(m, "CAENRunFileAccess")
+        .value("Normal", RedDigitizer::CAENRunFileAccess::Normal)
+        .value("Sequential", RedDigitizer::CAENRunFileAccess::Sequential)
+        .value("Random", RedDigitizer::CAENRunFileAccess::Random)
+        ;
+
+    // Memory mapped run file written by CAENRunFileWriter. Opening is
+    // instant for any file size; chunks are returned as dicts of read-only
+    // NumPy views of the mapped pages, loaded by the OS when first used.
+    // Waveforms of a chunk are [channels, events, samples].
+    py::class_<RedDigitizer::CAENRunFileMap, std::shared_ptr<RedDigitizer::CAENRunFileMap>>(m, "CAENRunFile")
+        .def(py::init<const std::string&, const RedDigitizer::CAENRunFileAccess&>(),
+             py::arg("path"), py::arg("access") = RedDigitizer::CAENRunFileAccess::Normal)
+        .def("GetHeader", [](const RedDigitizer::CAENRunFileMap& self) {
+            const auto& header = self.getHeader();
+            py::dict out;
+            out["Version"] = header.Version;
+            out["NumChannels"] = header.NumChannels;
+            out["RecordLength"] = header.RecordLength;
+            out["ADCResolution"] = header.ADCResolution;
+            out["ChunkEvents"] = header.ChunkEvents;
+            out["SamplePeriod"] = header.SamplePeriod;
+            out["TriggerTimeTagLSB"] = header.TriggerTimeTagLSB;
+            out["TriggerTimeTagBits"] = header.TriggerTimeTagBits;
+            out["Channels"] = self.getChannels();
+            return out;
+        })
+        .def("GetNumEvents", &RedDigitizer::CAENRunFileMap::getNumEvents)
+        .def("GetNumChunks", &RedDigitizer::CAENRunFileMap::getNumChunks)
+        .def("GetChannels", &RedDigitizer::CAENRunFileMap::getChannels)
+        .def("GetFileSize", &RedDigitizer::CAENRunFileMap::getFileSize)
+        // Index as a dict of arrays, one entry per chunk
+        .def("GetIndex", [](const RedDigitizer::CAENRunFileMap& self) {
+            const auto& entries = self.getIndex().entries();
+            const std::size_t n = entries.size();
+            py::array_t<uint64_t> offset(n), first_event(n), num_events(n),
+                first_counter(n), last_counter(n), first_ttt(n), last_ttt(n);
+            for (std::size_t i = 0; i < n; i++) {
+                offset.mutable_at(i) = entries[i].Offset;
+                first_event.mutable_at(i) = entries[i].FirstEvent;
+                num_events.mutable_at(i) = entries[i].NumEvents;
+                first_counter.mutable_at(i) = entries[i].FirstCounter;
+                last_counter.mutable_at(i) = entries[i].LastCounter;
+                first_ttt.mutable_at(i) = entries[i].FirstTriggerTimeTag;
+                last_ttt.mutable_at(i) = entries[i].LastTriggerTimeTag;
+            }
+            py::dict out;
+            out["Offset"] = offset;
+            out["FirstEvent"] = first_event;
+            out["NumEvents"] = num_events;
+            out["FirstCounter"] = first_counter;
+            out["LastCounter"] = last_counter;
+            out["FirstTriggerTimeTag"] = first_ttt;
+            out["LastTriggerTimeTag"] = last_ttt;
+            return out;
+        })
+        .def("GetChunk", [](py::object self_obj, std::size_t i) {
+            const auto& self = self_obj.cast<const RedDigitizer::CAENRunFileMap&>();
+            return run_chunk_to_dict(self.chunk(i), self_obj);
+        }, py::arg("i"))
+        .def("__len__", &RedDigitizer::CAENRunFileMap::getNumChunks)
+        .def("__getitem__", [](py::object self_obj, std::size_t i) {
+            const auto& self = self_obj.cast<const RedDigitizer::CAENRunFileMap&>();
+            if (i >= self.getNumChunks()) {
+                throw py::index_error("Chunk index out of range.");
+            }
+            return run_chunk_to_dict(self.chunk(i), self_obj);
+        }, py::arg("i"))
+        // Chunk holding event index event, GetNumChunks() if out of range
+        .def("FindEvent", [](const RedDigitizer::CAENRunFileMap& self, uint64_t event) {
+            return self.getIndex().findEvent(event);
+        }, py::arg("event"))
+        // First chunk reaching the extended EventCounter counter
+        .def("FindCounter", [](const RedDigitizer::CAENRunFileMap& self, uint64_t counter) {
+            return self.getIndex().findCounter(counter);
+        }, py::arg("counter"))
+        // First chunk reaching time ns, counted from the trigger time tag
+        // zero
+        .def("FindTime", [](const RedDigitizer::CAENRunFileMap& self, double ns) {
+            const double lsb = self.getHeader().TriggerTimeTagLSB;
+            const uint64_t ttt = ns <= 0.0 or lsb <= 0.0 ? 0
+                : static_cast<uint64_t>(std::ceil(ns / lsb));
+            return self.getIndex().findTriggerTimeTag(ttt);
+        }, py::arg("ns"))
+        .def("SetAccess", &RedDigitizer::CAENRunFileMap::setAccess, py::arg("access"))
+        // Starts loading count chunks from first in the background
+        .def("WillNeed", &RedDigitizer::CAENRunFileMap::willNeed,
+             py::arg("first"), py::arg("count") = 1)
+        // Lets the OS drop the pages of count chunks from first
+        .def("DontNeed", &RedDigitizer::CAENRunFileMap::dontNeed,
+             py::arg("first"), py::arg("count") = 1)
+        ;
+
+    py::enum_<RedDigitizer::CAENSharedReadStatus>(m, "CAENSharedReadStatus")
+        .value("Ok", RedDigitizer::CAENSharedReadStatus::Ok)
+        .value("NotYetWritten", RedDigitizer::CAENSharedReadStatus::NotYetWritten)
+        .value("Overwritten", RedDigitizer::CAENSharedReadStatus::Overwritten)
+        ;
 
-            // Move software and hardware trigger bits to lower locations
-            py::array pattern = events_info["Pattern"].cast<py::array>();
-            auto buf = pattern.request();
-            uint32_t* data = static_cast<uint32_t*>(buf.ptr);
-            for (size_t i = 0; i < buf.size; ++i) {
-                uint32_t mask = data[i];
-                uint32_t extracted = (mask >> 6) & (0b11 <<4);  // extract bits 10-11
-                mask &= ~(0b11 << 10 | 0b11 << 4);             // clear bits 10-11, 4-5
-                mask |= extracted;                 // insert bits into positions 4-5
-                data[i] = mask;
+    // Read-only access to a ring created by CAEN.EnableSharedRing(...).
+    // The arrays returned are views into the shared memory: use
+    // IsValid(batch["Sequence"]) after processing a batch to know if the
+    // writer overwrote it in the meantime.
+    py::class_<RedDigitizer::CAENSharedRingReader, std::shared_ptr<RedDigitizer::CAENSharedRingReader>>(m, "CAENSharedRingReader")
+        .def(py::init<const std::string&>(), py::arg("name"))
+        .def("LatestSequence", &RedDigitizer::CAENSharedRingReader::latestSequence)
+        // True once the writer removed the ring (its geometry changed or
+        // it was disabled). Create a new reader to follow the new one.
+        .def("IsRetired", &RedDigitizer::CAENSharedRingReader::isRetired)
+        .def("GetMissed", &RedDigitizer::CAENSharedRingReader::getMissed)
+        .def("GetNumSlots", [](const RedDigitizer::CAENSharedRingReader& self) {
+            return self.getHeader().NumSlots;
+        })
+        // Returns the dict of batch seq, or None if it is not available
+        .def("Read", [](py::object self_obj, uint64_t seq) -> py::object {
+            auto& self = self_obj.cast<RedDigitizer::CAENSharedRingReader&>();
+            RedDigitizer::CAENSharedBatchView view;
+            if (self.read(seq, view) != RedDigitizer::CAENSharedReadStatus::Ok) {
+                return py::none();
             }
-        
-            // Insert the waveforms and masks into the dictionary.
-            data_dict["EventCounter"] = events_info["EventCounter"];
-            data_dict["TriggerSource"] = pattern; 
-            data_dict["GroupMask"] = events_info["ChannelMask"];
-            data_dict["TriggerMask"] = trig_mask;
-            data_dict["AcquisitionMask"] = acq_mask;
-            data_dict["TriggerTimeTag"] = events_info["TriggerTimeTag"];
-            data_dict["Waveforms"] = waveforms;
-            return data_dict;
-        })     
-        .def("EnableAcquisition", &RedDigitizer::CAEN<>::EnableAcquisition)
-        .def("DisableAcquisition", &RedDigitizer::CAEN<>::DisableAcquisition)
+            return shared_batch_to_dict(view, self_obj);
+        }, py::arg("seq"))
+        // Returns the next unread batch, or None if there is nothing new
+        .def("Next", [](py::object self_obj) -> py::object {
+            auto& self = self_obj.cast<RedDigitizer::CAENSharedRingReader&>();
+            RedDigitizer::CAENSharedBatchView view;
+            if (not self.next(view)) {
+                return py::none();
+            }
+            return shared_batch_to_dict(view, self_obj);
+        })
+        .def("IsValid", [](const RedDigitizer::CAENSharedRingReader& self, uint64_t seq) {
+            RedDigitizer::CAENSharedBatchView view;
+            view.Sequence = seq;
+            return self.isValid(view);
+        }, py::arg("seq"))
         ;
 
+    py::class_<PyCAENStream>(m, "CAENStream")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &PyCAENStream::next)
+        // Number of free buffers
+        .def("Available", &PyCAENStream::available)
+        ;
+
+    py::class_<PyCAENPipeline>(m, "CAENPipeline")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &PyCAENPipeline::next)
+        .def("Stop", &PyCAENPipeline::stop)
+        .def("IsRunning", &PyCAENPipeline::isRunning)
+        .def("GetStats", &PyCAENPipeline::getStats)
+        .def("__enter__", [](py::object self) { return self; })
+        .def("__exit__", [](PyCAENPipeline& self, py::args) { self.stop(); })
+        ;
+
+    py::class_<PyCAENStreamBatch>(m, "CAENStreamBatch")
+        .def_property_readonly("NumEvents", [](PyCAENStreamBatch& self) {
+            return self.get().NumEvents;
+        })
+        // False if only the event info was kept (DropWaveforms)
+        .def_property_readonly("HasWaveforms", [](PyCAENStreamBatch& self) {
+            return self.get().HasWaveforms;
+        })
+        // Each event stands for Prescale read events
+        .def_property_readonly("Prescale", [](PyCAENStreamBatch& self) {
+            return self.get().Prescale;
+        })
+        // Consecutive for the batches of a pipeline, gaps are dropped batches
+        .def_property_readonly("Sequence", [](PyCAENStreamBatch& self) {
+            return self.get().Sequence;
+        })
+        .def_property_readonly("Channels", [](PyCAENStreamBatch& self) {
+            return self.get().Channels;
+        })
+        .def_property_readonly("EventCounter", [](PyCAENStreamBatch& self) {
+            auto& batch = self.get();
+            return stream_batch_view(self, batch.EventCounter, {batch.NumEvents});
+        })
+        .def_property_readonly("EventSize", [](PyCAENStreamBatch& self) {
+            auto& batch = self.get();
+            return stream_batch_view(self, batch.EventSize, {batch.NumEvents});
+        })
+        .def_property_readonly("BoardId", [](PyCAENStreamBatch& self) {
+            auto& batch = self.get();
+            return stream_batch_view(self, batch.BoardId, {batch.NumEvents});
+        })
+        .def_property_readonly("Pattern", [](PyCAENStreamBatch& self) {
+            auto& batch = self.get();
+            return stream_batch_view(self, batch.Pattern, {batch.NumEvents});
+        })
+        .def_property_readonly("ChannelMask", [](PyCAENStreamBatch& self) {
+            auto& batch = self.get();
+            return stream_batch_view(self, batch.ChannelMask, {batch.NumEvents});
+        })
+        .def_property_readonly("TriggerTimeTag", [](PyCAENStreamBatch& self) {
+            auto& batch = self.get();
+            return stream_batch_view(self, batch.TriggerTimeTag, {batch.NumEvents});
+        })
+        // [events, channels, samples], None if HasWaveforms is False
+        .def_property_readonly("Waveforms", [](PyCAENStreamBatch& self) -> py::object {
+            auto& batch = self.get();
+            if (not batch.HasWaveforms) {
+                return py::none();
+            }
+            return stream_batch_view(self, batch.Waveforms,
+                {batch.NumEvents, batch.NumChannels, batch.RecordLength});
+        })
+        // Gives the buffer back to the stream, or once the last array
+        // taken from this batch is gone if there are any left.
+        .def("release", [](PyCAENStreamBatch& self) { self.Handle.reset(); })
+        .def("__enter__", [](py::object self) { return self; })
+        .def("__exit__", [](PyCAENStreamBatch& self, py::args) { self.Handle.reset(); })
+        ;
+
+    bind_packed_waveforms<8>(m, "CAENPackedWaveforms8");
+    bind_packed_waveforms<12>(m, "CAENPackedWaveforms12");
+    bind_packed_waveforms<14>(m, "CAENPackedWaveforms14");
+    bind_packed_waveforms<16>(m, "CAENPackedWaveforms16");
+
     // Add a wrapper for iostream_wrapper if needed
     py::class_<RedDigitizer::iostream_wrapper, std::shared_ptr<RedDigitizer::iostream_wrapper>>(m, "iostream_wrapper")
         .def(py::init<>());
@@ -3,6 +3,7 @@ from setuptools import setup, Extension
 import pybind11
 from pybind11.setup_helpers import Pybind11Extension
 import os
+import sys
 
 version = "0.0.8"
 
@@ -15,7 +16,8 @@ else:
             "red_caen", 
             ["red_digitizer_helper.cpp"], 
             define_macros=[("VERSION", f"\"{version}\"")], 
-            libraries=["CAENDigitizer"],
+            # rt: shm_open for the shared memory ring on older glibc
+            libraries=["CAENDigitizer"] + (["rt"] if sys.platform.startswith("linux") else []),
             cxx_std=20
         ),
     ]